@@ -47,3 +47,12 @@ set_if(D2_HAS_BOOST_PROGRAM_OPTIONS_LIB D2_BOOST_PROGRAM_OPTIONS_LIB ${Boost_PRO
 set_if(D2_HAS_BOOST_SERIALIZATION_LIB   D2_BOOST_SERIALIZATION_LIB   ${Boost_SERIALIZATION_LIBRARY})
 set_if(D2_HAS_BOOST_SYSTEM_LIB          D2_BOOST_SYSTEM_LIB          ${Boost_SYSTEM_LIBRARY})
 set_if(D2_HAS_BOOST_THREAD_LIB          D2_BOOST_THREAD_LIB          ${Boost_THREAD_LIBRARY})
+
+
+#=============================================================================
+# Check support for zlib
+#=============================================================================
+find_package(ZLIB)
+set_true_if(ZLIB_FOUND                  D2_HAS_ZLIB)
+set_if(D2_HAS_ZLIB                      D2_ZLIB_INCLUDE              ${ZLIB_INCLUDE_DIRS})
+set_if(D2_HAS_ZLIB                      D2_ZLIB_LIB                  ${ZLIB_LIBRARIES})
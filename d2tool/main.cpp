@@ -3,6 +3,9 @@
  * with the `d2` library.
  */
 
+#include "symbolizer.hpp"
+
+#include <boost/bind.hpp>
 #include <boost/exception/diagnostic_information.hpp>
 #include <boost/exception/get_error_info.hpp>
 #include <boost/filesystem/operations.hpp>
@@ -11,6 +14,7 @@
 #include <boost/make_shared.hpp>
 #include <boost/program_options.hpp>
 #include <boost/shared_ptr.hpp>
+#include <cstddef>
 #include <cstdlib> // EXIT_FAILURE, EXIT_SUCCESS
 #include <d2/core/diagnostic.hpp>
 #include <d2/core/exceptions.hpp>
@@ -59,7 +63,10 @@ class Driver {
         }
 
         try {
-            return boost::make_shared<Skeleton>(repo);
+            return boost::make_shared<Skeleton>(repo, jobs,
+                        vector_clocks ? d2::core::vector_clock_ordering
+                                      : d2::core::segmentation_graph_ordering,
+                        read_ahead);
 
         } catch (d2::core::filesystem_error const& e) {
             error("unable to open the repository at " + repo);
@@ -117,6 +124,29 @@ class Driver {
             "debug",
             po::bool_switch(&debug)->default_value(false, "false"),
             "enable special debugging output"
+        )(
+            "symbolizer",
+            po::value<std::string>(&symbolizer_command)
+                ->default_value("addr2line -C -f -e"),
+            "command used to resolve the call stacks recorded with deferred "
+            "symbolization; it is given a module and addresses in it"
+        )(
+            "jobs,j",
+            po::value<std::size_t>(&jobs)->default_value(1),
+            "number of threads used to load the files of the repository "
+            "and to analyze them"
+        )(
+            "vector-clocks",
+            po::bool_switch(&vector_clocks)->default_value(false, "false"),
+            "order the segments of the threads with vector clocks instead of "
+            "building the segmentation graph, which takes less memory when "
+            "there are many segments; the segmentation graph is then empty"
+        )(
+            "read-ahead",
+            po::value<std::size_t>(&read_ahead)->default_value(
+                std::size_t(Skeleton::automatic_read_ahead), "automatic"),
+            "number of blocks of each compressed file decompressed in "
+            "parallel; by default, the jobs are split among the files"
         )
         ;
 
@@ -165,14 +195,20 @@ class Driver {
         return true;
     }
 
-    std::string repo;
-    bool help, debug, analyze, stats, show_lock_graph, show_seg_graph;
+    std::string repo, symbolizer_command;
+    std::size_t jobs, read_ahead;
+    bool help, debug, analyze, stats, show_lock_graph, show_seg_graph,
+         vector_clocks;
 
-    static void print_deadlock(d2::core::potential_deadlock const& dl) {
+    static void print_deadlock(d2tool::symbolizer& symbolizer,
+                               Skeleton const& skeleton,
+                               d2::core::potential_deadlock const& dl) {
+        symbolizer.symbolize(dl);
         std::cout <<
         // 80 columns
 "\n--------------------------------------------------------------------------------\n";
-        d2::core::plain_text_explanation(std::cout, dl);
+        d2::core::plain_text_explanation(std::cout, dl,
+                                         skeleton.call_stacks());
         std::cout << '\n';
     }
 
@@ -186,8 +222,13 @@ public:
             if (!skeleton)
                 return EXIT_FAILURE;
 
-            if (analyze)
-                skeleton->on_deadlocks(print_deadlock);
+            if (analyze) {
+                d2tool::symbolizer symbolizer(skeleton->module_map(),
+                                              skeleton->call_stacks(),
+                                              symbolizer_command);
+                skeleton->on_deadlocks(boost::bind(print_deadlock,
+                    boost::ref(symbolizer), boost::cref(*skeleton), _1));
+            }
 
             if (stats) {
                 std::cout << boost::format(
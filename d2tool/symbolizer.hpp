@@ -0,0 +1,191 @@
+/**
+ * This file defines the `symbolizer` class used by d2tool to resolve the
+ * call stacks recorded with deferred symbolization.
+ */
+
+#ifndef D2TOOL_SYMBOLIZER_HPP
+#define D2TOOL_SYMBOLIZER_HPP
+
+#include <boost/foreach.hpp>
+#include <cstddef>
+#include <cstdio>
+#include <d2/core/diagnostic.hpp>
+#include <d2/detail/call_stack_table.hpp>
+#include <d2/detail/lock_debug_info.hpp>
+#include <d2/detail/module_map.hpp>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#if defined(_WIN32)
+#   define popen _popen
+#   define pclose _pclose
+#endif
+
+
+namespace d2tool {
+/**
+ * Resolves the raw instruction pointers of call stacks to function names by
+ * running an external program like `addr2line` on the modules that were
+ * loaded in the analyzed program.
+ *
+ * The program is run as `command <module> <address>...` and must print two
+ * lines per address, the first of which is the name of the function, like
+ * `addr2line -f` does. Only the frames that were not symbolized at runtime
+ * are resolved, and they are resolved in place in the table of call stacks,
+ * so each frame is resolved at most once.
+ */
+class symbolizer {
+    typedef std::pair<std::string, std::size_t> ModuleAddress;
+
+    d2::detail::ModuleMap const& modules_;
+    d2::detail::CallStackTable& call_stacks_;
+    std::string command_;
+    std::map<ModuleAddress, std::string> functions_;
+
+    // Maximum number of addresses passed to a single run of the command.
+    static std::size_t const max_batch_size = 256;
+
+    static std::string quote(std::string const& s) {
+        std::string quoted = "'";
+        BOOST_FOREACH(char c, s) {
+            if (c == '\'')
+                quoted += "'\\''";
+            else
+                quoted += c;
+        }
+        return quoted + "'";
+    }
+
+    static bool getline(std::FILE* pipe, std::string& line) {
+        line.clear();
+        char buffer[512];
+        while (std::fgets(buffer, sizeof buffer, pipe)) {
+            line += buffer;
+            if (!line.empty() && line[line.size() - 1] == '\n') {
+                line.erase(line.size() - 1);
+                return true;
+            }
+        }
+        return !line.empty();
+    }
+
+    // Return addresses point after the call instruction, so we look up the
+    // previous byte to get the line of the call itself.
+    static std::size_t lookup_address(d2::detail::LoadedModule const& module,
+                                      std::size_t ip) {
+        return module.file_address(ip) - 1;
+    }
+
+    void run(std::string const& module,
+             std::set<std::size_t> const& addresses) {
+        // Addresses that can't be resolved are remembered as such, so that
+        // we don't try again for every deadlock.
+        BOOST_FOREACH(std::size_t address, addresses)
+            functions_[ModuleAddress(module, address)];
+
+        std::ostringstream command;
+        command << command_ << ' ' << quote(module) << std::hex;
+        BOOST_FOREACH(std::size_t address, addresses)
+            command << " 0x" << address;
+
+        std::FILE* pipe = popen(command.str().c_str(), "r");
+        if (!pipe)
+            return;
+
+        std::string function, location;
+        BOOST_FOREACH(std::size_t address, addresses) {
+            if (!getline(pipe, function) || !getline(pipe, location))
+                break;
+            if (function != "??")
+                functions_[ModuleAddress(module, address)] = function;
+        }
+        pclose(pipe);
+    }
+
+    template <typename Visitor>
+    void for_each_frame(d2::detail::CallStackId id, Visitor visit) {
+        d2::detail::LockDebugInfo* info = call_stacks_.find(id);
+        if (info)
+            BOOST_FOREACH(d2::detail::StackFrame& frame, info->call_stack)
+                (this->*visit)(frame);
+    }
+
+    template <typename Visitor>
+    void for_each_frame(d2::core::potential_deadlock const& dl,
+                        Visitor visit) {
+        BOOST_FOREACH(d2::core::deadlocked_thread const& thread, dl.threads) {
+            BOOST_FOREACH(d2::detail::CallStackId id, thread.holding_info)
+                for_each_frame(id, visit);
+            for_each_frame(thread.waiting_for_info, visit);
+        }
+    }
+
+    typedef std::map<std::string, std::set<std::size_t> > PendingLookups;
+    PendingLookups pending_;
+
+    void collect(d2::detail::StackFrame& frame) {
+        if (!frame.function.empty())
+            return;
+        d2::detail::LoadedModule const* module = modules_.find(frame.ip);
+        if (!module)
+            return;
+        std::size_t const address = lookup_address(*module, frame.ip);
+        if (!functions_.count(ModuleAddress(module->path, address)))
+            pending_[module->path].insert(address);
+    }
+
+    void resolve(d2::detail::StackFrame& frame) {
+        if (!frame.function.empty())
+            return;
+        d2::detail::LoadedModule const* module = modules_.find(frame.ip);
+        if (!module)
+            return;
+        frame.module = module->path;
+        std::map<ModuleAddress, std::string>::const_iterator function =
+            functions_.find(ModuleAddress(module->path,
+                                          lookup_address(*module, frame.ip)));
+        if (function != functions_.end() && !function->second.empty())
+            frame.function = function->second;
+    }
+
+public:
+    symbolizer(d2::detail::ModuleMap const& modules,
+               d2::detail::CallStackTable& call_stacks,
+               std::string const& command)
+        : modules_(modules), call_stacks_(call_stacks), command_(command)
+    { }
+
+    /**
+     * Resolve the frames of the call stacks of a potential deadlock that
+     * were not resolved at runtime.
+     *
+     * Frames whose function can't be resolved are at least given the name
+     * of the module they belong to.
+     */
+    void symbolize(d2::core::potential_deadlock const& dl) {
+        if (modules_.empty())
+            return;
+
+        for_each_frame(dl, &symbolizer::collect);
+        BOOST_FOREACH(PendingLookups::value_type const& lookups, pending_) {
+            std::set<std::size_t> batch;
+            BOOST_FOREACH(std::size_t address, lookups.second) {
+                batch.insert(address);
+                if (batch.size() == max_batch_size) {
+                    run(lookups.first, batch);
+                    batch.clear();
+                }
+            }
+            if (!batch.empty())
+                run(lookups.first, batch);
+        }
+        pending_.clear();
+        for_each_frame(dl, &symbolizer::resolve);
+    }
+};
+} // end namespace d2tool
+
+#endif // !D2TOOL_SYMBOLIZER_HPP
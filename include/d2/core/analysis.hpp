@@ -6,172 +6,459 @@
 #ifndef D2_CORE_ANALYSIS_HPP
 #define D2_CORE_ANALYSIS_HPP
 
-#include <d2/core/build_segmentation_graph.hpp> // for happens_before
-#include <d2/detail/vertex_to_edge_path.hpp>
+#include <d2/core/compact_lock_graph.hpp>
+#include <d2/core/happens_before_index.hpp>
+#include <d2/core/vector_clock_index.hpp>
+#include <d2/detail/atomic_ops.hpp>
+#include <d2/detail/thread.hpp>
 
-#include <boost/assert.hpp>
+#include <algorithm>
+#include <boost/exception_ptr.hpp>
+#include <boost/foreach.hpp>
 #include <boost/graph/graph_traits.hpp>
-#include <boost/graph/hawick_circuits.hpp>
 #include <boost/graph/properties.hpp>
-#include <boost/move/utility.hpp>
-#include <boost/range/begin.hpp>
-#include <boost/range/end.hpp>
-#include <boost/ref.hpp>
+#include <boost/graph/strong_components.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/property_map/property_map.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cstddef>
 #include <vector>
 
 
 namespace d2 {
 namespace analysis_detail {
-//! Return whether two unordered containers have a non-empty intersection.
-template <typename Unordered1, typename Unordered2>
-bool unordered_intersects(Unordered1 const& a, Unordered2 const& b) {
-    typedef typename Unordered1::const_iterator Iterator;
-    typename Unordered2::const_iterator not_found(boost::end(b));
-    Iterator elem(boost::begin(a)), last(boost::end(a));
-    for (; elem != last; ++elem)
-        if (b.find(*elem) != not_found)
-            return true;
-    return false;
-}
-
 /*!
  * @internal
- * Wrap a `BinaryFunction` to implement a visitor for the algorithm.
+ * Conditions two edges of the lock graph must satisfy to be part of the
+ * same potential deadlock.
  */
-template <typename LockGraph, typename SegmentationGraph, typename Function>
-class CycleVisitor {
-    typedef boost::graph_traits<LockGraph> GraphTraits;
-    typedef typename GraphTraits::edge_descriptor LockGraphEdgeDescriptor;
-
-    // Property map to access the edge labels of the lock graph.
-    typedef typename boost::property_map<
-                LockGraph, boost::edge_bundle_t
-            >::const_type EdgeLabelMap;
-
-    SegmentationGraph const& sg_;
-    Function f_;
+template <typename HappensBefore>
+class DeadlockConditions {
+    HappensBefore const& happens_before_;
 
 public:
-    CycleVisitor(SegmentationGraph const& sg, Function const& f)
-        : sg_(sg), f_(f)
+    explicit DeadlockConditions(HappensBefore const& happens_before)
+        : happens_before_(happens_before)
     { }
 
     /*!
-     * Method called whenever a cycle is found.
-     *
-     * If the cycle respects certain conditions, calls the wrapped
-     * `BinaryFunction` with a sequence of unspecified type containing the
-     * edges in the cycle and a constant reference to the lock graph.
+     * Return whether the edges `a` and `b` of `graph` can be part of the
+     * same potential deadlock.
      *
-     * @note The conditions are those that make a cycle a potential deadlock
-     *       in the lock graph.
+     * @pre `graph` was built with the same index of the `happens_before`
+     *      relation.
      */
-    template <typename EdgePath>
-    void cycle(EdgePath const& edge_path, LockGraph const& graph) const {
-        EdgeLabelMap labels = get(boost::edge_bundle, graph);
-
-        // These are the conditions for a cycle to be a valid
-        // potential deadlock:
-        // For any given pair of edges (e1, e2)
-        typedef typename EdgePath::const_iterator EdgeIterator;
-        EdgeIterator last = edge_path.end();
-        for (EdgeIterator ei1 = edge_path.begin(); ei1 != last; ++ei1) {
-            LockGraphEdgeDescriptor e1 = *ei1;
-            for (EdgeIterator ei2 = edge_path.begin(); ei2 != last; ++ei2) {
-                LockGraphEdgeDescriptor e2 = *ei2;
-
-                if (e1 == e2)
-                  continue;
-
-                // The threads must differ.
-                if (thread_of(labels[e1]) == thread_of(labels[e2]))
-                  return;
-
-                // The guard sets must not overlap.
-                if (unordered_intersects(gatelocks_of(labels[e1]),
-                                         gatelocks_of(labels[e2])))
-                  return;
-
-                // The segments must not be ordered.
-                if (core::happens_before(labels[e1].s2, labels[e2].s1, sg_))
-                  return;
-            }
+    template <typename Graph>
+    bool operator()(core::CompactLockGraph<Graph> const& graph,
+                    std::size_t a, std::size_t b) const {
+        // The threads must differ.
+        if (graph.thread(a) == graph.thread(b))
+            return false;
+
+        // The guard sets must not overlap.
+        if (graph.gatelocks(a).intersects(graph.gatelocks(b)))
+            return false;
+
+        // The segments must not be ordered.
+        return !happens_before_.happens_before_at(graph.s2(a), graph.s1(b)) &&
+               !happens_before_.happens_before_at(graph.s2(b), graph.s1(a));
+    }
+};
+
+/*!
+ * @internal
+ * Search of the cycles of edges of a lock graph that are potential
+ * deadlocks.
+ *
+ * The search walks the edges of the graph directly, so parallel edges are
+ * distinct branches of the search, and every edge appended to the current
+ * path must satisfy the `DeadlockConditions` with all the edges already in
+ * it. A path that can't satisfy them is abandoned right away, instead of
+ * being extended to every cycle containing it. Since the edges of a
+ * potential deadlock belong to different threads, the paths are never
+ * longer than the number of threads.
+ *
+ * Each cycle is found once, from its vertex that comes first in the graph,
+ * and the function is called with the edges of the compact graph forming
+ * the cycle, starting from that vertex, along with the compact graph.
+ */
+template <typename Graph, typename HappensBefore, typename Function>
+class DeadlockSearch {
+    core::CompactLockGraph<Graph> const& graph_;
+    DeadlockConditions<HappensBefore> const& conditions_;
+    Function const& f_;
+
+    std::size_t start_;
+    std::vector<std::size_t> path_;
+
+    // Return whether `e` can be appended to the path, i.e. whether it does
+    // not go back to a vertex of the path other than the start, and it
+    // satisfies the conditions with all the edges of the path.
+    bool extends_path(std::size_t e) const {
+        std::size_t const v = graph_.target_of(e);
+        BOOST_FOREACH(std::size_t other, path_)
+            if (graph_.target_of(other) == v || !conditions_(graph_, other, e))
+                return false;
+        return true;
+    }
+
+    void report() {
+        f_(static_cast<std::vector<std::size_t> const&>(path_), graph_);
+    }
+
+    void visit(std::size_t u) {
+        for (std::size_t e = graph_.edges_begin(u); e != graph_.edges_end(u);
+                                                                        ++e) {
+            std::size_t const v = graph_.target_of(e);
+            // Self loops are not cycles, and the cycles going through a
+            // vertex before the start were found from that vertex.
+            if (v == start_ ? path_.empty() : v < start_)
+                continue;
+            if (!extends_path(e))
+                continue;
+
+            path_.push_back(e);
+            if (v == start_)
+                report();
+            else
+                visit(v);
+            path_.pop_back();
         }
+    }
+
+public:
+    DeadlockSearch(core::CompactLockGraph<Graph> const& graph,
+                   DeadlockConditions<HappensBefore> const& conditions,
+                   Function const& f)
+        : graph_(graph), conditions_(conditions), f_(f)
+    { }
+
+    //! Find the cycles whose first vertex is `start`.
+    void from(std::size_t start) {
+        start_ = start;
+        visit(start);
+    }
 
-        f_(edge_path, graph);
+    //! Find all the cycles of the graph.
+    void operator()() {
+        for (std::size_t s = 0; s < graph_.num_vertices(); ++s)
+            from(s);
     }
 };
 
 /*!
  * @internal
- * Functor wrapping a cycle visitor.
+ * Call `f` with the vertices of each strongly connected component of
+ * `graph` that may hold a potential deadlock.
  *
- * When the functor is called, the visitor's `cycle` method is called with
- * the same arguments.
+ * The vertices that are not on any cycle are dropped, and so are the
+ * components whose edges all belong to the same thread, since a potential
+ * deadlock involves edges of different threads. The components are visited
+ * in the order of their first vertex in `graph`, and their vertices are
+ * given in the same order as in `graph`.
  */
-template <typename Visitor>
-struct cycle_visitor_as_functor {
-    explicit cycle_visitor_as_functor(Visitor const& visitor)
-        : visitor_(visitor)
+template <typename Graph, typename Function>
+void for_each_cyclic_component(Graph const& graph, Function f) {
+    typedef boost::graph_traits<Graph> Traits;
+    typedef typename Traits::vertex_descriptor Vertex;
+    typedef typename Traits::edge_descriptor Edge;
+
+    typename boost::property_map<
+        Graph, boost::vertex_index_t
+    >::const_type index = get(boost::vertex_index, graph);
+    std::vector<std::size_t> component_of(num_vertices(graph));
+    std::size_t const components = boost::strong_components(graph,
+        boost::make_iterator_property_map(component_of.begin(), index));
+
+    // The vertices are visited in order, so the first vertex of each
+    // component gives the order of the components.
+    std::vector<std::vector<Vertex> > members(components);
+    std::vector<std::size_t> order;
+    BOOST_FOREACH(Vertex v, vertices(graph)) {
+        std::size_t const c = component_of[get(index, v)];
+        if (members[c].empty())
+            order.push_back(c);
+        members[c].push_back(v);
+    }
+
+    BOOST_FOREACH(std::size_t c, order) {
+        if (members[c].size() < 2)
+            continue;
+
+        bool several_threads = false;
+        typename boost::edge_property_type<Graph>::type const* first = NULL;
+        BOOST_FOREACH(Vertex u, members[c]) {
+            BOOST_FOREACH(Edge e, out_edges(u, graph)) {
+                if (component_of[get(index, target(e, graph))] != c)
+                    continue;
+                if (!first)
+                    first = &graph[e];
+                else if (thread_of(*first) != thread_of(graph[e]))
+                    several_threads = true;
+            }
+            if (several_threads)
+                break;
+        }
+        if (several_threads)
+            f(static_cast<std::vector<Vertex> const&>(members[c]));
+    }
+}
+
+/*!
+ * @internal
+ * Function object running the search of potential deadlocks on a component
+ * of the lock graph.
+ */
+template <typename Graph, typename HappensBefore, typename Function>
+struct search_deadlocks {
+    search_deadlocks(Graph const& graph, HappensBefore const& happens_before,
+                     DeadlockConditions<HappensBefore> const& conditions,
+                     Function const& f)
+        : graph_(graph), happens_before_(happens_before),
+          conditions_(conditions), f_(f)
     { }
 
-    explicit cycle_visitor_as_functor(BOOST_RV_REF(Visitor) visitor)
-        : visitor_(boost::move(visitor))
+    template <typename Vertices>
+    void operator()(Vertices const& component) const {
+        core::CompactLockGraph<Graph> const compact(graph_, component,
+                                                    happens_before_);
+        DeadlockSearch<Graph, HappensBefore, Function> search(
+                                                compact, conditions_, f_);
+        search();
+    }
+
+private:
+    Graph const& graph_;
+    HappensBefore const& happens_before_;
+    DeadlockConditions<HappensBefore> const& conditions_;
+    Function const& f_;
+};
+
+/*!
+ * @internal
+ * Function object recording the cycles it is called with.
+ */
+struct record_cycle {
+    explicit record_cycle(std::vector<std::vector<std::size_t> >& cycles)
+        : cycles_(&cycles)
     { }
 
-    template <typename Cycle, typename Graph>
-    void operator()(BOOST_FWD_REF(Cycle) c, BOOST_FWD_REF(Graph) g) const {
-        visitor_.cycle(boost::forward<Cycle>(c), boost::forward<Graph>(g));
+    template <typename Graph>
+    void operator()(std::vector<std::size_t> const& cycle,
+                    Graph const&) const {
+        cycles_->push_back(cycle);
     }
 
 private:
-    Visitor visitor_;
+    std::vector<std::vector<std::size_t> >* cycles_;
 };
 
 /*!
  * @internal
- * Transform a cycle of vertex descriptors into one or more cycle of edge
- * descriptors.
+ * Search of potential deadlocks shared by several threads.
+ *
+ * The search runs in two phases, each of them shared by the workers with
+ * a counter from which they take the next item, like the loading of the
+ * repository. First, the compact copy of each component is built by the
+ * worker taking it. Then, the search from each start vertex of each
+ * component is a task, so the work is split finer than the components,
+ * and a worker done with a short task moves on to the next one.
  *
- * The wrapped cycle visitor is called with each cycle thus generated.
+ * The cycles found by each task are recorded separately, and they are
+ * reported in the order of the tasks once all of them are done, which is
+ * the order of the sequential search. The copy of each component is
+ * released once its cycles are reported.
  */
-template <typename Visitor>
-struct vertex_to_edge_cycle {
-    explicit vertex_to_edge_cycle(Visitor const& visitor)
-        : visitor_(visitor)
-    { }
+template <typename Graph, typename HappensBefore>
+class ParallelDeadlockSearch {
+    typedef core::CompactLockGraph<Graph> CompactGraph;
+    typedef typename CompactGraph::Vertex Vertex;
+    typedef std::vector<std::size_t> Cycle;
 
-    template <typename VertexPath, typename Graph>
-    void cycle(VertexPath vpath, Graph const& graph) const {
-        BOOST_ASSERT_MSG(vpath.size() >= 2,
-            "a cycle with less than two vertices is impossible, "
-            "since we're not considering self loops");
+    struct Component {
+        std::vector<Vertex> vertices;
+        boost::shared_ptr<CompactGraph const> graph;
+        boost::exception_ptr error;
+    };
 
-        // Close the cycle so we can transform it to a cycle of edges.
-        vpath.push_back(vpath.front());
+    struct Task {
+        std::size_t component;
+        std::size_t start;
+        std::vector<Cycle> cycles;
+        boost::exception_ptr error;
+    };
 
-        // Call the visitor with all the edge paths.
-        detail::make_vertex_to_edge_path(
-            cycle_visitor_as_functor<Visitor>(visitor_))(vpath, graph);
+    struct add_component {
+        explicit add_component(ParallelDeadlockSearch& self) : self_(&self)
+        { }
+
+        template <typename Vertices>
+        void operator()(Vertices const& vertices) const {
+            self_->components_.push_back(Component());
+            Component& component = self_->components_.back();
+            component.vertices.assign(vertices.begin(), vertices.end());
+        }
+
+    private:
+        ParallelDeadlockSearch* self_;
+    };
+
+    Graph const& graph_;
+    HappensBefore const& happens_before_;
+    DeadlockConditions<HappensBefore> const& conditions_;
+    std::vector<Component> components_;
+    std::vector<Task> tasks_;
+    std::size_t volatile next_;
+
+    static void build(void* self_) {
+        ParallelDeadlockSearch& self = *static_cast<ParallelDeadlockSearch*>(
+                                                                    self_);
+        std::size_t i;
+        while ((i = detail::fetch_add(self.next_, std::size_t(1)))
+                                                < self.components_.size()) {
+            Component& component = self.components_[i];
+            try {
+                component.graph = boost::make_shared<CompactGraph const>(
+                    self.graph_, component.vertices, self.happens_before_);
+            } catch (...) {
+                component.error = boost::current_exception();
+            }
+        }
     }
 
-private:
-    Visitor visitor_;
+    static void search(void* self_) {
+        ParallelDeadlockSearch& self = *static_cast<ParallelDeadlockSearch*>(
+                                                                    self_);
+        typedef record_cycle Record;
+        std::size_t i;
+        while ((i = detail::fetch_add(self.next_, std::size_t(1)))
+                                                    < self.tasks_.size()) {
+            Task& task = self.tasks_[i];
+            try {
+                Record const record(task.cycles);
+                DeadlockSearch<Graph, HappensBefore, Record> search(
+                    *self.components_[task.component].graph,
+                    self.conditions_, record);
+                search.from(task.start);
+            } catch (...) {
+                task.error = boost::current_exception();
+            }
+        }
+    }
+
+    // Run `work` with up to `jobs` threads, for `items` items.
+    void run(void (*work)(void*), std::size_t jobs, std::size_t items) {
+        next_ = 0;
+        std::size_t const workers = std::min(jobs, items);
+        std::vector<boost::shared_ptr<detail::thread> > threads;
+        for (std::size_t i = 0; i < workers; ++i)
+            threads.push_back(boost::make_shared<detail::thread>(work, this));
+        for (std::size_t i = 0; i < threads.size(); ++i)
+            threads[i]->join();
+    }
+
+public:
+    ParallelDeadlockSearch(Graph const& graph,
+                           HappensBefore const& happens_before,
+                           DeadlockConditions<HappensBefore> const& conditions)
+        : graph_(graph), happens_before_(happens_before),
+          conditions_(conditions), next_(0)
+    {
+        for_each_cyclic_component(graph, add_component(*this));
+        for (std::size_t c = 0; c < components_.size(); ++c) {
+            Task task;
+            task.component = c;
+            for (task.start = 0; task.start < components_[c].vertices.size();
+                                                                ++task.start)
+                tasks_.push_back(task);
+        }
+    }
+
+    /*!
+     * Run the search with up to `jobs` threads, and then call `f` with each
+     * cycle found, along with the compact copy of its component.
+     */
+    template <typename Function>
+    void operator()(std::size_t jobs, Function const& f) {
+        run(&ParallelDeadlockSearch::build, jobs, components_.size());
+        BOOST_FOREACH(Component const& component, components_)
+            if (component.error)
+                boost::rethrow_exception(component.error);
+
+        run(&ParallelDeadlockSearch::search, jobs, tasks_.size());
+        for (std::size_t i = 0; i < tasks_.size(); ++i) {
+            Task const& task = tasks_[i];
+            Component& component = components_[task.component];
+            if (task.error)
+                boost::rethrow_exception(task.error);
+            BOOST_FOREACH(Cycle const& cycle, task.cycles)
+                f(cycle, *component.graph);
+            if (i + 1 == tasks_.size() ||
+                    tasks_[i + 1].component != task.component)
+                component.graph.reset();
+        }
+    }
 };
 
 /*!
- * Analyze the lock graph and the segmentation graph to determine whether the
- * program execution represented by them contains a deadlock. `f` is called
- * whenever a potential deadlock is detected.
+ * @internal
+ * Analyze the lock graph with any index of the `happens_before` relation.
  */
-template <typename LockGraph, typename SegmentationGraph, typename F>
-void analyze(LockGraph const& lg, SegmentationGraph const& sg, F const& f) {
-    typedef CycleVisitor<LockGraph, SegmentationGraph, F> EdgeCycleVisitor;
-    typedef vertex_to_edge_cycle<EdgeCycleVisitor> VertexCycleVisitor;
-    EdgeCycleVisitor edge_visitor(sg, f);
-    VertexCycleVisitor vertex_visitor(edge_visitor);
+template <typename LockGraph, typename HappensBefore, typename F>
+void analyze_with(LockGraph const& lg, HappensBefore const& happens_before,
+                  F const& f, std::size_t jobs) {
+    DeadlockConditions<HappensBefore> const conditions(happens_before);
+
+    // Cycles can't span several strongly connected components, so they are
+    // searched in each component separately, on a compact copy of it.
+    if (jobs <= 1)
+        for_each_cyclic_component(lg,
+            search_deadlocks<LockGraph, HappensBefore, F>(
+                                        lg, happens_before, conditions, f));
+    else {
+        ParallelDeadlockSearch<LockGraph, HappensBefore> search(
+                                            lg, happens_before, conditions);
+        search(jobs, f);
+    }
+}
 
-    boost::hawick_unique_circuits(lg, vertex_visitor);
+/*!
+ * Analyze the lock graph and the `happens_before` relation of the
+ * segmentation graph to determine whether the program execution represented
+ * by them contains a deadlock. `f` is called whenever a potential deadlock
+ * is detected, with the numbers of the edges of the deadlock in a
+ * `d2::core::CompactLockGraph` of its component, and with that graph, which
+ * gives the attributes of the edges without referring to the lock graph.
+ *
+ * The search is shared by up to `jobs` threads, but `f` is always called by
+ * the calling thread, and with the same potential deadlocks in the same
+ * order whatever the number of jobs. With more than one job, `f` is only
+ * called once the whole search is done.
+ */
+template <typename LockGraph, typename F>
+void analyze(LockGraph const& lg, core::HappensBeforeIndex const& sg,
+             F const& f, std::size_t jobs = 1) {
+    analyze_with(lg, sg, f, jobs);
+}
+
+/*!
+ * Overload ordering the segments with the vector clocks they were stamped
+ * with, instead of a segmentation graph.
+ */
+template <typename LockGraph, typename F>
+void analyze(LockGraph const& lg, core::VectorClockIndex const& clocks,
+             F const& f, std::size_t jobs = 1) {
+    analyze_with(lg, clocks, f, jobs);
+}
+
+/*!
+ * Overload indexing the segmentation graph before analyzing it.
+ */
+template <typename LockGraph, typename SegmentationGraph, typename F>
+void analyze(LockGraph const& lg, SegmentationGraph const& sg, F const& f,
+             std::size_t jobs = 1) {
+    core::HappensBeforeIndex const index(sg);
+    analyze(lg, index, f, jobs);
 }
 } // end namespace analysis_detail
 
@@ -0,0 +1,266 @@
+/**
+ * This file defines the `AsyncWriter` class.
+ */
+
+#ifndef D2_CORE_ASYNC_WRITER_HPP
+#define D2_CORE_ASYNC_WRITER_HPP
+
+#include <d2/core/events.hpp>
+#include <d2/detail/condition_variable.hpp>
+#include <d2/detail/mutex.hpp>
+#include <d2/detail/thread.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/type_traits/remove_reference.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <cstddef>
+#include <list>
+#include <vector>
+
+
+namespace d2 {
+namespace async_writer_detail {
+/**
+ * Class writing events to repositories from a dedicated thread, so that the
+ * threads generating the events never wait for the serialization of the
+ * events or for the disk.
+ *
+ * Events are appended to a batch in memory. When the batch is full, it is
+ * queued to the writer thread and a recycled batch takes its place, so that
+ * the batches are filled and written concurrently. Up to `queue_depth`
+ * batches can be waiting to be written; when the queue is full, the threads
+ * generating events wait for the writer thread to catch up, so no event is
+ * ever dropped.
+ *
+ * Each batch holds a reference to the repository its events belong to, so
+ * the repository stays open until all of its events are written.
+ *
+ * @tparam Repository The type of the repositories in which events are
+ *                    written. It must have a `dispatch` method accepting
+ *                    every type of event.
+ */
+template <typename Repository>
+class AsyncWriter : boost::noncopyable {
+    struct Batch {
+        boost::shared_ptr<Repository> repository;
+        std::vector<core::events::thread_specific> thread_events;
+        std::vector<core::events::non_thread_specific> other_events;
+
+        std::size_t size() const {
+            return thread_events.size() + other_events.size();
+        }
+
+        bool empty() const { return size() == 0; }
+
+        void swap(Batch& other) {
+            repository.swap(other.repository);
+            thread_events.swap(other.thread_events);
+            other_events.swap(other.other_events);
+        }
+
+        // Events within a file are written in the order in which they were
+        // generated. The order of the events of different files is
+        // irrelevant.
+        void write() {
+            BOOST_FOREACH(core::events::thread_specific& event, thread_events)
+                repository->dispatch(event);
+            BOOST_FOREACH(core::events::non_thread_specific& event,
+                          other_events)
+                repository->dispatch(event);
+        }
+
+        // Clear the batch, but keep the memory to reuse it.
+        void clear() {
+            repository.reset();
+            thread_events.clear();
+            other_events.clear();
+        }
+    };
+
+    std::size_t const queue_depth_;
+    std::size_t const batch_size_;
+
+    // Everything below is guarded by `mutex_`, except the batch being
+    // written, which is only touched by the writer thread while it is at
+    // the front of `queue_`.
+    detail::mutex mutex_;
+    typedef detail::scoped_lock<detail::mutex> scoped_lock;
+
+    // Signalled when a batch is queued or when the writer must stop.
+    detail::condition_variable batch_queued_;
+    // Signalled when a batch was written.
+    detail::condition_variable batch_written_;
+
+    Batch front_;
+    std::list<Batch> queue_;
+    std::list<Batch> recycled_;
+    bool stopping_;
+
+    detail::thread writer_;
+
+    /**
+     * Move the batch being filled to the queue, waiting for some room in
+     * the queue if necessary.
+     *
+     * @pre `mutex_` is locked.
+     */
+    void submit() {
+        // Someone else may submit the batch while we are waiting.
+        while (!front_.empty() && queue_.size() >= queue_depth_)
+            batch_written_.wait(mutex_);
+        if (front_.empty())
+            return;
+
+        if (recycled_.empty())
+            recycled_.push_back(Batch());
+        queue_.splice(queue_.end(), recycled_, recycled_.begin());
+        queue_.back().swap(front_);
+        batch_queued_.notify_one();
+    }
+
+    /**
+     * Make sure the batch being filled can accept an event belonging to
+     * `repository`.
+     *
+     * @pre `mutex_` is locked.
+     */
+    void make_room_for(boost::shared_ptr<Repository> const& repository) {
+        while (!front_.empty() && (front_.repository != repository ||
+                                   front_.size() >= batch_size_))
+            submit();
+        front_.repository = repository;
+    }
+
+    static void run(void* self) {
+        static_cast<AsyncWriter*>(self)->write_batches();
+    }
+
+    void write_batches() {
+        scoped_lock lock(mutex_);
+        while (true) {
+            while (queue_.empty() && !stopping_)
+                batch_queued_.wait(mutex_);
+            if (queue_.empty())
+                return;
+
+            // The batch stays at the front of the queue while it is written,
+            // so that `flush` waits for it.
+            Batch& batch = queue_.front();
+            mutex_.unlock();
+            batch.write();
+            batch.clear();
+            mutex_.lock();
+
+            recycled_.splice(recycled_.end(), queue_, queue_.begin());
+            batch_written_.notify_all();
+        }
+    }
+
+public:
+    //! Default number of events in a batch.
+    static std::size_t const default_batch_size = 4096;
+
+    /**
+     * Create an `AsyncWriter` and start its writer thread.
+     *
+     * @param queue_depth The maximum number of batches waiting to be
+     *                    written. It must be at least 1.
+     * @param batch_size The number of events in a batch. It must be at
+     *                   least 1.
+     */
+    explicit AsyncWriter(std::size_t queue_depth,
+                         std::size_t batch_size = default_batch_size)
+        : queue_depth_(queue_depth), batch_size_(batch_size),
+          stopping_(false), writer_(&run, this)
+    {
+        BOOST_ASSERT_MSG(queue_depth_ > 0, "creating an empty queue");
+        BOOST_ASSERT_MSG(batch_size_ > 0, "creating empty batches");
+    }
+
+    /**
+     * Write all the pending events and stop the writer thread.
+     */
+    ~AsyncWriter() {
+        flush();
+        {
+            scoped_lock lock(mutex_);
+            stopping_ = true;
+            batch_queued_.notify_one();
+        }
+        writer_.join();
+    }
+
+    //! Return the maximum number of batches waiting to be written.
+    std::size_t queue_depth() const { return queue_depth_; }
+
+    //! Return the number of events in a batch.
+    std::size_t batch_size() const { return batch_size_; }
+
+    /**
+     * Append an event to be written to `repository`.
+     */
+    template <typename Event>
+    typename boost::enable_if<
+        core::events::is_thread_specific<
+            typename boost::remove_reference<Event>::type
+        >,
+    void>::type push(boost::shared_ptr<Repository> const& repository,
+                     Event const& event) {
+        scoped_lock lock(mutex_);
+        make_room_for(repository);
+        front_.thread_events.push_back(core::events::thread_specific(event));
+    }
+
+    /**
+     * Append the thread specific events in the range `[first, last)` to be
+     * written to `repository`, in order.
+     *
+     * The whole range is appended while holding the lock once, so handing
+     * off a buffer of events costs about the same as appending a single
+     * event.
+     */
+    template <typename Iterator>
+    void push(boost::shared_ptr<Repository> const& repository,
+              Iterator first, Iterator last) {
+        scoped_lock lock(mutex_);
+        while (first != last) {
+            make_room_for(repository);
+            for (; first != last && front_.size() < batch_size_; ++first)
+                front_.thread_events.push_back(*first);
+        }
+    }
+
+    template <typename Event>
+    typename boost::disable_if<
+        core::events::is_thread_specific<
+            typename boost::remove_reference<Event>::type
+        >,
+    void>::type push(boost::shared_ptr<Repository> const& repository,
+                     Event const& event) {
+        scoped_lock lock(mutex_);
+        make_room_for(repository);
+        front_.other_events.push_back(
+                                core::events::non_thread_specific(event));
+    }
+
+    /**
+     * Wait until all the events appended so far are written.
+     */
+    void flush() {
+        scoped_lock lock(mutex_);
+        submit();
+        while (!queue_.empty())
+            batch_written_.wait(mutex_);
+    }
+};
+} // end namespace async_writer_detail
+
+namespace core {
+    using async_writer_detail::AsyncWriter;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_ASYNC_WRITER_HPP
@@ -0,0 +1,480 @@
+/**
+ * This file defines the `binary_event_encoder` and the `binary_event_decoder`
+ * classes implementing the compact binary format of the event logs.
+ */
+
+#ifndef D2_CORE_BINARY_EVENT_CODEC_HPP
+#define D2_CORE_BINARY_EVENT_CODEC_HPP
+
+#include <d2/core/events.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/thread_id.hpp>
+
+#include <boost/noncopyable.hpp>
+#include <boost/serialization/access.hpp>
+#include <boost/variant/apply_visitor.hpp>
+#include <boost/variant/static_visitor.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+
+namespace d2 {
+namespace binary_event_codec_detail {
+/**
+ * Layout of the binary format
+ * ---------------------------
+ * A file starts with a header made of the 4 bytes of `magic` followed by a
+ * single byte holding the `version` of the format. The header is followed
+ * by a sequence of records, each of which represents a single event:
+ *
+ *  - A byte holding the `event_kind` of the event.
+ *  - For `acquire`, `release`, `recursive_acquire` and `recursive_release`:
+ *    the thread, the lock and the call stack identifier of the event.
+ *  - For `segment_hop`: the thread and the segment of the event.
+ *  - For `lock_order`: the thread, `l1`, `l2`, `s1` and `s2`, the number of
+ *    gatelocks followed by each of them, the call stack identifiers of `l1`
+ *    and `l2`, and the number of occurrences.
+ *  - For `start` and `join`: the parent, new parent and child segments.
+ *
+ * There is no event of kind 0, so a zero byte where a record should begin
+ * marks the end of the events, like the end of the file. This is how the
+ * zero filled tail of a memory mapped file that was not closed properly is
+ * ignored. The only exception is a header, which also starts with a zero
+ * byte: the events appended to an existing file are preceded by a header
+ * of their own, after which the records are read as if the file started
+ * there.
+ *
+ * Unless stated otherwise, integers are written as LEB128 variable length
+ * integers. Thread ids, lock ids and segments are written as the zigzag
+ * encoded difference with the last value of the same type written since
+ * the last header (or 0), which is very often a single byte. Call stack
+ * identifiers are small, so they are written as is.
+ */
+static char const magic[4] = {'\0', 'd', '2', 'b'};
+static unsigned char const version = 5;
+
+enum event_kind {
+    end_of_events_kind,
+    // The kinds of the thread specific events are the indices of the
+    // corresponding types in the `thread_specific` variant, offset by 1.
+    acquire_kind, release_kind, recursive_acquire_kind,
+    recursive_release_kind, segment_hop_kind, lock_order_kind,
+    // The kinds of the other events are the indices of the corresponding
+    // types in the `non_thread_specific` variant, offset by `start_kind`.
+    start_kind, join_kind,
+    number_of_kinds
+};
+
+/**
+ * @internal
+ * Archive-like objects used to access the single integral value serialized
+ * by `ThreadId`, `LockId` and `Segment` without making it public.
+ */
+struct value_getter {
+    std::size_t value;
+
+    value_getter& operator&(std::size_t value_) {
+        value = value_;
+        return *this;
+    }
+};
+
+struct value_setter {
+    std::size_t value;
+
+    value_setter& operator&(std::size_t& value_) {
+        value_ = value;
+        return *this;
+    }
+};
+
+template <typename Value>
+std::size_t get_value(Value const& v) {
+    value_getter getter;
+    boost::serialization::access::serialize(getter, const_cast<Value&>(v),0u);
+    return getter.value;
+}
+
+template <typename Value>
+void set_value(Value& v, std::size_t value) {
+    value_setter setter = {value};
+    boost::serialization::access::serialize(setter, v, 0u);
+}
+
+inline std::size_t zigzag(std::size_t value, std::size_t last) {
+    std::size_t const delta = value - last;
+    std::size_t const sign = delta >> (sizeof(std::size_t) * CHAR_BIT - 1);
+    return (delta << 1) ^ (std::size_t(0) - sign);
+}
+
+inline std::size_t unzigzag(std::size_t encoded, std::size_t last) {
+    std::size_t const delta = (encoded >> 1) ^ (std::size_t(0) - (encoded&1));
+    return last + delta;
+}
+
+/**
+ * Class writing events in the binary format to a `std::ostream`.
+ *
+ * @note The encoder is stateful; all the events written to a file after a
+ *       header must be written by the same encoder, in order.
+ */
+class binary_event_encoder : boost::noncopyable {
+    std::ostream& os_;
+    std::vector<char> record_;
+    std::size_t bytes_;
+
+    std::size_t last_thread_, last_lock_, last_segment_;
+
+    void put_varint(std::size_t value) {
+        while (value >= 0x80) {
+            record_.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        record_.push_back(static_cast<char>(value));
+    }
+
+    template <typename Value>
+    void put_delta(Value const& v, std::size_t& last) {
+        std::size_t const value = get_value(v);
+        put_varint(zigzag(value, last));
+        last = value;
+    }
+
+    void put_body(core::events::acquire const& event) {
+        put_delta(thread_of(event), last_thread_);
+        put_delta(lock_of(event), last_lock_);
+        put_varint(aux_info_of(event));
+    }
+
+    void put_body(core::events::segment_hop const& event) {
+        put_delta(thread_of(event), last_thread_);
+        put_delta(segment_of(event), last_segment_);
+    }
+
+    void put_body(core::events::lock_order const& event) {
+        put_delta(thread_of(event), last_thread_);
+        put_delta(event.l1, last_lock_);
+        put_delta(event.l2, last_lock_);
+        put_delta(event.s1, last_segment_);
+        put_delta(event.s2, last_segment_);
+        put_varint(event.gatelocks.size());
+        for (std::size_t i = 0; i < event.gatelocks.size(); ++i)
+            put_delta(event.gatelocks[i], last_lock_);
+        put_varint(event.l1_info);
+        put_varint(event.l2_info);
+        put_varint(event.occurrences);
+    }
+
+    void put_body(core::events::start const& event) {
+        put_delta(parent_of(event), last_segment_);
+        put_delta(new_parent_of(event), last_segment_);
+        put_delta(child_of(event), last_segment_);
+    }
+
+    template <unsigned char Offset>
+    struct put_event : boost::static_visitor<void> {
+        binary_event_encoder& self;
+        unsigned char kind;
+
+        put_event(binary_event_encoder& self, unsigned char kind)
+            : self(self), kind(kind)
+        { }
+
+        template <typename Event>
+        void operator()(Event const& event) const {
+            self.record_.push_back(static_cast<char>(Offset + kind));
+            self.put_body(event);
+        }
+    };
+
+    void flush_record() {
+        os_.write(&record_[0], static_cast<std::streamsize>(record_.size()));
+        bytes_ += record_.size();
+        record_.clear();
+    }
+
+public:
+    explicit binary_event_encoder(std::ostream& os)
+        : os_(os), bytes_(0), last_thread_(0), last_lock_(0),
+          last_segment_(0)
+    { }
+
+    /**
+     * Write the header identifying the binary format. The events written
+     * afterwards do not depend on the ones written before the header, so
+     * this must also be called before appending events to a file.
+     */
+    void write_header() {
+        os_.write(magic, sizeof magic);
+        os_.put(static_cast<char>(version));
+        bytes_ += sizeof magic + 1;
+        last_thread_ = last_lock_ = last_segment_ = 0;
+    }
+
+    //! Return the number of bytes written by the encoder so far.
+    std::size_t bytes_written() const { return bytes_; }
+
+    void write(core::events::thread_specific const& event) {
+        put_event<acquire_kind> visitor(*this,
+                                static_cast<unsigned char>(event.which()));
+        boost::apply_visitor(visitor, event);
+        flush_record();
+    }
+
+    void write(core::events::non_thread_specific const& event) {
+        put_event<start_kind> visitor(*this,
+                                static_cast<unsigned char>(event.which()));
+        boost::apply_visitor(visitor, event);
+        flush_record();
+    }
+};
+
+/**
+ * Class reading events in the binary format from a `std::istream`.
+ *
+ * When the end of the stream is reached before an event could be read, the
+ * `eofbit` and the `failbit` of the stream are set. When the stream does not
+ * contain a valid event, the `failbit` of the stream is set.
+ *
+ * @note Like the encoder, the decoder is stateful; all the events of a file
+ *       must be read by the same decoder, in order. The headers found
+ *       between the events, where events were appended to the file, are
+ *       consumed transparently.
+ */
+class binary_event_decoder : boost::noncopyable {
+    std::istream& is_;
+    std::streambuf& buf_;
+    bool ok_;
+
+    std::size_t last_thread_, last_lock_, last_segment_;
+
+    unsigned char get_byte() {
+        std::streambuf::int_type const c = buf_.sbumpc();
+        if (c == std::streambuf::traits_type::eof()) {
+            ok_ = false;
+            return 0;
+        }
+        return static_cast<unsigned char>(c);
+    }
+
+    std::size_t get_varint() {
+        std::size_t value = 0;
+        for (unsigned shift = 0; ok_; shift += 7) {
+            if (shift >= sizeof(std::size_t) * CHAR_BIT) {
+                ok_ = false;
+                break;
+            }
+            unsigned char const byte = get_byte();
+            value |= static_cast<std::size_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        return value;
+    }
+
+    template <typename Value>
+    Value get_delta(std::size_t& last) {
+        std::size_t const value = unzigzag(get_varint(), last);
+        Value v;
+        set_value(v, value);
+        last = value;
+        return v;
+    }
+
+    template <typename Event, typename Variant>
+    void get_lock_event(Variant& variant) {
+        ThreadId const thread = get_delta<ThreadId>(last_thread_);
+        LockId const lock = get_delta<LockId>(last_lock_);
+        Event event(thread, lock);
+        aux_info_of(event) = get_varint();
+        if (ok_)
+            variant = event;
+    }
+
+    template <typename Variant>
+    void get_segment_hop(Variant& variant) {
+        ThreadId const thread = get_delta<ThreadId>(last_thread_);
+        Segment const segment = get_delta<Segment>(last_segment_);
+        if (ok_)
+            variant = core::events::segment_hop(thread, segment);
+    }
+
+    template <typename Variant>
+    void get_lock_order(Variant& variant) {
+        core::events::lock_order event(get_delta<ThreadId>(last_thread_));
+        event.l1 = get_delta<LockId>(last_lock_);
+        event.l2 = get_delta<LockId>(last_lock_);
+        event.s1 = get_delta<Segment>(last_segment_);
+        event.s2 = get_delta<Segment>(last_segment_);
+        std::size_t const gatelocks = get_varint();
+        // Reading stops at the first error, so a corrupted number of
+        // gatelocks does not make us read for long.
+        for (std::size_t i = 0; ok_ && i < gatelocks; ++i)
+            event.gatelocks.push_back(get_delta<LockId>(last_lock_));
+        event.l1_info = get_varint();
+        event.l2_info = get_varint();
+        event.occurrences = get_varint();
+        if (ok_)
+            variant = event;
+    }
+
+    template <typename Event, typename Variant>
+    void get_start_or_join(Variant& variant) {
+        Segment const parent = get_delta<Segment>(last_segment_);
+        Segment const new_parent = get_delta<Segment>(last_segment_);
+        Segment const child = get_delta<Segment>(last_segment_);
+        if (ok_)
+            variant = Event(parent, new_parent, child);
+    }
+
+    // Consume the zero byte the next record starts with, and the rest of
+    // a header if it is one, in which case the events that follow it start
+    // over. Return whether it was a header of the supported version.
+    bool resume_after_header() {
+        buf_.sbumpc();
+        char header[sizeof magic];
+        if (buf_.sgetn(header, sizeof header) !=
+                                static_cast<std::streamsize>(sizeof header) ||
+                    !std::equal(magic + 1, magic + sizeof magic, header))
+            return false;
+        if (static_cast<unsigned char>(header[sizeof magic - 1]) != version) {
+            is_.setstate(std::ios::failbit);
+            return false;
+        }
+        last_thread_ = last_lock_ = last_segment_ = 0;
+        return true;
+    }
+
+    // Return the kind of the next event without consuming it, after the
+    // headers preceding it, or set the state of the stream and return
+    // `number_of_kinds` if there is no next event.
+    unsigned char peek_kind() {
+        std::streambuf::int_type c = buf_.sgetc();
+        while (c == end_of_events_kind && resume_after_header())
+            c = buf_.sgetc();
+        if (!is_)
+            return number_of_kinds;
+        if (c == std::streambuf::traits_type::eof() ||
+                                                c == end_of_events_kind) {
+            is_.setstate(std::ios::eofbit | std::ios::failbit);
+            return number_of_kinds;
+        }
+        return static_cast<unsigned char>(c);
+    }
+
+    // Read the kind of the next event, or set the state of the stream and
+    // return `number_of_kinds` if there is no next event.
+    unsigned char get_kind() {
+        unsigned char const kind = peek_kind();
+        if (kind != number_of_kinds)
+            buf_.sbumpc();
+        return kind;
+    }
+
+    void finish() {
+        if (!ok_)
+            is_.setstate(std::ios::failbit);
+    }
+
+public:
+    explicit binary_event_decoder(std::istream& is)
+        : is_(is), buf_(*is.rdbuf()), ok_(true),
+          last_thread_(0), last_lock_(0), last_segment_(0)
+    { }
+
+    /**
+     * Consume the header of the binary format if the stream starts with
+     * one, and return whether it was the case. If the stream does not start
+     * with a header, nothing is consumed.
+     *
+     * @note If the header announces an unsupported version of the format,
+     *       the `failbit` of the stream is set.
+     */
+    bool read_header() {
+        char header[sizeof magic + 1];
+        std::streamsize const read = buf_.sgetn(header, sizeof header);
+        if (read != static_cast<std::streamsize>(sizeof header) ||
+                    !std::equal(magic, magic + sizeof magic, header)) {
+            buf_.pubseekoff(-read, std::ios::cur, std::ios::in);
+            return false;
+        }
+        if (static_cast<unsigned char>(header[sizeof magic]) != version)
+            is_.setstate(std::ios::failbit);
+        return true;
+    }
+
+    void read(core::events::thread_specific& event) {
+        if (!is_)
+            return;
+        switch (get_kind()) {
+            case acquire_kind:
+                get_lock_event<core::events::acquire>(event); break;
+            case release_kind:
+                get_lock_event<core::events::release>(event); break;
+            case recursive_acquire_kind:
+                get_lock_event<core::events::recursive_acquire>(event); break;
+            case recursive_release_kind:
+                get_lock_event<core::events::recursive_release>(event); break;
+            case segment_hop_kind:
+                get_segment_hop(event); break;
+            case lock_order_kind:
+                get_lock_order(event); break;
+            case number_of_kinds:
+                return;
+            default:
+                ok_ = false; break;
+        }
+        finish();
+    }
+
+    void read(core::events::non_thread_specific& event) {
+        if (!is_)
+            return;
+        switch (get_kind()) {
+            case start_kind:
+                get_start_or_join<core::events::start>(event); break;
+            case join_kind:
+                get_start_or_join<core::events::join>(event); break;
+            case number_of_kinds:
+                return;
+            default:
+                ok_ = false; break;
+        }
+        finish();
+    }
+
+    /**
+     * Read the next event, whatever its type, and discard it. Return
+     * whether an event was read.
+     */
+    bool skip() {
+        if (!is_)
+            return false;
+        unsigned char const kind = peek_kind();
+        if (kind == number_of_kinds)
+            return false;
+        if (kind >= start_kind) {
+            core::events::non_thread_specific event;
+            read(event);
+        } else {
+            core::events::thread_specific event;
+            read(event);
+        }
+        return static_cast<bool>(is_);
+    }
+};
+} // end namespace binary_event_codec_detail
+
+namespace core {
+    using binary_event_codec_detail::binary_event_decoder;
+    using binary_event_codec_detail::binary_event_encoder;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_BINARY_EVENT_CODEC_HPP
@@ -35,12 +35,14 @@
 #include <boost/range/end.hpp>
 #include <boost/type_traits/is_same.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <boost/variant/apply_visitor.hpp>
 #include <boost/variant/static_visitor.hpp>
 #include <cstddef>
 #include <typeinfo>
 #include <utility>
+#include <vector>
 
 
 namespace d2 {
@@ -99,6 +101,100 @@ bool is_adjacent(Graph const& graph,
 }
 
 
+/**
+ * Index of the edges of a lock graph by their endpoints and their label, to
+ * find whether an edge is already in the graph in expected constant time,
+ * instead of scanning the out-edges of its source like `is_adjacent`.
+ *
+ * The index is meant to be kept alongside its graph, alongside the table
+ * interning the gatelock sets of the graph, across all the calls to
+ * `build_lock_graph` adding edges to it. Since the gatelock sets of the
+ * labels are interned, the index only stores the components of the labels
+ * and the number of their gatelock set in the table.
+ *
+ * @note The index is not updated when edges are added to the graph by other
+ *       means than `insert()`.
+ */
+template <typename Graph>
+class EdgeIndex {
+    typedef boost::graph_traits<Graph> Traits;
+    typedef typename Traits::vertex_descriptor VertexDescriptor;
+    typedef typename Traits::edge_descriptor EdgeDescriptor;
+    typedef typename boost::edge_property_type<Graph>::type EdgeLabel;
+
+    struct Key : boost::equality_comparable<Key> {
+        Key(VertexDescriptor u, VertexDescriptor v, EdgeLabel const& label,
+            std::size_t gatelocks)
+            : u(u), v(v), s1(label.s1), s2(label.s2),
+              thread(thread_of(label)), gatelocks(gatelocks),
+              l1_info(label.l1_info), l2_info(label.l2_info)
+        { }
+
+        VertexDescriptor u, v;
+        Segment s1, s2;
+        ThreadId thread;
+        std::size_t gatelocks;
+        detail::CallStackId l1_info, l2_info;
+
+        friend bool operator==(Key const& a, Key const& b) {
+            return a.u == b.u && a.v == b.v &&
+                   a.s1 == b.s1 && a.s2 == b.s2 &&
+                   a.thread == b.thread &&
+                   a.l1_info == b.l1_info && a.l2_info == b.l2_info &&
+                   a.gatelocks == b.gatelocks;
+        }
+
+        friend std::size_t hash_value(Key const& self) {
+            std::size_t seed = 0;
+            boost::hash_combine(seed, self.u);
+            boost::hash_combine(seed, self.v);
+            boost::hash_combine(seed, self.s1);
+            boost::hash_combine(seed, self.s2);
+            boost::hash_combine(seed, self.thread);
+            boost::hash_combine(seed, self.l1_info);
+            boost::hash_combine(seed, self.l2_info);
+            boost::hash_combine(seed, self.gatelocks);
+            return seed;
+        }
+    };
+
+    boost::unordered_set<Key> edges_;
+
+public:
+    //! Create an empty index, for a graph without edges.
+    EdgeIndex() { }
+
+    /**
+     * Create an index of the edges already in `graph`.
+     *
+     * @pre The gatelock sets of the edges of `graph` are all interned in
+     *      the same table, e.g. with `intern_gatelocks`.
+     */
+    explicit EdgeIndex(Graph const& graph) {
+        edges_.reserve(num_edges(graph));
+        BOOST_FOREACH(EdgeDescriptor e, edges(graph))
+            edges_.insert(Key(source(e, graph), target(e, graph), graph[e],
+                              gatelocks_id_of(graph[e])));
+    }
+
+    /**
+     * Add an edge from `u` to `v` with the property `label` to the index,
+     * and return whether there was no such edge in the index already.
+     *
+     * @pre The gatelock set of `label` is interned in the same table as the
+     *      gatelock sets of the edges already in the index.
+     */
+    bool insert(VertexDescriptor u, VertexDescriptor v,
+                EdgeLabel const& label) {
+        return edges_.insert(Key(u, v, label, gatelocks_id_of(label))).second;
+    }
+
+    //! Return the number of edges in the index.
+    std::size_t size() const {
+        return edges_.size();
+    }
+};
+
 /**
  * Represents a lock that is currently held by a thread. The segment in
  * which the lock was acquired is recorded along with some other arbitrary
@@ -144,6 +240,10 @@ struct EventVisitor : boost::static_visitor<void> {
 
     Segment current_segment;
     boost::unordered_map<LockId, std::size_t> recursive_lock_count;
+    core::GatelockTable& gatelocks;
+    EdgeIndex<Graph>& edge_index;
+    // Locks held by the thread, in order; reused to avoid allocations.
+    std::vector<LockId> held_lock_ids;
     CustomVertexInfo custom_vertex_info;
     CustomEdgeInfo custom_edge_info;
 
@@ -162,10 +262,13 @@ struct EventVisitor : boost::static_visitor<void> {
     //          initial value (default constructed) until we encounter a
     //          SegmentHopEvent.
     EventVisitor(Graph& lg, ThreadId const& this_thread,
+                 core::GatelockTable& gatelocks,
+                 EdgeIndex<Graph>& edge_index,
                  CustomVertexInfo const& vertex_info,
                  CustomEdgeInfo const& edge_info)
         : graph(lg), this_thread(this_thread), held_locks(),
           current_segment(), recursive_lock_count(),
+          gatelocks(gatelocks), edge_index(edge_index), held_lock_ids(),
           custom_vertex_info(vertex_info), custom_edge_info(edge_info)
     { }
 
@@ -207,10 +310,10 @@ struct EventVisitor : boost::static_visitor<void> {
 
         // Compute the gatelock set, i.e. the set of locks currently
         // held by this thread.
-        core::Gatelocks::underlying_set_type g_tmp;
+        held_lock_ids.clear();
         BOOST_FOREACH(HeldLock const& l, held_locks)
-            g_tmp.get<1>().push_back(l.lock);
-        core::Gatelocks g(boost::move(g_tmp));
+            held_lock_ids.push_back(l.lock);
+        core::Gatelocks g(gatelocks.intern(held_lock_ids));
 
         // Add an edge from every lock l1 already held by
         // this thread to l2.
@@ -238,7 +341,7 @@ struct EventVisitor : boost::static_visitor<void> {
             // place in the code, we would still want to detect a
             // different deadlock during the analysis. See the
             // simple_ABBA_redudant_diff_functions test for more info.
-            if (!is_adjacent(graph, l1_vertex, l2_vertex, label)) {
+            if (edge_index.insert(l1_vertex, l2_vertex, label)) {
                 std::pair<EdgeDescriptor, bool> added_edge =
                             add_edge(l1_vertex, l2_vertex, label, graph);
 
@@ -256,6 +359,36 @@ struct EventVisitor : boost::static_visitor<void> {
         process_acquire_event(event);
     }
 
+    // Edges recorded by the program are added as is, since the program
+    // already computed their label.
+    void operator()(core::events::lock_order const& event) {
+        ThreadId t(thread_of(event));
+        if (t != this_thread)
+            D2_THROW(EventThreadException()
+                        << ExpectedThread(this_thread)
+                        << ActualThread(t));
+
+        VertexDescriptor l1_vertex = add_vertex(event.l1, graph);
+        VertexDescriptor l2_vertex = add_vertex(event.l2, graph);
+        custom_vertex_info(l2_vertex, event.l2_info);
+
+        core::Gatelocks g(gatelocks.intern(event.gatelocks));
+
+        EdgeLabel label(event.s1, t, g, event.s2);
+        label.l1_info = event.l1_info;
+        label.l2_info = event.l2_info;
+        if (edge_index.insert(l1_vertex, l2_vertex, label)) {
+            std::pair<EdgeDescriptor, bool> added_edge =
+                            add_edge(l1_vertex, l2_vertex, label, graph);
+
+            BOOST_ASSERT_MSG(added_edge.second,
+                "two vertices that are not adjacent via an edge with "
+                "the current label could not be connected");
+
+            custom_edge_info(added_edge.first, event.l1_info, event.l2_info);
+        }
+    }
+
     void operator()(core::events::recursive_acquire const& event) {
         ThreadId thread(thread_of(event));
         LockId lock(lock_of(event));
@@ -331,7 +464,7 @@ struct DeduceThisThread : boost::static_visitor<ThreadId> {
     template <typename Event>
     ThreadId operator()(Event const& event) const {
         D2_THROW(EventTypeException()
-                    << ExpectedType("acquire, recursive_acquire or segment_hop")
+                    << ExpectedType("acquire, recursive_acquire, segment_hop or lock_order")
                     << ActualType(typeid(event).name()));
         return ThreadId(); // never reached.
     }
@@ -344,6 +477,9 @@ struct DeduceThisThread : boost::static_visitor<ThreadId> {
 
     ThreadId operator()(core::events::segment_hop const& event) const
     { return thread_of(event); }
+
+    ThreadId operator()(core::events::lock_order const& event) const
+    { return thread_of(event); }
 };
 
 template <typename Map>
@@ -373,10 +509,16 @@ struct CustomVertexInfo {
  * Depending on the `SilentlyIgnoreOtherEvents` template parameter,
  * unexpected events trigger an exception or are ignored silently.
  *
+ * The gatelock sets of the edges are interned in `gatelocks`, and the new
+ * edges are looked up in `edges`, so the same table and index should be
+ * kept alongside a graph for all the events added to it.
+ *
  * In all cases, the algorithm provides the basic exception guarantee.
  */
 template <bool SilentlyIgnoreOtherEvents, typename Iterator, typename Graph>
-void build_lock_graph(Iterator first, Iterator last, Graph& graph) {
+void build_lock_graph(Iterator first, Iterator last, Graph& graph,
+                      core::GatelockTable& gatelocks,
+                      EdgeIndex<Graph>& edges) {
     // We must be able to add new vertices/edges and to set their
     // respective properties to build the lock graph.
     // Note: See the note in build_segmentation_graph.hpp to know why
@@ -414,11 +556,54 @@ void build_lock_graph(Iterator first, Iterator last, Graph& graph) {
     EdgeBundleMap edge_bundle = get(boost::edge_bundle, graph);
     CustomEdgeInfo<EdgeBundleMap> edge_info(edge_bundle);
 
-    Visitor visitor(graph, this_thread, vertex_info, edge_info);
+    Visitor visitor(graph, this_thread, gatelocks, edges,
+                    vertex_info, edge_info);
     for (; first != last; ++first)
         boost::apply_visitor(visitor, *first);
 }
 
+/**
+ * Intern the gatelock sets of the edges already in `graph` in `gatelocks`,
+ * and make the labels of these edges refer to the interned sets.
+ *
+ * The edges of a graph may then be indexed with an `EdgeIndex`, and new
+ * edges be added with the same table, even if the graph was built with
+ * several tables.
+ */
+template <typename Graph>
+void intern_gatelocks(Graph& graph, core::GatelockTable& gatelocks) {
+    typedef typename boost::graph_traits<Graph>::edge_descriptor
+                                                            EdgeDescriptor;
+    typedef typename boost::edge_property_type<Graph>::type EdgeLabel;
+
+    BOOST_FOREACH(EdgeDescriptor e, edges(graph)) {
+        EdgeLabel& label = graph[e];
+        EdgeLabel interned(label.s1, thread_of(label),
+                    gatelocks.intern(gatelocks_of(label).template get<1>()),
+                    label.s2);
+        interned.l1_info = label.l1_info;
+        interned.l2_info = label.l2_info;
+        label = interned;
+    }
+}
+
+/**
+ * Overload interning the gatelock sets in a table of its own, and indexing
+ * the edges already in `graph` to add the new ones.
+ *
+ * @note The gatelock sets of the edges already in `graph` are interned
+ *       again in that table, so that the gatelock sets of all the edges of
+ *       `graph` have their number in the same table when it returns.
+ */
+template <bool SilentlyIgnoreOtherEvents, typename Iterator, typename Graph>
+void build_lock_graph(Iterator first, Iterator last, Graph& graph) {
+    core::GatelockTable gatelocks;
+    intern_gatelocks(graph, gatelocks);
+    EdgeIndex<Graph> edges(graph);
+    build_lock_graph<SilentlyIgnoreOtherEvents>(first, last, graph,
+                                                gatelocks, edges);
+}
+
 template <bool SilentlyIgnoreOtherEvents, typename Range, typename Graph>
 void build_lock_graph(Range const& range, Graph& graph) {
     build_lock_graph<SilentlyIgnoreOtherEvents>(
@@ -428,6 +613,8 @@ void build_lock_graph(Range const& range, Graph& graph) {
 
 namespace core {
     using build_lock_graph_detail::build_lock_graph;
+    using build_lock_graph_detail::EdgeIndex;
+    using build_lock_graph_detail::intern_gatelocks;
 }
 } // end namespace d2
 
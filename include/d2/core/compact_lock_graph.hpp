@@ -0,0 +1,219 @@
+/**
+ * This file defines the `CompactLockGraph` class.
+ */
+
+#ifndef D2_CORE_COMPACT_LOCK_GRAPH_HPP
+#define D2_CORE_COMPACT_LOCK_GRAPH_HPP
+
+#include <d2/core/lock_graph.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/call_stack_table.hpp>
+
+#include <boost/dynamic_bitset.hpp>
+#include <boost/foreach.hpp>
+#include <boost/graph/graph_traits.hpp>
+#include <boost/unordered_map.hpp>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+
+namespace d2 {
+namespace compact_lock_graph_detail {
+/**
+ * Read-only copy of a part of a lock graph, laid out for the search of
+ * potential deadlocks and the report of the deadlocks found.
+ *
+ * The vertices are numbered densely, in the order of the lock graph, and
+ * the out edges of each vertex are stored contiguously, in the order of
+ * the lock graph (compressed sparse row). The attributes of the edges are
+ * stored in separate arrays:
+ *  - the thread of the edge;
+ *  - the positions of its segments in an index of the `happens_before`
+ *    relation, i.e. a `HappensBeforeIndex` or a `VectorClockIndex`, so
+ *    they are ordered without hashing them;
+ *  - the number of its gatelock set, whose locks are stored in a bitset
+ *    over a dense numbering of the locks, so two sets overlap when their
+ *    bitsets share a word. Equal gatelock sets have the same number,
+ *    whether or not they were interned in the same `GatelockTable`;
+ *  - the call stacks at which its locks were acquired.
+ *
+ * The copy does not refer to the lock graph, which is not needed anymore
+ * once the copy is built.
+ *
+ * @note The positions of the segments are only meaningful for the index
+ *       the graph was built with.
+ */
+template <typename Graph>
+class CompactLockGraph {
+public:
+    typedef boost::dynamic_bitset<> Bitset;
+    typedef typename boost::graph_traits<Graph>::vertex_descriptor Vertex;
+    typedef typename boost::graph_traits<Graph>::edge_descriptor Edge;
+
+private:
+    // Lock of each vertex.
+    std::vector<LockId> locks_;
+
+    // The out edges of the vertex `v` are the edges `offsets_[v]` up to
+    // `offsets_[v + 1]`.
+    std::vector<std::size_t> offsets_;
+
+    // Attributes of each edge.
+    std::vector<std::size_t> targets_;
+    std::vector<ThreadId> threads_;
+    std::vector<std::size_t> s1_, s2_;
+    std::vector<std::size_t> gatelocks_;
+    std::vector<detail::CallStackId> l1_info_, l2_info_;
+
+    // Locks of each gatelock set, as a bitset and in the order in which
+    // they were acquired.
+    std::vector<Bitset> gatelock_sets_;
+    std::vector<std::vector<LockId> > held_locks_;
+
+    // The gatelock sets already numbered, by the address of their shared
+    // instance, and by their locks in the order in which they were acquired.
+    typedef core::Gatelocks::underlying_set_type GatelockSet;
+    typedef boost::unordered_map<GatelockSet const*, std::size_t> Instances;
+    typedef boost::unordered_map<
+                std::vector<LockId>, std::size_t
+            > Contents;
+
+    // Return the number of the gatelocks of `label`, numbering them and
+    // their locks if they were not already. The gatelock sets are numbered
+    // by their contents, whatever table they were interned in, if any; the
+    // locks of an instance shared by several edges are only hashed once.
+    template <typename Label>
+    std::size_t number_of(Label const& label, Instances& instances,
+                          Contents& contents,
+                          boost::unordered_map<LockId, std::size_t>& locks) {
+        GatelockSet const& gatelocks = gatelocks_of(label);
+        typename Instances::const_iterator const known =
+                                                instances.find(&gatelocks);
+        if (known != instances.end())
+            return known->second;
+
+        std::vector<LockId> held(gatelocks.template get<1>().begin(),
+                                 gatelocks.template get<1>().end());
+        std::pair<typename Contents::iterator, bool> const numbered =
+            contents.insert(std::make_pair(held, gatelock_sets_.size()));
+        instances.insert(std::make_pair(&gatelocks, numbered.first->second));
+        if (!numbered.second)
+            return numbered.first->second;
+
+        gatelock_sets_.push_back(Bitset());
+        Bitset& bitset = gatelock_sets_.back();
+        BOOST_FOREACH(LockId const& lock, held) {
+            std::size_t const number =
+                locks.insert(std::make_pair(lock, locks.size()))
+                                                        .first->second;
+            if (number >= bitset.size())
+                bitset.resize(number + 1);
+            bitset.set(number);
+        }
+        held_locks_.push_back(held);
+        return numbered.first->second;
+    }
+
+public:
+    /**
+     * Copy the vertices of `graph` in the `vertices` range, in order, and
+     * the edges between them.
+     *
+     * This takes `O(V + E)` time, where `V` and `E` are the number of
+     * vertices and out edges of the vertices in the range.
+     */
+    template <typename Vertices, typename HappensBefore>
+    CompactLockGraph(Graph const& graph, Vertices const& vertices,
+                     HappensBefore const& happens_before) {
+        boost::unordered_map<Vertex, std::size_t> dense;
+        BOOST_FOREACH(Vertex v, vertices) {
+            dense.insert(std::make_pair(v, dense.size()));
+            locks_.push_back(graph[v]);
+        }
+
+        Instances instances;
+        Contents contents;
+        boost::unordered_map<LockId, std::size_t> locks;
+        offsets_.reserve(dense.size() + 1);
+        offsets_.push_back(0);
+        BOOST_FOREACH(Vertex u, vertices) {
+            BOOST_FOREACH(Edge e, out_edges(u, graph)) {
+                typename boost::unordered_map<
+                    Vertex, std::size_t
+                >::const_iterator const v = dense.find(target(e, graph));
+                if (v == dense.end())
+                    continue;
+                targets_.push_back(v->second);
+                threads_.push_back(thread_of(graph[e]));
+                s1_.push_back(happens_before.position_of(graph[e].s1));
+                s2_.push_back(happens_before.position_of(graph[e].s2));
+                gatelocks_.push_back(
+                    number_of(graph[e], instances, contents, locks));
+                l1_info_.push_back(graph[e].l1_info);
+                l2_info_.push_back(graph[e].l2_info);
+            }
+            offsets_.push_back(targets_.size());
+        }
+
+        // All the bitsets have the same size, so they can be compared word
+        // by word.
+        BOOST_FOREACH(Bitset& bitset, gatelock_sets_)
+            bitset.resize(locks.size());
+    }
+
+    //! Return the number of vertices of the graph.
+    std::size_t num_vertices() const { return offsets_.size() - 1; }
+
+    //! Return the number of edges of the graph.
+    std::size_t num_edges() const { return targets_.size(); }
+
+    //! Return the first out edge of the vertex `v`.
+    std::size_t edges_begin(std::size_t v) const { return offsets_[v]; }
+
+    //! Return one past the last out edge of the vertex `v`.
+    std::size_t edges_end(std::size_t v) const { return offsets_[v + 1]; }
+
+    //! Return the lock of the vertex `v`.
+    LockId const& lock(std::size_t v) const { return locks_[v]; }
+
+    //! Return the vertex the edge `e` goes to.
+    std::size_t target_of(std::size_t e) const { return targets_[e]; }
+
+    //! Return the thread that created the edge `e`.
+    ThreadId const& thread(std::size_t e) const { return threads_[e]; }
+
+    //! Return the position of the first segment of the edge `e`.
+    std::size_t s1(std::size_t e) const { return s1_[e]; }
+
+    //! Return the position of the second segment of the edge `e`.
+    std::size_t s2(std::size_t e) const { return s2_[e]; }
+
+    //! Return the bitset of the gatelocks of the edge `e`.
+    Bitset const& gatelocks(std::size_t e) const {
+        return gatelock_sets_[gatelocks_[e]];
+    }
+
+    /**
+     * Return the locks of the gatelocks of the edge `e`, in the order in
+     * which they were acquired.
+     */
+    std::vector<LockId> const& held_locks(std::size_t e) const {
+        return held_locks_[gatelocks_[e]];
+    }
+
+    //! Return the call stack at which the source of `e` was acquired.
+    detail::CallStackId l1_info(std::size_t e) const { return l1_info_[e]; }
+
+    //! Return the call stack at which the target of `e` was acquired.
+    detail::CallStackId l2_info(std::size_t e) const { return l2_info_[e]; }
+};
+} // end namespace compact_lock_graph_detail
+
+namespace core {
+    using compact_lock_graph_detail::CompactLockGraph;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_COMPACT_LOCK_GRAPH_HPP
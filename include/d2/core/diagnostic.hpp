@@ -10,12 +10,11 @@
 #include <d2/core/lock_id.hpp>
 #include <d2/core/thread_id.hpp>
 #include <d2/detail/decl.hpp>
-#include <d2/detail/lock_debug_info.hpp>
+#include <d2/detail/call_stack_table.hpp>
 
 #include <boost/assert.hpp>
 #include <boost/move/utility.hpp>
 #include <boost/operators.hpp>
-#include <boost/optional.hpp>
 #include <boost/type_traits/remove_reference.hpp>
 #include <iosfwd>
 #include <vector>
@@ -33,7 +32,8 @@ struct deadlocked_thread : boost::partially_ordered<deadlocked_thread> {
     deadlocked_thread(ThreadId tid, BOOST_FWD_REF(Container) locks,
                                     LockId waiting_for)
         : tid(tid), holding(boost::forward<Container>(locks)),
-          holding_info(holding.size()), waiting_for(waiting_for)
+          holding_info(holding.size(), detail::no_call_stack),
+          waiting_for(waiting_for), waiting_for_info(detail::no_call_stack)
     {
         BOOST_ASSERT_MSG(holding.size() >= 1,
             "a thread can't be deadlocked if it is not holding at least one "
@@ -51,7 +51,8 @@ struct deadlocked_thread : boost::partially_ordered<deadlocked_thread> {
                       BOOST_FWD_REF(Iterator) last, LockId waiting_for)
         : tid(tid), holding(boost::forward<Iterator>(first),
                             boost::forward<Iterator>(last)),
-          holding_info(holding.size()), waiting_for(waiting_for)
+          holding_info(holding.size(), detail::no_call_stack),
+          waiting_for(waiting_for), waiting_for_info(detail::no_call_stack)
     {
         BOOST_ASSERT_MSG(holding.size() >= 1,
             "a thread can't be deadlocked if it is not holding at least one "
@@ -66,12 +67,14 @@ struct deadlocked_thread : boost::partially_ordered<deadlocked_thread> {
     typedef std::vector<LockId> lock_sequence;
 
     /*!
-     * Type of the sequence containing the information of the locks held by
-     * the thread.
+     * Type of the sequence containing the identifiers of the call stacks at
+     * which the locks held by the thread were acquired.
+     *
+     * @note Call stacks are resolved with the `detail::CallStackTable` of
+     *       the analyzed program; an identifier equal to
+     *       `detail::no_call_stack` means that no call stack is available.
      */
-    typedef std::vector<
-                boost::optional<detail::LockDebugInfo>
-            > lock_info_sequence;
+    typedef std::vector<detail::CallStackId> lock_info_sequence;
 
     /*!
      * Collection of locks held by that thread at the moment of the deadlock.
@@ -84,7 +87,8 @@ struct deadlocked_thread : boost::partially_ordered<deadlocked_thread> {
     //! Identifier of the lock the thread is waiting after.
     LockId waiting_for;
 
-    boost::optional<detail::LockDebugInfo> waiting_for_info;
+    //! Identifier of the call stack at which the thread waits for the lock.
+    detail::CallStackId waiting_for_info;
 
     /*!
      * Return whether two `deadlocked_thread`s represent the same thread
@@ -225,7 +229,8 @@ public:
 
 /*!
  * Write an explanation of the potential deadlock state in plain text to
- * an output stream.
+ * an output stream. The call stacks of the deadlocked threads are resolved
+ * using `call_stacks`.
  *
  * Example output:
  *  <begin output>
@@ -238,7 +243,8 @@ public:
  *  <end output>
  */
 D2_DECL extern std::ostream&
-plain_text_explanation(std::ostream&, potential_deadlock const&);
+plain_text_explanation(std::ostream&, potential_deadlock const&,
+                       detail::CallStackTable const& call_stacks);
 } // end namespace diagnostic_detail
 
 namespace core {
@@ -0,0 +1,366 @@
+/**
+ * This file defines the `event_ofstream` and the `event_ifstream` classes.
+ */
+
+#ifndef D2_CORE_EVENT_STREAM_HPP
+#define D2_CORE_EVENT_STREAM_HPP
+
+#include <d2/core/binary_event_codec.hpp>
+#include <d2/core/events.hpp>
+#include <d2/detail/compressed_streambuf.hpp>
+#include <d2/detail/mapped_filebuf.hpp>
+
+#include <algorithm>
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <cstddef>
+#include <cstring>
+#include <dyno/serializing_stream.hpp>
+#include <fstream>
+#include <ios>
+#include <streambuf>
+
+
+namespace d2 {
+namespace event_stream_detail {
+/**
+ * Formats in which events can be written to a repository.
+ */
+enum event_format {
+    //! Events are serialized with `boost::archive::text_oarchive`.
+    text_format,
+
+    //! Events are written in the compact format implemented by
+    //! `d2::core::binary_event_encoder`.
+    binary_format
+};
+
+/**
+ * Return the `event_format` named `name`, which must be either `"text"` or
+ * `"binary"`, in `format`. Return whether `name` was a valid format name.
+ */
+inline bool parse_event_format(char const* name, event_format& format) {
+    if (std::strcmp(name, "text") == 0)
+        format = text_format;
+    else if (std::strcmp(name, "binary") == 0)
+        format = binary_format;
+    else
+        return false;
+    return true;
+}
+
+//! Return the mode in which files of the given `format` must be opened.
+inline std::ios::openmode openmode_for(event_format format) {
+    return format == binary_format ? std::ios::binary : std::ios::openmode();
+}
+
+/**
+ * Flag of `std::ios::openmode` making an `event_ofstream` write its file
+ * through a memory mapping instead of a `std::filebuf`; see
+ * `d2::detail::mapped_filebuf`.
+ *
+ * @note This is not a standard flag. It is removed from the mode before the
+ *       mode is given to the standard library.
+ */
+static std::ios::openmode const mapped =
+                                    static_cast<std::ios::openmode>(0x1000);
+
+/**
+ * Flag of `std::ios::openmode` making an `event_ofstream` write its file as
+ * a compressed container; see `d2::detail::compressing_streambuf`.
+ *
+ * @note This is not a standard flag either, and it is removed from the mode
+ *       before the mode is given to the standard library.
+ */
+static std::ios::openmode const compressed =
+                                    static_cast<std::ios::openmode>(0x2000);
+
+/**
+ * Return the number of bytes of the file at `path` holding what was written
+ * by an `event_ofstream`.
+ *
+ * This is the size of the file, unless it was written through a memory
+ * mapping and never closed, e.g. because the program crashed, in which
+ * case the file ends with zero padding; see `d2::detail::mapped_filebuf`.
+ * Since the last bytes of a compressed or binary file may be legitimate
+ * zeros, the padding of these files is found by skipping their blocks or
+ * their events up to the first end marker. Text files never contain zeros,
+ * so their trailing zeros are all padding.
+ */
+inline boost::uintmax_t written_size(boost::filesystem::path const& path) {
+    namespace cs = detail::compressed_streambuf_detail;
+    std::ifstream file(path.string().c_str(),
+                       std::ios::in | std::ios::binary);
+    std::streambuf& buf = *file.rdbuf();
+    std::streamoff const size = buf.pubseekoff(0, std::ios::end,
+                                               std::ios::in);
+    if (!file || size <= 0) {
+        boost::system::error_code ec;
+        boost::uintmax_t const unread = boost::filesystem::file_size(path,ec);
+        return ec ? 0 : unread;
+    }
+
+    // A file that does not end with a zero has no padding.
+    buf.pubseekpos(size - 1, std::ios::in);
+    if (buf.sgetc() != 0)
+        return static_cast<boost::uintmax_t>(size);
+
+    buf.pubseekpos(0, std::ios::in);
+    char magic[sizeof cs::magic];
+    if (buf.sgetn(magic, sizeof magic) == sizeof magic &&
+                        std::equal(magic, magic + sizeof magic, cs::magic))
+        return cs::end_of_blocks(buf, static_cast<boost::uintmax_t>(size));
+
+    buf.pubseekpos(0, std::ios::in);
+    core::binary_event_decoder decoder(file);
+    if (decoder.read_header()) {
+        std::streamoff end = buf.pubseekoff(0, std::ios::cur, std::ios::in);
+        while (file && decoder.skip())
+            end = buf.pubseekoff(0, std::ios::cur, std::ios::in);
+        return static_cast<boost::uintmax_t>(end);
+    }
+
+    std::streamoff end = size;
+    char block[4096];
+    while (end > 0) {
+        std::streamoff const n = std::min<std::streamoff>(end, sizeof block);
+        buf.pubseekpos(end - n, std::ios::in);
+        if (buf.sgetn(block, n) != n)
+            break;
+        std::streamoff zeros = 0;
+        while (zeros < n && block[n - 1 - zeros] == 0)
+            ++zeros;
+        end -= zeros;
+        if (zeros != n)
+            break;
+    }
+    return static_cast<boost::uintmax_t>(end);
+}
+
+/**
+ * Output file stream writing events in one of the supported `event_format`s.
+ *
+ * The format is selected with the mode used to open the file: files opened
+ * with `std::ios::binary` are written in the binary format, and the other
+ * ones are written in the text format. Files opened with `mapped` are
+ * written through a memory mapping, and files opened with `compressed` are
+ * compressed, whatever their format.
+ *
+ * Files opened with `std::ios::app` are appended to. If such a file was
+ * left unclosed by a memory mapped stream, its padding is removed first, so
+ * that the events appended to it can be read back. In the binary format,
+ * the appended events are preceded by a header of their own, since they do
+ * not follow from the state the file was left in.
+ */
+class event_ofstream
+    : public dyno::serializing_stream<
+        std::ofstream, boost::archive::text_oarchive
+    >
+{
+    typedef dyno::serializing_stream<
+                std::ofstream, boost::archive::text_oarchive
+            > TextStream;
+
+    boost::scoped_ptr<core::binary_event_encoder> encoder_;
+    // Position at which the file was opened, for the text format.
+    std::streampos start_;
+    detail::mapped_filebuf mapped_buffer_;
+    // Note: This must be destroyed before the buffer it writes to.
+    detail::compressing_streambuf compressed_buffer_;
+
+    // The file was already opened by the `std::ofstream` we inherit from,
+    // so we close it and write to it through our own buffer instead.
+    template <typename Path>
+    void use_mapped_buffer(Path const& path, std::ios::openmode mode) {
+        if (!*this)
+            return;
+        this->close();
+        if (mapped_buffer_.open(path, mode))
+            this->std::ios::rdbuf(&mapped_buffer_);
+        else
+            this->setstate(std::ios::failbit);
+    }
+
+    // Compress what is written to the current buffer of the stream, which
+    // is either the `std::filebuf` or the memory mapped buffer.
+    void use_compressed_buffer() {
+        if (!*this)
+            return;
+        if (compressed_buffer_.open(this->std::ios::rdbuf()))
+            this->std::ios::rdbuf(&compressed_buffer_);
+        else
+            this->setstate(std::ios::failbit);
+    }
+
+    // Remove the padding of a file that is about to be appended to, and
+    // return its path.
+    template <typename Path>
+    static Path const& without_padding(Path const& path,
+                                       std::ios::openmode mode) {
+        if (!(mode & std::ios::app))
+            return path;
+        boost::filesystem::path const file(path);
+        boost::system::error_code ec;
+        if (boost::filesystem::is_regular_file(file, ec)) {
+            boost::uintmax_t const size = written_size(file);
+            if (size < boost::filesystem::file_size(file, ec) && !ec)
+                boost::filesystem::resize_file(file, size, ec);
+        }
+        return path;
+    }
+
+    template <typename Event>
+    event_ofstream& write(Event const& event) {
+        if (encoder_)
+            encoder_->write(event);
+        else
+            static_cast<TextStream&>(*this) << event;
+        return *this;
+    }
+
+public:
+    template <typename Path>
+    explicit event_ofstream(Path const& path,
+                            std::ios::openmode mode = std::ios::out)
+        : TextStream(without_padding(path, mode), mode & ~(mapped|compressed))
+    {
+        // Note: A std::filebuf opened with std::ios::app only moves to the
+        //       end of the file when it is written to, but the compressed
+        //       buffer needs the position to know whether the file is empty.
+        if (mode & mapped)
+            use_mapped_buffer(path, mode & ~(mapped | compressed));
+        else if (mode & std::ios::app)
+            this->seekp(0, std::ios::end);
+        if (mode & compressed)
+            use_compressed_buffer();
+        start_ = this->tellp();
+        if (mode & std::ios::binary) {
+            encoder_.reset(new core::binary_event_encoder(*this));
+            encoder_->write_header();
+        }
+    }
+
+    /**
+     * Return the number of bytes written to the file since it was opened,
+     * before compression if the file is compressed.
+     */
+    std::size_t bytes_written() {
+        if (encoder_)
+            return encoder_->bytes_written();
+        std::streampos const position = this->tellp();
+        if (position == std::streampos(-1) || start_ == std::streampos(-1))
+            return 0;
+        return static_cast<std::size_t>(position - start_);
+    }
+
+    //! Return the format in which events are written to the file.
+    event_format format() const {
+        return encoder_ ? binary_format : text_format;
+    }
+
+    using TextStream::operator<<;
+
+    event_ofstream& operator<<(core::events::thread_specific const& event) {
+        return write(event);
+    }
+
+    event_ofstream&
+    operator<<(core::events::non_thread_specific const& event) {
+        return write(event);
+    }
+};
+
+/**
+ * Input file stream reading events written by an `event_ofstream`.
+ *
+ * The format of the file is detected automatically when it is opened.
+ */
+class event_ifstream
+    : public dyno::serializing_stream<
+        std::ifstream, boost::archive::text_iarchive
+    >
+{
+    typedef dyno::serializing_stream<
+                std::ifstream, boost::archive::text_iarchive
+            > TextStream;
+
+    boost::scoped_ptr<core::binary_event_decoder> decoder_;
+    detail::decompressing_streambuf compressed_buffer_;
+
+    template <typename Event>
+    event_ifstream& read(Event& event) {
+        if (decoder_)
+            decoder_->read(event);
+        else
+            static_cast<TextStream&>(*this) >> event;
+        return *this;
+    }
+
+public:
+    // Note: The file is always opened in binary mode, since we don't know
+    //       its format until we've looked at its first bytes. This is
+    //       harmless for text files, whose parsing ignores line endings.
+    //       Compressed files are detected the same way, and the format of
+    //       their contents is detected after decompression.
+    template <typename Path>
+    explicit event_ifstream(Path const& path,
+                            std::ios::openmode mode = std::ios::in)
+        : TextStream(path, mode | std::ios::binary)
+    {
+        if (*this && compressed_buffer_.open(this->std::ifstream::rdbuf()))
+            this->std::ios::rdbuf(&compressed_buffer_);
+
+        if (*this) {
+            boost::scoped_ptr<core::binary_event_decoder>
+                                decoder(new core::binary_event_decoder(*this));
+            if (decoder->read_header())
+                decoder_.swap(decoder);
+        }
+    }
+
+    //! Return the format in which the events of the file are written.
+    event_format format() const {
+        return decoder_ ? binary_format : text_format;
+    }
+
+    /**
+     * Set the number of blocks of a compressed file that are decompressed
+     * in parallel. This has no effect on uncompressed files.
+     *
+     * @see `d2::detail::decompressing_streambuf::set_read_ahead`
+     */
+    void set_read_ahead(std::size_t read_ahead) {
+        compressed_buffer_.set_read_ahead(read_ahead);
+    }
+
+    using TextStream::operator>>;
+
+    event_ifstream& operator>>(core::events::thread_specific& event) {
+        return read(event);
+    }
+
+    event_ifstream& operator>>(core::events::non_thread_specific& event) {
+        return read(event);
+    }
+};
+} // end namespace event_stream_detail
+
+namespace core {
+    using event_stream_detail::binary_format;
+    using event_stream_detail::compressed;
+    using event_stream_detail::event_format;
+    using event_stream_detail::event_ifstream;
+    using event_stream_detail::event_ofstream;
+    using event_stream_detail::mapped;
+    using event_stream_detail::openmode_for;
+    using event_stream_detail::parse_event_format;
+    using event_stream_detail::text_format;
+    using event_stream_detail::written_size;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_EVENT_STREAM_HPP
@@ -8,8 +8,8 @@
 #include <d2/core/lock_id.hpp>
 #include <d2/core/segment.hpp>
 #include <d2/core/thread_id.hpp>
+#include <d2/detail/call_stack_table.hpp>
 #include <d2/detail/inherit_constructors.hpp>
-#include <d2/detail/lock_debug_info.hpp>
 
 #include <boost/mpl/bool.hpp>
 #include <boost/mpl/contains.hpp>
@@ -19,8 +19,11 @@
 #include <boost/serialization/access.hpp>
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/variant.hpp>
+#include <boost/serialization/vector.hpp>
 #include <boost/variant.hpp>
+#include <cstddef>
 #include <dyno/detail/auto_struct.hpp>
+#include <vector>
 
 
 namespace d2 {
@@ -65,15 +68,17 @@ struct acquire
     >
 {
     // Default constructor required for variant.
-    acquire() { }
+    acquire() : info(detail::no_call_stack) { }
 
     acquire(thread_id tid, lock_id lid)
         : auto_struct_(dyno::detail::make_member<tag::thread>(tid),
-                       dyno::detail::make_member<tag::lock>(lid))
+                       dyno::detail::make_member<tag::lock>(lid)),
+          info(detail::no_call_stack)
     { }
 
-    // This is temporary, for compatibility with the old events.
-    typedef detail::LockDebugInfo aux_info_type;
+    // The call stack of the event, which is stored once in the call stack
+    // table of the repository.
+    typedef detail::CallStackId aux_info_type;
     aux_info_type info;
 
     friend aux_info_type const& aux_info_of(acquire const& self) {
@@ -148,6 +153,48 @@ struct segment_hop
     { }
 };
 
+/**
+ * Edge of the lock graph recorded directly by the program, instead of being
+ * deduced from the acquisitions and releases of a thread.
+ *
+ * It records that `thread` acquired `l2` in segment `s2` while holding the
+ * `gatelocks`, one of which is `l1`, acquired in segment `s1`. The same edge
+ * is recorded once, so `occurrences` is the number of times it was seen
+ * when it was recorded; an edge may be recorded again later with a larger
+ * number of occurrences.
+ */
+struct lock_order
+    : dyno::detail::auto_struct<
+        dyno::detail::member<tag::thread, thread_id>
+    >
+{
+    // Default constructor required for variant.
+    lock_order()
+        : l1_info(detail::no_call_stack), l2_info(detail::no_call_stack),
+          occurrences(1)
+    { }
+
+    explicit lock_order(thread_id tid)
+        : auto_struct_(dyno::detail::make_member<events::tag::thread>(tid)),
+          l1_info(detail::no_call_stack), l2_info(detail::no_call_stack),
+          occurrences(1)
+    { }
+
+    lock_id l1, l2;
+    segment_id s1, s2;
+    std::vector<lock_id> gatelocks;
+    detail::CallStackId l1_info, l2_info;
+    std::size_t occurrences;
+
+private:
+    friend class boost::serialization::access;
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned int const) {
+        ar & boost::serialization::base_object<auto_struct_>(*this)
+           & l1 & l2 & s1 & s2 & gatelocks & l1_info & l2_info & occurrences;
+    }
+};
+
 /**
  * Variant holding events not specific to a single thread.
  */
@@ -157,7 +204,8 @@ typedef boost::variant<start, join> non_thread_specific;
  * Variant holding events specific to a single thread.
  */
 typedef boost::variant<
-            acquire, release, recursive_acquire, recursive_release, segment_hop
+            acquire, release, recursive_acquire, recursive_release,
+            segment_hop, lock_order
         > thread_specific;
 
 /**
@@ -167,7 +215,8 @@ template <typename Event>
 struct is_thread_specific
     : boost::mpl::contains<
         boost::mpl::vector<
-            acquire, release, recursive_acquire, recursive_release, segment_hop
+            acquire, release, recursive_acquire, recursive_release,
+            segment_hop, lock_order
         >,
         Event
     >
@@ -175,6 +224,7 @@ struct is_thread_specific
 
 template <> struct is_thread_specific<start> : boost::mpl::false_ { };
 template <> struct is_thread_specific<join> : boost::mpl::false_ { };
+template <> struct is_thread_specific<thread_specific> : boost::mpl::true_ { };
 } // end namespace events
 } // end namespace core
 } // end namespace d2
@@ -6,17 +6,28 @@
 #define D2_CORE_FILESYSTEM_HPP
 
 #include <d2/core/events.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/atomic_ops.hpp>
 #include <d2/detail/inherit_constructors.hpp>
+#include <d2/detail/mutex.hpp>
+#include <d2/detail/thread_specific_ptr.hpp>
 
+#include <boost/assert.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/move/utility.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/optional.hpp>
+#include <boost/ref.hpp>
 #include <boost/range/adaptor/filtered.hpp>
 #include <boost/type_traits/is_same.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/type_traits/remove_reference.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <boost/variant/apply_visitor.hpp>
 #include <boost/variant/static_visitor.hpp>
+#include <cstddef>
 #include <dyno/filesystem.hpp>
 #include <ios>
 #include <string>
@@ -62,6 +73,155 @@ struct mapping_for_sync_events {
     }
 };
 
+/**
+ * Name of the file holding the `d2::detail::ModuleMap` of the process that
+ * generated the events of a repository.
+ */
+static char const module_map_filename[] = "modules";
+
+/**
+ * Name of the file holding the `d2::detail::CallStackTable` referenced by
+ * the events of a repository.
+ */
+static char const call_stacks_filename[] = "call_stacks";
+
+/**
+ * @internal
+ * Streams of the files of a `filesystem` that are being written, indexed by
+ * thread, so that events can be routed to their file without computing and
+ * looking up its name.
+ *
+ * In addition, each thread remembers the last stream it has routed an event
+ * to, so that a thread generating its own events never even looks up the
+ * index.
+ */
+template <typename Stream>
+class open_streams : boost::noncopyable {
+public:
+    struct entry : boost::noncopyable {
+        explicit entry(Stream& stream) : stream(stream), bytes(0) { }
+
+        Stream& stream;
+        //! Serializes the writes to `stream`.
+        detail::mutex mutex;
+        //! Number of bytes written to `stream`, as of the last write.
+        std::size_t volatile bytes;
+    };
+
+private:
+    // Identifier distinguishing this object from all the other
+    // `open_streams`, even the destroyed ones, in the thread caches.
+    std::size_t const id_;
+
+    detail::mutex mutex_;
+    boost::unordered_map<ThreadId, boost::shared_ptr<entry> > threads_;
+    boost::shared_ptr<entry> start_and_join_holder_;
+    entry* volatile start_and_join_;
+    std::size_t volatile bytes_;
+
+    struct cached_entry {
+        std::size_t owner;
+        ThreadId thread;
+        entry* stream;
+    };
+
+    static void delete_cached_entry(cached_entry* cached) { delete cached; }
+
+    static detail::thread_specific_ptr<cached_entry>& thread_cache() {
+        static detail::thread_specific_ptr<cached_entry>
+                                        cache(&delete_cached_entry);
+        return cache;
+    }
+
+    static std::size_t new_id() {
+        static std::size_t volatile last_id = 0;
+        return detail::fetch_add(last_id, std::size_t(1)) + 1;
+    }
+
+public:
+    open_streams()
+        : id_(new_id()), start_and_join_(NULL), bytes_(0)
+    { }
+
+    /**
+     * Update the number of bytes written to the stream of `file` and to all
+     * the streams after a write.
+     *
+     * @pre The mutex of `file` is held.
+     */
+    void account(entry& file) {
+        std::size_t const bytes = file.stream.bytes_written();
+        detail::fetch_add(bytes_, bytes - file.bytes);
+        detail::store_relaxed(file.bytes, bytes);
+    }
+
+    //! Return the number of bytes written to all the streams.
+    std::size_t bytes_written() const {
+        return detail::load_relaxed(bytes_);
+    }
+
+    /**
+     * Return the stream of the file of `thread`, or `NULL` if it was not
+     * opened yet.
+     */
+    entry* find(ThreadId const& thread) {
+        cached_entry* cached = thread_cache().get();
+        if (cached && cached->owner == id_ && cached->thread == thread)
+            return cached->stream;
+
+        entry* stream;
+        {
+            detail::scoped_lock<detail::mutex> lock(mutex_);
+            typename boost::unordered_map<
+                ThreadId, boost::shared_ptr<entry>
+            >::const_iterator it = threads_.find(thread);
+            if (it == threads_.end())
+                return NULL;
+            stream = it->second.get();
+        }
+
+        if (!cached)
+            thread_cache().reset(cached = new cached_entry);
+        cached->owner = id_;
+        cached->thread = thread;
+        cached->stream = stream;
+        return stream;
+    }
+
+    //! Return the stream of the `start_and_join` file, or `NULL` if it was
+    //! not opened yet.
+    entry* find_start_and_join() {
+        return detail::load_acquire(start_and_join_);
+    }
+
+    /**
+     * Mutex that must be held while a file is opened and its stream is
+     * added with `add` or `add_start_and_join`.
+     */
+    detail::mutex& open_mutex() { return mutex_; }
+
+    //! @pre `open_mutex()` is held.
+    void add(ThreadId const& thread, Stream& stream) {
+        BOOST_ASSERT_MSG(!threads_.count(thread),
+                         "adding the stream of a thread twice");
+        threads_[thread] = boost::make_shared<entry>(boost::ref(stream));
+    }
+
+    //! @pre `open_mutex()` is held.
+    void add_start_and_join(Stream& stream) {
+        BOOST_ASSERT_MSG(!start_and_join_,
+                         "adding the stream of start and join events twice");
+        start_and_join_holder_ = boost::make_shared<entry>(boost::ref(stream));
+        detail::store_release(start_and_join_, start_and_join_holder_.get());
+    }
+
+    //! Return whether the stream of `thread` was added.
+    //! @pre `open_mutex()` is held.
+    bool contains(ThreadId const& thread) const {
+        return threads_.count(thread) != 0;
+    }
+};
+
 using dyno::filesystem_error;
 using dyno::filesystem_overwrite;
 using dyno::filesystem_overwrite_type;
@@ -81,17 +241,82 @@ class filesystem : public dyno::filesystem<mapping_for_sync_events, Stream> {
         typedef bool result_type;
         template <typename FileEntry>
         result_type operator()(FileEntry const& entry) const {
-            return entry.relative_path() != "start_and_join";
+            return entry.relative_path() != "start_and_join" &&
+                   entry.relative_path() != module_map_filename &&
+                   entry.relative_path() != call_stacks_filename;
         }
     };
 
+    typedef open_streams<Stream> OpenStreams;
+    OpenStreams streams_;
+
+    template <typename Event>
+    void write(typename OpenStreams::entry& file, Event const& event) {
+        detail::scoped_lock<detail::mutex> lock(file.mutex);
+        file.stream << event;
+        streams_.account(file);
+    }
+
+    // The first event of a file is dispatched to the `dyno::filesystem`,
+    // which creates the file. After that, the events are written directly
+    // to the stream of the file.
+    //
+    // Note: These are templates only so that they are not instantiated
+    //       along with filesystems of streams that can't write events.
+    template <typename Event>
+    void dispatch_thread_event(Event event) {
+        ThreadId const thread = boost::apply_visitor(
+                        mapping_for_sync_events::get_thread_id(), event);
+        typename OpenStreams::entry* file = streams_.find(thread);
+        if (!file) {
+            detail::scoped_lock<detail::mutex> lock(streams_.open_mutex());
+            if (!streams_.contains(thread)) {
+                Base::dispatch(event);
+                boost::optional<Stream&> stream =
+                    (*this)[boost::lexical_cast<std::string>(thread)];
+                BOOST_ASSERT_MSG(stream, "unable to find the file of a thread");
+                streams_.add(thread, *stream);
+                typename OpenStreams::entry& added = *streams_.find(thread);
+                detail::scoped_lock<detail::mutex> file_lock(added.mutex);
+                streams_.account(added);
+                return;
+            }
+        }
+        write(file ? *file : *streams_.find(thread), event);
+    }
+
+    template <typename Event>
+    void dispatch_other_event(Event event) {
+        typename OpenStreams::entry* file = streams_.find_start_and_join();
+        if (!file) {
+            detail::scoped_lock<detail::mutex> lock(streams_.open_mutex());
+            if (!streams_.find_start_and_join()) {
+                Base::dispatch(event);
+                boost::optional<Stream&> stream = start_join_file();
+                BOOST_ASSERT_MSG(stream, "unable to find the start and join "
+                                         "file");
+                streams_.add_start_and_join(*stream);
+                typename OpenStreams::entry& added =
+                                            *streams_.find_start_and_join();
+                detail::scoped_lock<detail::mutex> file_lock(added.mutex);
+                streams_.account(added);
+                return;
+            }
+        }
+        write(file ? *file : *streams_.find_start_and_join(), event);
+    }
+
 public:
     D2_INHERIT_CONSTRUCTORS(filesystem, Base)
 
     /**
      * Wrap the operand in the appropriate variant to allow saving
-     * heterogeneous objects in the same file and forward to the
-     * `dyno::filesystem`.
+     * heterogeneous objects in the same file and write it to its file.
+     *
+     * @note The stream of the file of each thread is resolved once, when
+     *       the first event of the thread is dispatched. After that,
+     *       dispatching an event of the same thread never computes nor
+     *       looks up a filename.
      */
     template <typename Event>
     typename boost::enable_if<
@@ -99,7 +324,7 @@ public:
             typename boost::remove_reference<Event>::type
         >,
     void>::type dispatch(BOOST_FWD_REF(Event) event) {
-        Base::dispatch(
+        dispatch_thread_event(
             core::events::thread_specific(boost::forward<Event>(event)));
     }
 
@@ -109,10 +334,29 @@ public:
             typename boost::remove_reference<Event>::type
         >,
     void>::type dispatch(BOOST_FWD_REF(Event) event) {
-        Base::dispatch(
+        dispatch_other_event(
             core::events::non_thread_specific(boost::forward<Event>(event)));
     }
 
+    /**
+     * Return the number of bytes written to all the files of the filesystem
+     * since they were opened.
+     *
+     * @note Only the events written with `dispatch` are counted.
+     */
+    std::size_t bytes_written() const {
+        return streams_.bytes_written();
+    }
+
+    /**
+     * Return the number of bytes written to the file of `thread` since it
+     * was opened, which is 0 if no event of `thread` was written.
+     */
+    std::size_t bytes_written(ThreadId const& thread) {
+        typename OpenStreams::entry* file = streams_.find(thread);
+        return file ? detail::load_relaxed(file->bytes) : 0;
+    }
+
     /**
      * Type of the range returned by the non-const version of `thread_files()`.
      */
@@ -154,14 +398,39 @@ public:
     start_join_file() const {
         return (*this)["start_and_join"];
     }
+
+    /**
+     * Return the stream associated to the file holding the map of the
+     * modules of the process if it exists.
+     *
+     * @note The module map is only needed to resolve call stacks recorded
+     *       with deferred symbolization, and it may be absent from
+     *       repositories created by older versions of the library.
+     */
+    boost::optional<typename filesystem::stream_type&> module_map_file() {
+        return (*this)[module_map_filename];
+    }
+
+    /**
+     * Return the stream associated to the file holding the call stacks
+     * referenced by the events if it exists.
+     *
+     * @note It can be the case that no such file exists if no acquisitions
+     *       have been recorded.
+     */
+    boost::optional<typename filesystem::stream_type&> call_stacks_file() {
+        return (*this)[call_stacks_filename];
+    }
 };
 } // end namespace filesystem_detail
 
 namespace core {
+    using filesystem_detail::call_stacks_filename;
     using filesystem_detail::filesystem;
     using filesystem_detail::filesystem_error;
     using filesystem_detail::filesystem_overwrite;
     using filesystem_detail::filesystem_overwrite_type;
+    using filesystem_detail::module_map_filename;
 }
 } // end namespace d2
 
@@ -5,37 +5,166 @@
 #ifndef D2_CORE_FILESYSTEM_DISPATCHER_HPP
 #define D2_CORE_FILESYSTEM_DISPATCHER_HPP
 
+#include <d2/core/async_writer.hpp>
+#include <d2/core/event_stream.hpp>
+#include <d2/core/events.hpp>
 #include <d2/core/filesystem.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/atomic_ops.hpp>
 #include <d2/detail/mutex.hpp>
+#include <d2/detail/thread_specific_ptr.hpp>
 
-#include <boost/archive/text_oarchive.hpp>
+#include <boost/assert.hpp>
 #include <boost/config.hpp>
+#include <boost/foreach.hpp>
 #include <boost/interprocess/smart_ptr/unique_ptr.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/move/utility.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/lock_guard.hpp>
-#include <dyno/serializing_stream.hpp>
-#include <fstream>
+#include <boost/type_traits/remove_reference.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <cstddef>
 #include <ios>
 #include <string>
+#include <utility>
 
 
 namespace d2 {
 namespace filesystem_dispatcher_detail {
 
-typedef core::filesystem<
-            dyno::serializing_stream<
-                std::ofstream,
-                boost::archive::text_oarchive
-            >
-        > Filesystem;
+typedef core::filesystem<core::event_ofstream> Filesystem;
+
+class FilesystemDispatcher;
+
+/**
+ * Link between a `FilesystemDispatcher` and the buffers of its threads,
+ * shared by all of them so that it outlives the dispatcher as long as some
+ * of its buffers do.
+ */
+struct DispatcherLink : boost::noncopyable {
+    explicit DispatcherLink(FilesystemDispatcher* dispatcher)
+        : dispatcher(dispatcher)
+    { }
+
+    //! Taken by the threads retiring their buffer, and by the dispatcher
+    //! for the whole time it is being destroyed.
+    detail::mutex lock;
+
+    /**
+     * Dispatcher in which the buffers are registered, or `NULL` once it was
+     * destroyed; guarded by `lock`.
+     */
+    FilesystemDispatcher* dispatcher;
+};
+
+/**
+ * Buffer of the events generated by a single thread.
+ *
+ * Events are appended by the thread owning the buffer without any
+ * synchronization. Each appended event is published with release semantics,
+ * so that published events can be handed off to the repository by any
+ * thread holding the repository lock, even while the owner keeps appending
+ * new events.
+ */
+class ThreadBuffer : boost::noncopyable {
+    ThreadId owner_;
+    std::size_t const capacity_;
+    boost::scoped_array<core::events::thread_specific> events_;
+
+    // Number of events appended so far; only touched by the owner.
+    std::size_t size_;
+    // Number of events visible to other threads.
+    std::size_t volatile published_;
+    // Number of events already handed off; guarded by the repository lock.
+    std::size_t handed_off_;
+
+public:
+    ThreadBuffer(boost::shared_ptr<DispatcherLink> const& link,
+                 ThreadId const& owner, std::size_t capacity)
+        : owner_(owner), capacity_(capacity),
+          events_(new core::events::thread_specific[capacity]),
+          size_(0), published_(0), handed_off_(0), link(link)
+    {
+        BOOST_ASSERT_MSG(capacity_ > 0, "creating an empty thread buffer");
+    }
+
+    //! Return the thread whose events are stored in this buffer.
+    ThreadId const& owner() const { return owner_; }
+
+    /**
+     * Append an event to the buffer and return whether there was enough
+     * room to do so. If there was not, the event is left untouched.
+     *
+     * @pre This is called from the thread owning the buffer.
+     */
+    template <typename Event>
+    bool push(BOOST_FWD_REF(Event) event) {
+        if (size_ == capacity_)
+            return false;
+        events_[size_] = boost::forward<Event>(event);
+        detail::store_release(published_, ++size_);
+        return true;
+    }
+
+    /**
+     * Dispatch all the events published since the last hand off to `sink`
+     * as a single range, or drop them if `sink` is `NULL`.
+     *
+     * @pre The repository lock is held.
+     */
+    template <typename Sink>
+    void hand_off(Sink* sink) {
+        std::size_t const published = detail::load_acquire(published_);
+        if (sink && handed_off_ != published)
+            sink->dispatch(events_.get() + handed_off_,
+                           events_.get() + published);
+        handed_off_ = published;
+    }
+
+    /**
+     * Make the whole buffer available for new events.
+     *
+     * @pre This is called from the thread owning the buffer.
+     * @pre The repository lock is held and the buffer was just handed off.
+     */
+    void clear() {
+        BOOST_ASSERT_MSG(handed_off_ == size_,
+            "clearing a thread buffer that was not handed off completely");
+        size_ = handed_off_ = 0;
+        detail::store_relaxed(published_, std::size_t(0));
+    }
+
+    //! Link to the dispatcher in which the buffer is registered.
+    boost::shared_ptr<DispatcherLink> const link;
+};
 
 /**
  * Class dispatching thread and process level events to a repository.
  *
  * This class is meant to be used concurrently by several threads.
+ *
+ * By default, every event is dispatched to the repository immediately.
+ * When thread buffering is enabled with `set_thread_buffer_size()`, the
+ * thread specific events are instead appended to a buffer owned by the
+ * thread that generated them, without taking any shared lock. Only handing
+ * off a buffer to the repository, which happens when the buffer is full,
+ * when the owner thread exits or when the repository is changed, requires
+ * taking the repository lock.
+ *
+ * By default, events are serialized and written to the repository by the
+ * threads generating them. When asynchronous writing is enabled with
+ * `set_async_queue_depth()`, they are instead queued in memory and written
+ * by a dedicated thread; see `AsyncWriter` for details. The thread specific
+ * events are then always buffered by their thread, in buffers of the size
+ * of a batch if thread buffering is disabled, and each buffer is queued as
+ * a whole. Hence, the threads generating events only take the shared locks
+ * once per buffer, and not once per event.
  */
 class FilesystemDispatcher {
     struct default_deleter {
@@ -53,22 +182,234 @@ class FilesystemDispatcher {
     detail::mutex mutable repository_lock_;
     typedef boost::lock_guard<detail::mutex> scoped_lock;
 
-    boost::shared_ptr<Filesystem> get_repository() {
+    // Format of the repositories set from now on, and whether their files
+    // are memory mapped and compressed; guarded by the repository lock.
+    core::event_format format_;
+    bool mapped_files_;
+    bool compressed_files_;
+
+    // Number of events in the buffers created from now on, as set with
+    // `set_thread_buffer_size()`; guarded by the repository lock.
+    std::size_t requested_buffer_size_;
+
+    // Number of events in the buffers created from now on; 0 when events
+    // are not buffered. This is the requested size, or the size of a batch
+    // of the writer thread if there is one and no size was requested. It
+    // is only modified with the repository lock held, but it is read
+    // without it on the hot path.
+    std::size_t volatile thread_buffer_size_;
+
+    // The writer thread, if asynchronous writing is enabled. Events are
+    // only queued to it with the repository lock held, so that it can't be
+    // replaced while events are being queued.
+    typedef core::AsyncWriter<Filesystem> Writer;
+    boost::scoped_ptr<Writer> writer_;
+
+    /**
+     * Write an event to the current repository, or queue it to the writer
+     * thread if there is one.
+     *
+     * @pre The repository lock is held and there is a current repository.
+     */
+    template <typename Event>
+    void write(BOOST_FWD_REF(Event) event) {
+        if (writer_)
+            writer_->push(repository_, event);
+        else
+            repository_->dispatch(boost::forward<Event>(event));
+    }
+
+    //! Sink used to hand off the thread buffers to the current repository.
+    class CurrentRepository {
+        FilesystemDispatcher& self_;
+
+    public:
+        explicit CurrentRepository(FilesystemDispatcher& self)
+            : self_(self)
+        { }
+
+        template <typename Event>
+        void dispatch(Event* first, Event* last) const {
+            if (self_.writer_)
+                self_.writer_->push(self_.repository_, first, last);
+            else
+                for (; first != last; ++first)
+                    self_.repository_->dispatch(*first);
+        }
+    };
+
+    //! Update the size of the buffers created from now on.
+    //! @pre The repository lock is held.
+    void update_thread_buffer_size() {
+        std::size_t size = requested_buffer_size_;
+        if (!size && writer_)
+            size = writer_->batch_size();
+        detail::store_relaxed(thread_buffer_size_, size);
+    }
+
+    //! @pre The repository lock is held.
+    void hand_off(ThreadBuffer& buffer) {
+        CurrentRepository sink(*this);
+        buffer.hand_off(repository_ ? &sink : NULL);
+    }
+
+    //! Wait until the writer thread, if any, has written every event.
+    //! @pre The repository lock is held.
+    void flush_writer() {
+        if (writer_)
+            writer_->flush();
+    }
+
+    // The buffer of the current thread, if any.
+    detail::thread_specific_ptr<ThreadBuffer> thread_buffer_;
+
+    // Shared with the buffers, which may outlive us.
+    boost::shared_ptr<DispatcherLink> link_;
+
+    // All the buffers owned by threads that are still alive. This is
+    // guarded by the repository lock.
+    typedef boost::unordered_map<ThreadId, ThreadBuffer*> ThreadBuffers;
+    ThreadBuffers thread_buffers_;
+
+    //! Hand off every buffer to the current repository.
+    //! @pre The repository lock is held.
+    void hand_off_all_buffers() {
+        BOOST_FOREACH(ThreadBuffers::value_type const& buffer,thread_buffers_)
+            hand_off(*buffer.second);
+    }
+
+    /**
+     * Called in a thread that exits while owning a buffer.
+     *
+     * @note The dispatcher may be destroyed concurrently, so it is only
+     *       accessed through the link of the buffer, with the lock of the
+     *       link held.
+     */
+    static void retire_buffer(ThreadBuffer* buffer) {
+        {
+            scoped_lock link_lock(buffer->link->lock);
+            if (FilesystemDispatcher* self = buffer->link->dispatcher) {
+                scoped_lock lock(self->repository_lock_);
+                self->hand_off(*buffer);
+                self->thread_buffers_.erase(buffer->owner());
+            }
+        }
+        delete buffer;
+    }
+
+    template <typename Event>
+    void dispatch_immediately(BOOST_FWD_REF(Event) event) {
+        boost::shared_ptr<Filesystem> repository;
+        {
+            scoped_lock lock(repository_lock_);
+            // Queueing an event is cheap enough to do it with the lock held.
+            // This only happens for the events that are not thread specific,
+            // which are rare, since the others are buffered when there is a
+            // writer thread.
+            if (writer_) {
+                if (repository_)
+                    writer_->push(repository_, event);
+                return;
+            }
+            repository = repository_;
+        }
+        if (repository)
+            repository->dispatch(boost::forward<Event>(event));
+    }
+
+    /**
+     * Slow path of the thread buffering, taken whenever an event can't be
+     * appended to the buffer of the current thread.
+     *
+     * The buffer of a thread is bound to the thread of the first event it
+     * receives. Events generated on behalf of another thread than the
+     * owner of the current buffer are dispatched immediately, but only
+     * after handing off the buffer of that other thread, so that the order
+     * of the events of every thread is preserved.
+     */
+    template <typename Event>
+    void dispatch_buffered_slow(ThreadBuffer* buffer,
+                                BOOST_FWD_REF(Event) event,
+                                std::size_t buffer_size) {
+        ThreadId const thread(thread_of(event));
         scoped_lock lock(repository_lock_);
-        return repository_;
+
+        if (!buffer && thread_buffers_.find(thread) == thread_buffers_.end()) {
+            buffer = new ThreadBuffer(link_, thread, buffer_size);
+            thread_buffers_[thread] = buffer;
+            thread_buffer_.reset(buffer);
+        }
+
+        if (buffer && buffer->owner() == thread) {
+            hand_off(*buffer);
+            buffer->clear();
+            bool const pushed = buffer->push(boost::forward<Event>(event));
+            BOOST_ASSERT_MSG(pushed, "unable to push an event in an empty "
+                                     "thread buffer"); (void)pushed;
+            return;
+        }
+
+        ThreadBuffers::iterator owner = thread_buffers_.find(thread);
+        if (owner != thread_buffers_.end())
+            hand_off(*owner->second);
+        if (repository_)
+            write(boost::forward<Event>(event));
+    }
+
+    template <typename Event>
+    void dispatch_buffered(BOOST_FWD_REF(Event) event,
+                           std::size_t buffer_size) {
+        ThreadBuffer* buffer = thread_buffer_.get();
+        if (buffer && buffer->owner() == thread_of(event) &&
+                                buffer->push(boost::forward<Event>(event)))
+            return;
+        dispatch_buffered_slow(buffer, boost::forward<Event>(event),
+                               buffer_size);
     }
 
 public:
     FilesystemDispatcher()
-        : repository_()
+        : repository_(), format_(core::text_format), mapped_files_(false),
+          compressed_files_(false), requested_buffer_size_(0),
+          thread_buffer_size_(0), thread_buffer_(&retire_buffer),
+          link_(boost::make_shared<DispatcherLink>(this))
     { }
 
     template <typename Path>
     explicit FilesystemDispatcher(BOOST_FWD_REF(Path) root)
         : repository_(boost::make_shared<Filesystem>(
-                                        root, dyno::filesystem_overwrite))
+                                        root, dyno::filesystem_overwrite)),
+          format_(core::text_format), mapped_files_(false),
+          compressed_files_(false), requested_buffer_size_(0),
+          thread_buffer_size_(0), thread_buffer_(&retire_buffer),
+          link_(boost::make_shared<DispatcherLink>(this))
     { }
 
+    /**
+     * Hand off all the buffered events to the repository and wait until
+     * they are written before it is closed.
+     *
+     * @note The buffers of the threads that are still alive can't be
+     *       deleted safely, so they are orphaned and deleted when their
+     *       owner thread exits, if ever.
+     */
+    ~FilesystemDispatcher() {
+        // The threads exiting from now on must not touch us, and those that
+        // are retiring their buffer must be done before we hand them off.
+        scoped_lock link_lock(link_->lock);
+        link_->dispatcher = NULL;
+
+        scoped_lock lock(repository_lock_);
+        hand_off_all_buffers();
+        writer_.reset();
+        thread_buffers_.clear();
+
+        if (ThreadBuffer* own = thread_buffer_.get()) {
+            thread_buffer_.reset(NULL);
+            delete own;
+        }
+    }
+
     /**
      * Set a new repository for the event dispatcher. If setting the
      * repository fails, an exception is thrown.
@@ -86,25 +427,180 @@ public:
                     Filesystem, default_deleter
                 > FilesystemPtr;
 
+        std::ios::openmode mode = std::ios::out | std::ios::app |
+                                  core::openmode_for(format());
+        if (mapped_files())
+            mode |= core::mapped;
+        if (compressed_files())
+            mode |= core::compressed;
         FilesystemPtr new_fs(new Filesystem(
-            boost::forward<Path>(new_root), std::ios::out | std::ios::ate));
+                                    boost::forward<Path>(new_root), mode));
 
         // "Atomically" exchange the old repository with the new one.
         // This has noexcept guarantee.
         {
             scoped_lock lock(repository_lock_);
+            hand_off_all_buffers();
+            flush_writer();
             repository_.reset(new_fs.release());
         }
     }
 
     /**
      * Unset the current repository.
+     *
+     * @note The events buffered by threads are handed off to the current
+     *       repository and written before it is unset.
      */
     void unset_repository() {
         scoped_lock lock(repository_lock_);
+        hand_off_all_buffers();
+        flush_writer();
         repository_.reset();
     }
 
+    /**
+     * Return the number of bytes written to the current repository, or 0
+     * if there is none.
+     *
+     * @note The events that are still buffered by the threads or waiting
+     *       for the writer thread are not counted.
+     */
+    std::size_t bytes_written() const {
+        scoped_lock lock(repository_lock_);
+        return repository_ ? repository_->bytes_written() : 0;
+    }
+
+    /**
+     * Return the number of bytes written to the file of `thread` in the
+     * current repository, or 0 if there is none.
+     */
+    std::size_t bytes_written(ThreadId const& thread) const {
+        boost::shared_ptr<Filesystem> repository;
+        {
+            scoped_lock lock(repository_lock_);
+            repository = repository_;
+        }
+        return repository ? repository->bytes_written(thread) : 0;
+    }
+
+    /**
+     * Set the format in which events are written to the repositories set
+     * from now on. The current repository, if any, is not affected.
+     */
+    void set_format(core::event_format format) {
+        scoped_lock lock(repository_lock_);
+        format_ = format;
+    }
+
+    //! Return the format of the repositories set from now on.
+    core::event_format format() const {
+        scoped_lock lock(repository_lock_);
+        return format_;
+    }
+
+    /**
+     * Set whether the files of the repositories set from now on are written
+     * through memory mappings. The current repository, if any, is not
+     * affected.
+     *
+     * @see `d2::detail::mapped_filebuf`
+     */
+    void set_mapped_files(bool mapped) {
+        scoped_lock lock(repository_lock_);
+        mapped_files_ = mapped;
+    }
+
+    //! Return whether the files of the repositories set from now on are
+    //! memory mapped.
+    bool mapped_files() const {
+        scoped_lock lock(repository_lock_);
+        return mapped_files_;
+    }
+
+    /**
+     * Set whether the files of the repositories set from now on are
+     * compressed. The current repository, if any, is not affected.
+     *
+     * @see `d2::detail::compressing_streambuf`
+     */
+    void set_compressed_files(bool compressed) {
+        scoped_lock lock(repository_lock_);
+        compressed_files_ = compressed;
+    }
+
+    //! Return whether the files of the repositories set from now on are
+    //! compressed.
+    bool compressed_files() const {
+        scoped_lock lock(repository_lock_);
+        return compressed_files_;
+    }
+
+    /**
+     * Set the number of events buffered by each thread before they are
+     * handed off to the repository. A size of 0 disables thread buffering,
+     * unless there is a writer thread.
+     *
+     * Every event buffered so far is handed off to the repository. Buffers
+     * that already exist keep their current size.
+     */
+    void set_thread_buffer_size(std::size_t size) {
+        scoped_lock lock(repository_lock_);
+        hand_off_all_buffers();
+        requested_buffer_size_ = size;
+        update_thread_buffer_size();
+    }
+
+    /**
+     * Return the size of the thread buffers, or 0 if events are not
+     * buffered. This is the size of a batch of the writer thread if there
+     * is one and thread buffering is disabled.
+     */
+    std::size_t thread_buffer_size() const {
+        return detail::load_relaxed(thread_buffer_size_);
+    }
+
+    /**
+     * Set the maximum number of batches of events waiting to be written by
+     * the writer thread. A depth of 0, which is the default, disables the
+     * writer thread, and events are written by the threads generating them.
+     *
+     * Every event buffered or queued so far is written before the writer
+     * thread is changed.
+     *
+     * @param batch_size The number of events in a batch, which is also the
+     *                   size of the thread buffers if thread buffering is
+     *                   disabled.
+     */
+    void set_async_queue_depth(std::size_t depth,
+                      std::size_t batch_size = Writer::default_batch_size) {
+        scoped_lock lock(repository_lock_);
+        hand_off_all_buffers();
+        writer_.reset(); // Stop the current writer before starting a new one.
+        if (depth)
+            writer_.reset(new Writer(depth, batch_size));
+        update_thread_buffer_size();
+    }
+
+    //! Return the depth of the writer queue, or 0 if there is no writer.
+    std::size_t async_queue_depth() const {
+        scoped_lock lock(repository_lock_);
+        return writer_ ? writer_->queue_depth() : 0;
+    }
+
+    /**
+     * Hand off the events buffered by all threads to the repository, and
+     * wait until the writer thread, if any, has written them.
+     *
+     * @note Events that are being buffered concurrently with a call to
+     *       this method may or may not be handed off.
+     */
+    void flush() {
+        scoped_lock lock(repository_lock_);
+        hand_off_all_buffers();
+        flush_writer();
+    }
+
     /**
      * Same as `set_repository`, but offers the `noexcept` guarantee. Instead
      * of reporting the success or failure using an exception, it will do so
@@ -132,10 +628,25 @@ public:
     }
 
     template <typename Event>
-    void dispatch(BOOST_FWD_REF(Event) event) {
-        boost::shared_ptr<Filesystem> repository = get_repository();
-        if (repository)
-            repository->dispatch(boost::forward<Event>(event));
+    typename boost::enable_if<
+        core::events::is_thread_specific<
+            typename boost::remove_reference<Event>::type
+        >,
+    void>::type dispatch(BOOST_FWD_REF(Event) event) {
+        std::size_t const buffer_size = thread_buffer_size();
+        if (buffer_size)
+            dispatch_buffered(boost::forward<Event>(event), buffer_size);
+        else
+            dispatch_immediately(boost::forward<Event>(event));
+    }
+
+    template <typename Event>
+    typename boost::disable_if<
+        core::events::is_thread_specific<
+            typename boost::remove_reference<Event>::type
+        >,
+    void>::type dispatch(BOOST_FWD_REF(Event) event) {
+        dispatch_immediately(boost::forward<Event>(event));
     }
 };
 } // end namespace filesystem_dispatcher_detail
@@ -5,30 +5,110 @@
 #ifndef D2_CORE_FRAMEWORK_HPP
 #define D2_CORE_FRAMEWORK_HPP
 
+#include <d2/core/event_stream.hpp>
+#include <d2/core/diagnostic.hpp>
 #include <d2/core/events.hpp>
+#include <d2/core/filesystem.hpp>
 #include <d2/core/framework_fwd.hpp>
 #include <d2/core/lock_id.hpp>
+#include <d2/core/log_budget.hpp>
+#include <d2/core/online_detector.hpp>
+#include <d2/core/raw_api.hpp>
 #include <d2/core/segment.hpp>
 #include <d2/core/thread_id.hpp>
 #include <d2/detail/atomic.hpp>
+#include <d2/detail/atomic_ops.hpp>
+#include <d2/detail/call_stack_table.hpp>
+#include <d2/detail/lock_debug_info.hpp>
+#include <d2/detail/module_map.hpp>
 #include <d2/detail/mutex.hpp>
 
 #include <boost/assert.hpp>
-#include <boost/thread/lock_guard.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/foreach.hpp>
 #include <cstddef>
 #include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <ostream>
+#include <utility>
 
 
 namespace d2 {
 namespace core {
 namespace framework_detail {
-    template <typename Value, typename Container>
-    bool contains(Value const& v, Container const& c) {
-        return c.find(v) != c.end();
+    void print_deadlock(potential_deadlock const& deadlock) {
+        std::cerr << "d2: potential deadlock\n";
+        explain_potential_deadlock(std::cerr, deadlock);
+        std::cerr << std::endl;
     }
+
+    // Sink counting the edges of a stopped thread instead of logging them.
+    struct dropped_events {
+        explicit dropped_events(LogBudget& budget) : budget(budget) { }
+
+        template <typename Event>
+        void dispatch(Event const&) const { budget.dropped_event(); }
+
+        LogBudget& budget;
+    };
 }
 
-framework::framework() : event_logging_enabled_(false) {
+framework::framework()
+    : has_repository_(false), deferred_symbolization_(false),
+      call_stacks_generation_(0),
+      call_stack_caches_(&delete_call_stack_cache)
+{
+    char const* buffer_size = std::getenv("D2_THREAD_BUFFER_SIZE");
+    if (buffer_size)
+        set_thread_buffer_size(std::strtoul(buffer_size, NULL, 10));
+
+    char const* queue_depth = std::getenv("D2_ASYNC_QUEUE_DEPTH");
+    if (queue_depth)
+        set_async_queue_depth(std::strtoul(queue_depth, NULL, 10));
+
+    char const* deferred = std::getenv("D2_DEFERRED_SYMBOLIZATION");
+    if (deferred)
+        set_deferred_symbolization(std::strcmp(deferred, "0") != 0);
+
+    char const* samples = std::getenv("D2_CALL_STACK_SAMPLES");
+    if (samples)
+        set_call_stack_samples(std::strtoul(samples, NULL, 10));
+
+    char const* format = std::getenv("D2_REPOSITORY_FORMAT");
+    if (format)
+        set_repository_format(format);
+
+    char const* mapped = std::getenv("D2_MAPPED_FILES");
+    if (mapped)
+        set_mapped_files(std::strcmp(mapped, "0") != 0);
+
+    char const* compressed = std::getenv("D2_COMPRESSED_FILES");
+    if (compressed)
+        set_compressed_files(std::strcmp(compressed, "0") != 0);
+
+    char const* repository_budget = std::getenv("D2_REPOSITORY_BUDGET");
+    char const* thread_budget = std::getenv("D2_THREAD_BUDGET");
+    if (repository_budget || thread_budget)
+        set_log_budget(
+            repository_budget ? std::strtoul(repository_budget, NULL, 10) : 0,
+            thread_budget ? std::strtoul(thread_budget, NULL, 10) : 0);
+
+    char const* policy = std::getenv("D2_OVERFLOW_POLICY");
+    if (policy)
+        set_overflow_policy(policy);
+
+    char const* lock_orders = std::getenv("D2_LOCK_ORDER_RECORDS");
+    if (lock_orders)
+        set_lock_order_records(std::strcmp(lock_orders, "0") != 0);
+
+    char const* online = std::getenv("D2_ONLINE_DETECTION");
+    if (online && std::strcmp(online, "0") != 0) {
+        set_deadlock_callback(&framework_detail::print_deadlock);
+        enable();
+    }
+
     char const* repo = std::getenv("D2_REPOSITORY");
     if (repo) {
         enable();
@@ -37,55 +117,366 @@ framework::framework() : event_logging_enabled_(false) {
 }
 
 framework::~framework() {
-    if (is_enabled()) {
+    if (is_enabled())
         disable();
-        unset_repository();
-    }
+    // Make sure the events that are still buffered or waiting for the
+    // writer thread are written before the process exits.
+    unset_repository();
 }
 
-void framework::enable() { event_logging_enabled_ = true; }
-void framework::disable() { event_logging_enabled_ = false; }
+// Note: Whether event logging is enabled is only stored in the
+//       `raw_api_detail::enabled_framework` pointer, which the raw API
+//       checks before calling us.
+void framework::enable() {
+    detail::store_release(raw_api_detail::enabled_framework, this);
+}
+
+void framework::disable() {
+    detail::store_release(raw_api_detail::enabled_framework,
+                          static_cast<framework*>(NULL));
+}
+
+bool framework::is_enabled() const {
+    return raw_api_detail::get_enabled_framework() == this;
+}
 
-bool framework::is_enabled() const { return event_logging_enabled_; }
 bool framework::is_disabled() const { return !is_enabled(); }
 
 int framework::set_repository(char const* path) {
+    // The events kept because of the budget and the occurrences of the
+    // edges belong to the current repository, if any.
+    budget_.flush(dispatcher_);
+    lock_orders_.flush(dispatcher_);
+
     // Note: 0 for success and anything else but 0 for failure.
-    return dispatcher_.set_repository_noexcept(path) ? 0 : 1;
+    if (!dispatcher_.set_repository_noexcept(path))
+        return 1;
+
+    // Identifiers of call stacks are only meaningful within a repository,
+    // so we start over with an empty table.
+    {
+        detail::scoped_lock<detail::mutex> lock(call_stacks_mutex_);
+        call_stacks_.clear();
+        detail::fetch_add(call_stacks_generation_, std::size_t(1));
+        call_stack_sampler_.clear();
+        if (call_stacks_file_.is_open())
+            call_stacks_file_.close();
+        call_stacks_file_.clear();
+        call_stacks_file_.open(
+            boost::filesystem::path(path) / call_stacks_filename);
+    }
+    has_repository_ = true;
+
+    // Save the module map along with the events so that call stacks
+    // recorded with deferred symbolization can be resolved. Failing to do
+    // so only means that they won't be resolved.
+    boost::filesystem::ofstream modules(
+        boost::filesystem::path(path) / module_map_filename);
+    modules << detail::ModuleMap::of_current_process();
+    return 0;
 }
 
 void framework::unset_repository() {
+    budget_.flush(dispatcher_);
+    lock_orders_.flush(dispatcher_);
     dispatcher_.unset_repository();
+    has_repository_ = false;
+
+    detail::scoped_lock<detail::mutex> lock(call_stacks_mutex_);
+    if (call_stacks_file_.is_open())
+        call_stacks_file_.close();
+}
+
+int framework::set_repository_format(char const* name) {
+    event_format format;
+    if (!parse_event_format(name, format))
+        return 1;
+    dispatcher_.set_format(format);
+    return 0;
+}
+
+void framework::set_mapped_files(bool enabled) {
+    dispatcher_.set_mapped_files(enabled);
+}
+
+void framework::set_compressed_files(bool enabled) {
+    dispatcher_.set_compressed_files(enabled);
+}
+
+void framework::set_log_budget(std::size_t repository_bytes,
+                               std::size_t thread_bytes) {
+    budget_.set_limits(repository_bytes, thread_bytes);
+}
+
+int framework::set_overflow_policy(char const* name) {
+    overflow_policy policy;
+    if (!parse_overflow_policy(name, policy))
+        return 1;
+    budget_.set_policy(policy);
+    return 0;
+}
+
+log_statistics framework::get_log_statistics() const {
+    return budget_.statistics();
+}
+
+void framework::set_thread_buffer_size(std::size_t size) {
+    dispatcher_.set_thread_buffer_size(size);
+}
+
+void framework::set_async_queue_depth(std::size_t depth) {
+    dispatcher_.set_async_queue_depth(depth);
+}
+
+void framework::set_deferred_symbolization(bool enabled) {
+    deferred_symbolization_ = enabled;
+}
+
+void framework::set_call_stack_samples(std::size_t samples) {
+    call_stack_sampler_.set_limit(samples);
+}
+
+void framework::set_lock_order_records(bool enabled) {
+    lock_orders_.set_enabled(enabled);
+}
+
+void framework::set_deadlock_callback(OnlineDetector::Callback callback) {
+    online_detector_.set_callback(callback);
+}
+
+void framework::delete_call_stack_cache(CallStackCache* cache) {
+    delete cache;
+}
+
+detail::CallStackId
+framework::cached_call_stack(detail::LockDebugInfo& info) {
+    CallStackCache* cache = call_stack_caches_.get();
+    if (!cache)
+        call_stack_caches_.reset(cache = new CallStackCache);
+    std::size_t const generation =
+                            detail::load_relaxed(call_stacks_generation_);
+    if (cache->generation != generation) {
+        cache->ids.clear();
+        cache->generation = generation;
+    }
+
+    CallStackCache::Ids::const_iterator const cached =
+                                        cache->ids.find(info.call_stack);
+    if (cached != cache->ids.end())
+        return cached->second;
+
+    // Interning the call stack may resolve its frames, so the raw frames
+    // are kept aside to look it up next time.
+    detail::LockDebugInfo::CallStack const raw(info.call_stack);
+    detail::CallStackId const id = intern_call_stack(info);
+    cache->ids.insert(std::make_pair(raw, id));
+    return id;
+}
+
+detail::CallStackId
+framework::intern_call_stack(detail::LockDebugInfo& info) {
+    detail::scoped_lock<detail::mutex> lock(call_stacks_mutex_);
+    std::pair<detail::CallStackId, bool> const interned =
+                                        call_stacks_.insert(info.call_stack);
+
+    // The table only contains the raw call stacks, so a call stack is
+    // only resolved the first time it is encountered, if ever.
+    if (interned.second && call_stacks_file_.is_open()) {
+        if (!deferred_symbolization_)
+            info.resolve_call_stack();
+        detail::CallStackTable::write(call_stacks_file_, interned.first, info);
+        // Call stacks are rare enough that we can afford to make sure they
+        // are on disk before the events referring to them.
+        call_stacks_file_.flush();
+    }
+    return interned.first;
+}
+
+void framework::explain_deadlock(std::ostream& os,
+                                 potential_deadlock const& deadlock) {
+    // The call stacks of the table are left untouched, since they may have
+    // been recorded without being resolved, which is always the case without
+    // a repository. Those of the deadlock are copied to a table of their own
+    // and resolved there instead.
+    potential_deadlock resolved(deadlock);
+    detail::CallStackTable call_stacks;
+    {
+        detail::scoped_lock<detail::mutex> lock(call_stacks_mutex_);
+        BOOST_FOREACH(deadlocked_thread& thread, resolved.threads) {
+            BOOST_FOREACH(detail::CallStackId& id, thread.holding_info)
+                id = copy_call_stack(id, call_stacks);
+            thread.waiting_for_info =
+                        copy_call_stack(thread.waiting_for_info, call_stacks);
+        }
+    }
+    for (detail::CallStackId id = 1; id <= call_stacks.size(); ++id)
+        call_stacks.find(id)->resolve_call_stack();
+    plain_text_explanation(os, resolved, call_stacks);
+}
+
+detail::CallStackId
+framework::copy_call_stack(detail::CallStackId id,
+                           detail::CallStackTable& call_stacks) const {
+    detail::LockDebugInfo const* info = call_stacks_.find(id);
+    return info ? call_stacks.insert(info->call_stack).first
+                : detail::no_call_stack;
+}
+
+LogBudget::mode framework::budget_acquire(ThreadId const& thread) {
+    return budget_.is_enabled() ? budget_.acquire(thread, dispatcher_)
+                                : LogBudget::logging;
+}
+
+LogBudget::mode framework::budget_release(ThreadId const& thread) {
+    return budget_.is_enabled() ? budget_.release(thread, dispatcher_)
+                                : LogBudget::logging;
+}
+
+bool framework::captures_call_stack(LogBudget::mode mode,
+                                    ThreadId const& thread,
+                                    LockId const& lock,
+                                    detail::CallStackId& info) {
+    if (mode == LogBudget::stopped || !has_repository_)
+        // Nothing is logged, but the online detector may still report the
+        // acquisition. It only needs the call stacks of the acquisitions
+        // that may add lock-orders, and the other ones refer to them.
+        return online_detector_.is_enabled() &&
+               online_detector_.is_new_context(thread, lock, info);
+    if (mode == LogBudget::degraded && budget_.policy() == drop_call_stacks) {
+        budget_.dropped_call_stack();
+        return false;
+    }
+    return true;
+}
+
+bool framework::tracks_lock_orders() const {
+    return lock_orders_.is_enabled() || (budget_.is_enabled() &&
+                                budget_.policy() == keep_new_lock_orders);
+}
+
+bool framework::folds_lock_orders(LogBudget::mode mode) {
+    if (lock_orders_.is_enabled())
+        return true;
+    if (mode == LogBudget::degraded &&
+                                budget_.policy() == keep_new_lock_orders) {
+        budget_.folded_event();
+        return true;
+    }
+    return false;
+}
+
+template <typename Event>
+void framework::log(Event& event, LogBudget::mode mode) {
+    if (mode == LogBudget::logging)
+        dispatcher_.dispatch(event);
+    else
+        budget_.keep(event, dispatcher_);
 }
 
 void framework::notify_acquire(std::size_t thread_id, std::size_t lock_id) {
     if (is_enabled()) {
         events::acquire event((ThreadId(thread_id)), LockId(lock_id));
-                        // ignore current frame
-        event.info.init_call_stack(1);
-        dispatcher_.dispatch(event);
+        LogBudget::mode const mode = budget_acquire(thread_of(event));
+        if (call_stack_sampler_.acquire(lock_id, event.info)) {
+            if (captures_call_stack(mode, thread_of(event), lock_of(event),
+                                    event.info)) {
+                detail::LockDebugInfo info;
+                info.init_raw_call_stack(1); // ignore current frame
+                event.info = cached_call_stack(info);
+            }
+            // The sampler must know what became of the call stack even if
+            // it was not captured, so the pair stops taking its lock.
+            call_stack_sampler_.sampled(event.info);
+        }
+        if (online_detector_.is_enabled())
+            online_detector_.acquire(thread_of(event), lock_of(event),
+                                     event.info);
+        if (!folds_lock_orders(mode))
+            log(event, mode);
+        else if (mode == LogBudget::stopped) {
+            framework_detail::dropped_events dropped(budget_);
+            lock_orders_.acquire(thread_of(event), lock_of(event),
+                segments_.segment_of(thread_of(event)), event.info,
+                dropped);
+        }
+        else
+            lock_orders_.acquire(thread_of(event), lock_of(event),
+                segments_.segment_of(thread_of(event)), event.info,
+                dispatcher_);
     }
 }
 
 void framework::notify_release(std::size_t thread_id, std::size_t lock_id) {
-    if (is_enabled())
-        dispatcher_.dispatch(
-            events::release(ThreadId(thread_id), LockId(lock_id)));
+    if (is_enabled()) {
+        events::release event((ThreadId(thread_id)), LockId(lock_id));
+        LogBudget::mode const mode = budget_release(thread_of(event));
+        call_stack_sampler_.release(lock_id);
+        if (online_detector_.is_enabled())
+            online_detector_.release(thread_of(event), lock_of(event));
+        // The locks must be released even when the release is not folded,
+        // since logging may have stopped while they were held.
+        if (tracks_lock_orders())
+            lock_orders_.release(lock_of(event));
+        if (!folds_lock_orders(mode))
+            log(event, mode);
+    }
 }
 
 void framework::notify_recursive_acquire(std::size_t thread_id, std::size_t lock_id) {
     if (is_enabled()) {
         events::recursive_acquire event((ThreadId(thread_id)), LockId(lock_id));
-                        // ignore current frame
-        event.info.init_call_stack(1);
-        dispatcher_.dispatch(event);
+        LogBudget::mode const mode = budget_acquire(thread_of(event));
+        if (call_stack_sampler_.acquire(lock_id, event.info)) {
+            if (captures_call_stack(mode, thread_of(event), lock_of(event),
+                                    event.info)) {
+                detail::LockDebugInfo info;
+                info.init_raw_call_stack(1); // ignore current frame
+                event.info = cached_call_stack(info);
+            }
+            // The sampler must know what became of the call stack even if
+            // it was not captured, so the pair stops taking its lock.
+            call_stack_sampler_.sampled(event.info);
+        }
+        if (online_detector_.is_enabled())
+            online_detector_.recursive_acquire(thread_of(event),
+                                               lock_of(event), event.info);
+        if (!folds_lock_orders(mode))
+            log(event, mode);
+        else if (mode == LogBudget::stopped) {
+            framework_detail::dropped_events dropped(budget_);
+            lock_orders_.recursive_acquire(thread_of(event), lock_of(event),
+                segments_.segment_of(thread_of(event)), event.info,
+                dropped);
+        }
+        else
+            lock_orders_.recursive_acquire(thread_of(event), lock_of(event),
+                segments_.segment_of(thread_of(event)), event.info,
+                dispatcher_);
     }
 }
 
 void framework::notify_recursive_release(std::size_t thread_id, std::size_t lock_id) {
-    if (is_enabled())
-        dispatcher_.dispatch(
-            events::recursive_release(ThreadId(thread_id), LockId(lock_id)));
+    if (is_enabled()) {
+        events::recursive_release event((ThreadId(thread_id)),
+                                        LockId(lock_id));
+        LogBudget::mode const mode = budget_release(thread_of(event));
+        call_stack_sampler_.release(lock_id);
+        if (online_detector_.is_enabled())
+            online_detector_.release(thread_of(event), lock_of(event));
+        if (tracks_lock_orders())
+            lock_orders_.recursive_release(lock_of(event));
+        if (!folds_lock_orders(mode))
+            log(event, mode);
+    }
+}
+
+// The segment_hops of a thread must be kept along with its other events
+// when they are subject to the budget.
+void framework::log_segment_hop(events::segment_hop& hop) {
+    if (budget_.is_enabled())
+        budget_.keep(hop, dispatcher_);
+    else
+        dispatcher_.dispatch(hop);
 }
 
 void framework::notify_start(std::size_t parent_id, std::size_t child_id) {
@@ -93,36 +484,20 @@ void framework::notify_start(std::size_t parent_id, std::size_t child_id) {
         return;
 
     ThreadId parent(parent_id), child(child_id);
-    Segment parent_segment, child_segment, new_parent_segment;
-    {
-        boost::lock_guard<detail::mutex> lock(segment_mutex);
-        BOOST_ASSERT_MSG(parent != child, "thread starting itself");
-        BOOST_ASSERT_MSG(segment_of.empty() || framework_detail::contains(parent,segment_of),
-    "starting a thread from another thread that has not been created yet");
-        // segment_of[parent] will be the initial segment value on the
-        // very first call, which is the same as current_segment. so this
-        // means two things:
-        //  - parent_segment will be the initial segment value on the very
-        //    first call, and the segment of `parent` on subsequent calls,
-        //    which is fine.
-        //  - we must PREincrement the current_segment so it is distinct
-        //    from the initial value.
-        Segment& segment_of_parent = segment_of[parent];
-        parent_segment = segment_of_parent;
-        new_parent_segment = ++current_segment;
-        child_segment = ++current_segment;
-        segment_of[child] = child_segment;
-        segment_of_parent = new_parent_segment;
-    }
+    Segment parent_segment, new_parent_segment, child_segment;
+    segments_.start(parent, child,
+                    parent_segment, new_parent_segment, child_segment);
 
     dispatcher_.dispatch(
         events::start(parent_segment, new_parent_segment, child_segment));
 
-    dispatcher_.dispatch(
-        events::segment_hop(parent, new_parent_segment));
+    // Note: We are called from the child thread, so its segment_hop must be
+    //       dispatched first; see `FilesystemDispatcher` for details.
+    events::segment_hop child_hop(child, child_segment);
+    log_segment_hop(child_hop);
 
-    dispatcher_.dispatch(
-        events::segment_hop(child, child_segment));
+    events::segment_hop parent_hop(parent, new_parent_segment);
+    log_segment_hop(parent_hop);
 }
 
 void framework::notify_join(std::size_t parent_id, std::size_t child_id) {
@@ -130,26 +505,15 @@ void framework::notify_join(std::size_t parent_id, std::size_t child_id) {
         return;
 
     ThreadId parent(parent_id), child(child_id);
-    Segment parent_segment, child_segment, new_parent_segment;
-    {
-        detail::scoped_lock<detail::mutex> lock(segment_mutex);
-        BOOST_ASSERT_MSG(parent != child, "thread joining itself");
-        BOOST_ASSERT_MSG(framework_detail::contains(parent, segment_of),
-    "joining a thread into another thread that has not been created yet");
-        BOOST_ASSERT_MSG(framework_detail::contains(child, segment_of),
-                        "joining a thread that has not been created yet");
-        Segment& segment_of_parent = segment_of[parent];
-        parent_segment = segment_of_parent;
-        child_segment = segment_of[child];
-        new_parent_segment = ++current_segment;
-        segment_of_parent = new_parent_segment;
-        segment_of.erase(child);
-    }
+    Segment parent_segment, new_parent_segment, child_segment;
+    segments_.join(parent, child,
+                   parent_segment, new_parent_segment, child_segment);
 
     dispatcher_.dispatch(
         events::join(parent_segment, new_parent_segment, child_segment));
 
-    dispatcher_.dispatch(events::segment_hop(parent, new_parent_segment));
+    events::segment_hop parent_hop(parent, new_parent_segment);
+    log_segment_hop(parent_hop);
     // We could possibly generate informative events like end-of-thread
     // in the child thread, but that's not strictly necessary right now.
 }
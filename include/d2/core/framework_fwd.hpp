@@ -5,14 +5,26 @@
 #ifndef D2_CORE_FRAMEWORK_FWD_HPP
 #define D2_CORE_FRAMEWORK_FWD_HPP
 
+#include <d2/core/diagnostic.hpp>
+#include <d2/core/events.hpp>
 #include <d2/core/filesystem_dispatcher.hpp>
-#include <d2/core/segment.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/lock_order_recorder.hpp>
+#include <d2/core/log_budget.hpp>
+#include <d2/core/online_detector.hpp>
 #include <d2/core/thread_id.hpp>
+#include <d2/core/thread_segments.hpp>
 #include <d2/detail/atomic.hpp>
+#include <d2/detail/call_stack_sampler.hpp>
+#include <d2/detail/call_stack_table.hpp>
+#include <d2/detail/lock_debug_info.hpp>
 #include <d2/detail/mutex.hpp>
+#include <d2/detail/thread_specific_ptr.hpp>
 
+#include <boost/filesystem/fstream.hpp>
 #include <boost/unordered_map.hpp>
 #include <cstddef>
+#include <iosfwd>
 
 
 namespace d2 {
@@ -30,6 +42,22 @@ public:
 
     int set_repository(char const* path);
     void unset_repository();
+    int set_repository_format(char const* format);
+    void set_mapped_files(bool enabled);
+    void set_compressed_files(bool enabled);
+    void set_log_budget(std::size_t repository_bytes,
+                        std::size_t thread_bytes);
+    int set_overflow_policy(char const* policy);
+    log_statistics get_log_statistics() const;
+
+    void set_thread_buffer_size(std::size_t size);
+    void set_async_queue_depth(std::size_t depth);
+    void set_deferred_symbolization(bool enabled);
+    void set_call_stack_samples(std::size_t samples);
+    void set_lock_order_records(bool enabled);
+    void set_deadlock_callback(OnlineDetector::Callback callback);
+    void explain_deadlock(std::ostream& os,
+                          potential_deadlock const& deadlock);
 
     void notify_acquire(std::size_t thread, std::size_t lock);
     void notify_recursive_acquire(std::size_t thread, std::size_t lock);
@@ -41,13 +69,71 @@ public:
     void notify_join(std::size_t parent, std::size_t child);
 
 private:
+    // Identifiers of the call stacks interned by a thread, as of the
+    // `generation` of the table of call stacks.
+    struct CallStackCache {
+        struct Hash {
+            std::size_t
+            operator()(detail::LockDebugInfo::CallStack const& stack) const {
+                return detail::CallStackTable::hash(stack);
+            }
+        };
+
+        typedef boost::unordered_map<
+                    detail::LockDebugInfo::CallStack, detail::CallStackId,
+                    Hash
+                > Ids;
+
+        CallStackCache() : generation(0) { }
+
+        Ids ids;
+        std::size_t generation;
+    };
+
+    static void delete_call_stack_cache(CallStackCache* cache);
+    detail::CallStackId cached_call_stack(detail::LockDebugInfo& info);
+    detail::CallStackId intern_call_stack(detail::LockDebugInfo& info);
+    detail::CallStackId copy_call_stack(detail::CallStackId id,
+                                detail::CallStackTable& call_stacks) const;
+
+    LogBudget::mode budget_acquire(ThreadId const& thread);
+    LogBudget::mode budget_release(ThreadId const& thread);
+    bool captures_call_stack(LogBudget::mode mode, ThreadId const& thread,
+                             LockId const& lock, detail::CallStackId& info);
+    bool tracks_lock_orders() const;
+    bool folds_lock_orders(LogBudget::mode mode);
+
+    template <typename Event>
+    void log(Event& event, LogBudget::mode mode);
+    void log_segment_hop(events::segment_hop& hop);
+
     FilesystemDispatcher dispatcher_;
-    detail::atomic<bool> event_logging_enabled_;
+    detail::atomic<bool> has_repository_;
+    detail::atomic<bool> deferred_symbolization_;
+
+    ThreadSegments segments_;
+
+    // Every distinct call stack is written once to the call stacks file of
+    // the repository, and events refer to it by its identifier.
+    detail::mutex call_stacks_mutex_;
+    detail::CallStackTable call_stacks_;
+    boost::filesystem::ofstream call_stacks_file_;
+
+    // Each thread remembers the call stacks it interned, so it only takes
+    // `call_stacks_mutex_` the first time it sees a call stack. The caches
+    // are forgotten whenever the table is cleared, which increments the
+    // generation of the table.
+    std::size_t volatile call_stacks_generation_;
+    detail::thread_specific_ptr<CallStackCache> call_stack_caches_;
+
+    // Decides which acquisitions have their call stack captured.
+    detail::CallStackSampler call_stack_sampler_;
+
+    LockOrderRecorder lock_orders_;
+    OnlineDetector online_detector_;
 
-    // default initialized to the initial segment value
-    Segment current_segment;
-    detail::mutex segment_mutex;
-    boost::unordered_map<ThreadId, Segment> segment_of;
+    // Decides what is logged once the repository grows past its budget.
+    LogBudget budget_;
 };
 } // end namespace core
 } // end namespace d2
@@ -0,0 +1,237 @@
+/**
+ * This file defines the `HappensBeforeIndex` class.
+ */
+
+#ifndef D2_CORE_HAPPENS_BEFORE_INDEX_HPP
+#define D2_CORE_HAPPENS_BEFORE_INDEX_HPP
+
+#include <d2/core/segment.hpp>
+
+#include <boost/foreach.hpp>
+#include <boost/graph/graph_traits.hpp>
+#include <boost/graph/properties.hpp>
+#include <boost/graph/topological_sort.hpp>
+#include <boost/unordered_map.hpp>
+#include <climits>
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+
+namespace d2 {
+namespace happens_before_index_detail {
+/**
+ * Index of the `happens_before` relation of a segmentation graph, i.e. of
+ * its transitive closure, answering each query in constant time.
+ *
+ * The segments are numbered in a topological order of the graph, so a
+ * segment can only happen before the segments that come after it. Hence,
+ * each segment only stores the bits of the segments after it, starting at
+ * the word holding the next segment, which takes about half the size of the
+ * full transitive closure. Since the bits of every segment are aligned the
+ * same way, the bits of a successor are merged word by word.
+ *
+ * When the closure would take more than a given amount of memory, it is
+ * not stored, and each query searches the successors of the segments
+ * instead, which only takes memory in the size of the graph.
+ *
+ * @note The index is a snapshot of the graph it was built from; it is not
+ *       updated when the graph changes.
+ */
+class HappensBeforeIndex {
+    typedef unsigned long Block;
+    static std::size_t const bits_per_block = sizeof(Block) * CHAR_BIT;
+
+    // Position of each segment in the topological order.
+    boost::unordered_map<Segment, std::size_t> positions_;
+
+    // The successors of the segment at position `p` are at the positions
+    // `successors_[first_successor_[p]]` to
+    // `successors_[first_successor_[p + 1]]` excluded.
+    std::vector<std::size_t> first_successor_;
+    std::vector<std::size_t> successors_;
+
+    // The bits of the segment at position `p` start at the block
+    // `first_block_[p]`, which holds the bits of the positions from
+    // `(p + 1) / bits_per_block * bits_per_block` onwards. The bit of a
+    // position is set when the segment at `p` happens before it. Both are
+    // empty if the closure is not stored.
+    std::vector<std::size_t> first_block_;
+    std::vector<Block> blocks_;
+
+    std::size_t size() const { return positions_.size(); }
+
+    static std::size_t block_of(std::size_t position) {
+        return position / bits_per_block;
+    }
+
+    static Block mask_of(std::size_t position) {
+        return Block(1) << (position % bits_per_block);
+    }
+
+    // Return the block holding the bit of `pv` in the bits of `pu`.
+    Block& block_at(std::size_t pu, std::size_t pv) {
+        return blocks_[first_block_[pu] + block_of(pv) - block_of(pu + 1)];
+    }
+
+    Block block_at(std::size_t pu, std::size_t pv) const {
+        return blocks_[first_block_[pu] + block_of(pv) - block_of(pu + 1)];
+    }
+
+    // Set the bits of the closure, from the last position in the
+    // topological order, so the successors of a segment are always done
+    // before it. Nothing is stored if it would take more than `max_bytes`.
+    void build_closure(std::size_t max_bytes) {
+        std::size_t const blocks = block_of(size() - 1) + 1;
+        std::size_t total = 0;
+        for (std::size_t p = 0; p < size(); ++p)
+            total += blocks - block_of(p + 1);
+        if (total > max_bytes / sizeof(Block))
+            return;
+
+        first_block_.resize(size());
+        for (std::size_t p = 0, first = 0; p < size(); ++p) {
+            first_block_[p] = first;
+            first += blocks - block_of(p + 1);
+        }
+        blocks_.assign(total, Block(0));
+
+        for (std::size_t pu = size(); pu > 0; --pu) {
+            std::size_t const u = pu - 1;
+            for (std::size_t i = first_successor_[u];
+                                    i < first_successor_[u + 1]; ++i) {
+                std::size_t const v = successors_[i];
+                block_at(u, v) |= mask_of(v);
+                // The blocks of `v` are the last blocks of `u`.
+                std::size_t const first = block_of(v + 1);
+                Block* const to = &blocks_[0] + first_block_[u] +
+                                                (first - block_of(u + 1));
+                Block const* const from = &blocks_[0] + first_block_[v];
+                for (std::size_t b = 0; b < blocks - first; ++b)
+                    to[b] |= from[b];
+            }
+        }
+    }
+
+    // Search the successors of `pu` for `pv`, when the closure is not
+    // stored. Only the positions between `pu` and `pv` can be on a path.
+    bool is_reachable(std::size_t pu, std::size_t pv) const {
+        std::vector<bool> seen(pv - pu, false);
+        std::vector<std::size_t> stack(1, pu);
+        while (!stack.empty()) {
+            std::size_t const p = stack.back();
+            stack.pop_back();
+            for (std::size_t i = first_successor_[p];
+                                    i < first_successor_[p + 1]; ++i) {
+                std::size_t const q = successors_[i];
+                if (q == pv)
+                    return true;
+                if (q < pv && !seen[q - pu]) {
+                    seen[q - pu] = true;
+                    stack.push_back(q);
+                }
+            }
+        }
+        return false;
+    }
+
+public:
+    //! Default maximum size of the stored closure, in bytes.
+    static std::size_t const default_max_closure_bytes = 64 << 20;
+
+    //! Create an empty index, in which no segment happens before another.
+    HappensBeforeIndex() { }
+
+    /**
+     * Create the index of a segmentation graph built with
+     * `build_segmentation_graph`.
+     *
+     * This takes `O(E * V / w)` time, where `w` is the number of bits in a
+     * word, and `O(V^2 / 2)` bits of memory. If these bits would take more
+     * than `max_closure_bytes`, they are not stored, and the index only
+     * takes `O(V + E)` memory, but each query takes `O(V + E)` time.
+     */
+    template <typename Graph>
+    explicit HappensBeforeIndex(Graph const& graph,
+                                std::size_t max_closure_bytes =
+                                                default_max_closure_bytes) {
+        typedef boost::graph_traits<Graph> Traits;
+        typedef typename Traits::vertex_descriptor Vertex;
+        typedef typename Traits::edge_descriptor Edge;
+
+        // topological_sort outputs the vertices in reverse order.
+        std::vector<Vertex> order;
+        order.reserve(num_vertices(graph));
+        boost::topological_sort(graph, std::back_inserter(order));
+        std::size_t const size = order.size();
+        if (size == 0)
+            return;
+
+        typename boost::property_map<
+            Graph, boost::vertex_index_t
+        >::const_type index = get(boost::vertex_index, graph);
+        std::vector<std::size_t> position_of(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            position_of[get(index, order[i])] = size - 1 - i;
+            positions_[graph[order[i]]] = size - 1 - i;
+        }
+
+        first_successor_.reserve(size + 1);
+        successors_.reserve(num_edges(graph));
+        for (std::size_t i = size; i > 0; --i) {
+            first_successor_.push_back(successors_.size());
+            BOOST_FOREACH(Edge e, out_edges(order[i - 1], graph))
+                successors_.push_back(position_of[get(index,
+                                                      target(e, graph))]);
+        }
+        first_successor_.push_back(successors_.size());
+
+        build_closure(max_closure_bytes);
+    }
+
+    //! Return whether the transitive closure of the graph is stored.
+    bool has_closure() const {
+        return !first_block_.empty();
+    }
+
+    /**
+     * Return the position of the segment `s` in the index, which is the
+     * number of indexed segments if `s` is not in the indexed graph.
+     *
+     * Positions can be looked up once and then queried with
+     * `happens_before_at`, which does not hash the segments.
+     */
+    std::size_t position_of(Segment const& s) const {
+        boost::unordered_map<Segment, std::size_t>::const_iterator const it =
+                                                        positions_.find(s);
+        return it == positions_.end() ? size() : it->second;
+    }
+
+    /**
+     * Return whether the segment at the position `pu` happens before the
+     * segment at the position `pv`.
+     */
+    bool happens_before_at(std::size_t pu, std::size_t pv) const {
+        if (pu >= pv || pv >= size())
+            return false;
+        if (!has_closure())
+            return is_reachable(pu, pv);
+        return (block_at(pu, pv) & mask_of(pv)) != 0;
+    }
+
+    /**
+     * Return whether the segment `u` happens before the segment `v`, which
+     * is never the case if one of them is not in the indexed graph.
+     */
+    bool happens_before(Segment const& u, Segment const& v) const {
+        return happens_before_at(position_of(u), position_of(v));
+    }
+};
+} // end namespace happens_before_index_detail
+
+namespace core {
+    using happens_before_index_detail::HappensBeforeIndex;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_HAPPENS_BEFORE_INDEX_HPP
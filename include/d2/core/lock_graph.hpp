@@ -10,9 +10,11 @@
 #include <d2/core/segment.hpp>
 #include <d2/core/thread_id.hpp>
 #include <d2/detail/decl.hpp>
-#include <d2/detail/lock_debug_info.hpp>
+#include <d2/detail/call_stack_table.hpp>
 
+#include <algorithm>
 #include <boost/assert.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/named_graph.hpp>
 #include <boost/make_shared.hpp>
@@ -24,8 +26,11 @@
 #include <boost/multi_index_container.hpp>
 #include <boost/operators.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
+#include <cstddef>
 #include <iosfwd>
+#include <utility>
 
 
 namespace d2 {
@@ -33,16 +38,24 @@ namespace lock_graph_detail {
 /**
  * Set whose underlying representation can be shared by several owners.
  *
+ * The hash of the set, as computed by `Hash`, is computed once when the
+ * underlying set is created, and shared along with it. So is the number
+ * given to the set by its creator, if any.
+ *
  * @note This structure is optimized so that several duplicated read-only
  *       copies of it are space efficient.
  */
-template <typename Set>
+template <typename Set, typename Hash>
 struct shared_set {
     typedef Set underlying_set_type;
 
+    //! Number of the sets that were not given one.
+    static std::size_t const no_id = static_cast<std::size_t>(-1);
+
     //! Construct an empty set.
     shared_set()
-        : set_(boost::make_shared<underlying_set_type>())
+        : set_(boost::make_shared<data>(underlying_set_type(),
+                                        std::size_t(no_id)))
     { }
 
     //! Construct a shared set sharing its underlying set with `other`.
@@ -51,49 +64,140 @@ struct shared_set {
     { }
 
     //! Construct a shared set with an underlying set equal to `other`.
-    explicit shared_set(BOOST_RV_REF(underlying_set_type) other)
-        : set_(boost::make_shared<underlying_set_type>(boost::move(other)))
+    explicit shared_set(BOOST_RV_REF(underlying_set_type) other,
+                        std::size_t id = no_id)
+        : set_(boost::make_shared<data>(boost::move(other), id))
     { }
 
     //! Construct a shared set with an underlying set equal to `other`.
-    explicit shared_set(underlying_set_type const& other)
-        : set_(boost::make_shared<underlying_set_type>(other))
+    explicit shared_set(underlying_set_type const& other,
+                        std::size_t id = no_id)
+        : set_(boost::make_shared<data>(other, id))
     { }
 
     //! Return a constant reference to the underlying set of `*this`.
     operator underlying_set_type const&() const {
         BOOST_ASSERT_MSG(set_, "invariant broken: the shared_ptr of a "
                                "shared set instance is invalid");
-        return *set_;
+        return set_->set;
+    }
+
+    //! Return the hash of the underlying set.
+    std::size_t hash() const { return set_->hash; }
+
+    //! Return the number given to the underlying set, or `no_id`.
+    std::size_t id() const { return set_->id; }
+
+    //! Return whether `*this` and `other` share the same underlying set.
+    bool shares_with(shared_set const& other) const {
+        return set_ == other.set_;
     }
 
 private:
-    boost::shared_ptr<underlying_set_type const> set_;
+    struct data {
+        data(BOOST_RV_REF(underlying_set_type) other, std::size_t id)
+            : set(boost::move(other)), hash(Hash()(set)), id(id)
+        { }
+
+        data(underlying_set_type const& other, std::size_t id)
+            : set(other), hash(Hash()(set)), id(id)
+        { }
+
+        underlying_set_type const set;
+        std::size_t const hash;
+        std::size_t const id;
+    };
+
+    boost::shared_ptr<data const> set_;
+};
+
+//! Hash of a sequence of locks, in order.
+struct hash_lock_sequence {
+    template <typename Sequence>
+    std::size_t operator()(Sequence const& locks) const {
+        return boost::hash_range(locks.begin(), locks.end());
+    }
+};
+
+typedef boost::multi_index_container<
+            LockId,
+            boost::multi_index::indexed_by<
+                boost::multi_index::hashed_unique<boost::multi_index::identity<LockId> >,
+                boost::multi_index::sequenced<>
+            >
+        > GatelockSet;
+
+struct hash_gatelock_set {
+    std::size_t operator()(GatelockSet const& set) const {
+        return hash_lock_sequence()(set.get<1>());
+    }
 };
 
 /**
  * Set of locks held by a thread.
  *
  * @note We use a `shared_set` because an instance of `Gatelocks` is stored
- *       on each edge of the lock graph. We could use a `flyweight` too, but
- *       benchmarking shows that the current solution offers a better
- *       space/time tradeoff.
- *       The main differences between the two approaches are:
- *       - `flyweight` requires the set to be hashed everytime, which is
- *         more CPU intensive.
- *       - Using a `shared_set` is suboptimal because there may be some
- *         repetition of the gatelocks in the lock graph when the gatelocks
- *         are the same on different events.
+ *       on each edge of the lock graph. The same sets of locks are held
+ *       over and over by the threads of a program, so they are interned in
+ *       a `GatelockTable` when the lock graph is built, which makes the
+ *       equal sets share the same instance.
  */
-typedef shared_set<
-            boost::multi_index_container<
-                LockId,
-                boost::multi_index::indexed_by<
-                    boost::multi_index::hashed_unique<boost::multi_index::identity<LockId> >,
-                    boost::multi_index::sequenced<>
-                >
-            >
-        > Gatelocks;
+typedef shared_set<GatelockSet, hash_gatelock_set> Gatelocks;
+
+/**
+ * Table interning the gatelock sets of a lock graph, so that each distinct
+ * sequence of held locks is represented by a single immutable instance of
+ * `Gatelocks`, shared by all the edges it appears on.
+ *
+ * Each interned set is numbered densely, in the order in which it was
+ * interned, so the sets of a lock graph can be told apart and indexed by
+ * their number, as long as they all come from the same table. Labels
+ * whose gatelocks share the same instance are compared without looking at
+ * the locks at all.
+ */
+class GatelockTable {
+    // Interned sets, by the hash of their sequence of locks.
+    boost::unordered_multimap<std::size_t, Gatelocks> sets_;
+
+public:
+    /**
+     * Return the interned set made of the locks of `locks`, in order,
+     * creating it if needed.
+     */
+    template <typename Sequence>
+    Gatelocks intern(Sequence const& locks) {
+        typedef boost::unordered_multimap<
+                    std::size_t, Gatelocks
+                >::const_iterator Iterator;
+        std::size_t const hash = hash_lock_sequence()(locks);
+        std::pair<Iterator, Iterator> const candidates =
+                                                    sets_.equal_range(hash);
+        for (Iterator it = candidates.first; it != candidates.second; ++it) {
+            GatelockSet const& set = it->second;
+            if (set.size() == locks.size() &&
+                    std::equal(locks.begin(), locks.end(),
+                               set.get<1>().begin()))
+                return it->second;
+        }
+
+        GatelockSet set;
+        set.get<1>().insert(set.get<1>().end(), locks.begin(), locks.end());
+        Gatelocks const interned(boost::move(set), sets_.size());
+        sets_.insert(std::make_pair(hash, interned));
+        return interned;
+    }
+
+    //! Overload interning a set that was created elsewhere.
+    Gatelocks intern(Gatelocks const& gatelocks) {
+        GatelockSet const& set = gatelocks;
+        return intern(set.get<1>());
+    }
+
+    //! Return the number of distinct sets interned in the table.
+    std::size_t size() const {
+        return sets_.size();
+    }
+};
 
 /**
  * Label stored on each edge of a lock graph.
@@ -101,10 +205,13 @@ typedef shared_set<
 struct LockGraphLabel : boost::equality_comparable<LockGraphLabel> {
     LockGraphLabel(Segment s1, ThreadId thread,
                    Gatelocks const& gatelocks, Segment s2)
-        : s1(s1), s2(s2), thread_(thread), gatelocks_(gatelocks)
+        : l1_info(detail::no_call_stack), l2_info(detail::no_call_stack),
+          s1(s1), s2(s2), thread_(thread), gatelocks_(gatelocks),
+          gatelocks_id_(gatelocks.id())
     { }
 
-    detail::LockDebugInfo l1_info, l2_info;
+    //! Identifiers of the call stacks at which the locks were acquired.
+    detail::CallStackId l1_info, l2_info;
     Segment s1, s2;
 
     friend Gatelocks::underlying_set_type const&
@@ -112,6 +219,14 @@ struct LockGraphLabel : boost::equality_comparable<LockGraphLabel> {
         return self.gatelocks_;
     }
 
+    /**
+     * Return the number of the gatelocks of `self` in the `GatelockTable`
+     * they were interned in, or `Gatelocks::no_id` if they were not.
+     */
+    friend std::size_t gatelocks_id_of(LockGraphLabel const& self) {
+        return self.gatelocks_id_;
+    }
+
     friend ThreadId const& thread_of(LockGraphLabel const& self) {
         return self.thread_;
     }
@@ -124,7 +239,20 @@ struct LockGraphLabel : boost::equality_comparable<LockGraphLabel> {
                thread_of(a) == thread_of(b) &&
                a.l1_info == b.l1_info &&
                a.l2_info == b.l2_info &&
-               gatelocks_of(a).get<1>() == gatelocks_of(b).get<1>();
+               (a.gatelocks_.shares_with(b.gatelocks_) ||
+                (a.gatelocks_.hash() == b.gatelocks_.hash() &&
+                 gatelocks_of(a).get<1>() == gatelocks_of(b).get<1>()));
+    }
+
+    friend std::size_t hash_value(LockGraphLabel const& self) {
+        std::size_t seed = 0;
+        boost::hash_combine(seed, self.s1);
+        boost::hash_combine(seed, self.s2);
+        boost::hash_combine(seed, thread_of(self));
+        boost::hash_combine(seed, self.l1_info);
+        boost::hash_combine(seed, self.l2_info);
+        boost::hash_combine(seed, self.gatelocks_.hash());
+        return seed;
     }
 
     D2_DECL friend
@@ -133,6 +261,7 @@ struct LockGraphLabel : boost::equality_comparable<LockGraphLabel> {
 private:
     ThreadId thread_;
     Gatelocks gatelocks_;
+    std::size_t gatelocks_id_;
 };
 
 /**
@@ -149,6 +278,7 @@ namespace core {
     using lock_graph_detail::LockGraph;
     using lock_graph_detail::LockGraphLabel;
     using lock_graph_detail::Gatelocks;
+    using lock_graph_detail::GatelockTable;
 }
 } // end namespace d2
 
@@ -0,0 +1,307 @@
+/**
+ * This file defines the `LockOrderRecorder` class.
+ */
+
+#ifndef D2_CORE_LOCK_ORDER_RECORDER_HPP
+#define D2_CORE_LOCK_ORDER_RECORDER_HPP
+
+#include <d2/core/events.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/atomic_ops.hpp>
+#include <d2/detail/call_stack_table.hpp>
+#include <d2/detail/mutex.hpp>
+#include <d2/detail/thread_specific_ptr.hpp>
+
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <cstddef>
+#include <vector>
+
+
+namespace d2 {
+namespace lock_order_recorder_detail {
+//! Hash of the label of a `lock_order`, ignoring its occurrences.
+struct lock_order_hash {
+    std::size_t operator()(core::events::lock_order const& e) const {
+        std::size_t seed = 0;
+        boost::hash_combine(seed, thread_of(e));
+        boost::hash_combine(seed, e.l1);
+        boost::hash_combine(seed, e.l2);
+        boost::hash_combine(seed, e.s1);
+        boost::hash_combine(seed, e.s2);
+        boost::hash_combine(seed, e.l1_info);
+        boost::hash_combine(seed, e.l2_info);
+        BOOST_FOREACH(LockId const& lock, e.gatelocks)
+            boost::hash_combine(seed, lock);
+        return seed;
+    }
+};
+
+//! Equality of the labels of two `lock_order`s, ignoring their occurrences.
+struct lock_order_equal {
+    bool operator()(core::events::lock_order const& a,
+                    core::events::lock_order const& b) const {
+        return thread_of(a) == thread_of(b) &&
+               a.l1 == b.l1 && a.l2 == b.l2 && a.s1 == b.s1 &&
+               a.s2 == b.s2 && a.l1_info == b.l1_info &&
+               a.l2_info == b.l2_info && a.gatelocks == b.gatelocks;
+    }
+};
+
+/**
+ * Class turning the acquisitions and releases of the threads into the edges
+ * of the lock graph while the program runs.
+ *
+ * Most acquisitions are the same nested acquisitions repeated in loops, all
+ * of which create the same edges in the lock graph. Instead of recording
+ * every acquisition and release, the locks held by each thread are tracked
+ * here, and a `lock_order` event is generated only the first time each
+ * distinct edge is seen. The number of occurrences of the edges is counted,
+ * and the edges seen more than once are generated again with their final
+ * count when `flush` is called.
+ *
+ * The edges seen by each thread are counted by that thread, so repeating an
+ * acquisition does not take any shared lock. The counts of the threads are
+ * only merged by `flush`.
+ *
+ * The edges are generated exactly as the post-mortem analysis would deduce
+ * them from the acquisitions and releases, so the lock graph is the same.
+ */
+class LockOrderRecorder : boost::noncopyable {
+    struct HeldLock {
+        HeldLock(LockId const& lock, Segment const& segment,
+                 detail::CallStackId info)
+            : lock(lock), segment(segment), info(info)
+        { }
+
+        LockId lock;
+        Segment segment;
+        detail::CallStackId info;
+    };
+
+    struct Count {
+        explicit Count(std::size_t value) : value(value) { }
+
+        std::size_t volatile value;
+    };
+
+    typedef boost::unordered_map<
+                core::events::lock_order, Count,
+                lock_order_hash, lock_order_equal
+            > Occurrences;
+
+    // Occurrences of the edges seen by a thread since the last flush, which
+    // is shared with the recorder so that `flush` can read it. Only the
+    // thread modifies it, and it does so with `mutex` held, except for the
+    // counts of the edges, which are updated atomically.
+    struct Counts {
+        Counts() : generation(0) { }
+
+        detail::mutex mutex;
+        Occurrences occurrences;
+        // The generation of the recorder the edges were seen in.
+        std::size_t generation;
+    };
+
+    struct HeldLocks {
+        std::vector<HeldLock> locks;
+        boost::unordered_map<LockId, std::size_t> recursion;
+        boost::shared_ptr<Counts> counts;
+    };
+
+    bool volatile enabled_;
+    detail::thread_specific_ptr<HeldLocks> held_locks_;
+
+    // Incremented by `flush`, so that the threads forget the edges they saw.
+    std::size_t volatile generation_;
+
+    // The counts of every thread, including the threads that exited since
+    // the last flush.
+    detail::mutex mutex_;
+    std::vector<boost::shared_ptr<Counts> > counts_;
+
+    static void delete_held_locks(HeldLocks* held) {
+        delete held;
+    }
+
+    HeldLocks& held_locks() {
+        HeldLocks* held = held_locks_.get();
+        if (!held)
+            held_locks_.reset(held = new HeldLocks);
+        return *held;
+    }
+
+    // Return the counts of the current thread, forgetting them if they are
+    // from before the last flush.
+    Counts& counts_of(HeldLocks& held) {
+        if (!held.counts) {
+            held.counts = boost::make_shared<Counts>();
+            detail::scoped_lock<detail::mutex> guard(mutex_);
+            counts_.push_back(held.counts);
+        }
+        Counts& counts = *held.counts;
+        std::size_t const generation = detail::load_relaxed(generation_);
+        if (counts.generation != generation) {
+            detail::scoped_lock<detail::mutex> guard(counts.mutex);
+            counts.occurrences.clear();
+            counts.generation = generation;
+        }
+        return counts;
+    }
+
+public:
+    LockOrderRecorder()
+        : enabled_(false), held_locks_(&delete_held_locks), generation_(0)
+    { }
+
+    /**
+     * Set whether acquisitions are turned into edges.
+     *
+     * @note The locks held by each thread are only tracked while this is
+     *       enabled, so it should be enabled before any lock is acquired.
+     */
+    void set_enabled(bool enabled) {
+        detail::store_relaxed(enabled_, enabled);
+    }
+
+    bool is_enabled() const {
+        return detail::load_relaxed(enabled_);
+    }
+
+    /**
+     * Record that the current thread, identified by `thread`, acquired
+     * `lock` in `segment` at the call stack identified by `info`, and
+     * dispatch the edges that were never seen before to `dispatcher`.
+     */
+    template <typename Dispatcher>
+    void acquire(ThreadId const& thread, LockId const& lock,
+                 Segment const& segment, detail::CallStackId info,
+                 Dispatcher& dispatcher) {
+        HeldLocks& held = held_locks();
+        std::vector<core::events::lock_order> new_edges;
+        if (!held.locks.empty()) {
+            core::events::lock_order edge(thread);
+            edge.l2 = lock;
+            edge.s2 = segment;
+            edge.l2_info = info;
+            BOOST_FOREACH(HeldLock const& h, held.locks)
+                edge.gatelocks.push_back(h.lock);
+
+            Counts& counts = counts_of(held);
+            BOOST_FOREACH(HeldLock const& h, held.locks) {
+                edge.l1 = h.lock;
+                edge.s1 = h.segment;
+                edge.l1_info = h.info;
+                Occurrences::iterator const known =
+                                            counts.occurrences.find(edge);
+                if (known != counts.occurrences.end()) {
+                    std::size_t volatile& count = known->second.value;
+                    detail::store_relaxed(count,
+                                          detail::load_relaxed(count) + 1);
+                    continue;
+                }
+                detail::scoped_lock<detail::mutex> guard(counts.mutex);
+                counts.occurrences.insert(std::make_pair(edge, Count(1)));
+                new_edges.push_back(edge);
+            }
+        }
+        held.locks.push_back(HeldLock(lock, segment, info));
+
+        BOOST_FOREACH(core::events::lock_order& edge, new_edges)
+            dispatcher.dispatch(edge);
+    }
+
+    /**
+     * Record that the current thread acquired `lock` recursively. Only the
+     * first acquisition of a lock creates edges.
+     */
+    template <typename Dispatcher>
+    void recursive_acquire(ThreadId const& thread, LockId const& lock,
+                           Segment const& segment, detail::CallStackId info,
+                           Dispatcher& dispatcher) {
+        if (held_locks().recursion[lock]++ == 0)
+            acquire(thread, lock, segment, info, dispatcher);
+    }
+
+    /**
+     * Record that the current thread released `lock`.
+     */
+    void release(LockId const& lock) {
+        std::vector<HeldLock>& locks = held_locks().locks;
+        for (std::size_t i = locks.size(); i > 0; --i)
+            if (locks[i - 1].lock == lock)
+                locks.erase(locks.begin() + (i - 1));
+    }
+
+    /**
+     * Record that the current thread released `lock` recursively. Only the
+     * last release of a lock actually releases it.
+     */
+    void recursive_release(LockId const& lock) {
+        boost::unordered_map<LockId, std::size_t>& recursion =
+                                                    held_locks().recursion;
+        boost::unordered_map<LockId, std::size_t>::iterator const it =
+                                                        recursion.find(lock);
+        if (it == recursion.end() || it->second == 0)
+            return;
+        if (--it->second == 0) {
+            recursion.erase(it);
+            release(lock);
+        }
+    }
+
+    /**
+     * Dispatch the edges that were seen more than once to `dispatcher`,
+     * with their number of occurrences, and forget about all the edges.
+     *
+     * @note The threads forget their edges the next time they acquire a
+     *       lock, so the occurrences counted concurrently with a call to
+     *       this method may or may not be dispatched.
+     */
+    template <typename Dispatcher>
+    void flush(Dispatcher& dispatcher) {
+        std::vector<core::events::lock_order> counted;
+        {
+            detail::scoped_lock<detail::mutex> guard(mutex_);
+            std::size_t const generation =
+                            detail::fetch_add(generation_, std::size_t(1));
+            std::vector<boost::shared_ptr<Counts> > alive;
+            BOOST_FOREACH(boost::shared_ptr<Counts> const& counts, counts_) {
+                detail::scoped_lock<detail::mutex> lock(counts->mutex);
+                // The counts from before the last flush were dispatched
+                // already.
+                if (counts->generation == generation) {
+                    BOOST_FOREACH(Occurrences::value_type const& edge,
+                                  counts->occurrences) {
+                        std::size_t const occurrences =
+                                    detail::load_relaxed(edge.second.value);
+                        if (occurrences > 1) {
+                            counted.push_back(edge.first);
+                            counted.back().occurrences = occurrences;
+                        }
+                    }
+                }
+                // The threads that exited won't count anything anymore.
+                if (!counts.unique())
+                    alive.push_back(counts);
+            }
+            counts_.swap(alive);
+        }
+        BOOST_FOREACH(core::events::lock_order& edge, counted)
+            dispatcher.dispatch(edge);
+    }
+};
+} // end namespace lock_order_recorder_detail
+
+namespace core {
+    using lock_order_recorder_detail::LockOrderRecorder;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_LOCK_ORDER_RECORDER_HPP
@@ -0,0 +1,602 @@
+/**
+ * This file defines the `LogBudget` class.
+ */
+
+#ifndef D2_CORE_LOG_BUDGET_HPP
+#define D2_CORE_LOG_BUDGET_HPP
+
+#include <d2/core/events.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/atomic_ops.hpp>
+#include <d2/detail/mutex.hpp>
+#include <d2/detail/thread_specific_ptr.hpp>
+
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/variant/apply_visitor.hpp>
+#include <boost/variant/get.hpp>
+#include <boost/variant/static_visitor.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+
+namespace d2 {
+namespace log_budget_detail {
+/**
+ * Policies deciding what is logged once the budget of a thread or of the
+ * repository is exhausted.
+ */
+enum overflow_policy {
+    //! Nothing is logged anymore.
+    stop_logging,
+
+    //! Events are logged without the call stacks of the acquisitions.
+    drop_call_stacks,
+
+    //! Only the lock-order edges that were never seen are logged; see
+    //! `d2::core::LockOrderRecorder`.
+    keep_new_lock_orders,
+
+    //! The most recent events of each thread are kept in memory, and they
+    //! are only logged when the repository is closed.
+    keep_recent_events
+};
+
+/**
+ * Return the `overflow_policy` named `name`, which must be one of `"stop"`,
+ * `"drop_call_stacks"`, `"lock_orders"` or `"recent_events"`, in `policy`.
+ * Return whether `name` was a valid policy name.
+ */
+inline bool parse_overflow_policy(char const* name, overflow_policy& policy) {
+    if (std::strcmp(name, "stop") == 0)
+        policy = stop_logging;
+    else if (std::strcmp(name, "drop_call_stacks") == 0)
+        policy = drop_call_stacks;
+    else if (std::strcmp(name, "lock_orders") == 0)
+        policy = keep_new_lock_orders;
+    else if (std::strcmp(name, "recent_events") == 0)
+        policy = keep_recent_events;
+    else
+        return false;
+    return true;
+}
+
+/**
+ * Counters of what was not logged because of the budget.
+ */
+struct log_statistics {
+    log_statistics()
+        : dropped_events(0), dropped_call_stacks(0), folded_events(0)
+    { }
+
+    //! Number of events that were not logged at all, either because logging
+    //! stopped or because they were evicted from the recent events.
+    std::size_t dropped_events;
+
+    //! Number of acquisitions that were logged without their call stack.
+    std::size_t dropped_call_stacks;
+
+    //! Number of acquisitions and releases that were not logged because only
+    //! the new lock-order edges were.
+    std::size_t folded_events;
+};
+
+/**
+ * Class enforcing a budget on the size of the events logged to a
+ * repository, in bytes per repository and per thread.
+ *
+ * Once a thread or the repository exceeds its budget, the thread enters the
+ * `degraded` mode, in which what is logged is decided by the
+ * `overflow_policy`. Regardless of the policy, a thread enters the `stopped`
+ * mode and nothing is logged anymore once twice the budget is used, so the
+ * size of a repository is always bounded.
+ *
+ * The sizes are those of the files of the repository, before compression,
+ * and they are only checked every few events of each thread. Since the
+ * events may be buffered before they are written, the budget may be
+ * exceeded by the size of the buffers.
+ *
+ * With the `keep_recent_events` policy, the size of the events kept by a
+ * thread is estimated from the average size of the events it logged before,
+ * so it is counted in the same units as the budget. The threads share the
+ * budget of the repository for the events they keep, and the events that
+ * are logged when the repository is closed are trimmed to what still fits
+ * below twice the budget.
+ *
+ * The events of a thread must balance its acquisitions and releases for
+ * the repository to be analyzed. Hence, a thread enters the `degraded` mode
+ * only when it holds no locks, and so do the gaps left between the events
+ * kept with the `keep_recent_events` policy. Nothing else is logged after
+ * a thread was stopped, so it can be stopped at any time.
+ *
+ * @note The `acquire` and `release` methods must be called by the thread
+ *       generating the events, but the other methods can be called from
+ *       any thread.
+ */
+class LogBudget : boost::noncopyable {
+public:
+    //! What is logged for a thread.
+    enum mode {
+        //! Every event is logged.
+        logging,
+        //! What is logged is decided by the policy.
+        degraded,
+        //! Nothing is logged.
+        stopped
+    };
+
+private:
+    typedef std::vector<core::events::thread_specific> Chunk;
+
+    struct ThreadState : boost::noncopyable {
+        explicit ThreadState(ThreadId const& thread)
+            : thread(thread), held(0), countdown(1), generation(0),
+              events(0), degrade(false), current_mode(logging),
+              event_size(0), recent_size(0)
+        { }
+
+        ThreadId thread;
+
+        // Only accessed by the thread itself.
+        std::size_t held;
+        std::size_t countdown;
+        std::size_t generation;
+        // Number of acquisitions and releases logged by the thread since the
+        // repository changed.
+        std::size_t events;
+        bool degrade;
+
+        // Written by the thread itself with `mutex` held, so other threads
+        // can read it with `mutex` held.
+        mode current_mode;
+
+        // The most recent events of the thread, with the `keep_recent_events`
+        // policy. They are divided in chunks starting whenever the thread
+        // holds no locks, and only whole chunks are evicted. Their size is
+        // estimated in bytes, with the size of an event estimated when the
+        // thread enters the `degraded` mode.
+        detail::mutex mutex;
+        std::size_t event_size;
+        std::deque<Chunk> recent;
+        std::size_t recent_size;
+        // The last segment_hop that was evicted, which must precede the
+        // recent events when they are logged.
+        boost::optional<core::events::segment_hop> evicted_hop;
+    };
+
+    typedef boost::shared_ptr<ThreadState> ThreadStatePtr;
+
+    //! Number of events of a thread between two checks of its budget.
+    static std::size_t const check_interval = 64;
+
+    static std::size_t const unlimited = static_cast<std::size_t>(-1);
+
+    std::size_t volatile repository_limit_;
+    std::size_t volatile thread_limit_;
+    overflow_policy volatile policy_;
+
+    // Incremented whenever the repository changes, so that the threads go
+    // back to the `logging` mode.
+    std::size_t volatile generation_;
+
+    detail::mutex mutex_;
+    boost::unordered_map<ThreadId, ThreadStatePtr> threads_;
+    // Size of `threads_`, which can be read without `mutex_`.
+    std::size_t volatile thread_count_;
+    detail::thread_specific_ptr<ThreadStatePtr> own_state_;
+
+    std::size_t volatile dropped_events_;
+    std::size_t volatile dropped_call_stacks_;
+    std::size_t volatile folded_events_;
+
+    static void delete_own_state(ThreadStatePtr* state) { delete state; }
+
+    ThreadState& own_state(ThreadId const& thread) {
+        ThreadStatePtr* state = own_state_.get();
+        if (state && (*state)->thread == thread)
+            return **state;
+
+        ThreadStatePtr& shared = state_of(thread);
+        if (!state)
+            own_state_.reset(state = new ThreadStatePtr);
+        *state = shared;
+        return **state;
+    }
+
+    ThreadStatePtr& state_of(ThreadId const& thread) {
+        detail::scoped_lock<detail::mutex> lock(mutex_);
+        ThreadStatePtr& state = threads_[thread];
+        if (!state) {
+            state = boost::make_shared<ThreadState>(thread);
+            detail::store_relaxed(thread_count_, threads_.size());
+        }
+        return state;
+    }
+
+    // With the `stop_logging` policy, exhausting the budget stops the thread
+    // right away.
+    static mode degraded_mode(overflow_policy policy) {
+        return policy == stop_logging ? stopped : degraded;
+    }
+
+    static bool keeps_recent_events(overflow_policy policy) {
+        return policy == keep_recent_events;
+    }
+
+    // Only the policies that change the structure of the events of a thread
+    // must wait until it holds no locks.
+    static bool needs_quiescence(overflow_policy policy) {
+        return policy == keep_new_lock_orders ||
+               policy == keep_recent_events;
+    }
+
+    // Return the size in bytes of the recent events a thread may keep. The
+    // budget of the repository is split among the threads, so that all the
+    // events they keep fit between the budget and twice the budget.
+    std::size_t recent_capacity() const {
+        std::size_t const thread_limit = detail::load_relaxed(thread_limit_);
+        std::size_t const repository_limit =
+                                    detail::load_relaxed(repository_limit_);
+        std::size_t capacity = unlimited;
+        if (thread_limit)
+            capacity = thread_limit;
+        if (repository_limit) {
+            std::size_t const threads = detail::load_relaxed(thread_count_);
+            capacity = std::min(capacity, repository_limit /
+                                        std::max(threads, std::size_t(1)));
+        }
+        return capacity;
+    }
+
+    // Return the average size of the events logged by the thread of
+    // `state`, or the size of an event in memory if it logged none yet.
+    template <typename Dispatcher>
+    static std::size_t event_size_of(ThreadState const& state,
+                                     Dispatcher& dispatcher) {
+        std::size_t const bytes = dispatcher.bytes_written(state.thread);
+        if (state.events == 0 || bytes == 0)
+            return sizeof(core::events::thread_specific);
+        return std::max(bytes / state.events, std::size_t(1));
+    }
+
+    // Return the number of bytes that can still be logged for the thread of
+    // `state` before it reaches twice its budget, not counting the budget
+    // of the repository.
+    template <typename Dispatcher>
+    std::size_t thread_room(ThreadState const& state,
+                            Dispatcher& dispatcher) const {
+        std::size_t const limit = detail::load_relaxed(thread_limit_);
+        if (limit == 0)
+            return unlimited;
+        std::size_t const bytes = dispatcher.bytes_written(state.thread);
+        return bytes < 2 * limit ? 2 * limit - bytes : 0;
+    }
+
+    // Return the number of bytes that can still be logged to the repository
+    // before it reaches twice its budget.
+    template <typename Dispatcher>
+    std::size_t repository_room(Dispatcher& dispatcher) const {
+        std::size_t const limit = detail::load_relaxed(repository_limit_);
+        if (limit == 0)
+            return unlimited;
+        std::size_t const bytes = dispatcher.bytes_written();
+        return bytes < 2 * limit ? 2 * limit - bytes : 0;
+    }
+
+    template <typename Dispatcher>
+    void set_mode(ThreadState& state, mode new_mode, Dispatcher& dispatcher){
+        detail::scoped_lock<detail::mutex> lock(state.mutex);
+        if (state.current_mode == degraded && !state.recent.empty()) {
+            std::size_t room = repository_room(dispatcher);
+            log_recent_events(state, dispatcher, room);
+        }
+        if (new_mode == degraded && state.current_mode != degraded)
+            state.event_size = event_size_of(state, dispatcher);
+        state.current_mode = new_mode;
+    }
+
+    // Dispatch the events kept in the chunks with their actual type.
+    template <typename Dispatcher>
+    struct dispatch_event : boost::static_visitor<void> {
+        explicit dispatch_event(Dispatcher& dispatcher)
+            : dispatcher(dispatcher)
+        { }
+
+        template <typename Event>
+        void operator()(Event event) const {
+            dispatcher.dispatch(event);
+        }
+
+        Dispatcher& dispatcher;
+    };
+
+    /**
+     * Log the recent events of `state` that fit in the `room` left in the
+     * repository and in the room left for the thread, dropping the oldest
+     * chunks that don't, and decrease `room` by the size of what is logged.
+     *
+     * @pre The mutex of `state` is held.
+     */
+    template <typename Dispatcher>
+    void log_recent_events(ThreadState& state, Dispatcher& dispatcher,
+                           std::size_t& room) {
+        evict(state, std::min(room, thread_room(state, dispatcher)), true);
+        if (room != unlimited)
+            room -= std::min(room, state.recent_size);
+
+        if (state.evicted_hop) {
+            core::events::segment_hop hop = *state.evicted_hop;
+            dispatcher.dispatch(hop);
+        }
+        dispatch_event<Dispatcher> visitor(dispatcher);
+        BOOST_FOREACH(Chunk const& chunk, state.recent)
+            BOOST_FOREACH(core::events::thread_specific const& event, chunk)
+                boost::apply_visitor(visitor, event);
+        state.recent.clear();
+        state.recent_size = 0;
+        state.evicted_hop = boost::none;
+    }
+
+    // Check the budget of the thread every few events, and decide in which
+    // mode it must be.
+    template <typename Dispatcher>
+    void check(ThreadState& state, Dispatcher& dispatcher) {
+        if (state.generation != detail::load_relaxed(generation_)) {
+            if (state.held != 0)
+                return;
+            state.generation = detail::load_relaxed(generation_);
+            state.degrade = false;
+            state.countdown = 1;
+            state.events = 0;
+            set_mode(state, logging, dispatcher);
+        }
+
+        if (state.current_mode == stopped || --state.countdown != 0)
+            return;
+        state.countdown = check_interval;
+
+        std::size_t const repository_limit =
+                                    detail::load_relaxed(repository_limit_);
+        std::size_t const thread_limit = detail::load_relaxed(thread_limit_);
+        std::size_t const repository_bytes =
+                            repository_limit ? dispatcher.bytes_written() : 0;
+        std::size_t const thread_bytes =
+                thread_limit ? dispatcher.bytes_written(state.thread) : 0;
+
+        if ((repository_limit && repository_bytes >= 2 * repository_limit) ||
+                (thread_limit && thread_bytes >= 2 * thread_limit))
+            set_mode(state, stopped, dispatcher);
+        else if (state.current_mode == logging &&
+                    ((repository_limit && repository_bytes>=repository_limit)
+                     || (thread_limit && thread_bytes >= thread_limit)))
+            state.degrade = true;
+    }
+
+public:
+    LogBudget()
+        : repository_limit_(0), thread_limit_(0), policy_(stop_logging),
+          generation_(0), thread_count_(0), own_state_(&delete_own_state),
+          dropped_events_(0), dropped_call_stacks_(0), folded_events_(0)
+    { }
+
+    /**
+     * Set the budget of the repository and of each of its threads, in bytes.
+     * A budget of 0 is unlimited.
+     */
+    void set_limits(std::size_t repository_bytes, std::size_t thread_bytes) {
+        detail::store_relaxed(repository_limit_, repository_bytes);
+        detail::store_relaxed(thread_limit_, thread_bytes);
+    }
+
+    //! Set the policy applied once the budget is exhausted.
+    void set_policy(overflow_policy policy) {
+        detail::store_relaxed(policy_, policy);
+    }
+
+    overflow_policy policy() const {
+        return detail::load_relaxed(policy_);
+    }
+
+    //! Return whether there is a budget at all.
+    bool is_enabled() const {
+        return detail::load_relaxed(repository_limit_) != 0 ||
+               detail::load_relaxed(thread_limit_) != 0;
+    }
+
+    /**
+     * Record that the current thread, identified by `thread`, acquires a
+     * lock, and return in which mode the acquisition must be logged.
+     *
+     * `dispatcher` is used to query the number of bytes written to the
+     * repository, and to log the events kept by the thread when it leaves
+     * the `degraded` mode.
+     */
+    template <typename Dispatcher>
+    mode acquire(ThreadId const& thread, Dispatcher& dispatcher) {
+        ThreadState& state = own_state(thread);
+        check(state, dispatcher);
+        if (state.held++ == 0) {
+            if (state.degrade) {
+                state.degrade = false;
+                set_mode(state, degraded_mode(policy()), dispatcher);
+            }
+            if (state.current_mode == degraded &&
+                                        keeps_recent_events(policy())) {
+                detail::scoped_lock<detail::mutex> lock(state.mutex);
+                state.recent.push_back(Chunk());
+            }
+        }
+        else if (state.degrade && !needs_quiescence(policy())) {
+            state.degrade = false;
+            set_mode(state, degraded_mode(policy()), dispatcher);
+        }
+        if (state.current_mode == logging)
+            ++state.events;
+        return state.current_mode;
+    }
+
+    /**
+     * Record that the current thread, identified by `thread`, releases a
+     * lock, and return in which mode the release must be logged.
+     */
+    template <typename Dispatcher>
+    mode release(ThreadId const& thread, Dispatcher& dispatcher) {
+        ThreadState& state = own_state(thread);
+        check(state, dispatcher);
+        if (state.held != 0)
+            --state.held;
+        if (state.current_mode == logging)
+            ++state.events;
+        return state.current_mode;
+    }
+
+    /**
+     * Keep an event of a thread in the `degraded` mode with the
+     * `keep_recent_events` policy, evicting the oldest events if needed,
+     * drop it if the thread is `stopped`, or dispatch it to `dispatcher`
+     * otherwise.
+     *
+     * This can be called from any thread, e.g. to log a `segment_hop` on
+     * behalf of another thread.
+     */
+    template <typename Event, typename Dispatcher>
+    void keep(Event event, Dispatcher& dispatcher) {
+        ThreadStatePtr* own = own_state_.get();
+        if (own && (*own)->thread == thread_of(event)) {
+            keep(**own, event, dispatcher);
+            return;
+        }
+
+        ThreadStatePtr state;
+        {
+            detail::scoped_lock<detail::mutex> lock(mutex_);
+            boost::unordered_map<ThreadId, ThreadStatePtr>::const_iterator
+                                    it = threads_.find(thread_of(event));
+            if (it != threads_.end())
+                state = it->second;
+        }
+        if (state)
+            keep(*state, event, dispatcher);
+        else
+            dispatcher.dispatch(event);
+    }
+
+private:
+    template <typename Event, typename Dispatcher>
+    void keep(ThreadState& state, Event& event, Dispatcher& dispatcher) {
+        detail::scoped_lock<detail::mutex> lock(state.mutex);
+        if (state.current_mode == stopped) {
+            dropped_event();
+            return;
+        }
+        if (state.current_mode == degraded && keeps_recent_events(policy())) {
+            if (state.recent.empty())
+                state.recent.push_back(Chunk());
+            state.recent.back().push_back(event);
+            state.recent_size += state.event_size;
+            evict(state, recent_capacity(), false);
+            return;
+        }
+        dispatcher.dispatch(event);
+    }
+
+    /**
+     * Evict the oldest chunks of `state` until its recent events fit in
+     * `capacity` bytes. The chunk being filled is only evicted if
+     * `evict_last` is true.
+     *
+     * @pre The mutex of `state` is held.
+     */
+    void evict(ThreadState& state, std::size_t capacity, bool evict_last) {
+        std::size_t const kept = evict_last ? 0 : 1;
+        while (state.recent_size > capacity && state.recent.size() > kept) {
+            Chunk const& oldest = state.recent.front();
+            for (std::size_t i = oldest.size(); i > 0; --i) {
+                core::events::segment_hop const* hop =
+                        boost::get<core::events::segment_hop>(&oldest[i - 1]);
+                if (hop) {
+                    state.evicted_hop = *hop;
+                    break;
+                }
+            }
+            state.recent_size -= std::min(state.recent_size,
+                                          oldest.size() * state.event_size);
+            detail::fetch_add(dropped_events_, oldest.size());
+            state.recent.pop_front();
+        }
+    }
+
+public:
+    /**
+     * Log the events kept by all the threads to `dispatcher`, and make the
+     * threads go back to the `logging` mode once they hold no locks.
+     *
+     * This must be called before the repository is changed.
+     */
+    template <typename Dispatcher>
+    void flush(Dispatcher& dispatcher) {
+        std::vector<ThreadStatePtr> states;
+        {
+            detail::scoped_lock<detail::mutex> lock(mutex_);
+            detail::fetch_add(generation_, std::size_t(1));
+            typedef boost::unordered_map<ThreadId, ThreadStatePtr>::value_type
+                                                                    Entry;
+            BOOST_FOREACH(Entry const& entry, threads_)
+                states.push_back(entry.second);
+        }
+        // The events of the previous threads may not be written yet, so the
+        // room left in the repository is tracked here.
+        std::size_t room = repository_room(dispatcher);
+        BOOST_FOREACH(ThreadStatePtr const& state, states) {
+            detail::scoped_lock<detail::mutex> lock(state->mutex);
+            log_recent_events(*state, dispatcher, room);
+        }
+    }
+
+    //! Count an event that was not logged.
+    void dropped_event() {
+        detail::fetch_add(dropped_events_, std::size_t(1));
+    }
+
+    //! Count an acquisition that was logged without its call stack.
+    void dropped_call_stack() {
+        detail::fetch_add(dropped_call_stacks_, std::size_t(1));
+    }
+
+    //! Count an event that was folded in a lock-order edge.
+    void folded_event() {
+        detail::fetch_add(folded_events_, std::size_t(1));
+    }
+
+    //! Return the counters of what was not logged because of the budget.
+    log_statistics statistics() const {
+        log_statistics stats;
+        stats.dropped_events = detail::load_relaxed(dropped_events_);
+        stats.dropped_call_stacks =
+                                detail::load_relaxed(dropped_call_stacks_);
+        stats.folded_events = detail::load_relaxed(folded_events_);
+        return stats;
+    }
+};
+} // end namespace log_budget_detail
+
+namespace core {
+    using log_budget_detail::drop_call_stacks;
+    using log_budget_detail::keep_new_lock_orders;
+    using log_budget_detail::keep_recent_events;
+    using log_budget_detail::log_statistics;
+    using log_budget_detail::LogBudget;
+    using log_budget_detail::overflow_policy;
+    using log_budget_detail::parse_overflow_policy;
+    using log_budget_detail::stop_logging;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_LOG_BUDGET_HPP
@@ -0,0 +1,346 @@
+/**
+ * This file defines the `OnlineDetector` class.
+ */
+
+#ifndef D2_CORE_ONLINE_DETECTOR_HPP
+#define D2_CORE_ONLINE_DETECTOR_HPP
+
+#include <d2/core/diagnostic.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/atomic_ops.hpp>
+#include <d2/detail/call_stack_table.hpp>
+#include <d2/detail/mutex.hpp>
+#include <d2/detail/thread_specific_ptr.hpp>
+
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <set>
+#include <utility>
+#include <vector>
+
+
+namespace d2 {
+namespace online_detector_detail {
+/**
+ * Class detecting potential deadlocks while the analyzed program runs,
+ * instead of analyzing the events after the fact.
+ *
+ * The detector keeps the lock-order graph of the program in memory: there
+ * is an edge from `l1` to `l2` whenever a thread acquired `l2` while holding
+ * `l1`, labeled with the thread and the set of locks it was holding. When
+ * an acquisition adds a new edge to the graph, only the cycles going through
+ * that edge are searched, so the cost of the detection is proportional to
+ * the part of the graph reachable from the new edge, and only paid the first
+ * time each lock-order is seen.
+ *
+ * As in the post-mortem analysis, a cycle is a potential deadlock only if
+ * its edges were created by different threads holding disjoint sets of
+ * locks. However, the detector does not know about the segments of the
+ * threads, so it also reports the cycles whose edges can't happen
+ * concurrently because of a thread start or join.
+ *
+ * The locks held by each thread are kept in the thread-local storage of the
+ * thread notifying the detector, along with the contexts in which it already
+ * acquired locks, so the acquisitions that don't add any edge to the graph
+ * don't take any lock. The state of a thread goes away when it exits.
+ *
+ * Every potential deadlock is reported once to a callback, which is called
+ * without any lock held by the detector.
+ */
+class OnlineDetector : boost::noncopyable {
+public:
+    //! Type of the function called when a potential deadlock is found.
+    typedef void (*Callback)(core::potential_deadlock const&);
+
+private:
+    struct HeldLock {
+        HeldLock(LockId const& lock, detail::CallStackId info)
+            : lock(lock), info(info), recursion(1)
+        { }
+
+        LockId lock;
+        detail::CallStackId info;
+        std::size_t recursion;
+    };
+
+    typedef std::vector<HeldLock> HeldLocks;
+
+    // Lock acquired by a thread along with the locks it was holding, in
+    // their order of acquisition.
+    typedef std::pair<
+                LockId, core::deadlocked_thread::lock_sequence
+            > Context;
+
+    struct ThreadState {
+        HeldLocks held;
+        // Call stack of the first acquisition in each context seen by the
+        // thread. The edges of the later acquisitions in the same context
+        // are already in the graph.
+        boost::unordered_map<Context, detail::CallStackId> known;
+        // Reused to look up `known` without allocating.
+        Context context;
+    };
+
+    // Threads are identified by their `ThreadId`, which is not necessarily
+    // the same for all the events of an operating system thread.
+    typedef boost::unordered_map<ThreadId, ThreadState> ThreadStates;
+
+    struct Edge {
+        LockId from, to;
+        ThreadId thread;
+        // Locks held by the thread, in their order of acquisition, and the
+        // call stacks at which they were acquired.
+        core::deadlocked_thread::lock_sequence holding;
+        core::deadlocked_thread::lock_info_sequence holding_info;
+        detail::CallStackId to_info;
+
+        bool shares_locks_with(Edge const& other) const {
+            BOOST_FOREACH(LockId const& lock, holding)
+                if (std::find(other.holding.begin(), other.holding.end(),
+                              lock) != other.holding.end())
+                    return true;
+            return false;
+        }
+
+        core::deadlocked_thread to_deadlocked_thread() const {
+            core::deadlocked_thread thread(this->thread, holding, to);
+            thread.holding_info = holding_info;
+            thread.waiting_for_info = to_info;
+            return thread;
+        }
+    };
+
+    typedef std::vector<Edge> Edges;
+
+    Callback volatile callback_;
+
+    // The locks held by each thread are only seen by that thread, so the
+    // graph is only locked when an acquisition adds edges to it.
+    detail::thread_specific_ptr<ThreadStates> thread_states_;
+
+    detail::mutex mutex_;
+    boost::unordered_map<LockId, Edges> edges_from_;
+    std::set<core::potential_deadlock> reported_;
+
+    static void delete_thread_states(ThreadStates* states) {
+        delete states;
+    }
+
+    ThreadState& state_of(ThreadId const& thread) {
+        ThreadStates* states = thread_states_.get();
+        if (!states)
+            thread_states_.reset(states = new ThreadStates);
+        return (*states)[thread];
+    }
+
+    static HeldLock* find(HeldLocks& held, LockId const& lock) {
+        for (std::size_t i = held.size(); i > 0; --i)
+            if (held[i - 1].lock == lock)
+                return &held[i - 1];
+        return NULL;
+    }
+
+    // Return the context in which `state`'s thread acquires `lock`.
+    static Context const& context_of(ThreadState& state, LockId const& lock) {
+        state.context.first = lock;
+        state.context.second.clear();
+        BOOST_FOREACH(HeldLock const& h, state.held)
+            state.context.second.push_back(h.lock);
+        return state.context;
+    }
+
+    /**
+     * Find the paths from `from` back to the first lock of `cycle`, and
+     * append the potential deadlocks they form to `found`.
+     *
+     * @pre `mutex_` is locked.
+     */
+    void find_cycles(LockId const& from, std::vector<Edge const*>& cycle,
+                     std::vector<core::potential_deadlock>& found) {
+        LockId const& start = cycle.front()->from;
+        typedef boost::unordered_map<LockId, Edges>::const_iterator Iterator;
+        Iterator const edges = edges_from_.find(from);
+        if (edges == edges_from_.end())
+            return;
+
+        BOOST_FOREACH(Edge const& edge, edges->second) {
+            bool compatible = true;
+            BOOST_FOREACH(Edge const* other, cycle) {
+                if (other->thread == edge.thread ||
+                        other->shares_locks_with(edge)) {
+                    compatible = false;
+                    break;
+                }
+            }
+            if (!compatible)
+                continue;
+
+            cycle.push_back(&edge);
+            if (edge.to == start)
+                found.push_back(make_deadlock(cycle));
+            else
+                find_cycles(edge.to, cycle, found);
+            cycle.pop_back();
+        }
+    }
+
+    // Make a potential deadlock from a cycle, starting with its smallest
+    // thread so that the rotations of a cycle are reported only once.
+    static core::potential_deadlock
+    make_deadlock(std::vector<Edge const*> const& cycle) {
+        std::vector<core::deadlocked_thread> threads;
+        BOOST_FOREACH(Edge const* edge, cycle)
+            threads.push_back(edge->to_deadlocked_thread());
+        std::rotate(threads.begin(),
+                    std::min_element(threads.begin(), threads.end()),
+                    threads.end());
+        return core::potential_deadlock(threads);
+    }
+
+    /**
+     * Add an edge from every lock held in `state` to `lock`, and append the
+     * potential deadlocks closed by the new edges to `found`. Only the
+     * cycles going through the new edges are searched.
+     */
+    void add_edges(ThreadId const& thread, ThreadState const& state,
+                   LockId const& lock, detail::CallStackId info,
+                   std::vector<core::potential_deadlock>& found) {
+        Edge edge;
+        edge.to = lock;
+        edge.thread = thread;
+        BOOST_FOREACH(HeldLock const& h, state.held) {
+            edge.holding.push_back(h.lock);
+            edge.holding_info.push_back(h.info);
+        }
+        edge.to_info = info;
+
+        detail::scoped_lock<detail::mutex> guard(mutex_);
+        BOOST_FOREACH(HeldLock const& h, state.held) {
+            edge.from = h.lock;
+            Edges& edges = edges_from_[h.lock];
+            edges.push_back(edge);
+            std::vector<Edge const*> cycle(1, &edges.back());
+            find_cycles(lock, cycle, found);
+        }
+    }
+
+public:
+    OnlineDetector()
+        : callback_(NULL), thread_states_(&delete_thread_states)
+    { }
+
+    /**
+     * Set the function called when a potential deadlock is found, or
+     * disable the detection if `callback` is `NULL`.
+     */
+    void set_callback(Callback callback) {
+        detail::store_release(callback_, callback);
+    }
+
+    //! Return whether potential deadlocks are being detected.
+    bool is_enabled() const {
+        return detail::load_acquire(callback_) != NULL;
+    }
+
+    /**
+     * Return whether `thread` acquiring `lock` now is the first acquisition
+     * in its context, i.e. of `lock` along with the locks currently held by
+     * `thread`, in which case its call stack is needed to report the
+     * potential deadlocks it may create.
+     *
+     * Otherwise, `info` is set to the call stack of the first acquisition
+     * in the same context, if the lock is not already held.
+     *
+     * @note This must be called by the thread acquiring the lock.
+     */
+    bool is_new_context(ThreadId const& thread, LockId const& lock,
+                        detail::CallStackId& info) {
+        ThreadState& state = state_of(thread);
+        if (find(state.held, lock))
+            return false;
+        boost::unordered_map<Context, detail::CallStackId>::const_iterator
+                        const known = state.known.find(context_of(state, lock));
+        if (known == state.known.end())
+            return true;
+        info = known->second;
+        return false;
+    }
+
+    /**
+     * Record that `thread` acquired `lock` at the call stack identified by
+     * `info`, and report the potential deadlocks created by the
+     * acquisition.
+     *
+     * @note This must be called by the thread acquiring the lock.
+     */
+    void acquire(ThreadId const& thread, LockId const& lock,
+                 detail::CallStackId info) {
+        std::vector<core::potential_deadlock> found;
+        ThreadState& state = state_of(thread);
+        if (!find(state.held, lock)) {
+            bool const is_new = state.known.insert(
+                        std::make_pair(context_of(state, lock), info)).second;
+            if (is_new && !state.held.empty())
+                add_edges(thread, state, lock, info, found);
+        }
+        state.held.push_back(HeldLock(lock, info));
+        report(found);
+    }
+
+    /**
+     * Record that `thread` acquired `lock` recursively at the call stack
+     * identified by `info`. Only the first acquisition of a lock that is
+     * already held can create a potential deadlock.
+     *
+     * @note This must be called by the thread acquiring the lock.
+     */
+    void recursive_acquire(ThreadId const& thread, LockId const& lock,
+                           detail::CallStackId info) {
+        HeldLock* held = find(state_of(thread).held, lock);
+        if (held)
+            ++held->recursion;
+        else
+            acquire(thread, lock, info);
+    }
+
+    /**
+     * Record that `thread` released `lock`, recursively or not.
+     *
+     * @note This must be called by the thread releasing the lock.
+     */
+    void release(ThreadId const& thread, LockId const& lock) {
+        HeldLocks& held = state_of(thread).held;
+        HeldLock* h = find(held, lock);
+        if (h && --h->recursion == 0)
+            held.erase(held.begin() + (h - &held[0]));
+    }
+
+private:
+    void report(std::vector<core::potential_deadlock> const& found) {
+        if (found.empty())
+            return;
+        Callback const callback = detail::load_acquire(callback_);
+        BOOST_FOREACH(core::potential_deadlock const& deadlock, found) {
+            bool is_new;
+            {
+                detail::scoped_lock<detail::mutex> guard(mutex_);
+                is_new = reported_.insert(deadlock).second;
+            }
+            if (is_new && callback)
+                callback(deadlock);
+        }
+    }
+};
+} // end namespace online_detector_detail
+
+namespace core {
+    using online_detector_detail::OnlineDetector;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_ONLINE_DETECTOR_HPP
@@ -7,10 +7,12 @@
 #define D2_CORE_RAW_API_HPP
 
 #include <d2/core/framework_fwd.hpp>
+#include <d2/detail/atomic_ops.hpp>
 #include <d2/detail/decl.hpp>
 
 #include <boost/config.hpp>
 #include <cstddef>
+#include <iosfwd>
 #include <string>
 
 
@@ -18,6 +20,27 @@ namespace d2 {
 namespace core {
 namespace raw_api_detail {
     D2_DECL extern framework& get_framework();
+
+    /**
+     * Pointer to the framework while event logging is enabled, and `NULL`
+     * otherwise.
+     *
+     * The functions generating events check it inline before doing
+     * anything else, so they cost a single load when event logging is
+     * disabled. The load has acquire semantics, pairing with the release
+     * store of `framework::enable()`, so the framework is seen fully built
+     * by the threads dereferencing the pointer; this is a plain load on
+     * x86.
+     *
+     * @note The framework is created when the library is loaded, so events
+     *       generated before, e.g. by the static initializers of other
+     *       libraries, are ignored.
+     */
+    D2_DECL extern framework* volatile enabled_framework;
+
+    inline framework* get_enabled_framework() BOOST_NOEXCEPT {
+        return detail::load_acquire(enabled_framework);
+    }
 }
 
 /**
@@ -51,6 +74,240 @@ inline void unset_log_repository() BOOST_NOEXCEPT {
     raw_api_detail::get_framework().unset_repository();
 }
 
+/**
+ * Set the format in which events are written to the repositories set from
+ * now on. The `format` must be either:
+ *  - `"text"`, which is the default.
+ *  - `"binary"`, which is a much more compact format that is also much
+ *    faster to write and to read.
+ * Repositories in both formats can be analyzed the same way.
+ *
+ * The format can also be set with the `D2_REPOSITORY_FORMAT` environment
+ * variable.
+ *
+ * @return 0 if the operation succeeded, and a non zero value otherwise.
+ * @note The format of the current repository, if any, is not changed.
+ */
+inline int set_log_format(char const* format) BOOST_NOEXCEPT {
+    return raw_api_detail::get_framework().set_repository_format(format);
+}
+
+/**
+ * Set whether the files of the repositories set from now on are written
+ * through memory mappings, which is disabled by default.
+ *
+ * Writing an event to a memory mapped file only copies it to memory, and
+ * the operating system takes care of writing it to the disk. Everything
+ * written to the file reaches the disk even if the program crashes, which
+ * makes it possible to analyze the runs that crashed. Events still buffered
+ * in memory by `set_thread_buffer_size()` or `set_async_queue_depth()` are
+ * lost in that case, though.
+ *
+ * Memory mapped files can also be enabled by setting the `D2_MAPPED_FILES`
+ * environment variable to anything but `0`.
+ */
+inline void set_mapped_files(bool enabled) BOOST_NOEXCEPT {
+    raw_api_detail::get_framework().set_mapped_files(enabled);
+}
+
+/**
+ * Set whether the files of the repositories set from now on are compressed,
+ * which is disabled by default.
+ *
+ * Compressed files are made of independent blocks of events compressed with
+ * zlib, which are decompressed in parallel when the repository is analyzed.
+ * The events are compressed one block at a time, so the events of the last
+ * block of each file are lost if the program crashes, even if memory mapped
+ * files are used.
+ *
+ * Compressed files can also be enabled by setting the `D2_COMPRESSED_FILES`
+ * environment variable to anything but `0`.
+ */
+inline void set_compressed_files(bool enabled) BOOST_NOEXCEPT {
+    raw_api_detail::get_framework().set_compressed_files(enabled);
+}
+
+/**
+ * Set the maximum number of bytes of events written to a repository, and to
+ * the file of each thread of a repository. A budget of 0, which is the
+ * default, is unlimited.
+ *
+ * Once a budget is exhausted, the threads it applies to only log what the
+ * policy set by `set_overflow_policy()` allows, and they stop logging
+ * altogether once twice the budget is used. The sizes are those of the
+ * events before compression, and they are only checked every few events.
+ *
+ * The budgets can also be set with the `D2_REPOSITORY_BUDGET` and the
+ * `D2_THREAD_BUDGET` environment variables.
+ */
+inline void set_log_budget(std::size_t repository_bytes,
+                           std::size_t thread_bytes) BOOST_NOEXCEPT {
+    raw_api_detail::get_framework().set_log_budget(repository_bytes,
+                                                   thread_bytes);
+}
+
+/**
+ * Set what is logged once the budget set by `set_log_budget()` is
+ * exhausted. The valid policies are:
+ *  - `"stop"`: Nothing is logged anymore. This is the default.
+ *  - `"drop_call_stacks"`: The call stacks of the acquisitions are not
+ *    captured anymore.
+ *  - `"lock_orders"`: Only the edges of the lock graph that were never seen
+ *    are logged, as with `set_lock_order_records()`.
+ *  - `"recent_events"`: The most recent events of each thread are kept in
+ *    memory, within its budget, and they are only written when the
+ *    repository is closed.
+ *
+ * The policy can also be set with the `D2_OVERFLOW_POLICY` environment
+ * variable.
+ *
+ * @return 0 if the policy is valid, and anything else otherwise.
+ */
+inline int set_overflow_policy(char const* policy) BOOST_NOEXCEPT {
+    return raw_api_detail::get_framework().set_overflow_policy(policy);
+}
+
+/**
+ * Return the number of events that were not logged because of the budget
+ * set by `set_log_budget()`, since the program started.
+ */
+inline log_statistics get_log_statistics() BOOST_NOEXCEPT {
+    return raw_api_detail::get_framework().get_log_statistics();
+}
+
+/**
+ * Set the number of events each thread buffers before writing them to the
+ * repository. Buffered events are written without taking any lock shared
+ * with other threads, which reduces contention when many threads generate
+ * events. A `size` of 0, which is the default, disables buffering.
+ *
+ * The size can also be set with the `D2_THREAD_BUFFER_SIZE` environment
+ * variable.
+ *
+ * @note Buffered events are always written to the repository when the
+ *       buffer is full, when its thread exits and before the repository
+ *       is changed or unset.
+ */
+inline void set_thread_buffer_size(std::size_t size) BOOST_NOEXCEPT {
+    raw_api_detail::get_framework().set_thread_buffer_size(size);
+}
+
+/**
+ * Set the number of batches of events that can wait to be written to the
+ * repository by a dedicated writer thread. The threads generating events
+ * only copy them to memory, and the serialization and the writing of the
+ * events happen in the writer thread, so that slow disks don't slow down
+ * the program. When `depth` batches are already waiting, the threads
+ * generating events wait for the writer thread to catch up. A `depth` of
+ * 0, which is the default, disables the writer thread.
+ *
+ * With a writer thread, the events of each thread are always buffered as
+ * with `set_thread_buffer_size()`, in buffers of the size of a batch if no
+ * size was set, and each buffer is handed to the writer thread at once.
+ *
+ * The depth can also be set with the `D2_ASYNC_QUEUE_DEPTH` environment
+ * variable.
+ *
+ * @note All the events are written before the repository is changed or
+ *       unset, and before the program exits normally.
+ */
+inline void set_async_queue_depth(std::size_t depth) BOOST_NOEXCEPT {
+    raw_api_detail::get_framework().set_async_queue_depth(depth);
+}
+
+/**
+ * Set whether the call stacks of the acquisitions are resolved to function
+ * and module names when they are recorded, which is the default, or only
+ * when they are needed by `d2tool` to explain a potential deadlock.
+ *
+ * Resolving a call stack is by far the most expensive part of recording an
+ * acquisition at a new call site, so deferring it reduces the overhead of
+ * the library, especially in programs with many distinct call sites.
+ *
+ * Deferred symbolization can also be enabled by setting the
+ * `D2_DEFERRED_SYMBOLIZATION` environment variable to anything but `0`.
+ */
+inline void set_deferred_symbolization(bool enabled) BOOST_NOEXCEPT {
+    raw_api_detail::get_framework().set_deferred_symbolization(enabled);
+}
+
+/**
+ * Set the number of call stacks captured for each lock-order pair, i.e. for
+ * each set of locks held by a thread along with the lock it acquires. The
+ * acquisitions of a lock-order pair that was already captured `samples`
+ * times are recorded without a call stack, which saves the cost of walking
+ * the stack of the thread. A `samples` of 0 captures no call stack at all.
+ * By default, every call stack is captured.
+ *
+ * This does not change the potential deadlocks `d2tool` can find, but only
+ * the call stacks it can show for them. It should be set before any lock is
+ * acquired.
+ *
+ * The number of call stacks can also be set with the `D2_CALL_STACK_SAMPLES`
+ * environment variable.
+ */
+inline void set_call_stack_samples(std::size_t samples) BOOST_NOEXCEPT {
+    raw_api_detail::get_framework().set_call_stack_samples(samples);
+}
+
+/**
+ * Set whether the edges of the lock graph are recorded instead of the
+ * acquisitions and releases of the locks.
+ *
+ * The locks held by each thread are then tracked by the library, and each
+ * distinct edge of the lock graph, i.e. each distinct lock-order along with
+ * the thread, the locks held and the segments involved, is written to the
+ * repository only the first time it is seen. Since most acquisitions are the
+ * same nested acquisitions repeated in loops, this makes the repository much
+ * smaller and faster to analyze, and `d2tool` finds the same potential
+ * deadlocks. The number of occurrences of each edge is written when the
+ * repository is closed.
+ *
+ * This should be set before any lock is acquired. It can also be enabled by
+ * setting the `D2_LOCK_ORDER_RECORDS` environment variable to anything but
+ * `0`.
+ */
+inline void set_lock_order_records(bool enabled) BOOST_NOEXCEPT {
+    raw_api_detail::get_framework().set_lock_order_records(enabled);
+}
+
+/**
+ * Detect potential deadlocks while the program runs, and report each of them
+ * to `callback` as soon as the acquisition creating it happens. Passing
+ * `NULL` disables the detection.
+ *
+ * The detection happens in memory, so it does not need a repository: it
+ * works as soon as event logging is enabled, whether or not the events are
+ * also written to a repository. Unlike `d2tool`, it does not take the thread
+ * starts and joins into account, so it may report potential deadlocks that
+ * can't happen because of them. Without a repository, only the call stack
+ * of the first acquisition of each lock along with the same held locks is
+ * captured by each thread, and the reports refer to it; the call stacks can
+ * be printed with `explain_potential_deadlock()`.
+ *
+ * Setting the `D2_ONLINE_DETECTION` environment variable to anything but `0`
+ * enables event logging and the detection, with a callback printing the
+ * potential deadlocks to the standard error.
+ *
+ * @note The callback may be called from any thread that acquires a lock.
+ */
+inline void set_deadlock_callback(void (*callback)(potential_deadlock const&)) BOOST_NOEXCEPT {
+    raw_api_detail::get_framework().set_deadlock_callback(callback);
+}
+
+/**
+ * Write an explanation of a potential deadlock reported to the callback set
+ * with `set_deadlock_callback()` to an output stream, with the call stacks
+ * its threads refer to.
+ *
+ * The call stacks of the reported potential deadlocks are identified by
+ * `detail::CallStackId`s, which are only meaningful to the library; this
+ * resolves them to function and module names.
+ */
+inline void explain_potential_deadlock(std::ostream& os, potential_deadlock const& deadlock) {
+    raw_api_detail::get_framework().explain_deadlock(os, deadlock);
+}
+
 /**
  * Disable the logging of events by the library.
  *
@@ -75,12 +332,12 @@ inline void enable_event_logging() BOOST_NOEXCEPT {
 
 //! Return whether the logging is currently enabled.
 inline bool is_enabled() BOOST_NOEXCEPT {
-    return raw_api_detail::get_framework().is_enabled();
+    return raw_api_detail::get_enabled_framework() != NULL;
 }
 
 //! Effectively returns `!is_enabled()`.
 inline bool is_disabled() BOOST_NOEXCEPT {
-    return raw_api_detail::get_framework().is_disabled();
+    return !is_enabled();
 }
 
 /**
@@ -89,7 +346,8 @@ inline bool is_disabled() BOOST_NOEXCEPT {
  * `thread_id`.
  */
 inline void notify_acquire(std::size_t thread, std::size_t lock) BOOST_NOEXCEPT {
-    raw_api_detail::get_framework().notify_acquire(thread, lock);
+    if (framework* enabled = raw_api_detail::get_enabled_framework())
+        enabled->notify_acquire(thread, lock);
 }
 
 /**
@@ -98,7 +356,8 @@ inline void notify_acquire(std::size_t thread, std::size_t lock) BOOST_NOEXCEPT
  * times by the same thread.
  */
 inline void notify_recursive_acquire(std::size_t thread, std::size_t lock) BOOST_NOEXCEPT {
-    raw_api_detail::get_framework().notify_recursive_acquire(thread, lock);
+    if (framework* enabled = raw_api_detail::get_enabled_framework())
+        enabled->notify_recursive_acquire(thread, lock);
 }
 
 /**
@@ -106,7 +365,8 @@ inline void notify_recursive_acquire(std::size_t thread, std::size_t lock) BOOST
  * unique identifier `lock` by the thread with the unique identifier `thread`.
  */
 inline void notify_release(std::size_t thread, std::size_t lock) BOOST_NOEXCEPT {
-    raw_api_detail::get_framework().notify_release(thread, lock);
+    if (framework* enabled = raw_api_detail::get_enabled_framework())
+        enabled->notify_release(thread, lock);
 }
 
 /**
@@ -115,7 +375,8 @@ inline void notify_release(std::size_t thread, std::size_t lock) BOOST_NOEXCEPT
  * times by the same thread.
  */
 inline void notify_recursive_release(std::size_t thread, std::size_t lock) BOOST_NOEXCEPT {
-    raw_api_detail::get_framework().notify_recursive_release(thread, lock);
+    if (framework* enabled = raw_api_detail::get_enabled_framework())
+        enabled->notify_recursive_release(thread, lock);
 }
 
 /**
@@ -123,7 +384,8 @@ inline void notify_recursive_release(std::size_t thread, std::size_t lock) BOOST
  * `child` created by a thread uniquely identified by `parent`.
  */
 inline void notify_start(std::size_t parent, std::size_t child) BOOST_NOEXCEPT {
-    raw_api_detail::get_framework().notify_start(parent, child);
+    if (framework* enabled = raw_api_detail::get_enabled_framework())
+        enabled->notify_start(parent, child);
 }
 
 /**
@@ -131,7 +393,8 @@ inline void notify_start(std::size_t parent, std::size_t child) BOOST_NOEXCEPT {
  * `child` into a thread uniquely identified by `parent`.
  */
 inline void notify_join(std::size_t parent, std::size_t child) BOOST_NOEXCEPT {
-    raw_api_detail::get_framework().notify_join(parent, child);
+    if (framework* enabled = raw_api_detail::get_enabled_framework())
+        enabled->notify_join(parent, child);
 }
 } // end namespace core
 } // end namespace d2
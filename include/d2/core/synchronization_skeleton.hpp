@@ -6,26 +6,46 @@
 #define D2_CORE_SYNCHRONIZATION_SKELETON_HPP
 
 #include <d2/core/diagnostic.hpp>
+#include <d2/core/event_stream.hpp>
 #include <d2/core/filesystem.hpp>
+#include <d2/core/happens_before_index.hpp>
 #include <d2/core/lock_graph.hpp>
 #include <d2/core/segmentation_graph.hpp>
+#include <d2/core/vector_clock_index.hpp>
+#include <d2/detail/call_stack_table.hpp>
 #include <d2/detail/decl.hpp>
+#include <d2/detail/module_map.hpp>
 
-#include <boost/archive/text_iarchive.hpp>
-#include <boost/foreach.hpp>
 #include <boost/function.hpp>
 #include <boost/move/utility.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/range/distance.hpp>
 #include <cstddef>
-#include <dyno/serializing_stream.hpp>
-#include <fstream>
 #include <ios>
+#include <istream>
 #include <vector>
 
 
 namespace d2 {
 namespace synchronization_skeleton_detail {
+/**
+ * Ways of ordering the segments of a program when looking for potential
+ * deadlocks. Both give the same `happens_before` relation.
+ */
+enum segment_ordering {
+    //! The segmentation graph is built, and its transitive closure is
+    //! indexed with `d2::core::HappensBeforeIndex`. This takes quadratic
+    //! memory in the number of segments, up to a bound above which the
+    //! graph is searched on each query instead.
+    segmentation_graph_ordering,
+
+    //! The segments are stamped with vector clocks by
+    //! `d2::core::VectorClockIndex`, without building the segmentation
+    //! graph. This takes memory in the number of segments times the
+    //! number of threads they depend on.
+    vector_clock_ordering
+};
+
 /**
  * Class representing a program stripped from all information unrelated to
  * synchronization.
@@ -35,41 +55,110 @@ class synchronization_skeleton : boost::noncopyable {
                 void (core::potential_deadlock const&)
             > DeadlockVisitor;
 
-    typedef dyno::serializing_stream<
-                std::ifstream, boost::archive::text_iarchive
-            > Stream;
+    // Note: The format of every file is detected when it is opened, so
+    //       repositories in any `core::event_format` can be analyzed.
+    typedef core::event_ifstream Stream;
 
     typedef core::filesystem<Stream> Filesystem;
 
     D2_DECL void build_segmentation_graph(Stream&);
-    D2_DECL void feed_lock_graph(Stream&);
+    D2_DECL void build_vector_clocks(Stream&);
+    D2_DECL static void feed_lock_graph(Stream&, core::LockGraph&);
+    D2_DECL void build_graphs(std::size_t jobs, std::size_t read_ahead);
     D2_DECL void deadlocks_impl(DeadlockVisitor const&) const;
 
     Filesystem fs_;
     core::SegmentationGraph sg_;
+    // Note: This is built once the segmentation graph is complete.
+    core::HappensBeforeIndex happens_before_;
+    // Note: This is built instead of the two above with
+    //       `vector_clock_ordering`.
+    core::VectorClockIndex clocks_;
+    segment_ordering ordering_;
     core::LockGraph lg_;
+    // Gatelock sets shared by the edges of `lg_`.
+    core::GatelockTable gatelocks_;
+    // Number of threads used to load the repository and to analyze it.
+    std::size_t jobs_;
+    detail::CallStackTable call_stacks_;
+    detail::ModuleMap modules_;
 
 public:
+    //! Value of the read-ahead chosen from the number of jobs.
+    static std::size_t const automatic_read_ahead = 0;
+
     /**
      * Create a `synchronization_skeleton` from the events located on the
      * filesystem rooted at `root`.
      *
+     * The files of the threads are parsed by up to `jobs` threads, while
+     * the segmentation graph is built by the calling thread. Whatever the
+     * number of jobs, the resulting graphs are the same. The same number of
+     * threads is used by the analysis of the skeleton.
+     *
+     * The segments are ordered as specified by `ordering`. With
+     * `vector_clock_ordering`, the segmentation graph is not built, so it
+     * is printed empty by `print_segmentation_graph`.
+     *
+     * Up to `read_ahead` blocks of each compressed file are decompressed
+     * in parallel. With the default of `automatic_read_ahead`, the jobs are
+     * split among the files parsed at the same time, so that the blocks are
+     * decompressed by the thread parsing their file when there are at least
+     * as many files as jobs.
+     *
      * @warning This may be a resource intensive operation since we have
      *          to build two potentially large graphs.
      *
      * @see `d2::core::filesystem`
      */
     template <typename Path>
-    explicit synchronization_skeleton(BOOST_FWD_REF(Path) root)
-        : fs_(boost::forward<Path>(root), std::ios::in)
+    explicit synchronization_skeleton(BOOST_FWD_REF(Path) root,
+                                      std::size_t jobs = 1,
+                                      segment_ordering ordering =
+                                                segmentation_graph_ordering,
+                                      std::size_t read_ahead =
+                                                automatic_read_ahead)
+        : fs_(boost::forward<Path>(root), std::ios::in), ordering_(ordering),
+          jobs_(jobs)
     {
-        // The start_join file could be absent if we were analyzing a single
-        // thread. See `d2::core::filesystem::start_join_file()` for info.
-        if (fs_.start_join_file())
-            build_segmentation_graph(*fs_.start_join_file());
+        build_graphs(jobs, read_ahead);
+
+        if (fs_.call_stacks_file()) {
+            std::istream& call_stacks = *fs_.call_stacks_file();
+            call_stacks >> call_stacks_;
+        }
 
-        BOOST_FOREACH(Filesystem::file_entry thread, fs_.thread_files())
-            feed_lock_graph(thread.stream());
+        if (fs_.module_map_file()) {
+            std::istream& module_map = *fs_.module_map_file();
+            module_map >> modules_;
+        }
+    }
+
+    /**
+     * Return the table of the call stacks referenced by the lock graph and
+     * by the potential deadlocks detected in the skeleton.
+     */
+    detail::CallStackTable const& call_stacks() const {
+        return call_stacks_;
+    }
+
+    /**
+     * Overload returning the table of the call stacks for modification,
+     * which is useful to resolve call stacks recorded with deferred
+     * symbolization.
+     */
+    detail::CallStackTable& call_stacks() {
+        return call_stacks_;
+    }
+
+    /**
+     * Return the map of the modules of the program captured by the
+     * skeleton, which is empty if it was not recorded.
+     *
+     * @see `d2::detail::LockDebugInfo::init_raw_call_stack`
+     */
+    detail::ModuleMap const& module_map() const {
+        return modules_;
     }
 
     /**
@@ -99,6 +188,9 @@ public:
      * The analysis tries to minimize false positives, i.e. to yield fiew
      * deadlock states that are unreachable by the program.
      *
+     * The visitor is always called by the calling thread, in the same order
+     * whatever the number of jobs the skeleton was created with.
+     *
      * @warning This operation can be time-consuming if the graphs happen
      *          to be very large.
      */
@@ -127,7 +219,10 @@ public:
 } // end namespace synchronization_skeleton_detail
 
 namespace core {
+    using synchronization_skeleton_detail::segment_ordering;
+    using synchronization_skeleton_detail::segmentation_graph_ordering;
     using synchronization_skeleton_detail::synchronization_skeleton;
+    using synchronization_skeleton_detail::vector_clock_ordering;
 }
 } // end namespace d2
 
@@ -0,0 +1,162 @@
+/**
+ * This file defines the `ThreadSegments` class.
+ */
+
+#ifndef D2_CORE_THREAD_SEGMENTS_HPP
+#define D2_CORE_THREAD_SEGMENTS_HPP
+
+#include <d2/core/segment.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/atomic_ops.hpp>
+#include <d2/detail/mutex.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+
+namespace d2 {
+namespace thread_segments_detail {
+/**
+ * Class keeping track of the segment in which each thread of the analyzed
+ * program currently is.
+ *
+ * Segments are allocated from an atomic counter, and the segments of the
+ * threads are spread over shards that are locked independently. Hence,
+ * starting or joining a thread only synchronizes with the operations
+ * involving one of the two threads at hand, or a thread sharing a shard
+ * with one of them.
+ */
+class ThreadSegments : boost::noncopyable {
+    struct Shard {
+        detail::mutex mutex;
+        boost::unordered_map<ThreadId, Segment> segment_of;
+    };
+
+    static std::size_t const shard_count = 64;
+    Shard shards_[shard_count];
+
+    // Value of the last segment that was allocated. The initial segment
+    // is never allocated, since it is the segment of the main thread.
+    std::size_t volatile last_segment_;
+
+    // Whether a thread was ever started. It is only used to check the
+    // preconditions of `start`.
+    bool volatile started_;
+
+    Shard& shard_of(ThreadId const& thread) {
+        return shards_[hash_value(thread) % shard_count];
+    }
+
+    Segment allocate_segments(std::size_t count) {
+        return Segment() + (detail::fetch_add(last_segment_, count) + 1);
+    }
+
+    // Locks the shards of two threads, always in the same order to avoid
+    // deadlocks.
+    class scoped_pair_lock : boost::noncopyable {
+        detail::mutex* first_;
+        detail::mutex* second_;
+
+    public:
+        scoped_pair_lock(Shard& a, Shard& b)
+            : first_(&a.mutex), second_(&a == &b ? NULL : &b.mutex)
+        {
+            if (second_ && std::less<detail::mutex*>()(second_, first_))
+                std::swap(first_, second_);
+            first_->lock();
+            if (second_)
+                second_->lock();
+        }
+
+        ~scoped_pair_lock() {
+            if (second_)
+                second_->unlock();
+            first_->unlock();
+        }
+    };
+
+public:
+    ThreadSegments()
+        : last_segment_(0), started_(false)
+    { }
+
+    /**
+     * Record that `parent` started `child`, and return the segment of
+     * `parent` before the start, its segment after the start and the
+     * segment of `child`.
+     *
+     * A parent that was never started is assumed to be the main thread,
+     * which is in the initial segment.
+     */
+    void start(ThreadId const& parent, ThreadId const& child,
+               Segment& parent_segment, Segment& new_parent_segment,
+               Segment& child_segment) {
+        BOOST_ASSERT_MSG(parent != child, "thread starting itself");
+        Shard& parent_shard = shard_of(parent);
+        Shard& child_shard = shard_of(child);
+        scoped_pair_lock lock(parent_shard, child_shard);
+        BOOST_ASSERT_MSG(!detail::load_relaxed(started_) ||
+                         parent_shard.segment_of.count(parent),
+    "starting a thread from another thread that has not been created yet");
+        detail::store_relaxed(started_, true);
+
+        // Segments are allocated with the lock of the parent held, so that
+        // the successive segments of a thread are increasing.
+        new_parent_segment = allocate_segments(2);
+        child_segment = new_parent_segment + 1;
+        Segment& segment_of_parent = parent_shard.segment_of[parent];
+        parent_segment = segment_of_parent;
+        segment_of_parent = new_parent_segment;
+        child_shard.segment_of[child] = child_segment;
+    }
+
+    /**
+     * Return the segment in which `thread` currently is. A thread that was
+     * never started is assumed to be the main thread, which is in the
+     * initial segment until it starts another thread.
+     */
+    Segment segment_of(ThreadId const& thread) {
+        Shard& shard = shard_of(thread);
+        detail::scoped_lock<detail::mutex> lock(shard.mutex);
+        boost::unordered_map<ThreadId, Segment>::const_iterator const it =
+                                            shard.segment_of.find(thread);
+        return it == shard.segment_of.end() ? Segment() : it->second;
+    }
+
+    /**
+     * Record that `parent` joined `child`, and return the segment of
+     * `parent` before the join, its segment after the join and the
+     * segment of `child`.
+     */
+    void join(ThreadId const& parent, ThreadId const& child,
+              Segment& parent_segment, Segment& new_parent_segment,
+              Segment& child_segment) {
+        BOOST_ASSERT_MSG(parent != child, "thread joining itself");
+        Shard& parent_shard = shard_of(parent);
+        Shard& child_shard = shard_of(child);
+        scoped_pair_lock lock(parent_shard, child_shard);
+        BOOST_ASSERT_MSG(parent_shard.segment_of.count(parent),
+    "joining a thread into another thread that has not been created yet");
+        BOOST_ASSERT_MSG(child_shard.segment_of.count(child),
+                        "joining a thread that has not been created yet");
+
+        new_parent_segment = allocate_segments(1);
+        Segment& segment_of_parent = parent_shard.segment_of[parent];
+        parent_segment = segment_of_parent;
+        segment_of_parent = new_parent_segment;
+        child_segment = child_shard.segment_of[child];
+        child_shard.segment_of.erase(child);
+    }
+};
+} // end namespace thread_segments_detail
+
+namespace core {
+    using thread_segments_detail::ThreadSegments;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_THREAD_SEGMENTS_HPP
@@ -0,0 +1,263 @@
+/**
+ * This file defines the `VectorClockIndex` class.
+ */
+
+#ifndef D2_CORE_VECTOR_CLOCK_INDEX_HPP
+#define D2_CORE_VECTOR_CLOCK_INDEX_HPP
+
+#include <d2/core/events.hpp>
+#include <d2/core/segment.hpp>
+
+#include <algorithm>
+#include <boost/unordered_map.hpp>
+#include <boost/variant/apply_visitor.hpp>
+#include <boost/variant/static_visitor.hpp>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+
+namespace d2 {
+namespace vector_clock_index_detail {
+/**
+ * Index of the `happens_before` relation of the segments of a program,
+ * computed from its `start` and `join` events without building its
+ * segmentation graph.
+ *
+ * Each segment is stamped with a vector clock holding, for each thread,
+ * the number of segments of that thread that happen before it or are it.
+ * A segment `u` of the thread `t` then happens before a segment `v` if and
+ * only if they differ and the clock of `v` has at least the value of the
+ * clock of `u` for `t`, which is answered in logarithmic time in the
+ * number of threads that happen before `v`.
+ *
+ * A thread is identified by its first segment. The clocks are sparse, i.e.
+ * they only hold the threads that happen before their segment, and they
+ * are stored one after the other in a single array.
+ *
+ * Building the index takes `O(E log E)` time for sorting the `E` events,
+ * plus the size of the clocks, instead of the `O(S^2)` memory needed to
+ * index the transitive closure of a segmentation graph with `S` segments.
+ */
+class VectorClockIndex {
+    // A thread and the number of its segments up to some segment.
+    typedef std::pair<std::size_t, std::size_t> Component;
+
+    // Position of each segment.
+    boost::unordered_map<Segment, std::size_t> positions_;
+
+    // Thread of the segment at each position, along with the value of the
+    // clock of the segment for that thread.
+    std::vector<Component> stamps_;
+
+    // The clock of the segment at position `p` is made of the components
+    // `offsets_[p]` up to `offsets_[p + 1]`, sorted by thread.
+    std::vector<std::size_t> offsets_;
+    std::vector<Component> components_;
+
+    // Number of threads seen so far.
+    std::size_t threads_;
+
+    struct Event {
+        Segment parent, new_parent, child;
+        bool is_join;
+
+        friend bool operator<(Event const& a, Event const& b) {
+            return a.new_parent < b.new_parent;
+        }
+    };
+
+    struct record_events : boost::static_visitor<void> {
+        explicit record_events(std::vector<Event>& events)
+            : events_(&events)
+        { }
+
+        void operator()(core::events::start const& event) const {
+            record(event, false);
+        }
+
+        void operator()(core::events::join const& event) const {
+            record(event, true);
+        }
+
+        template <typename Other>
+        void operator()(Other const&) const { }
+
+    private:
+        std::vector<Event>* events_;
+
+        void record(core::events::start const& event, bool is_join) const {
+            Event const e = {parent_of(event), new_parent_of(event),
+                             child_of(event), is_join};
+            events_->push_back(e);
+        }
+    };
+
+    // Give the clock in `clock` to `segment`, which belongs to `thread`,
+    // unless `segment` already has one.
+    void stamp(Segment const& segment, std::size_t thread,
+               std::vector<Component> const& clock) {
+        if (!positions_.insert(std::make_pair(segment, stamps_.size()))
+                                                                    .second)
+            return;
+        std::vector<Component>::const_iterator const own =
+            std::lower_bound(clock.begin(), clock.end(),
+                             Component(thread, 0));
+        stamps_.push_back(*own);
+        components_.insert(components_.end(), clock.begin(), clock.end());
+        offsets_.push_back(components_.size());
+    }
+
+    // Return the position of `segment`, stamping it as the first segment
+    // of a new thread if it does not have a clock. This happens for the
+    // initial segment of the program, which is not created by any event.
+    std::size_t position_or_stamp(Segment const& segment) {
+        boost::unordered_map<Segment, std::size_t>::const_iterator const it =
+                                                    positions_.find(segment);
+        if (it != positions_.end())
+            return it->second;
+        std::vector<Component> const clock(1, Component(threads_++, 1));
+        stamp(segment, clock.front().first, clock);
+        return stamps_.size() - 1;
+    }
+
+    // Copy the clock of the segment at `position` in `clock`.
+    void clock_of(std::size_t position, std::vector<Component>& clock) const {
+        clock.assign(components_.begin() + offsets_[position],
+                     components_.begin() + offsets_[position + 1]);
+    }
+
+    // Increment the component of `thread`, which is in `clock`.
+    static void tick(std::vector<Component>& clock, std::size_t thread) {
+        std::lower_bound(clock.begin(), clock.end(),
+                         Component(thread, 0))->second++;
+    }
+
+    // Set `clock` to the componentwise maximum of the clocks of the
+    // segments at positions `a` and `b`.
+    void merge(std::size_t a, std::size_t b,
+               std::vector<Component>& clock) const {
+        std::vector<Component>::const_iterator
+            first1 = components_.begin() + offsets_[a],
+            last1 = components_.begin() + offsets_[a + 1],
+            first2 = components_.begin() + offsets_[b],
+            last2 = components_.begin() + offsets_[b + 1];
+        clock.clear();
+        while (first1 != last1 && first2 != last2) {
+            if (first1->first < first2->first)
+                clock.push_back(*first1++);
+            else if (first2->first < first1->first)
+                clock.push_back(*first2++);
+            else {
+                clock.push_back(Component(first1->first,
+                                std::max(first1->second, first2->second)));
+                ++first1;
+                ++first2;
+            }
+        }
+        clock.insert(clock.end(), first1, last1);
+        clock.insert(clock.end(), first2, last2);
+    }
+
+    void process(std::vector<Event>& events) {
+        // Segments are allocated in increasing order as the program runs,
+        // and the segments an event depends on exist before it allocates
+        // its new segment. Hence, processing the events by new segment
+        // always gives a clock to the segments before they are used, even
+        // though the events may be logged out of order.
+        std::sort(events.begin(), events.end());
+
+        std::vector<Component> clock;
+        for (std::size_t i = 0; i < events.size(); ++i) {
+            Event const& event = events[i];
+            std::size_t const parent = position_or_stamp(event.parent);
+            std::size_t const thread = stamps_[parent].first;
+
+            if (event.is_join) {
+                // The parent continues after the end of the child.
+                merge(parent, position_or_stamp(event.child), clock);
+                tick(clock, thread);
+                stamp(event.new_parent, thread, clock);
+            } else {
+                // The parent continues, and the child starts with what the
+                // parent had done so far. The new thread comes after all
+                // the others, so the clock stays sorted.
+                clock_of(parent, clock);
+                tick(clock, thread);
+                stamp(event.new_parent, thread, clock);
+
+                clock_of(parent, clock);
+                clock.push_back(Component(threads_++, 1));
+                stamp(event.child, clock.back().first, clock);
+            }
+        }
+    }
+
+public:
+    //! Create an empty index, in which no segment happens before another.
+    VectorClockIndex() : offsets_(1, 0), threads_(0) { }
+
+    /**
+     * Create the index of the `start` and `join` events in a range, which
+     * may be in any order. Other events are ignored.
+     */
+    template <typename Iterator>
+    VectorClockIndex(Iterator first, Iterator last)
+        : offsets_(1, 0), threads_(0)
+    {
+        std::vector<Event> events;
+        record_events record(events);
+        for (; first != last; ++first)
+            boost::apply_visitor(record, *first);
+        process(events);
+    }
+
+    //! Return the number of segments in the index.
+    std::size_t size() const { return stamps_.size(); }
+
+    //! Return the number of threads the segments in the index belong to.
+    std::size_t threads() const { return threads_; }
+
+    /**
+     * Return the position of the segment `s` in the index, which is the
+     * number of indexed segments if `s` is not in the index.
+     */
+    std::size_t position_of(Segment const& s) const {
+        boost::unordered_map<Segment, std::size_t>::const_iterator const it =
+                                                        positions_.find(s);
+        return it == positions_.end() ? stamps_.size() : it->second;
+    }
+
+    /**
+     * Return whether the segment at the position `pu` happens before the
+     * segment at the position `pv`.
+     */
+    bool happens_before_at(std::size_t pu, std::size_t pv) const {
+        if (pu == pv || pu >= stamps_.size() || pv >= stamps_.size())
+            return false;
+        Component const& own = stamps_[pu];
+        std::vector<Component>::const_iterator const last =
+                                    components_.begin() + offsets_[pv + 1];
+        std::vector<Component>::const_iterator const it =
+            std::lower_bound(components_.begin() + offsets_[pv], last,
+                             Component(own.first, 0));
+        return it != last && it->first == own.first &&
+               own.second <= it->second;
+    }
+
+    /**
+     * Return whether the segment `u` happens before the segment `v`, which
+     * is never the case if one of them is not in the index.
+     */
+    bool happens_before(Segment const& u, Segment const& v) const {
+        return happens_before_at(position_of(u), position_of(v));
+    }
+};
+} // end namespace vector_clock_index_detail
+
+namespace core {
+    using vector_clock_index_detail::VectorClockIndex;
+}
+} // end namespace d2
+
+#endif // !D2_CORE_VECTOR_CLOCK_INDEX_HPP
@@ -5,22 +5,31 @@
 #ifndef D2_DETAIL_ATOMIC_HPP
 #define D2_DETAIL_ATOMIC_HPP
 
-#include <d2/detail/mutex.hpp>
+#include <d2/detail/atomic_ops.hpp>
 
 #include <boost/noncopyable.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/is_integral.hpp>
 
 
 namespace d2 {
 namespace detail {
 /**
- * Basic atomic class relying only on `mutex`. We can't use `Boost.Atomic`
- * it relies on locks right now. If `Boost` used this library, we would be
- * in trouble.
+ * Basic atomic class relying only on the lock-free operations defined in
+ * `atomic_ops.hpp`. We can't use `Boost.Atomic` because it relies on locks
+ * on some platforms. If `Boost` used this library, we would be in trouble.
+ *
+ * Stores have release semantics and loads have acquire semantics, unless
+ * `load_relaxed()` is used. Read-modify-write operations are sequentially
+ * consistent.
+ *
+ * @tparam T An integral type, which includes `bool`.
  */
 template <typename T>
 class atomic : public boost::noncopyable {
-    T val_;
-    mutex mutable mutex_;
+    BOOST_STATIC_ASSERT((boost::is_integral<T>::value));
+
+    T volatile val_;
 
 public:
     // val_ voluntarily left uninitialized. atomic should have
@@ -32,51 +41,45 @@ public:
     { }
 
     atomic& operator=(T const& val) {
-        scoped_lock<mutex> lock(mutex_);
-        val_ = val;
+        store_release(val_, val);
         return *this;
     }
 
     friend T operator++(atomic& self) {
-        scoped_lock<mutex> lock(self.mutex_);
-        T ret(++self.val_);
-        return ret;
+        return fetch_add(self.val_, T(1)) + T(1);
     }
 
     friend T operator++(atomic& self, int) {
-        scoped_lock<mutex> lock(self.mutex_);
-        T ret(self.val_++);
-        return ret;
+        return fetch_add(self.val_, T(1));
     }
 
     friend T operator--(atomic& self) {
-        scoped_lock<mutex> lock(self.mutex_);
-        T ret(--self.val_);
-        return ret;
+        return fetch_add(self.val_, T(0) - T(1)) - T(1);
     }
 
     friend T operator--(atomic& self, int) {
-        scoped_lock<mutex> lock(self.mutex_);
-        T ret(self.val_--);
-        return ret;
+        return fetch_add(self.val_, T(0) - T(1));
     }
 
     friend T operator+=(atomic& self, T const& val) {
-        scoped_lock<mutex> lock(self.mutex_);
-        T ret(self.val_ += val);
-        return ret;
+        return fetch_add(self.val_, val) + val;
     }
 
     friend T operator-=(atomic& self, T const& val) {
-        scoped_lock<mutex> lock(self.mutex_);
-        T ret(self.val_ -= val);
-        return ret;
+        return fetch_add(self.val_, T(0) - val) - val;
     }
 
     operator T() const {
-        scoped_lock<mutex> lock(mutex_);
-        T ret(val_);
-        return ret;
+        return load_acquire(val_);
+    }
+
+    /**
+     * Return the current value without ordering the surrounding memory
+     * accesses. This is the cheapest way to read the value, and it is
+     * enough to poll a flag.
+     */
+    T load_relaxed() const {
+        return detail::load_relaxed(val_);
     }
 };
 } // end namespace detail
@@ -0,0 +1,105 @@
+/**
+ * This file defines lock-free atomic operations on integral types.
+ */
+
+#ifndef D2_DETAIL_ATOMIC_OPS_HPP
+#define D2_DETAIL_ATOMIC_OPS_HPP
+
+#include <boost/config.hpp>
+#include <boost/static_assert.hpp>
+
+#if !defined(__GNUC__) && defined(BOOST_MSVC)
+#   include <intrin.h>
+#endif
+
+
+namespace d2 {
+namespace detail {
+/**
+ * Lock-free atomic operations on naturally aligned integral (and `bool`)
+ * objects, implemented with compiler intrinsics.
+ *
+ * We can't use `Boost.Atomic` for the same reason we can't use
+ * `Boost.Thread`'s mutexes; see `d2::detail::mutex`. These operations are
+ * meant to be used on the hot paths of the library, where even an
+ * uncontended `detail::mutex` is too expensive.
+ *
+ * @note Only the memory orderings actually needed by the library are
+ *       provided.
+ */
+#if defined(__GNUC__)
+
+template <typename T>
+T load_relaxed(T const volatile& object) {
+    return __atomic_load_n(&object, __ATOMIC_RELAXED);
+}
+
+template <typename T>
+T load_acquire(T const volatile& object) {
+    return __atomic_load_n(&object, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void store_relaxed(T volatile& object, T value) {
+    __atomic_store_n(&object, value, __ATOMIC_RELAXED);
+}
+
+template <typename T>
+void store_release(T volatile& object, T value) {
+    __atomic_store_n(&object, value, __ATOMIC_RELEASE);
+}
+
+//! Atomically add `value` to `object` and return the previous value.
+template <typename T>
+T fetch_add(T volatile& object, T value) {
+    return __atomic_fetch_add(&object, value, __ATOMIC_ACQ_REL);
+}
+
+#elif defined(BOOST_MSVC)
+
+// On MSVC, volatile accesses have acquire/release semantics, so we only
+// need to prevent the compiler from reordering around them.
+template <typename T>
+T load_relaxed(T const volatile& object) {
+    return object;
+}
+
+template <typename T>
+T load_acquire(T const volatile& object) {
+    T const value = object;
+    _ReadWriteBarrier();
+    return value;
+}
+
+template <typename T>
+void store_relaxed(T volatile& object, T value) {
+    object = value;
+}
+
+template <typename T>
+void store_release(T volatile& object, T value) {
+    _ReadWriteBarrier();
+    object = value;
+}
+
+template <typename T>
+T fetch_add(T volatile& object, T value) {
+    BOOST_STATIC_ASSERT(sizeof(T) == sizeof(long) ||
+                        sizeof(T) == sizeof(__int64));
+    if (sizeof(T) == sizeof(long))
+        return static_cast<T>(_InterlockedExchangeAdd(
+                reinterpret_cast<long volatile*>(&object),
+                static_cast<long>(value)));
+    else
+        return static_cast<T>(_InterlockedExchangeAdd64(
+                reinterpret_cast<__int64 volatile*>(&object),
+                static_cast<__int64>(value)));
+}
+
+#else
+#   error "d2: lock-free atomic operations are not supported on this compiler"
+#endif
+} // end namespace detail
+} // end namespace d2
+
+#endif // !D2_DETAIL_ATOMIC_OPS_HPP
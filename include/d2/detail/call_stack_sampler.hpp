@@ -0,0 +1,232 @@
+/**
+ * This file defines the `CallStackSampler` class.
+ */
+
+#ifndef D2_DETAIL_CALL_STACK_SAMPLER_HPP
+#define D2_DETAIL_CALL_STACK_SAMPLER_HPP
+
+#include <d2/detail/atomic_ops.hpp>
+#include <d2/detail/call_stack_table.hpp>
+#include <d2/detail/mutex.hpp>
+#include <d2/detail/thread_specific_ptr.hpp>
+
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <cstddef>
+#include <vector>
+
+
+namespace d2 {
+namespace detail {
+/**
+ * Policy deciding whether the call stack of a lock acquisition is worth
+ * capturing.
+ *
+ * Acquisitions are grouped by lock-order pair, i.e. by the set of locks held
+ * by the acquiring thread along with the acquired lock. Only the call stacks
+ * of the first acquisitions of each lock-order pair are captured; the other
+ * acquisitions are still recorded, but they refer to a call stack captured
+ * for their lock-order pair instead of their own.
+ *
+ * The pairs whose call stacks were all captured are remembered by each
+ * thread, so the acquisitions of such a pair don't take any lock once the
+ * thread has seen the pair. The other pairs are counted in a table shared
+ * by all the threads, split in shards with their own lock, which is only
+ * used the first few times a thread sees a pair.
+ *
+ * The lock-order pairs are only identified by a hash, and a collision may
+ * cause an acquisition to refer to the call stack of another pair. Since the
+ * acquisitions themselves are always recorded, the potential deadlocks that
+ * can be found are the same, but some of them may be reported with a call
+ * stack that is not theirs.
+ *
+ * @note The locks held by each thread are only tracked while a limit is set,
+ *       so the limit should be set before any lock is acquired.
+ */
+class CallStackSampler : boost::noncopyable {
+    struct HeldLocks {
+        HeldLocks() : hash(0), last_pair(0), generation(0) { }
+
+        std::vector<std::size_t> locks;
+        // Order independent hash of `locks`, updated incrementally.
+        std::size_t hash;
+        // Lock-order pair of the last acquisition whose call stack must be
+        // captured.
+        std::size_t last_pair;
+        // Call stack of each pair whose call stacks were all captured, as of
+        // the `generation` of the sampler.
+        boost::unordered_map<std::size_t, CallStackId> known;
+        std::size_t generation;
+    };
+
+    struct Samples {
+        Samples() : count(0), last(no_call_stack), decided(false) { }
+
+        std::size_t count;
+        CallStackId last;
+        // Whether `sampled` was called for the pair, even if it was with
+        // `no_call_stack`.
+        bool decided;
+    };
+
+    struct Shard {
+        mutex lock;
+        boost::unordered_map<std::size_t, Samples> samples;
+    };
+
+    static std::size_t const number_of_shards = 16;
+
+    std::size_t volatile limit_;
+    // Incremented by `clear`, so that the threads forget the pairs they know.
+    std::size_t volatile generation_;
+    thread_specific_ptr<HeldLocks> held_locks_;
+    Shard shards_[number_of_shards];
+
+    static std::size_t hash_lock(std::size_t lock) {
+        std::size_t seed = 0;
+        boost::hash_combine(seed, lock);
+        return seed;
+    }
+
+    static void delete_held_locks(HeldLocks* held) {
+        delete held;
+    }
+
+    HeldLocks& held_locks() {
+        HeldLocks* held = held_locks_.get();
+        if (!held)
+            held_locks_.reset(held = new HeldLocks);
+        return *held;
+    }
+
+    Shard& shard_of(std::size_t pair) {
+        return shards_[pair % number_of_shards];
+    }
+
+public:
+    //! Value of the limit under which every call stack is captured.
+    static std::size_t const unlimited = static_cast<std::size_t>(-1);
+
+    explicit CallStackSampler(std::size_t limit = unlimited)
+        : limit_(limit), generation_(0), held_locks_(&delete_held_locks)
+    { }
+
+    /**
+     * Set the number of call stacks captured for each lock-order pair. A
+     * limit of 0 means that no call stack is captured at all.
+     */
+    void set_limit(std::size_t limit) {
+        store_relaxed(limit_, limit);
+    }
+
+    std::size_t limit() const {
+        return load_relaxed(limit_);
+    }
+
+    /**
+     * Record that the current thread acquired `lock`, and return whether
+     * the call stack of the acquisition must be captured, in which case
+     * `sampled` must be called with its identifier.
+     *
+     * Otherwise, `call_stack` is set to the identifier of the call stack the
+     * acquisition should refer to, which is `no_call_stack` if there is
+     * none.
+     */
+    bool acquire(std::size_t lock, CallStackId& call_stack) {
+        std::size_t const limit = this->limit();
+        if (limit == unlimited)
+            return true;
+
+        HeldLocks& held = held_locks();
+        std::size_t pair = held.hash;
+        boost::hash_combine(pair, lock);
+        held.locks.push_back(lock);
+        held.hash += hash_lock(lock);
+
+        call_stack = no_call_stack;
+        if (limit == 0)
+            return false;
+
+        std::size_t const generation = load_relaxed(generation_);
+        if (held.generation != generation) {
+            held.known.clear();
+            held.generation = generation;
+        }
+        boost::unordered_map<std::size_t, CallStackId>::const_iterator const
+                                            known = held.known.find(pair);
+        if (known != held.known.end()) {
+            call_stack = known->second;
+            return false;
+        }
+
+        Shard& shard = shard_of(pair);
+        scoped_lock<mutex> guard(shard.lock);
+        // While the first call stack of a pair is being captured by another
+        // thread, there is no call stack to refer to yet.
+        Samples& samples = shard.samples[pair];
+        if (samples.count >= limit && samples.decided) {
+            call_stack = samples.last;
+            held.known[pair] = call_stack;
+            return false;
+        }
+        ++samples.count;
+        held.last_pair = pair;
+        return true;
+    }
+
+    /**
+     * Record the identifier of the call stack captured for the last
+     * acquisition of the current thread, or `no_call_stack` if it was not
+     * captured after all.
+     *
+     * @note This must be called whenever `acquire` returns true, since the
+     *       acquisitions of a pair keep taking a lock until it is.
+     */
+    void sampled(CallStackId call_stack) {
+        if (limit() == unlimited)
+            return;
+        HeldLocks& held = held_locks();
+        Shard& shard = shard_of(held.last_pair);
+        scoped_lock<mutex> guard(shard.lock);
+        Samples& samples = shard.samples[held.last_pair];
+        samples.decided = true;
+        if (call_stack != no_call_stack)
+            samples.last = call_stack;
+    }
+
+    /**
+     * Record that the current thread released `lock`.
+     */
+    void release(std::size_t lock) {
+        if (limit() == unlimited)
+            return;
+
+        // Locks are usually released in the reverse order of their
+        // acquisition, so we look for the most recent acquisition first.
+        HeldLocks& held = held_locks();
+        for (std::size_t i = held.locks.size(); i > 0; --i) {
+            if (held.locks[i - 1] == lock) {
+                held.locks.erase(held.locks.begin() + (i - 1));
+                held.hash -= hash_lock(lock);
+                return;
+            }
+        }
+    }
+
+    /**
+     * Forget the call stacks captured so far, so that the next acquisitions
+     * of every lock-order pair have their call stack captured again.
+     */
+    void clear() {
+        for (std::size_t i = 0; i < number_of_shards; ++i) {
+            scoped_lock<mutex> guard(shards_[i].lock);
+            shards_[i].samples.clear();
+        }
+        fetch_add(generation_, std::size_t(1));
+    }
+};
+} // end namespace detail
+} // end namespace d2
+
+#endif // !D2_DETAIL_CALL_STACK_SAMPLER_HPP
@@ -0,0 +1,144 @@
+/**
+ * This file defines the `CallStackTable` class.
+ */
+
+#ifndef D2_DETAIL_CALL_STACK_TABLE_HPP
+#define D2_DETAIL_CALL_STACK_TABLE_HPP
+
+#include <d2/detail/decl.hpp>
+#include <d2/detail/lock_debug_info.hpp>
+
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include <cstddef>
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+
+namespace d2 {
+namespace detail {
+/**
+ * Identifier of a call stack in a `CallStackTable`.
+ */
+typedef std::size_t CallStackId;
+
+/**
+ * Value of a `CallStackId` which never identifies a call stack. It is used
+ * when no call stack is available.
+ */
+static CallStackId const no_call_stack = 0;
+
+/**
+ * Table holding a single copy of each distinct call stack, and identifying
+ * each of them with a small `CallStackId`.
+ *
+ * Identifiers are assigned sequentially, starting at 1, in the order in
+ * which the call stacks are added to the table.
+ *
+ * @note Call stacks are hashed using the instruction pointers of their
+ *       frames only. Hence, call stacks that were recorded without their
+ *       function and module names can be resolved in place without
+ *       invalidating the table.
+ */
+class CallStackTable {
+    typedef LockDebugInfo::CallStack CallStack;
+
+    // The call stack identified by `id` is at `stacks_[id - 1]`.
+    std::vector<LockDebugInfo> stacks_;
+    boost::unordered_multimap<std::size_t, CallStackId> ids_by_hash_;
+
+    CallStackId push_back(LockDebugInfo const& info, std::size_t hash) {
+        stacks_.push_back(info);
+        CallStackId const id = stacks_.size();
+        ids_by_hash_.insert(std::make_pair(hash, id));
+        return id;
+    }
+
+public:
+    //! Return the hash of `stack`, which only depends on its frames' ips.
+    static std::size_t hash(CallStack const& stack) {
+        std::size_t seed = 0;
+        BOOST_FOREACH(StackFrame const& frame, stack)
+            boost::hash_combine(seed, frame.ip);
+        return seed;
+    }
+
+    /**
+     * Return the identifier of a call stack equal to `stack` in the table,
+     * adding `stack` to the table if there is no such call stack. The
+     * returned boolean is whether `stack` was added to the table.
+     */
+    std::pair<CallStackId, bool> insert(CallStack const& stack) {
+        std::size_t const h = hash(stack);
+        typedef boost::unordered_multimap<
+                    std::size_t, CallStackId
+                >::const_iterator Iterator;
+        std::pair<Iterator, Iterator> same_hash = ids_by_hash_.equal_range(h);
+        for (; same_hash.first != same_hash.second; ++same_hash.first)
+            if (stacks_[same_hash.first->second - 1].call_stack == stack)
+                return std::make_pair(same_hash.first->second, false);
+
+        LockDebugInfo info;
+        info.call_stack = stack;
+        return std::make_pair(push_back(info, h), true);
+    }
+
+    /**
+     * Add a call stack to the table, even if an equal call stack is already
+     * in the table, and return its identifier.
+     */
+    CallStackId push_back(LockDebugInfo const& info) {
+        return push_back(info, hash(info.call_stack));
+    }
+
+    //! Return the call stack identified by `id`, or `NULL` if there is none.
+    LockDebugInfo const* find(CallStackId id) const {
+        return id == no_call_stack || id > stacks_.size()
+                    ? NULL : &stacks_[id - 1];
+    }
+
+    //! @copydoc find
+    LockDebugInfo* find(CallStackId id) {
+        return id == no_call_stack || id > stacks_.size()
+                    ? NULL : &stacks_[id - 1];
+    }
+
+    bool empty() const { return stacks_.empty(); }
+    std::size_t size() const { return stacks_.size(); }
+
+    void clear() {
+        stacks_.clear();
+        ids_by_hash_.clear();
+    }
+
+    /**
+     * Write the call stack identified by `id` to a stream, in the format
+     * read by `operator>>`.
+     *
+     * This is used to save the call stacks to a file as they are added to
+     * a table.
+     */
+    D2_DECL static void write(std::ostream&, CallStackId id,
+                              LockDebugInfo const& info);
+
+    /**
+     * Write all the call stacks of a table to a stream.
+     */
+    D2_DECL friend std::ostream&
+    operator<<(std::ostream&, CallStackTable const&);
+
+    /**
+     * Read call stacks written with `write` or `operator<<` from a stream,
+     * adding them to the table.
+     *
+     * The identifiers of the call stacks that are read must follow the ones
+     * of the table; otherwise, the `failbit` of the stream is set.
+     */
+    D2_DECL friend std::istream& operator>>(std::istream&, CallStackTable&);
+};
+} // end namespace detail
+} // end namespace d2
+
+#endif // !D2_DETAIL_CALL_STACK_TABLE_HPP
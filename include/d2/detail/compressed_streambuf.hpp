@@ -0,0 +1,454 @@
+/**
+ * This file defines the `compressing_streambuf` and the
+ * `decompressing_streambuf` classes.
+ */
+
+#ifndef D2_DETAIL_COMPRESSED_STREAMBUF_HPP
+#define D2_DETAIL_COMPRESSED_STREAMBUF_HPP
+
+#include <d2/detail/condition_variable.hpp>
+#include <d2/detail/mutex.hpp>
+#include <d2/detail/thread.hpp>
+
+#include <boost/cstdint.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cstddef>
+#include <cstring>
+#include <ios>
+#include <streambuf>
+#include <vector>
+#include <zlib.h>
+
+
+namespace d2 {
+namespace detail {
+/**
+ * @internal
+ * Constants and helpers of the format of the compressed containers.
+ *
+ * A container starts with the 4 bytes of `magic`, followed by a sequence of
+ * blocks. Each block is made of:
+ *  - The size of its uncompressed data, as a 32 bits little endian integer.
+ *  - The size of its compressed data, as a 32 bits little endian integer.
+ *  - Its data, compressed as a single zlib stream.
+ *
+ * Every block is compressed independently of the others, so they can be
+ * decompressed in any order, and in parallel. A block whose uncompressed size
+ * is 0 marks the end of the container; in particular, the zero padding
+ * ending the memory mapped files that were never closed is an end marker.
+ */
+namespace compressed_streambuf_detail {
+static char const magic[4] = {'d', '2', 'z', '\x01'};
+static std::size_t const header_size = 8;
+
+//! Blocks larger than this are considered corrupted.
+static boost::uint32_t const max_block_size = 1u << 26;
+
+inline void put_uint32(char* out, boost::uint32_t value) {
+    for (std::size_t i = 0; i < 4; ++i, value >>= 8)
+        out[i] = static_cast<char>(value & 0xff);
+}
+
+inline boost::uint32_t get_uint32(char const* in) {
+    boost::uint32_t value = 0;
+    for (std::size_t i = 4; i > 0; --i)
+        value = (value << 8) | static_cast<unsigned char>(in[i - 1]);
+    return value;
+}
+
+/**
+ * Return the position of the end of the last complete block of a container
+ * of `size` bytes read from `source`, which must be positioned right after
+ * the magic of the container. The blocks are skipped without being read.
+ */
+inline boost::uintmax_t end_of_blocks(std::streambuf& source,
+                                      boost::uintmax_t size) {
+    boost::uintmax_t end = sizeof magic;
+    char header[header_size];
+    while (source.sgetn(header, sizeof header) == sizeof header) {
+        boost::uint32_t const block_size = get_uint32(header);
+        boost::uintmax_t const next = end + header_size + get_uint32(header+4);
+        if (block_size == 0 || next > size)
+            break;
+        end = next;
+        source.pubseekpos(static_cast<std::streamoff>(end), std::ios::in);
+    }
+    return end;
+}
+} // end namespace compressed_streambuf_detail
+
+/**
+ * Output stream buffer compressing what is written to it into the blocks of
+ * a compressed container, which are written to another stream buffer.
+ *
+ * The data is accumulated in memory until a whole block is available, which
+ * is then compressed and written at once. Hence, flushing the buffer does
+ * not write the block being accumulated; only closing the buffer does.
+ *
+ * @note Only writing sequentially is supported; the only position that can
+ *       be queried is the current one, and it can't be changed.
+ */
+class compressing_streambuf : public std::streambuf, boost::noncopyable {
+    std::streambuf* sink_;
+    std::vector<char> block_;
+    std::vector<char> compressed_;
+    int level_;
+    // Position of the start of `block_` in the stream.
+    boost::uintmax_t offset_;
+
+    // Compress the data accumulated in `block_` and write it to the sink.
+    bool write_block() {
+        namespace cs = compressed_streambuf_detail;
+        std::size_t const size = static_cast<std::size_t>(pptr() - pbase());
+        if (size == 0)
+            return true;
+
+        uLongf compressed_size = compressBound(static_cast<uLong>(size));
+        compressed_.resize(cs::header_size + compressed_size);
+        if (compress2(reinterpret_cast<Bytef*>(&compressed_[cs::header_size]),
+                      &compressed_size,
+                      reinterpret_cast<Bytef const*>(pbase()),
+                      static_cast<uLong>(size), level_) != Z_OK)
+            return false;
+
+        cs::put_uint32(&compressed_[0], static_cast<boost::uint32_t>(size));
+        cs::put_uint32(&compressed_[4],
+                       static_cast<boost::uint32_t>(compressed_size));
+        std::streamsize const total =
+            static_cast<std::streamsize>(cs::header_size + compressed_size);
+        if (sink_->sputn(&compressed_[0], total) != total)
+            return false;
+
+        offset_ += size;
+        setp(&block_[0], &block_[0] + block_.size());
+        return true;
+    }
+
+protected:
+    virtual int_type overflow(int_type c) {
+        if (!sink_ || !write_block())
+            return traits_type::eof();
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+    virtual pos_type seekoff(off_type off, std::ios::seekdir way,
+                             std::ios::openmode which) {
+        if (!sink_ || off != 0 || way != std::ios::cur ||
+                                                !(which & std::ios::out))
+            return pos_type(off_type(-1));
+        return pos_type(static_cast<off_type>(
+                        offset_ + static_cast<std::size_t>(pptr()-pbase())));
+    }
+
+    // Only the complete blocks are written to the sink, since compressing
+    // small blocks would defeat the purpose of compression.
+    virtual int sync() {
+        return sink_ ? sink_->pubsync() : -1;
+    }
+
+public:
+    //! Default size of the uncompressed data of the blocks.
+    static std::size_t const default_block_size = 1 << 16;
+
+    /**
+     * Create a closed buffer compressing blocks of `block_size` bytes with
+     * the zlib compression `level`.
+     */
+    explicit compressing_streambuf(std::size_t block_size =
+                                                        default_block_size,
+                                   int level = Z_BEST_SPEED)
+        : sink_(NULL), block_(block_size ? block_size : 1), level_(level),
+          offset_(0)
+    { }
+
+    ~compressing_streambuf() {
+        close();
+    }
+
+    bool is_open() const { return sink_ != NULL; }
+
+    /**
+     * Start writing a compressed container to `sink` and return `this`, or
+     * return `NULL` if the buffer is already open or if `sink` can't be
+     * written to.
+     *
+     * If `sink` is not at its beginning, it is assumed to be at the end of
+     * an existing container, to which blocks are appended. In that case, the
+     * position of the buffer starts at the position of `sink` instead of 0,
+     * so that it is only 0 at the beginning of a new container.
+     */
+    compressing_streambuf* open(std::streambuf* sink) {
+        namespace cs = compressed_streambuf_detail;
+        if (sink_ || !sink)
+            return NULL;
+        pos_type const position = sink->pubseekoff(0, std::ios::cur,
+                                                   std::ios::out);
+        if (position == pos_type(off_type(-1)))
+            return NULL;
+        if (position == pos_type(0) &&
+                sink->sputn(cs::magic, sizeof cs::magic) != sizeof cs::magic)
+            return NULL;
+
+        sink_ = sink;
+        offset_ = static_cast<boost::uintmax_t>(off_type(position));
+        setp(&block_[0], &block_[0] + block_.size());
+        return this;
+    }
+
+    /**
+     * Write the block being accumulated and flush the sink. Return `this`,
+     * or `NULL` if the buffer was not open or if writing failed.
+     */
+    compressing_streambuf* close() {
+        if (!sink_)
+            return NULL;
+        bool const ok = write_block() && sink_->pubsync() == 0;
+        sink_ = NULL;
+        setp(NULL, NULL);
+        return ok ? this : NULL;
+    }
+};
+
+/**
+ * Input stream buffer decompressing a compressed container read from
+ * another stream buffer.
+ *
+ * Since the blocks of a container are independent, several of them are
+ * read at once and decompressed in parallel, by the reading thread and by
+ * worker threads owned by the buffer. The workers are started the first time
+ * they are needed and live as long as the buffer. With a read-ahead of 1,
+ * which is best when the caller already reads several containers in
+ * parallel, the blocks are decompressed by the reading thread only.
+ *
+ * Reading stops at the end of the container, or at the first block that
+ * is truncated or corrupted.
+ *
+ * @note Only reading sequentially is supported, except for moving within
+ *       the block being read.
+ */
+class decompressing_streambuf : public std::streambuf, boost::noncopyable {
+    struct block {
+        std::vector<char> compressed;
+        std::vector<char> data;
+        bool ok;
+    };
+
+    std::streambuf* source_;
+    std::size_t read_ahead_;
+    std::vector<block> blocks_;
+    // Number of valid blocks in `blocks_`, and index of the block whose data
+    // is the get area.
+    std::size_t count_, current_;
+    bool at_end_;
+    // Position of the start of the get area in the stream.
+    boost::uintmax_t offset_;
+
+    // The blocks of a batch are handed out in order to the reading thread
+    // and to the workers, and the reading thread waits until none of them
+    // is `pending_` anymore.
+    std::vector<boost::shared_ptr<thread> > workers_;
+    mutex mutex_;
+    condition_variable batch_ready_, batch_done_;
+    std::size_t batch_size_, next_, pending_;
+    bool stopping_;
+
+    // Read the next block from the source without decompressing it.
+    bool read_block(block& b) {
+        namespace cs = compressed_streambuf_detail;
+        char header[cs::header_size];
+        if (source_->sgetn(header, sizeof header) != sizeof header)
+            return false;
+        boost::uint32_t const size = cs::get_uint32(header);
+        boost::uint32_t const compressed_size = cs::get_uint32(header + 4);
+        if (size == 0 || size > cs::max_block_size ||
+                compressed_size > compressBound(cs::max_block_size))
+            return false;
+
+        b.compressed.resize(compressed_size);
+        b.data.resize(size);
+        std::streamsize const n = static_cast<std::streamsize>(
+                                                            compressed_size);
+        return compressed_size == 0 || source_->sgetn(&b.compressed[0], n)==n;
+    }
+
+    static void decompress(block& b) {
+        uLongf size = static_cast<uLongf>(b.data.size());
+        b.ok = !b.compressed.empty() &&
+               uncompress(reinterpret_cast<Bytef*>(&b.data[0]), &size,
+                          reinterpret_cast<Bytef const*>(&b.compressed[0]),
+                          static_cast<uLong>(b.compressed.size())) == Z_OK &&
+               size == b.data.size();
+    }
+
+    /**
+     * Decompress the blocks of the current batch until there are none left
+     * to hand out.
+     *
+     * @pre `mutex_` is locked; it is unlocked while decompressing.
+     */
+    void decompress_batch() {
+        while (next_ < batch_size_) {
+            block& b = blocks_[next_++];
+            mutex_.unlock();
+            decompress(b);
+            mutex_.lock();
+            if (--pending_ == 0)
+                batch_done_.notify_one();
+        }
+    }
+
+    static void work(void* self_) {
+        decompressing_streambuf& self =
+                                *static_cast<decompressing_streambuf*>(self_);
+        scoped_lock<mutex> lock(self.mutex_);
+        while (!self.stopping_) {
+            self.decompress_batch();
+            if (!self.stopping_)
+                self.batch_ready_.wait(self.mutex_);
+        }
+    }
+
+    // Read and decompress the next blocks of the source.
+    bool fill() {
+        // Resizing is safe here, since the get area is about to be reset.
+        if (blocks_.size() != read_ahead_)
+            blocks_.resize(read_ahead_);
+
+        // The first block is read alone, so that peeking at the beginning
+        // of the container does not start any worker before the reader had
+        // a chance to set the read-ahead.
+        std::size_t const wanted = offset_ == 0 ? 1 : blocks_.size();
+        count_ = current_ = 0;
+        while (!at_end_ && count_ < wanted) {
+            if (read_block(blocks_[count_]))
+                ++count_;
+            else
+                at_end_ = true;
+        }
+        if (count_ == 0)
+            return false;
+
+        if (count_ == 1) {
+            decompress(blocks_[0]);
+        } else {
+            while (workers_.size() < count_ - 1)
+                workers_.push_back(boost::make_shared<thread>(&work, this));
+            scoped_lock<mutex> lock(mutex_);
+            batch_size_ = pending_ = count_;
+            next_ = 0;
+            batch_ready_.notify_all();
+            decompress_batch();
+            while (pending_ != 0)
+                batch_done_.wait(mutex_);
+        }
+
+        for (std::size_t i = 0; i < count_; ++i) {
+            if (!blocks_[i].ok) {
+                count_ = i;
+                at_end_ = true;
+            }
+        }
+        return count_ != 0;
+    }
+
+protected:
+    virtual int_type underflow() {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        if (!source_)
+            return traits_type::eof();
+
+        offset_ += static_cast<std::size_t>(egptr() - eback());
+        if (++current_ >= count_ && !fill()) {
+            setg(NULL, NULL, NULL);
+            return traits_type::eof();
+        }
+        std::vector<char>& data = blocks_[current_].data;
+        setg(&data[0], &data[0], &data[0] + data.size());
+        return traits_type::to_int_type(*gptr());
+    }
+
+    // Moving within the current block is supported, which is enough to
+    // peek at the first bytes of the stream and go back.
+    virtual pos_type seekoff(off_type off, std::ios::seekdir way,
+                             std::ios::openmode which) {
+        if (!source_ || way != std::ios::cur || !(which & std::ios::in) ||
+                off < eback() - gptr() || off > egptr() - gptr())
+            return pos_type(off_type(-1));
+        gbump(static_cast<int>(off));
+        return pos_type(static_cast<off_type>(
+                        offset_ + static_cast<std::size_t>(gptr()-eback())));
+    }
+
+public:
+    //! Default number of blocks decompressed in parallel.
+    static std::size_t const default_read_ahead = 4;
+
+    /**
+     * Create a closed buffer decompressing up to `read_ahead` blocks in
+     * parallel.
+     */
+    explicit decompressing_streambuf(std::size_t read_ahead =
+                                                        default_read_ahead)
+        : source_(NULL), read_ahead_(read_ahead ? read_ahead : 1),
+          blocks_(read_ahead_), count_(0), current_(0), at_end_(false),
+          offset_(0), batch_size_(0), next_(0), pending_(0), stopping_(false)
+    { }
+
+    ~decompressing_streambuf() {
+        {
+            scoped_lock<mutex> lock(mutex_);
+            stopping_ = true;
+            batch_ready_.notify_all();
+        }
+        for (std::size_t i = 0; i < workers_.size(); ++i)
+            workers_[i]->join();
+    }
+
+    bool is_open() const { return source_ != NULL; }
+
+    /**
+     * Set the number of blocks decompressed in parallel, which takes effect
+     * the next time blocks are read from the source. Workers that were
+     * already started are kept, but they stay idle if they are not needed
+     * anymore.
+     */
+    void set_read_ahead(std::size_t read_ahead) {
+        read_ahead_ = read_ahead ? read_ahead : 1;
+    }
+
+    std::size_t read_ahead() const { return read_ahead_; }
+
+    /**
+     * Start reading the compressed container at the beginning of `source`
+     * and return `this`. If `source` does not contain a compressed
+     * container, it is rewound to its beginning and `NULL` is returned.
+     */
+    decompressing_streambuf* open(std::streambuf* source) {
+        namespace cs = compressed_streambuf_detail;
+        if (source_ || !source)
+            return NULL;
+        char magic[sizeof cs::magic];
+        if (source->sgetn(magic, sizeof magic) != sizeof magic ||
+                std::memcmp(magic, cs::magic, sizeof magic) != 0) {
+            source->pubseekpos(0, std::ios::in);
+            return NULL;
+        }
+        source_ = source;
+        count_ = current_ = 0;
+        at_end_ = false;
+        offset_ = 0;
+        setg(NULL, NULL, NULL);
+        return this;
+    }
+};
+} // end namespace detail
+} // end namespace d2
+
+#endif // !D2_DETAIL_COMPRESSED_STREAMBUF_HPP
@@ -0,0 +1,93 @@
+/**
+ * This file defines the `condition_variable` class.
+ */
+
+#ifndef D2_DETAIL_CONDITION_VARIABLE_HPP
+#define D2_DETAIL_CONDITION_VARIABLE_HPP
+
+#include <d2/detail/mutex.hpp>
+
+#include <boost/assert.hpp>
+#include <boost/noncopyable.hpp>
+#include <cstddef> // for NULL
+
+#include <boost/thread/detail/platform.hpp>
+#if defined(BOOST_THREAD_PLATFORM_PTHREAD)
+#   include <pthread.h>
+#elif defined(BOOST_THREAD_PLATFORM_WIN32)
+#   include <Windows.h>
+#endif
+
+
+namespace d2 {
+namespace detail {
+/**
+ * Basic condition variable working with `d2::detail::mutex`, and not relying
+ * on anything that might be using this library, which would create a
+ * circular dependency.
+ *
+ * Like any condition variable, `wait` may return spuriously, so it must
+ * always be called in a loop checking the awaited condition.
+ */
+class condition_variable : public boost::noncopyable {
+
+#if defined(BOOST_THREAD_PLATFORM_PTHREAD)
+private:
+    pthread_cond_t condition_;
+
+public:
+    condition_variable() {
+        int const res = pthread_cond_init(&condition_, NULL);
+        BOOST_ASSERT(res == 0); (void)res;
+    }
+
+    //! @pre `mutex` is locked by the calling thread.
+    void wait(mutex& mutex) {
+        int const res = pthread_cond_wait(&condition_, &mutex.mutex_);
+        BOOST_ASSERT(res == 0); (void)res;
+    }
+
+    void notify_one() {
+        int const res = pthread_cond_signal(&condition_);
+        BOOST_ASSERT(res == 0); (void)res;
+    }
+
+    void notify_all() {
+        int const res = pthread_cond_broadcast(&condition_);
+        BOOST_ASSERT(res == 0); (void)res;
+    }
+
+    ~condition_variable() {
+        int const res = pthread_cond_destroy(&condition_);
+        BOOST_ASSERT(res == 0); (void)res;
+    }
+
+#elif defined(BOOST_THREAD_PLATFORM_WIN32)
+private:
+    CONDITION_VARIABLE condition_;
+
+public:
+    condition_variable() {
+        InitializeConditionVariable(&condition_);
+    }
+
+    //! @pre `mutex` is locked by the calling thread.
+    void wait(mutex& mutex) {
+        bool const success = SleepConditionVariableCS(
+                                &condition_, &mutex.section_, INFINITE) != 0;
+        BOOST_ASSERT(success); (void)success;
+    }
+
+    void notify_one() {
+        WakeConditionVariable(&condition_);
+    }
+
+    void notify_all() {
+        WakeAllConditionVariable(&condition_);
+    }
+#endif // BOOST_THREAD_PLATFORM_{PTHREAD, WIN32}
+};
+} // end namespace detail
+} // end namespace d2
+
+#endif // !D2_DETAIL_CONDITION_VARIABLE_HPP
@@ -59,8 +59,28 @@ struct LockDebugInfo : boost::equality_comparable<LockDebugInfo> {
         ar & call_stack;
     }
 
+    /**
+     * Fill the call stack with the frames of the calling thread, ignoring
+     * the `ignore` innermost frames. Each frame is resolved to the name of
+     * its function and module.
+     */
     void init_call_stack(unsigned int ignore = 0);
 
+    /**
+     * Same as `init_call_stack`, but only record the instruction pointers
+     * of the frames, leaving their function and module empty. This is much
+     * faster, and the frames can be resolved later using the `ModuleMap` of
+     * the process.
+     */
+    void init_raw_call_stack(unsigned int ignore = 0);
+
+    /**
+     * Resolve the function and module names of the frames recorded with
+     * `init_raw_call_stack`. This must be called in the process where the
+     * call stack was recorded.
+     */
+    void resolve_call_stack();
+
     friend bool operator==(LockDebugInfo const& a, LockDebugInfo const&b) {
         return a.call_stack == b.call_stack;
     }
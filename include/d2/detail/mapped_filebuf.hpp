@@ -0,0 +1,197 @@
+/**
+ * This file defines the `mapped_filebuf` class.
+ */
+
+#ifndef D2_DETAIL_MAPPED_FILEBUF_HPP
+#define D2_DETAIL_MAPPED_FILEBUF_HPP
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <ios>
+#include <streambuf>
+
+
+namespace d2 {
+namespace detail {
+/**
+ * Output stream buffer writing to a file through a memory mapping.
+ *
+ * The file is mapped one chunk at a time. Writing to the buffer copies the
+ * data to the mapped chunk, which lives in the page cache of the operating
+ * system, so no system call is made until the chunk is full. The file is
+ * then extended by another chunk, which is mapped in turn.
+ *
+ * Since the mapped pages belong to the file, everything written to the
+ * buffer ends up in the file even if the process dies without closing it.
+ * In that case, the file ends with the zero filled remainder of its last
+ * chunk. When the buffer is closed properly, the file is truncated to the
+ * size of what was written. Since the padding can't be told apart from
+ * data without knowing its format, it is removed by `core::event_ofstream`
+ * before such a file is appended to, not by this buffer.
+ *
+ * @note Only writing sequentially is supported; the only position that can
+ *       be queried is the current one, and it can't be changed.
+ */
+class mapped_filebuf : public std::streambuf, boost::noncopyable {
+    boost::filesystem::path path_;
+    std::size_t chunk_size_;
+    boost::interprocess::mapped_region region_;
+    // Offset in the file of the first byte of `region_`.
+    boost::uintmax_t region_offset_;
+    bool is_open_;
+
+    boost::uintmax_t position() const {
+        return region_offset_ + static_cast<std::size_t>(pptr() - pbase());
+    }
+
+    // Map the chunk starting at `offset`, extending the file if needed.
+    void map_chunk(boost::uintmax_t offset) {
+        namespace ipc = boost::interprocess;
+        if (boost::filesystem::file_size(path_) < offset + chunk_size_)
+            boost::filesystem::resize_file(path_, offset + chunk_size_);
+        ipc::file_mapping file(path_.string().c_str(), ipc::read_write);
+        ipc::mapped_region region(file, ipc::read_write, offset, chunk_size_);
+        region_.swap(region);
+        region_offset_ = offset;
+
+        char* const chunk = static_cast<char*>(region_.get_address());
+        setp(chunk, chunk + chunk_size_);
+    }
+
+    void unmap_chunk() {
+        boost::interprocess::mapped_region().swap(region_);
+        setp(NULL, NULL);
+    }
+
+protected:
+    virtual int_type overflow(int_type c) {
+        if (!is_open_)
+            return traits_type::eof();
+        try {
+            map_chunk(position());
+        } catch (std::exception const&) {
+            return traits_type::eof();
+        }
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+    virtual std::streamsize xsputn(char const* s, std::streamsize n) {
+        std::streamsize written = 0;
+        while (written != n) {
+            if (pptr() == epptr() &&
+                    traits_type::eq_int_type(overflow(traits_type::eof()),
+                                             traits_type::eof()))
+                break;
+            std::streamsize const count =
+                        std::min<std::streamsize>(n - written, epptr()-pptr());
+            std::memcpy(pptr(), s + written, static_cast<std::size_t>(count));
+            pbump(static_cast<int>(count));
+            written += count;
+        }
+        return written;
+    }
+
+    virtual pos_type seekoff(off_type off, std::ios::seekdir way,
+                             std::ios::openmode which) {
+        if (!is_open_ || off != 0 || way != std::ios::cur ||
+                                                !(which & std::ios::out))
+            return pos_type(off_type(-1));
+        return pos_type(static_cast<off_type>(position()));
+    }
+
+    // The data is already in the page cache, which is all a `std::filebuf`
+    // would guarantee, so there is nothing to do.
+    virtual int sync() { return is_open_ ? 0 : -1; }
+
+public:
+    //! Default size of the chunks in which files are mapped.
+    static std::size_t const default_chunk_size = 1 << 20;
+
+    /**
+     * Create a closed buffer mapping files in chunks of `chunk_size` bytes,
+     * rounded up to a multiple of the size of a page.
+     */
+    explicit mapped_filebuf(std::size_t chunk_size = default_chunk_size)
+        : region_offset_(0), is_open_(false)
+    {
+        std::size_t const page =
+                        boost::interprocess::mapped_region::get_page_size();
+        chunk_size_ = (std::max<std::size_t>(chunk_size, 1) + page - 1)
+                                                            / page * page;
+    }
+
+    ~mapped_filebuf() {
+        close();
+    }
+
+    bool is_open() const { return is_open_; }
+
+    /**
+     * Open a file for writing and return `this`, or return `NULL` if the
+     * file can't be opened or if the buffer is already open.
+     *
+     * The file is truncated, unless `mode` contains `std::ios::app`, in
+     * which case writing starts at its end.
+     */
+    mapped_filebuf* open(boost::filesystem::path const& path,
+                         std::ios::openmode mode) {
+        if (is_open_)
+            return NULL;
+
+        // Create the file or truncate it, as a std::filebuf would.
+        std::ios::openmode const create =
+            std::ios::out | std::ios::binary |
+            (mode & std::ios::app ? std::ios::app : std::ios::trunc);
+        std::filebuf file;
+        if (!file.open(path.string().c_str(), create) || !file.close())
+            return NULL;
+
+        try {
+            path_ = path;
+            boost::uintmax_t const size = boost::filesystem::file_size(path);
+            map_chunk(size / chunk_size_ * chunk_size_);
+            pbump(static_cast<int>(size % chunk_size_));
+        } catch (std::exception const&) {
+            unmap_chunk();
+            return NULL;
+        }
+        is_open_ = true;
+        return this;
+    }
+
+    /**
+     * Unmap the file and truncate it to the size of what was written.
+     * Return `this`, or `NULL` if the buffer was not open or if the file
+     * can't be truncated.
+     */
+    mapped_filebuf* close() {
+        if (!is_open_)
+            return NULL;
+        boost::uintmax_t const size = position();
+        unmap_chunk();
+        is_open_ = false;
+        try {
+            boost::filesystem::resize_file(path_, size);
+        } catch (std::exception const&) {
+            return NULL;
+        }
+        return this;
+    }
+};
+} // end namespace detail
+} // end namespace d2
+
+#endif // !D2_DETAIL_MAPPED_FILEBUF_HPP
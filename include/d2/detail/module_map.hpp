@@ -0,0 +1,109 @@
+/**
+ * This file defines the `LoadedModule` and the `ModuleMap` classes.
+ */
+
+#ifndef D2_DETAIL_MODULE_MAP_HPP
+#define D2_DETAIL_MODULE_MAP_HPP
+
+#include <d2/detail/decl.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+
+namespace d2 {
+namespace detail {
+/**
+ * Module (executable or shared library) loaded in the address space of a
+ * process.
+ */
+struct LoadedModule {
+    //! Range of addresses [begin, end) at which the module is mapped.
+    std::size_t begin, end;
+
+    //! Difference between the addresses in the address space of the
+    //! process and the addresses in the module file.
+    std::size_t bias;
+
+    //! Path of the module file.
+    std::string path;
+
+    LoadedModule()
+        : begin(0), end(0), bias(0)
+    { }
+
+    LoadedModule(std::size_t begin, std::size_t end, std::size_t bias,
+                 std::string const& path)
+        : begin(begin), end(end), bias(bias), path(path)
+    { }
+
+    //! Return the address in the module file of the address `ip` of the
+    //! process.
+    std::size_t file_address(std::size_t ip) const {
+        return ip - bias;
+    }
+};
+
+/**
+ * Set of the modules loaded in a process.
+ *
+ * The map of a process can be saved along with raw instruction pointers so
+ * that the instruction pointers can be resolved to symbols later on, and
+ * possibly outside of the process.
+ */
+class ModuleMap {
+    struct begins_after {
+        bool operator()(std::size_t ip, LoadedModule const& module) const {
+            return ip < module.begin;
+        }
+    };
+
+    // Sorted by begin address.
+    std::vector<LoadedModule> modules_;
+
+public:
+    /**
+     * Return the map of the modules currently loaded in the calling process.
+     *
+     * @note The map is empty on platforms where this is not supported.
+     */
+    D2_DECL static ModuleMap of_current_process();
+
+    //! Add a module to the map.
+    void add(LoadedModule const& module) {
+        modules_.insert(std::upper_bound(modules_.begin(), modules_.end(),
+                                         module.begin, begins_after()),
+                        module);
+    }
+
+    //! Return the module mapped at address `ip`, or `NULL` if there is none.
+    LoadedModule const* find(std::size_t ip) const {
+        std::vector<LoadedModule>::const_iterator module =
+            std::upper_bound(modules_.begin(), modules_.end(),
+                             ip, begins_after());
+        if (module == modules_.begin() || ip >= (--module)->end)
+            return NULL;
+        return &*module;
+    }
+
+    bool empty() const { return modules_.empty(); }
+    std::size_t size() const { return modules_.size(); }
+
+    /**
+     * Write a module map to a stream, one module per line.
+     */
+    D2_DECL friend std::ostream& operator<<(std::ostream&, ModuleMap const&);
+
+    /**
+     * Read a module map written with `operator<<` from a stream, adding the
+     * modules to the map.
+     */
+    D2_DECL friend std::istream& operator>>(std::istream&, ModuleMap&);
+};
+} // end namespace detail
+} // end namespace d2
+
+#endif // !D2_DETAIL_MODULE_MAP_HPP
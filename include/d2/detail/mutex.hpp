@@ -19,11 +19,14 @@
 
 namespace d2 {
 namespace detail {
+class condition_variable;
+
 /**
  * Basic mutex class not relying on anything that might be using this library,
  * which would create a circular dependency.
  */
 class mutex : public boost::noncopyable {
+    friend class condition_variable;
 
 #if defined(BOOST_THREAD_PLATFORM_PTHREAD)
 private:
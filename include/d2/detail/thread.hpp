@@ -0,0 +1,95 @@
+/**
+ * This file defines the `thread` class.
+ */
+
+#ifndef D2_DETAIL_THREAD_HPP
+#define D2_DETAIL_THREAD_HPP
+
+#include <boost/assert.hpp>
+#include <boost/noncopyable.hpp>
+#include <cstddef> // for NULL
+
+#include <boost/thread/detail/platform.hpp>
+#if defined(BOOST_THREAD_PLATFORM_PTHREAD)
+#   include <pthread.h>
+#elif defined(BOOST_THREAD_PLATFORM_WIN32)
+#   include <Windows.h>
+#endif
+
+
+namespace d2 {
+namespace detail {
+/**
+ * Basic thread class not relying on anything that might be using this
+ * library, which would create a circular dependency.
+ *
+ * The thread starts running `function(argument)` when it is constructed,
+ * and it must be joined before it is destroyed.
+ */
+class thread : public boost::noncopyable {
+public:
+    typedef void (*thread_function)(void*);
+
+private:
+    thread_function function_;
+    void* argument_;
+    bool joined_;
+
+#if defined(BOOST_THREAD_PLATFORM_PTHREAD)
+    pthread_t thread_;
+
+    static void* run(void* self_) {
+        thread* self = static_cast<thread*>(self_);
+        self->function_(self->argument_);
+        return NULL;
+    }
+
+public:
+    thread(thread_function function, void* argument)
+        : function_(function), argument_(argument), joined_(false)
+    {
+        int const res = pthread_create(&thread_, NULL, &run, this);
+        BOOST_ASSERT(res == 0); (void)res;
+    }
+
+    void join() {
+        BOOST_ASSERT_MSG(!joined_, "joining a thread twice");
+        int const res = pthread_join(thread_, NULL);
+        BOOST_ASSERT(res == 0); (void)res;
+        joined_ = true;
+    }
+
+#elif defined(BOOST_THREAD_PLATFORM_WIN32)
+    HANDLE thread_;
+
+    static DWORD WINAPI run(LPVOID self_) {
+        thread* self = static_cast<thread*>(self_);
+        self->function_(self->argument_);
+        return 0;
+    }
+
+public:
+    thread(thread_function function, void* argument)
+        : function_(function), argument_(argument), joined_(false),
+          thread_(CreateThread(NULL, 0, &run, this, 0, NULL))
+    {
+        BOOST_ASSERT(thread_ != NULL);
+    }
+
+    void join() {
+        BOOST_ASSERT_MSG(!joined_, "joining a thread twice");
+        DWORD const res = WaitForSingleObject(thread_, INFINITE);
+        BOOST_ASSERT(res == WAIT_OBJECT_0); (void)res;
+        CloseHandle(thread_);
+        joined_ = true;
+    }
+#endif // BOOST_THREAD_PLATFORM_{PTHREAD, WIN32}
+
+    ~thread() {
+        BOOST_ASSERT_MSG(joined_, "destroying a thread that was not joined");
+    }
+};
+} // end namespace detail
+} // end namespace d2
+
+#endif // !D2_DETAIL_THREAD_HPP
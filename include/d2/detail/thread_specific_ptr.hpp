@@ -0,0 +1,100 @@
+/**
+ * This file defines the `thread_specific_ptr` class.
+ */
+
+#ifndef D2_DETAIL_THREAD_SPECIFIC_PTR_HPP
+#define D2_DETAIL_THREAD_SPECIFIC_PTR_HPP
+
+#include <boost/assert.hpp>
+#include <boost/noncopyable.hpp>
+#include <cstddef> // for NULL
+
+#include <boost/thread/detail/platform.hpp>
+#if defined(BOOST_THREAD_PLATFORM_PTHREAD)
+#   include <pthread.h>
+#elif defined(BOOST_THREAD_PLATFORM_WIN32)
+#   include <Windows.h>
+#endif
+
+
+namespace d2 {
+namespace detail {
+/**
+ * Basic thread specific pointer not relying on anything that might be using
+ * this library, which would create a circular dependency.
+ *
+ * Each thread sees its own value of the pointer, which is initially `NULL`.
+ * When a thread exits with a non-`NULL` value, `cleanup` is called with
+ * that value in the exiting thread.
+ *
+ * @note Contrary to `boost::thread_specific_ptr`, the pointers are never
+ *       deleted automatically; this is the job of `cleanup`.
+ *
+ * @warning What happens to the values of the threads that are still alive
+ *          when the `thread_specific_ptr` is destroyed is platform
+ *          dependent. With pthreads, `cleanup` is never called for them.
+ *          On Win32, `cleanup` is called for each of them by the destructor.
+ *          Clients must handle both cases.
+ */
+template <typename T>
+class thread_specific_ptr : public boost::noncopyable {
+public:
+    typedef void (*cleanup_function)(T*);
+
+#if defined(BOOST_THREAD_PLATFORM_PTHREAD)
+private:
+    pthread_key_t key_;
+
+public:
+    explicit thread_specific_ptr(cleanup_function cleanup) {
+        int const res = pthread_key_create(&key_,
+                            reinterpret_cast<void (*)(void*)>(cleanup));
+        BOOST_ASSERT(res == 0); (void)res;
+    }
+
+    T* get() const {
+        return static_cast<T*>(pthread_getspecific(key_));
+    }
+
+    void reset(T* ptr) {
+        int const res = pthread_setspecific(key_, ptr);
+        BOOST_ASSERT(res == 0); (void)res;
+    }
+
+    ~thread_specific_ptr() {
+        int const res = pthread_key_delete(key_);
+        BOOST_ASSERT(res == 0); (void)res;
+    }
+
+#elif defined(BOOST_THREAD_PLATFORM_WIN32)
+private:
+    DWORD index_;
+
+public:
+    // Fiber local storage is used because it is the only Win32 facility
+    // calling a destructor when a thread exits.
+    explicit thread_specific_ptr(cleanup_function cleanup)
+        : index_(FlsAlloc(reinterpret_cast<PFLS_CALLBACK_FUNCTION>(cleanup)))
+    {
+        BOOST_ASSERT(index_ != FLS_OUT_OF_INDEXES);
+    }
+
+    T* get() const {
+        return static_cast<T*>(FlsGetValue(index_));
+    }
+
+    void reset(T* ptr) {
+        bool const success = FlsSetValue(index_, ptr) != 0;
+        BOOST_ASSERT(success); (void)success;
+    }
+
+    ~thread_specific_ptr() {
+        // Note: This calls the cleanup function on every non-NULL value.
+        FlsFree(index_);
+    }
+#endif // BOOST_THREAD_PLATFORM_{PTHREAD, WIN32}
+};
+} // end namespace detail
+} // end namespace d2
+
+#endif // !D2_DETAIL_THREAD_SPECIFIC_PTR_HPP
@@ -6,7 +6,6 @@
 #ifndef D2_TRACKABLE_SYNC_OBJECT_HPP
 #define D2_TRACKABLE_SYNC_OBJECT_HPP
 
-#include <d2/core/raw_api.hpp>
 #include <d2/detail/decl.hpp>
 #include <d2/detail/ut_access.hpp>
 
@@ -14,18 +13,25 @@
 #include <boost/mpl/assert.hpp>
 #include <boost/mpl/or.hpp>
 #include <boost/type_traits/is_same.hpp>
-#include <cstddef>
-#include <dyno/thread_id.hpp>
-#include <dyno/uniquely_identifiable.hpp>
+
+#ifdef D2_ENABLED
+#   include <d2/core/raw_api.hpp>
+
+#   include <cstddef>
+#   include <dyno/thread_id.hpp>
+#   include <dyno/uniquely_identifiable.hpp>
+#endif
 
 
 namespace d2 {
+#ifdef D2_ENABLED
 namespace trackable_sync_object_detail {
     //! @internal Class holding an identifier unique across all locks.
     struct unique_id_for_all_locks
         : dyno::uniquely_identifiable<unique_id_for_all_locks>
     { };
 } // end namespace trackable_sync_object_detail
+#endif
 
 /*!
  * Tag to signal that it is legal for a synchronization object to be acquired
@@ -74,6 +80,11 @@ struct non_recursive;
  *            objects and `d2::trackable_sync_object`s without hassle.
  *          - It does not alter the public interface of the derived class.
  *
+ * @note Unless `D2_ENABLED` is defined, this class is empty and its methods
+ *       do nothing, so the synchronization objects using it compile down
+ *       to the objects they wrap. When `D2_ENABLED` is defined and event
+ *       logging is disabled at runtime, notifying `d2` costs a single load.
+ *
  * @tparam Recursive
  *         Tag signalling whether it is legal for a synchronization object
  *         to be acquired recursively by the same thread. It must be one of
@@ -81,19 +92,21 @@ struct non_recursive;
  */
 template <typename Recursive>
 class trackable_sync_object {
-    trackable_sync_object_detail::unique_id_for_all_locks lock_id_;
-
     // No need to evaluate the metafunctions with the current usage.
     typedef boost::is_same<Recursive, recursive> is_recursive;
     typedef boost::is_same<Recursive, non_recursive> is_non_recursive;
 
     BOOST_MPL_ASSERT((boost::mpl::or_<is_recursive, is_non_recursive>));
 
+#ifdef D2_ENABLED
+    trackable_sync_object_detail::unique_id_for_all_locks lock_id_;
+
     friend class detail::ut_access;
     std::size_t d2_unique_id() const {
         using dyno::unique_id;
         return unique_id(lock_id_);
     }
+#endif
 
 public:
     /*!
@@ -102,6 +115,9 @@ public:
      */
     void notify_lock() const BOOST_NOEXCEPT {
 #ifdef D2_ENABLED
+        // Don't even compute the thread id when nobody is listening.
+        if (core::is_disabled())
+            return;
         using dyno::unique_id;
         std::size_t const tid = unique_id(dyno::this_thread::get_id());
         if (::d2::trackable_sync_object<Recursive>::is_recursive::value)
@@ -117,6 +133,8 @@ public:
      */
     void notify_unlock() const BOOST_NOEXCEPT {
 #ifdef D2_ENABLED
+        if (core::is_disabled())
+            return;
         using dyno::unique_id;
         std::size_t const tid = unique_id(dyno::this_thread::get_id());
         if (::d2::trackable_sync_object<Recursive>::is_recursive::value)
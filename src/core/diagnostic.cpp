@@ -7,12 +7,14 @@
 #include <d2/detail/cyclic_permutation.hpp>
 
 #include <boost/assert.hpp>
+#include <boost/bind.hpp>
 #include <boost/mem_fn.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/range/algorithm/adjacent_find.hpp>
 #include <boost/range/algorithm/sort.hpp>
 #include <boost/range/algorithm/transform.hpp>
 #include <boost/range/iterator_range.hpp>
+#include <boost/ref.hpp>
 #include <boost/spirit/include/karma.hpp>
 #include <iterator>
 #include <ostream>
@@ -55,7 +57,17 @@ potential_deadlock::is_equivalent_to(potential_deadlock const& other) const {
 }
 
 namespace {
-std::string explain_thread(deadlocked_thread const& thread) {
+void explain_call_stack(std::ostream& os, detail::CallStackId id,
+                        detail::CallStackTable const& call_stacks) {
+    detail::LockDebugInfo const* info = call_stacks.find(id);
+    if (info)
+        os << "\n" << *info << "\n\n";
+    else
+        os << " [no location information]\n";
+}
+
+std::string explain_thread(deadlocked_thread const& thread,
+                           detail::CallStackTable const& call_stacks) {
     typedef deadlocked_thread::lock_sequence::size_type size_type;
     std::stringstream ss;
 
@@ -65,26 +77,22 @@ std::string explain_thread(deadlocked_thread const& thread) {
     for (size_type i = 0; i < thread.holding.size(); ++i) {
 
         ss << "holds object #" << thread.holding.at(i) << " acquired at";
-        if (thread.holding_info.at(i))
-            ss << "\n" << *thread.holding_info.at(i) << "\n\n";
-        else
-            ss << " [no location information]\n";
+        explain_call_stack(ss, thread.holding_info.at(i), call_stacks);
     }
 
     ss << "tries to acquire object #" << thread.waiting_for << " at";
-    if (thread.waiting_for_info)
-        ss << "\n" << *thread.waiting_for_info << "\n\n";
-    else
-        ss << " [no location information]\n";
+    explain_call_stack(ss, thread.waiting_for_info, call_stacks);
 
     return ss.str();
 }
 } // end anonymous namespace
 
 D2_DECL extern std::ostream&
-plain_text_explanation(std::ostream& os, potential_deadlock const& dl) {
+plain_text_explanation(std::ostream& os, potential_deadlock const& dl,
+                       detail::CallStackTable const& call_stacks) {
     os << karma::format(karma::string % '\n',
-                    dl.threads | boost::adaptors::transformed(explain_thread));
+                    dl.threads | boost::adaptors::transformed(boost::bind(
+                        explain_thread, _1, boost::cref(call_stacks))));
     return os;
 }
 } // end namespace diagnostic_detail
@@ -11,10 +11,20 @@
 namespace d2 {
 namespace core {
 namespace raw_api_detail {
+    D2_DECL framework* volatile enabled_framework = NULL;
+
     D2_DECL extern framework& get_framework() {
         static framework FRAMEWORK;
         return FRAMEWORK;
     }
+
+    namespace {
+        // Create the framework when the library is loaded. Since events are
+        // only forwarded to an enabled framework, it would otherwise never
+        // be created, and the configuration found in the environment would
+        // never be applied.
+        framework& force_creation = get_framework();
+    }
 }
 }
 }
@@ -11,12 +11,11 @@
 #include <d2/detail/decl.hpp>
 
 #include <boost/foreach.hpp>
-#include <boost/graph/graph_traits.hpp>
-#include <boost/graph/properties.hpp>
 #include <boost/move/utility.hpp>
 #include <boost/phoenix/core/argument.hpp>
 #include <boost/phoenix/stl/container.hpp>
 #include <boost/ref.hpp>
+#include <cstddef>
 #include <vector>
 
 
@@ -34,31 +33,16 @@ struct GiveSynchronizationSemantics {
         : visitor_(visitor)
     { }
 
-    template <typename EdgePath, typename LockGraph>
-    void operator()(EdgePath const& cycle, LockGraph const& graph) const {
-        typedef typename boost::graph_traits<
-                            LockGraph
-                        >::edge_descriptor EdgeDescriptor;
-
-        typedef typename boost::edge_property_type<
-                            LockGraph
-                        >::type EdgeLabel;
-
+    template <typename Cycle, typename CompactLockGraph>
+    void operator()(Cycle const& cycle, CompactLockGraph const& graph) const {
         std::vector<core::deadlocked_thread> threads;
-        BOOST_FOREACH(EdgeDescriptor const& edge_desc, cycle) {
-            EdgeLabel const& edge_label = graph[edge_desc];
-
-            std::vector<LockId> were_held(
-                gatelocks_of(edge_label).template get<1>().begin(),
-                gatelocks_of(edge_label).template get<1>().end());
-
-            LockId when_waited_for = graph[target(edge_desc, graph)];
-
+        BOOST_FOREACH(std::size_t e, cycle) {
             core::deadlocked_thread thread(
-                thread_of(edge_label), boost::move(were_held), when_waited_for
+                graph.thread(e), graph.held_locks(e),
+                graph.lock(graph.target_of(e))
             );
-            thread.holding_info[0] = edge_label.l1_info;
-            thread.waiting_for_info = edge_label.l2_info;
+            thread.holding_info[0] = graph.l1_info(e);
+            thread.waiting_for_info = graph.l2_info(e);
             threads.push_back(boost::move(thread));
         }
 
@@ -70,8 +54,11 @@ struct GiveSynchronizationSemantics {
 D2_DECL void
 synchronization_skeleton::deadlocks_impl(DeadlockVisitor const& visitor) const
 {
-    core::analyze(lg_, sg_,
-        GiveSynchronizationSemantics<DeadlockVisitor>(visitor));
+    GiveSynchronizationSemantics<DeadlockVisitor> const f(visitor);
+    if (ordering_ == vector_clock_ordering)
+        core::analyze(lg_, clocks_, f, jobs_);
+    else
+        core::analyze(lg_, happens_before_, f, jobs_);
 }
 
 D2_DECL synchronization_skeleton::deadlock_range
@@ -1,30 +1,157 @@
 /**
- * This file implements the `feed_lock_graph` method of the
- * `synchronization_skeleton` class.
+ * This file implements the `feed_lock_graph` and `build_graphs` methods of
+ * the `synchronization_skeleton` class.
  */
 
 #define D2_SOURCE
 #include <d2/core/build_lock_graph.hpp>
 #include <d2/core/events.hpp>
 #include <d2/core/synchronization_skeleton.hpp>
+#include <d2/detail/atomic_ops.hpp>
 #include <d2/detail/decl.hpp>
+#include <d2/detail/thread.hpp>
 
+#include <algorithm>
+#include <boost/exception_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <boost/graph/graph_traits.hpp>
 #include <boost/graph/graphviz.hpp>
 #include <boost/graph/properties.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cstddef>
 #include <dyno/istream_iterator.hpp>
 #include <ostream>
+#include <vector>
 
 
 namespace d2 {
 namespace synchronization_skeleton_detail {
-D2_DECL void synchronization_skeleton::feed_lock_graph(Stream& stream) {
+D2_DECL void synchronization_skeleton::feed_lock_graph(Stream& stream,
+                                                       core::LockGraph& lg) {
     typedef dyno::istream_iterator<
                 Stream, core::events::thread_specific
             > Iterator;
 
     Iterator first(stream), last;
     static bool const ignore_unrelated_events = true;
-    core::build_lock_graph<ignore_unrelated_events>(first, last, lg_);
+    core::build_lock_graph<ignore_unrelated_events>(first, last, lg);
+}
+
+namespace {
+    /**
+     * Files of the threads shared by the workers parsing them. Each file is
+     * parsed into its own lock graph, along with the exception thrown while
+     * parsing it, if any.
+     */
+    template <typename Stream>
+    struct ThreadFiles {
+        std::vector<Stream*> streams;
+        std::vector<core::LockGraph> graphs;
+        std::vector<boost::exception_ptr> errors;
+        std::size_t volatile next;
+        void (*feed)(Stream&, core::LockGraph&);
+
+        static void work(void* self_) {
+            ThreadFiles& self = *static_cast<ThreadFiles*>(self_);
+            std::size_t i;
+            while ((i = detail::fetch_add(self.next, std::size_t(1)))
+                                                    < self.streams.size()) {
+                try {
+                    self.feed(*self.streams[i], self.graphs[i]);
+                } catch (...) {
+                    self.errors[i] = boost::current_exception();
+                }
+            }
+        }
+    };
+
+    /**
+     * Add the vertices and the edges of `partial` to `lg`, in the order in
+     * which they appear in `partial`.
+     *
+     * Since the edges of a partial graph all come from the same thread,
+     * they can't be equal to the edges of another partial graph, so they
+     * don't have to be deduplicated again. However, their gatelocks are
+     * interned again in `gatelocks`, so that the partial graphs share them.
+     */
+    void merge_lock_graph(core::LockGraph const& partial,
+                          core::LockGraph& lg,
+                          core::GatelockTable& gatelocks) {
+        typedef boost::graph_traits<core::LockGraph> Traits;
+        std::vector<Traits::vertex_descriptor> copies;
+        copies.reserve(num_vertices(partial));
+        BOOST_FOREACH(Traits::vertex_descriptor v, vertices(partial))
+            copies.push_back(add_vertex(partial[v], lg));
+
+        BOOST_FOREACH(Traits::vertex_descriptor u, vertices(partial)) {
+            BOOST_FOREACH(Traits::edge_descriptor e, out_edges(u, partial)) {
+                core::LockGraphLabel const& label = partial[e];
+                core::LockGraphLabel copy(label.s1, thread_of(label),
+                            gatelocks.intern(gatelocks_of(label).get<1>()),
+                            label.s2);
+                copy.l1_info = label.l1_info;
+                copy.l2_info = label.l2_info;
+                add_edge(copies[u], copies[target(e, partial)], copy, lg);
+            }
+        }
+    }
+} // end anonymous namespace
+
+D2_DECL void
+synchronization_skeleton::build_graphs(std::size_t jobs,
+                                       std::size_t read_ahead) {
+    // The streams are opened up front, since the filesystem can't be used
+    // by several threads.
+    ThreadFiles<Stream> files;
+    BOOST_FOREACH(Filesystem::file_entry thread, fs_.thread_files())
+        files.streams.push_back(&thread.stream());
+    files.graphs.resize(files.streams.size());
+    files.errors.resize(files.streams.size());
+    files.next = 0;
+    files.feed = &feed_lock_graph;
+
+    jobs = std::max(jobs, std::size_t(1));
+    std::size_t const workers = std::min(jobs, files.streams.size());
+    if (read_ahead == automatic_read_ahead)
+        read_ahead = jobs / std::max(workers, std::size_t(1));
+    BOOST_FOREACH(Stream* stream, files.streams)
+        stream->set_read_ahead(read_ahead);
+    std::vector<boost::shared_ptr<detail::thread> > threads;
+    for (std::size_t i = 0; i < workers; ++i)
+        threads.push_back(boost::make_shared<detail::thread>(
+                                            &ThreadFiles<Stream>::work, &files));
+
+    // The start_join file could be absent if we were analyzing a single
+    // thread. See `d2::core::filesystem::start_join_file()` for info.
+    boost::exception_ptr segmentation_error;
+    try {
+        if (ordering_ == vector_clock_ordering) {
+            if (fs_.start_join_file())
+                build_vector_clocks(*fs_.start_join_file());
+        } else {
+            if (fs_.start_join_file())
+                build_segmentation_graph(*fs_.start_join_file());
+            happens_before_ = core::HappensBeforeIndex(sg_);
+        }
+    } catch (...) {
+        segmentation_error = boost::current_exception();
+    }
+
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i]->join();
+
+    if (segmentation_error)
+        boost::rethrow_exception(segmentation_error);
+
+    // The partial graphs are merged in the order of the files, so the lock
+    // graph does not depend on which worker parsed which file.
+    for (std::size_t i = 0; i < files.graphs.size(); ++i) {
+        if (files.errors[i])
+            boost::rethrow_exception(files.errors[i]);
+        merge_lock_graph(files.graphs[i], lg_, gatelocks_);
+        files.graphs[i] = core::LockGraph();
+    }
 }
 
 namespace {
@@ -1,12 +1,13 @@
 /**
- * This file implements the `build_segmentation_graph` method of the
- * `synchronization_skeleton` class.
+ * This file implements the `build_segmentation_graph` and
+ * `build_vector_clocks` methods of the `synchronization_skeleton` class.
  */
 
 #define D2_SOURCE
 #include <d2/core/build_segmentation_graph.hpp>
 #include <d2/core/events.hpp>
 #include <d2/core/synchronization_skeleton.hpp>
+#include <d2/core/vector_clock_index.hpp>
 #include <d2/detail/decl.hpp>
 
 #include <boost/graph/graphviz.hpp>
@@ -28,6 +29,15 @@ synchronization_skeleton::build_segmentation_graph(Stream& stream) {
     core::build_segmentation_graph<ignore_other_events>(first, last, sg_);
 }
 
+D2_DECL void synchronization_skeleton::build_vector_clocks(Stream& stream) {
+    typedef dyno::istream_iterator<
+                Stream, core::events::non_thread_specific
+            > Iterator;
+
+    Iterator first(stream), last;
+    clocks_ = core::VectorClockIndex(first, last);
+}
+
 namespace {
     template <typename SegmentMap>
     class SegmentWriter {
@@ -0,0 +1,85 @@
+/**
+ * This file implements the d2/detail/call_stack_table.hpp header.
+ */
+
+#define D2_SOURCE
+#include <d2/detail/call_stack_table.hpp>
+#include <d2/detail/decl.hpp>
+#include <d2/detail/lock_debug_info.hpp>
+
+#include <cstddef>
+#include <ios>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+
+namespace d2 {
+namespace detail {
+// Each call stack is written as a line holding its identifier and its
+// number of frames, followed by one line per frame holding the instruction
+// pointer, the module and the function of the frame, separated by tabs.
+
+D2_DECL void CallStackTable::write(std::ostream& os, CallStackId id,
+                                   LockDebugInfo const& info) {
+    os << id << ' ' << info.call_stack.size() << '\n';
+    BOOST_FOREACH(StackFrame const& frame, info.call_stack) {
+        os << std::hex << frame.ip << std::dec << '\t'
+           << frame.module << '\t' << frame.function << '\n';
+    }
+}
+
+D2_DECL std::ostream& operator<<(std::ostream& os, CallStackTable const& self){
+    for (std::size_t i = 0; i < self.stacks_.size(); ++i)
+        CallStackTable::write(os, i + 1, self.stacks_[i]);
+    return os;
+}
+
+namespace {
+    bool read_frame(std::istream& is, StackFrame& frame) {
+        std::string line;
+        if (!std::getline(is, line))
+            return false;
+        std::string::size_type const module = line.find('\t');
+        std::string::size_type const function =
+            module == std::string::npos ? module : line.find('\t', module + 1);
+        if (function == std::string::npos)
+            return false;
+
+        std::istringstream ip(line.substr(0, module));
+        if (!(ip >> std::hex >> frame.ip))
+            return false;
+        frame.module = line.substr(module + 1, function - module - 1);
+        frame.function = line.substr(function + 1);
+        return true;
+    }
+} // end anonymous namespace
+
+D2_DECL std::istream& operator>>(std::istream& is, CallStackTable& self) {
+    CallStackId id;
+    std::size_t size;
+    while (is >> id >> size && is.ignore(1)) {
+        LockDebugInfo info;
+        info.call_stack.resize(size);
+        for (std::size_t i = 0; i < size; ++i) {
+            if (!read_frame(is, info.call_stack[i])) {
+                is.setstate(std::ios::failbit);
+                return is;
+            }
+        }
+
+        if (id != self.size() + 1) {
+            is.setstate(std::ios::failbit);
+            return is;
+        }
+        self.push_back(info);
+    }
+
+    // Reaching the end of the stream is the normal way to stop reading.
+    if (is.eof())
+        is.clear(std::ios::eofbit);
+    return is;
+}
+} // end namespace detail
+} // end namespace d2
@@ -29,6 +29,19 @@ namespace {
             *out_++ = StackFrame(reinterpret_cast<std::size_t>(ip), name, module);
         }
     };
+
+    class StackFrameResolver : public dbg::symsink {
+        StackFrame* frame_;
+
+    public:
+        explicit StackFrameResolver(StackFrame& frame) : frame_(&frame) { }
+
+        virtual void process_function(void const*, char const* name,
+                                                   char const* module) {
+            frame_->function = name;
+            frame_->module = module;
+        }
+    };
 } // end anonymous namespace
 
 void LockDebugInfo::init_call_stack(unsigned int ignore /*= 0*/) {
@@ -46,5 +59,26 @@ void LockDebugInfo::init_call_stack(unsigned int ignore /*= 0*/) {
                     "not all the frames from the dbg::call_stack "
                     "were copied to this->call_stack");
 }
+
+void LockDebugInfo::init_raw_call_stack(unsigned int ignore /*= 0*/) {
+    dbg::call_stack<100> stack;
+    stack.collect(ignore + 1); // ignore our frame
+    call_stack.reserve(stack.size());
+
+    BOOST_STATIC_ASSERT(sizeof(std::size_t) >= sizeof(void const*));
+    for (unsigned int frame = 0; frame < stack.size(); ++frame)
+        call_stack.push_back(StackFrame(
+            reinterpret_cast<std::size_t>(stack.pc(frame)), "", ""));
+}
+
+void LockDebugInfo::resolve_call_stack() {
+    dbg::symdb symbols;
+    for (CallStack::iterator frame = call_stack.begin();
+                             frame != call_stack.end(); ++frame) {
+        StackFrameResolver sink(*frame);
+        symbols.lookup_function(reinterpret_cast<void const*>(frame->ip),
+                                sink);
+    }
+}
 } // end namespace detail
 } // end namespace d2
@@ -0,0 +1,93 @@
+/**
+ * This file implements the d2/detail/module_map.hpp header.
+ */
+
+#define D2_SOURCE
+#include <d2/detail/decl.hpp>
+#include <d2/detail/module_map.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <ios>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <string>
+
+#if defined(__linux__) || defined(__FreeBSD__)
+#   define D2_I_HAS_DL_ITERATE_PHDR
+#   include <link.h>
+#   include <unistd.h>
+#endif
+
+
+namespace d2 {
+namespace detail {
+namespace {
+#if defined(D2_I_HAS_DL_ITERATE_PHDR)
+    // The main executable has an empty name in `dl_iterate_phdr`.
+    std::string path_of_executable() {
+        char path[4096];
+        ssize_t const size = readlink("/proc/self/exe", path, sizeof path);
+        return size > 0 ? std::string(path, static_cast<std::size_t>(size))
+                        : std::string();
+    }
+
+    int add_module(dl_phdr_info* info, std::size_t, void* map_) {
+        ModuleMap& map = *static_cast<ModuleMap*>(map_);
+        std::size_t begin = std::numeric_limits<std::size_t>::max(), end = 0;
+        for (std::size_t i = 0; i < info->dlpi_phnum; ++i) {
+            ElfW(Phdr) const& segment = info->dlpi_phdr[i];
+            if (segment.p_type != PT_LOAD)
+                continue;
+            std::size_t const first = info->dlpi_addr + segment.p_vaddr;
+            begin = std::min(begin, first);
+            end = std::max(end, first + segment.p_memsz);
+        }
+
+        if (begin < end) {
+            std::string const path = info->dlpi_name && *info->dlpi_name
+                                        ? info->dlpi_name
+                                        : path_of_executable();
+            map.add(LoadedModule(begin, end, info->dlpi_addr, path));
+        }
+        return 0;
+    }
+#endif
+} // end anonymous namespace
+
+D2_DECL ModuleMap ModuleMap::of_current_process() {
+    ModuleMap map;
+#if defined(D2_I_HAS_DL_ITERATE_PHDR)
+    dl_iterate_phdr(add_module, &map);
+#endif
+    return map;
+}
+
+D2_DECL std::ostream& operator<<(std::ostream& os, ModuleMap const& self) {
+    std::ios::fmtflags const flags = os.flags();
+    os << std::hex;
+    for (std::size_t i = 0; i < self.modules_.size(); ++i) {
+        LoadedModule const& module = self.modules_[i];
+        os << module.begin << ' ' << module.end << ' ' << module.bias << ' '
+           << module.path << '\n';
+    }
+    os.flags(flags);
+    return os;
+}
+
+D2_DECL std::istream& operator>>(std::istream& is, ModuleMap& self) {
+    std::ios::fmtflags const flags = is.flags();
+    LoadedModule module;
+    while (is >> std::hex >> module.begin >> module.end >> module.bias &&
+           is.ignore(1) && std::getline(is, module.path))
+        self.add(module);
+
+    // Reaching the end of the stream is the normal way to stop reading.
+    if (is.eof())
+        is.clear(std::ios::eofbit);
+    is.flags(flags);
+    return is;
+}
+} // end namespace detail
+} // end namespace d2
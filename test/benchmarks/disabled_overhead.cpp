@@ -0,0 +1,68 @@
+/**
+ * This file contains a benchmark measuring the overhead of `d2` on the
+ * locking and unlocking of a mutex when event logging is disabled.
+ *
+ * Usage: benchmark_disabled_overhead [tolerance in percent]
+ *
+ * The benchmark fails if the overhead is above the tolerance, which
+ * defaults to 25%. An uncontended mutex is locked and unlocked in a few
+ * nanoseconds, so the check made by `d2` on each of these operations is
+ * already a noticeable fraction of it.
+ */
+
+#include <d2/basic_lockable.hpp>
+#include <d2/core/raw_api.hpp>
+
+#include <algorithm>
+#include <boost/thread/mutex.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+
+
+namespace {
+typedef boost::mutex raw_mutex;
+typedef d2::basic_lockable<boost::mutex> tracked_mutex;
+
+template <typename Mutex>
+double nanoseconds_per_lock(std::size_t iterations) {
+    Mutex mutex;
+    std::chrono::steady_clock::time_point const start =
+                                            std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        mutex.lock();
+        mutex.unlock();
+    }
+    std::chrono::steady_clock::duration const elapsed =
+                                    std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count()
+                                                                / iterations;
+}
+} // end anonymous namespace
+
+int main(int argc, char const* argv[]) {
+    double const tolerance = argc > 1 ? std::atof(argv[1]) : 25.0;
+    std::size_t const iterations = 10000000;
+    std::size_t const runs = 10;
+
+    d2::core::disable_event_logging();
+
+    // We keep the best time of several interleaved runs to filter out the
+    // noise caused by the rest of the system.
+    double raw = std::numeric_limits<double>::max();
+    double tracked = std::numeric_limits<double>::max();
+    for (std::size_t run = 0; run < runs; ++run) {
+        raw = std::min(raw, nanoseconds_per_lock<raw_mutex>(iterations));
+        tracked = std::min(tracked,
+                           nanoseconds_per_lock<tracked_mutex>(iterations));
+    }
+
+    double const overhead = (tracked - raw) / raw * 100.0;
+    std::cout << "uninstrumented mutex:         " << raw << " ns\n"
+              << "d2 mutex, logging disabled:   " << tracked << " ns\n"
+              << "overhead:                     " << overhead << "%\n";
+
+    return overhead <= tolerance ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,200 @@
+/**
+ * This file contains a benchmark measuring the latency and the throughput of
+ * the locking and unlocking of mutexes tracked by `d2`, compared to the
+ * same mutexes without `d2`.
+ *
+ * Usage: benchmark_lock_overhead [max threads] [lock pairs per thread]
+ *
+ * Each configuration is a number of threads (1, 2, 4, ... up to the maximum,
+ * which defaults to the number of hardware threads), a nesting depth, and
+ * whether the threads share their mutexes (contended) or have their own
+ * (uncontended). Each configuration is run with:
+ *  - raw:      the uninstrumented mutex;
+ *  - disabled: a `d2::basic_lockable` with event logging disabled;
+ *  - nostacks: event logging enabled without capturing any call stack,
+ *              which is the cost of logging the events alone;
+ *  - stacks:   event logging enabled and every call stack captured;
+ *  - sampled:  event logging enabled and a single call stack captured per
+ *              lock-order pair, which removes the cost of walking the
+ *              stack from nearly every acquisition.
+ *
+ * The threads lock and unlock their mutexes in batches, and the duration of
+ * each batch divided by its size is a latency sample. The percentiles of
+ * these samples, over all the threads, are reported in nanoseconds per
+ * lock/unlock pair, along with the total throughput in millions of pairs per
+ * second.
+ */
+
+#include <d2/basic_lockable.hpp>
+#include <d2/core/raw_api.hpp>
+#include <d2/standard_thread.hpp>
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace {
+typedef boost::mutex raw_mutex;
+typedef d2::basic_lockable<boost::mutex> tracked_mutex;
+typedef std::chrono::steady_clock clock_type;
+
+//! Number of lock/unlock pairs timed together as one latency sample.
+std::size_t const batch_size = 64;
+
+struct configuration {
+    std::size_t threads;
+    std::size_t depth;
+    bool contended;
+};
+
+struct results {
+    std::vector<double> samples; // in ns per lock/unlock pair
+    double seconds;
+    std::size_t pairs;
+};
+
+// Lock and unlock `depth` nested mutexes starting at `mutexes`, `batches`
+// times `batch_size` times, and record the latency of each batch.
+template <typename Mutex>
+void lock_unlock(Mutex* mutexes, std::size_t depth, std::size_t batches,
+                 std::vector<double>& samples) {
+    samples.reserve(batches);
+    for (std::size_t batch = 0; batch < batches; ++batch) {
+        clock_type::time_point const start = clock_type::now();
+        for (std::size_t i = 0; i < batch_size; ++i) {
+            for (std::size_t level = 0; level < depth; ++level)
+                mutexes[level].lock();
+            for (std::size_t level = depth; level > 0; --level)
+                mutexes[level - 1].unlock();
+        }
+        clock_type::duration const elapsed = clock_type::now() - start;
+        samples.push_back(
+            std::chrono::duration<double, std::nano>(elapsed).count()
+                                                    / (batch_size * depth));
+    }
+}
+
+template <typename Mutex>
+results run(configuration const& config, std::size_t pairs) {
+    // Contended threads share the same mutexes, and the others each have
+    // their own.
+    std::size_t const sets = config.contended ? 1 : config.threads;
+    std::unique_ptr<Mutex[]> mutexes(new Mutex[sets * config.depth]);
+    std::size_t const batches =
+                        std::max<std::size_t>(1, pairs / config.depth
+                                                       / batch_size);
+    std::vector<std::vector<double> > samples(config.threads);
+
+    clock_type::time_point const start = clock_type::now();
+    {
+        std::vector<d2::standard_thread<boost::thread>*> threads;
+        for (std::size_t t = 0; t < config.threads; ++t) {
+            Mutex* own = &mutexes[(config.contended ? 0 : t) * config.depth];
+            std::vector<double>* own_samples = &samples[t];
+            std::size_t const depth = config.depth;
+            threads.push_back(new d2::standard_thread<boost::thread>(
+                [=] { lock_unlock(own, depth, batches, *own_samples); }));
+        }
+        for (std::size_t t = 0; t < threads.size(); ++t) {
+            threads[t]->join();
+            delete threads[t];
+        }
+    }
+    clock_type::duration const elapsed = clock_type::now() - start;
+
+    results result;
+    for (std::size_t t = 0; t < samples.size(); ++t)
+        result.samples.insert(result.samples.end(),
+                              samples[t].begin(), samples[t].end());
+    std::sort(result.samples.begin(), result.samples.end());
+    result.seconds = std::chrono::duration<double>(elapsed).count();
+    result.pairs = config.threads * batches * batch_size * config.depth;
+    return result;
+}
+
+double percentile(std::vector<double> const& sorted, double p) {
+    std::size_t const index =
+            static_cast<std::size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+void report(std::string const& mode, configuration const& config,
+            results const& result) {
+    std::cout << std::setw(9) << mode
+              << std::setw(8) << config.threads
+              << std::setw(6) << config.depth
+              << std::setw(11) << (config.contended ? "yes" : "no")
+              << std::fixed << std::setprecision(1)
+              << std::setw(9) << percentile(result.samples, 50)
+              << std::setw(9) << percentile(result.samples, 90)
+              << std::setw(9) << percentile(result.samples, 99)
+              << std::setw(10) << percentile(result.samples, 99.9)
+              << std::setw(10) << result.samples.back()
+              << std::setprecision(2)
+              << std::setw(12) << result.pairs / result.seconds / 1e6
+              << std::endl;
+}
+} // end anonymous namespace
+
+int main(int argc, char const* argv[]) {
+    std::size_t const max_threads = argc > 1
+                    ? std::strtoul(argv[1], NULL, 10)
+                    : std::max(1u, boost::thread::hardware_concurrency());
+    std::size_t const pairs = argc > 2 ? std::strtoul(argv[2], NULL, 10)
+                                       : 1000000;
+    std::size_t const depths[] = {1, 4};
+
+    boost::filesystem::path const root =
+        boost::filesystem::temp_directory_path() /
+        boost::filesystem::unique_path("d2-benchmark-%%%%-%%%%-%%%%");
+
+    std::cout << "     mode threads depth contended      p50      p90      "
+                 "p99    p99.9       max  Mpairs/s\n";
+
+    std::size_t repository = 0;
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2)
+    for (std::size_t d = 0; d < sizeof depths / sizeof *depths; ++d)
+    for (int contended = 0; contended < 2; ++contended) {
+        configuration const config = {threads, depths[d], contended != 0};
+        if (threads == 1 && config.contended)
+            continue;
+
+        d2::core::disable_event_logging();
+        report("raw", config, run<raw_mutex>(config, pairs));
+        report("disabled", config, run<tracked_mutex>(config, pairs));
+
+        // Every call stack is captured unless a number of samples is set,
+        // and none is captured with 0 samples.
+        std::size_t const samples[] = {0, static_cast<std::size_t>(-1), 1};
+        char const* const names[] = {"nostacks", "stacks", "sampled"};
+        for (std::size_t s = 0; s < sizeof samples / sizeof *samples; ++s) {
+            std::ostringstream path;
+            path << (root / "repository").string() << repository++;
+            d2::core::set_call_stack_samples(samples[s]);
+            if (d2::core::set_log_repository(path.str()) != 0) {
+                std::cerr << "unable to set the repository at "
+                          << path.str() << std::endl;
+                return EXIT_FAILURE;
+            }
+            d2::core::enable_event_logging();
+            report(names[s], config, run<tracked_mutex>(config, pairs));
+            d2::core::disable_event_logging();
+            d2::core::unset_log_repository();
+        }
+    }
+
+    boost::system::error_code ignored;
+    boost::filesystem::remove_all(root, ignored);
+    return EXIT_SUCCESS;
+}
@@ -143,11 +143,28 @@ check_scenario(boost::function<void()> const& scenario,
     d2::core::disable_event_logging();
     d2::core::unset_log_repository();
 
-    d2::core::synchronization_skeleton skeleton(directory);
+    // The repository is also loaded and analyzed in parallel, so that the
+    // scenarios check that the deadlocks found and their order don't depend
+    // on the number of jobs.
+    d2::core::synchronization_skeleton skeleton(directory, 1);
+    d2::core::synchronization_skeleton const parallel(directory, 4);
     std::vector<d2::core::potential_deadlock> actual, expected;
     boost::copy(skeleton.deadlocks(), std::back_inserter(actual));
     boost::transform(expected_, std::back_inserter(expected), to_d2_deadlock);
 
+    std::vector<d2::core::potential_deadlock> const
+                                        actual_parallel = parallel.deadlocks();
+    // Note: `potential_deadlock`s are only less-than comparable.
+    if (actual < actual_parallel || actual_parallel < actual) {
+        std::cout << "deadlocks found with 1 job:\n";
+        BOOST_FOREACH(d2::core::potential_deadlock const& dl, actual)
+            std::cout << dl << '\n';
+        std::cout << "deadlocks found with 4 jobs:\n";
+        BOOST_FOREACH(d2::core::potential_deadlock const& dl, actual_parallel)
+            std::cout << dl << '\n';
+        return EXIT_FAILURE;
+    }
+
     if (!check_scenario_results(expected, actual)) {
         std::cout << "Segmentation graph\n"
                      "------------------\n";
@@ -0,0 +1,376 @@
+/**
+ * This file contains unit tests for the search of potential deadlocks in
+ * the lock graph.
+ *
+ * The search is compared with the algorithm it replaced, which enumerated
+ * the circuits of the lock graph with `boost::hawick_unique_circuits`,
+ * expanded each of them to all the cycles of edges going through its
+ * vertices, and then kept the cycles whose edges satisfied the deadlock
+ * conditions pairwise.
+ */
+
+#include <d2/core/analysis.hpp>
+#include <d2/core/build_segmentation_graph.hpp>
+#include <d2/core/compact_lock_graph.hpp>
+#include <d2/core/happens_before_index.hpp>
+#include <d2/core/lock_graph.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/segmentation_graph.hpp>
+#include <d2/core/thread_id.hpp>
+
+#include <algorithm>
+#include <boost/foreach.hpp>
+#include <boost/graph/graph_traits.hpp>
+#include <boost/graph/hawick_circuits.hpp>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <vector>
+
+
+using namespace d2;
+
+namespace {
+typedef boost::graph_traits<core::LockGraph>::vertex_descriptor Vertex;
+typedef boost::graph_traits<core::LockGraph>::edge_descriptor Edge;
+
+// A cycle, as the numbers of its edges in the order they were added.
+typedef std::vector<std::size_t> Cycle;
+typedef core::CompactLockGraph<core::LockGraph> CompactLockGraph;
+
+struct collect_circuits {
+    explicit collect_circuits(std::vector<std::vector<Vertex> >& circuits)
+        : circuits_(&circuits)
+    { }
+
+    template <typename Path, typename Graph>
+    void cycle(Path const& path, Graph const&) const {
+        circuits_->push_back(std::vector<Vertex>(path.begin(), path.end()));
+    }
+
+private:
+    std::vector<std::vector<Vertex> >* circuits_;
+};
+
+struct collect_components {
+    explicit collect_components(std::vector<std::vector<Vertex> >& components)
+        : components_(&components)
+    { }
+
+    void operator()(std::vector<Vertex> const& component) const {
+        components_->push_back(component);
+    }
+
+private:
+    std::vector<std::vector<Vertex> >* components_;
+};
+
+struct analysis_test : testing::Test {
+    core::LockGraph graph;
+    core::SegmentationGraph segmentation;
+    core::GatelockTable gatelocks;
+    std::vector<Segment> segments;
+    std::vector<Vertex> locks;
+    std::vector<Edge> edges;
+
+    void SetUp() {
+        //      0   1   2
+        // t0   o___o___o
+        // t1   |___o
+        //
+        //      3   4   5
+        // t2   o___o   o
+        for (std::size_t i = 0; i < 6; ++i) {
+            segments.push_back(Segment() + i);
+            add_vertex(segments.back(), segmentation);
+        }
+        add_edge(0, 1, segmentation);
+        add_edge(1, 2, segmentation);
+        add_edge(3, 4, segmentation);
+
+        for (std::size_t i = 0; i < 6; ++i)
+            locks.push_back(add_vertex(LockId(i), graph));
+    }
+
+    void add_lock_edge(std::size_t u, std::size_t v, std::size_t thread,
+                       std::vector<LockId> const& held = std::vector<LockId>(),
+                       std::size_t s1 = 5, std::size_t s2 = 5) {
+        // Each edge is numbered by the call stack of its first lock, so it
+        // can be told apart in the compact graphs.
+        core::LockGraphLabel label(segments[s1], ThreadId(thread),
+                                   gatelocks.intern(held), segments[s2]);
+        label.l1_info = edges.size();
+        edges.push_back(add_edge(locks[u], locks[v], label, graph).first);
+    }
+
+    // Return `numbers` starting from the lowest one, so a cycle can be
+    // compared with the same cycle found elsewhere.
+    static Cycle normalize(Cycle numbers) {
+        std::rotate(numbers.begin(),
+                    std::min_element(numbers.begin(), numbers.end()),
+                    numbers.end());
+        return numbers;
+    }
+
+    struct record {
+        explicit record(std::vector<Cycle>& cycles) : cycles_(&cycles) { }
+
+        void operator()(std::vector<std::size_t> const& cycle,
+                        CompactLockGraph const& graph) const {
+            Cycle numbers;
+            BOOST_FOREACH(std::size_t e, cycle)
+                numbers.push_back(graph.l1_info(e));
+            cycles_->push_back(normalize(numbers));
+        }
+
+    private:
+        std::vector<Cycle>* cycles_;
+    };
+
+    // Return the cycles found by the search, in the order it found them.
+    std::vector<Cycle> search(std::size_t jobs = 1) const {
+        std::vector<Cycle> cycles;
+        core::HappensBeforeIndex const index(segmentation);
+        core::analyze(graph, index, record(cycles), jobs);
+        return cycles;
+    }
+
+    // Return whether the edges `e1` and `e2` may be part of the same
+    // potential deadlock, like the previous algorithm did.
+    bool old_conditions(Edge e1, Edge e2) const {
+        core::LockGraphLabel const& l1 = graph[e1];
+        core::LockGraphLabel const& l2 = graph[e2];
+        if (thread_of(l1) == thread_of(l2))
+            return false;
+        BOOST_FOREACH(LockId const& lock, gatelocks_of(l1).get<1>())
+            if (gatelocks_of(l2).find(lock) != gatelocks_of(l2).end())
+                return false;
+        return !core::happens_before(l1.s2, l2.s1, segmentation);
+    }
+
+    // Add to `cycles` the cycles of edges going through the vertices of
+    // `circuit` from its `i`-th vertex on, after the edges in `path`.
+    void expand(std::vector<Vertex> const& circuit, std::size_t i,
+                std::vector<Edge>& path, std::vector<Cycle>& cycles) const {
+        if (i == circuit.size()) {
+            for (std::size_t a = 0; a < path.size(); ++a)
+                for (std::size_t b = 0; b < path.size(); ++b)
+                    if (a != b && !old_conditions(path[a], path[b]))
+                        return;
+            Cycle numbers;
+            BOOST_FOREACH(Edge e, path)
+                numbers.push_back(graph[e].l1_info);
+            cycles.push_back(normalize(numbers));
+            return;
+        }
+        Vertex const v = circuit[(i + 1) % circuit.size()];
+        BOOST_FOREACH(Edge e, out_edges(circuit[i], graph)) {
+            if (target(e, graph) != v)
+                continue;
+            path.push_back(e);
+            expand(circuit, i + 1, path, cycles);
+            path.pop_back();
+        }
+    }
+
+    // Return the cycles found by the previous algorithm, sorted.
+    std::vector<Cycle> reference() const {
+        std::vector<std::vector<Vertex> > circuits;
+        boost::hawick_unique_circuits(graph, collect_circuits(circuits));
+
+        std::vector<Cycle> cycles;
+        std::vector<Edge> path;
+        BOOST_FOREACH(std::vector<Vertex> const& circuit, circuits) {
+            // Self loops are not potential deadlocks.
+            if (circuit.size() >= 2)
+                expand(circuit, 0, path, cycles);
+        }
+        std::sort(cycles.begin(), cycles.end());
+        return cycles;
+    }
+
+    // Check that the search finds the same cycles as the previous
+    // algorithm, each of them once, and return them.
+    std::vector<Cycle> expect_same_as_reference() {
+        std::vector<Cycle> found = search();
+        std::sort(found.begin(), found.end());
+        EXPECT_TRUE(std::adjacent_find(found.begin(), found.end())
+                                                            == found.end());
+        EXPECT_EQ(reference(), found);
+        return found;
+    }
+};
+
+std::vector<LockId> held(std::size_t a) {
+    return std::vector<LockId>(1, LockId(a));
+}
+
+TEST_F(analysis_test, empty_graph_has_no_deadlocks) {
+    EXPECT_TRUE(expect_same_as_reference().empty());
+}
+
+TEST_F(analysis_test, ABBA_is_found) {
+    add_lock_edge(0, 1, 0);
+    add_lock_edge(1, 0, 1);
+
+    EXPECT_EQ(1u, expect_same_as_reference().size());
+}
+
+TEST_F(analysis_test, same_thread_cycles_are_not_deadlocks) {
+    add_lock_edge(0, 1, 0);
+    add_lock_edge(1, 0, 0);
+    add_lock_edge(1, 2, 0);
+    add_lock_edge(2, 0, 0);
+
+    EXPECT_TRUE(expect_same_as_reference().empty());
+}
+
+TEST_F(analysis_test, parallel_edges_give_distinct_deadlocks) {
+    add_lock_edge(0, 1, 0);
+    add_lock_edge(0, 1, 2);
+    add_lock_edge(1, 0, 1);
+    add_lock_edge(1, 0, 2);
+
+    // Both edges of thread 2 can't be in the same deadlock.
+    EXPECT_EQ(3u, expect_same_as_reference().size());
+}
+
+TEST_F(analysis_test, shared_gatelocks_prevent_deadlocks) {
+    add_lock_edge(0, 1, 0, held(4));
+    add_lock_edge(1, 0, 1, held(4));
+    add_lock_edge(1, 2, 1, held(5));
+    add_lock_edge(2, 0, 2, held(4));
+
+    EXPECT_TRUE(expect_same_as_reference().empty());
+}
+
+TEST_F(analysis_test, distinct_gatelocks_allow_deadlocks) {
+    add_lock_edge(0, 1, 0, held(4));
+    add_lock_edge(1, 0, 1, held(5));
+
+    EXPECT_EQ(1u, expect_same_as_reference().size());
+}
+
+TEST_F(analysis_test, ordered_segments_prevent_deadlocks) {
+    // The second edge starts after the first one ends.
+    add_lock_edge(0, 1, 0, std::vector<LockId>(), 0, 0);
+    add_lock_edge(1, 0, 1, std::vector<LockId>(), 1, 1);
+    // These two are in unordered segments.
+    add_lock_edge(2, 3, 0, std::vector<LockId>(), 2, 2);
+    add_lock_edge(3, 2, 2, std::vector<LockId>(), 3, 4);
+
+    EXPECT_EQ(1u, expect_same_as_reference().size());
+}
+
+TEST_F(analysis_test, cycles_are_found_once_from_any_start) {
+    // Three threads going around the same vertices, in both directions,
+    // so the cycles don't start at the first vertex of the graph.
+    add_lock_edge(3, 1, 0);
+    add_lock_edge(1, 2, 1);
+    add_lock_edge(2, 3, 2);
+    add_lock_edge(2, 1, 0);
+    add_lock_edge(1, 3, 2);
+    add_lock_edge(3, 2, 1);
+
+    expect_same_as_reference();
+}
+
+TEST_F(analysis_test, components_are_searched_separately) {
+    // Two components with a deadlock each, connected by edges that are on
+    // no cycle, and a component of a single thread.
+    add_lock_edge(0, 1, 0);
+    add_lock_edge(1, 0, 1);
+    add_lock_edge(1, 2, 0);
+    add_lock_edge(2, 3, 1);
+    add_lock_edge(3, 2, 2);
+    add_lock_edge(4, 5, 1);
+    add_lock_edge(5, 4, 1);
+    add_lock_edge(3, 4, 2);
+
+    EXPECT_EQ(2u, expect_same_as_reference().size());
+}
+
+TEST_F(analysis_test, self_loops_are_not_deadlocks) {
+    add_lock_edge(0, 0, 0);
+    add_lock_edge(0, 1, 1);
+    add_lock_edge(1, 0, 2);
+
+    EXPECT_EQ(1u, expect_same_as_reference().size());
+}
+
+TEST_F(analysis_test, cyclic_components_drop_single_thread_components) {
+    add_lock_edge(0, 1, 0);
+    add_lock_edge(1, 0, 1);
+    add_lock_edge(1, 2, 0);
+    add_lock_edge(2, 3, 1);
+    add_lock_edge(3, 4, 2);
+    add_lock_edge(4, 5, 1);
+    add_lock_edge(5, 4, 1);
+
+    std::vector<std::vector<Vertex> > components;
+    analysis_detail::for_each_cyclic_component(graph,
+        collect_components(components));
+
+    ASSERT_EQ(1u, components.size());
+    ASSERT_EQ(2u, components[0].size());
+    EXPECT_EQ(locks[0], components[0][0]);
+    EXPECT_EQ(locks[1], components[0][1]);
+}
+
+TEST_F(analysis_test, several_jobs_find_the_same_deadlocks_in_order) {
+    // Three components with deadlocks, each with parallel edges.
+    add_lock_edge(0, 1, 0);
+    add_lock_edge(0, 1, 2);
+    add_lock_edge(1, 0, 1);
+    add_lock_edge(1, 2, 0);
+    add_lock_edge(2, 3, 1);
+    add_lock_edge(3, 2, 2);
+    add_lock_edge(3, 2, 0);
+    add_lock_edge(3, 4, 2);
+    add_lock_edge(4, 5, 1);
+    add_lock_edge(5, 4, 0);
+    add_lock_edge(5, 4, 2);
+
+    std::vector<Cycle> const sequential = search(1);
+    EXPECT_EQ(6u, sequential.size());
+    for (std::size_t jobs = 2; jobs <= 8; ++jobs) {
+        SCOPED_TRACE(testing::Message() << jobs << " jobs");
+        EXPECT_EQ(sequential, search(jobs));
+    }
+}
+
+// Deterministic generator, so the graphs are the same on every run.
+struct generator {
+    explicit generator(unsigned long seed) : state_(seed) { }
+
+    std::size_t operator()(std::size_t n) {
+        state_ = state_ * 6364136223846793005ul + 1442695040888963407ul;
+        return static_cast<std::size_t>(state_ >> 33) % n;
+    }
+
+private:
+    unsigned long state_;
+};
+
+TEST_F(analysis_test, random_graphs_agree_with_the_reference) {
+    for (unsigned long seed = 0; seed < 200; ++seed) {
+        BOOST_FOREACH(Vertex v, locks)
+            clear_out_edges(v, graph);
+        edges.clear();
+
+        generator random(seed);
+        std::size_t const count = 4 + random(10);
+        for (std::size_t i = 0; i < count; ++i) {
+            std::vector<LockId> locks_held;
+            if (random(3) == 0)
+                locks_held.push_back(LockId(6 + random(2)));
+            add_lock_edge(random(5), random(5), random(4), locks_held,
+                          random(6), random(6));
+        }
+
+        SCOPED_TRACE(testing::Message() << "seed " << seed);
+        expect_same_as_reference();
+        EXPECT_EQ(search(1), search(3));
+    }
+}
+} // end anonymous namespace
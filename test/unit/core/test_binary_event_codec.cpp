@@ -0,0 +1,212 @@
+/**
+ * This file contains unit tests for the binary format of the events.
+ */
+
+#include <d2/core/binary_event_codec.hpp>
+#include <d2/core/events.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/thread_id.hpp>
+
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace d2 { namespace core { namespace events {
+    // Equality operators required to compare the variants of events.
+    static bool operator==(acquire const& a, acquire const& b) {
+        return thread_of(a) == thread_of(b) && lock_of(a) == lock_of(b) &&
+               aux_info_of(a) == aux_info_of(b);
+    }
+
+    static bool operator==(segment_hop const& a, segment_hop const& b) {
+        return thread_of(a) == thread_of(b) && segment_of(a) == segment_of(b);
+    }
+
+    static bool operator==(lock_order const& a, lock_order const& b) {
+        return thread_of(a) == thread_of(b) &&
+               a.l1 == b.l1 && a.l2 == b.l2 && a.s1 == b.s1 &&
+               a.s2 == b.s2 && a.gatelocks == b.gatelocks &&
+               a.l1_info == b.l1_info && a.l2_info == b.l2_info &&
+               a.occurrences == b.occurrences;
+    }
+
+    static bool operator==(start const& a, start const& b) {
+        return parent_of(a) == parent_of(b) &&
+               new_parent_of(a) == new_parent_of(b) &&
+               child_of(a) == child_of(b);
+    }
+}}}
+
+using namespace d2;
+namespace ev = d2::core::events;
+
+namespace {
+struct binary_event_codec_test : testing::Test {
+    std::stringstream stream;
+    std::vector<ev::thread_specific> thread_events;
+    std::vector<ev::non_thread_specific> other_events;
+
+    void write_all() {
+        core::binary_event_encoder encoder(stream);
+        encoder.write_header();
+        for (std::size_t i = 0; i < thread_events.size(); ++i)
+            encoder.write(thread_events[i]);
+        for (std::size_t i = 0; i < other_events.size(); ++i)
+            encoder.write(other_events[i]);
+    }
+
+    void check_all() {
+        core::binary_event_decoder decoder(stream);
+        ASSERT_TRUE(decoder.read_header());
+        for (std::size_t i = 0; i < thread_events.size(); ++i) {
+            ev::thread_specific event;
+            decoder.read(event);
+            ASSERT_TRUE(stream.good());
+            EXPECT_TRUE(thread_events[i] == event);
+        }
+        for (std::size_t i = 0; i < other_events.size(); ++i) {
+            ev::non_thread_specific event;
+            decoder.read(event);
+            ASSERT_TRUE(stream.good());
+            EXPECT_TRUE(other_events[i] == event);
+        }
+
+        ev::non_thread_specific event;
+        decoder.read(event);
+        EXPECT_TRUE(stream.eof());
+        EXPECT_TRUE(stream.fail());
+    }
+};
+
+TEST_F(binary_event_codec_test, empty_stream_has_a_header_only) {
+    write_all();
+    check_all();
+}
+
+TEST_F(binary_event_codec_test, stream_without_header_is_left_untouched) {
+    stream << "22 serialization::archive";
+    core::binary_event_decoder decoder(stream);
+    EXPECT_FALSE(decoder.read_header());
+    std::string word;
+    stream >> word;
+    EXPECT_EQ("22", word);
+}
+
+TEST_F(binary_event_codec_test, all_events_are_read_back) {
+    ThreadId t1(1), t2(std::size_t(-1));
+    LockId l1(0), l2(123456789), l3(3);
+    Segment s0, s1 = s0 + 1, s2 = s0 + 1000000;
+
+    ev::acquire acquire(t1, l2);
+    aux_info_of(acquire) = 1;
+    thread_events.push_back(acquire);
+    thread_events.push_back(ev::recursive_acquire(t2, l1));
+    thread_events.push_back(ev::recursive_release(t2, l1));
+    ev::release release(t1, l3);
+    aux_info_of(release) = 123456;
+    thread_events.push_back(release);
+    thread_events.push_back(ev::segment_hop(t1, s2));
+    thread_events.push_back(ev::segment_hop(t2, s1));
+    thread_events.push_back(acquire);
+
+    ev::lock_order order(t2);
+    order.l1 = l3;
+    order.l2 = l2;
+    order.s1 = s1;
+    order.s2 = s2;
+    order.gatelocks.push_back(l1);
+    order.gatelocks.push_back(l3);
+    order.l1_info = 12;
+    order.l2_info = 34;
+    order.occurrences = 567;
+    thread_events.push_back(order);
+    thread_events.push_back(ev::lock_order(t1));
+
+    other_events.push_back(ev::start(s0, s1, s2));
+    other_events.push_back(ev::join(s2, s1, s0));
+
+    write_all();
+    check_all();
+}
+
+TEST_F(binary_event_codec_test, repeated_events_are_small) {
+    ev::acquire acquire(ThreadId(99), LockId(12345));
+    aux_info_of(acquire) = 42;
+    for (std::size_t i = 0; i < 100; ++i)
+        thread_events.push_back(acquire);
+    write_all();
+
+    // kind, thread, lock and call stack
+    std::size_t const size_of_repeated_event = 4;
+    std::size_t const size_of_first_event = 16;
+    EXPECT_GT(size_of_first_event + 99 * size_of_repeated_event,
+              stream.str().size());
+    check_all();
+}
+
+TEST_F(binary_event_codec_test, zero_byte_ends_the_events) {
+    thread_events.push_back(ev::acquire(ThreadId(1), LockId(2)));
+    thread_events.push_back(ev::release(ThreadId(1), LockId(2)));
+    write_all();
+    // This is what the unused tail of a memory mapped file looks like.
+    stream << std::string(100, '\0');
+    check_all();
+}
+
+TEST_F(binary_event_codec_test, events_appended_after_a_header_start_over) {
+    thread_events.push_back(ev::acquire(ThreadId(7), LockId(200)));
+    thread_events.push_back(ev::segment_hop(ThreadId(7), Segment() + 30));
+    write_all();
+
+    // A new encoder appending to the stream knows nothing of the values
+    // written before, as when a file is opened again.
+    ev::thread_specific const appended = ev::release(ThreadId(7), LockId(100));
+    core::binary_event_encoder encoder(stream);
+    encoder.write_header();
+    encoder.write(appended);
+    encoder.write(appended);
+    thread_events.push_back(appended);
+    thread_events.push_back(appended);
+    check_all();
+
+    stream.clear();
+    stream.seekg(0);
+    core::binary_event_decoder decoder(stream);
+    ASSERT_TRUE(decoder.read_header());
+    std::size_t skipped = 0;
+    while (decoder.skip())
+        ++skipped;
+    EXPECT_EQ(thread_events.size(), skipped);
+}
+
+TEST_F(binary_event_codec_test, truncated_event_sets_failbit) {
+    ev::acquire acquire(ThreadId(99), LockId(12345));
+    aux_info_of(acquire) = 123456;
+    thread_events.push_back(acquire);
+    write_all();
+
+    std::string const data = stream.str();
+    std::stringstream truncated(data.substr(0, data.size() - 2));
+    core::binary_event_decoder decoder(truncated);
+    ASSERT_TRUE(decoder.read_header());
+    ev::thread_specific event;
+    decoder.read(event);
+    EXPECT_TRUE(truncated.fail());
+}
+
+TEST_F(binary_event_codec_test, event_of_unexpected_kind_sets_failbit) {
+    other_events.push_back(ev::start(Segment(), Segment(), Segment()));
+    write_all();
+
+    core::binary_event_decoder decoder(stream);
+    ASSERT_TRUE(decoder.read_header());
+    ev::thread_specific event;
+    decoder.read(event);
+    EXPECT_TRUE(stream.fail());
+    EXPECT_FALSE(stream.eof());
+}
+} // end anonymous namespace
@@ -0,0 +1,183 @@
+/**
+ * This file contains unit tests for the deduplication of the edges of the
+ * lock graph by `build_lock_graph`.
+ */
+
+#include <d2/core/analysis.hpp>
+#include <d2/core/build_lock_graph.hpp>
+#include <d2/core/compact_lock_graph.hpp>
+#include <d2/core/events.hpp>
+#include <d2/core/happens_before_index.hpp>
+#include <d2/core/lock_graph.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/segmentation_graph.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/call_stack_table.hpp>
+
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <vector>
+
+
+using namespace d2;
+namespace ev = d2::core::events;
+
+namespace {
+struct count_deadlocks {
+    explicit count_deadlocks(std::size_t& count) : count_(&count) { }
+
+    void operator()(std::vector<std::size_t> const&,
+                    core::CompactLockGraph<core::LockGraph> const&) const {
+        ++*count_;
+    }
+
+private:
+    std::size_t* count_;
+};
+
+struct build_lock_graph_test : testing::Test {
+    ThreadId thread;
+    LockId A, B, C;
+    std::vector<ev::thread_specific> events;
+
+    build_lock_graph_test()
+        : thread(1), A(10), B(11), C(12)
+    {
+        hop(Segment() + 1);
+    }
+
+    void hop(Segment const& segment) {
+        events.push_back(ev::segment_hop(thread, segment));
+    }
+
+    void acquire(LockId const& lock, detail::CallStackId info = 1) {
+        ev::acquire event(thread, lock);
+        aux_info_of(event) = info;
+        events.push_back(event);
+    }
+
+    void release(LockId const& lock) {
+        events.push_back(ev::release(thread, lock));
+    }
+
+    // Acquire `A` and then `B` at the given call stacks, and release both.
+    void acquire_AB(detail::CallStackId a_info = 1,
+                    detail::CallStackId b_info = 1) {
+        acquire(A, a_info);
+        acquire(B, b_info);
+        release(B);
+        release(A);
+    }
+};
+
+TEST_F(build_lock_graph_test, duplicate_acquisitions_add_one_edge) {
+    for (std::size_t i = 0; i < 10; ++i)
+        acquire_AB();
+
+    core::LockGraph graph;
+    core::build_lock_graph<false>(events, graph);
+    EXPECT_EQ(2u, num_vertices(graph));
+    EXPECT_EQ(1u, num_edges(graph));
+}
+
+TEST_F(build_lock_graph_test, distinct_call_stacks_add_distinct_edges) {
+    acquire_AB(1, 1);
+    acquire_AB(2, 1);
+    acquire_AB(1, 2);
+    acquire_AB(1, 1);
+
+    core::LockGraph graph;
+    core::build_lock_graph<false>(events, graph);
+    EXPECT_EQ(3u, num_edges(graph));
+}
+
+TEST_F(build_lock_graph_test, distinct_segments_add_distinct_edges) {
+    acquire(A);
+    hop(Segment() + 2);
+    acquire(B);
+    release(B);
+    release(A);
+    acquire_AB();
+    hop(Segment() + 3);
+    acquire_AB();
+    acquire_AB();
+
+    core::LockGraph graph;
+    core::build_lock_graph<false>(events, graph);
+    EXPECT_EQ(3u, num_edges(graph));
+}
+
+TEST_F(build_lock_graph_test, distinct_gatelocks_add_distinct_edges) {
+    acquire_AB();
+    acquire(C);
+    acquire_AB();
+    acquire_AB();
+    release(C);
+
+    // C -> A, C -> B, and A -> B with and without C held.
+    core::LockGraph graph;
+    core::build_lock_graph<false>(events, graph);
+    EXPECT_EQ(4u, num_edges(graph));
+}
+
+TEST_F(build_lock_graph_test, edges_are_deduplicated_across_calls) {
+    acquire_AB();
+    acquire_AB(2, 1);
+
+    core::LockGraph graph;
+    core::GatelockTable gatelocks;
+    core::EdgeIndex<core::LockGraph> edges;
+    core::build_lock_graph<false>(events.begin(), events.end(), graph,
+                                  gatelocks, edges);
+    core::build_lock_graph<false>(events.begin(), events.end(), graph,
+                                  gatelocks, edges);
+    EXPECT_EQ(2u, num_edges(graph));
+    EXPECT_EQ(2u, edges.size());
+}
+
+TEST_F(build_lock_graph_test, edges_already_in_the_graph_are_indexed) {
+    acquire_AB();
+
+    core::LockGraph graph;
+    core::build_lock_graph<false>(events, graph);
+    core::build_lock_graph<false>(events, graph);
+    EXPECT_EQ(1u, num_edges(graph));
+}
+
+TEST_F(build_lock_graph_test, graphs_built_over_several_calls_are_analyzed) {
+    // The first call interns {B} and then {A}, and the second call meets
+    // {A} first, so their tables give distinct numbers to the same sets.
+    acquire(B);
+    acquire(A);
+    release(A);
+    release(B);
+    acquire(A);
+    acquire(C);
+    release(C);
+    release(A);
+
+    core::LockGraph graph;
+    core::build_lock_graph<false>(events, graph);
+
+    events.clear();
+    thread = ThreadId(2);
+    hop(Segment() + 2);
+    acquire(A);
+    acquire(B);
+    release(B);
+    release(A);
+    core::build_lock_graph<false>(events, graph);
+    ASSERT_EQ(3u, num_edges(graph));
+
+    // B -> A, held by the first thread under {B}, and A -> B, held by the
+    // second thread under {A}, do not share a gatelock.
+    core::SegmentationGraph segmentation;
+    for (std::size_t i = 0; i < 3; ++i)
+        add_vertex(Segment() + i, segmentation);
+    std::size_t deadlocks = 0;
+    core::analyze(graph, core::HappensBeforeIndex(segmentation),
+                  count_deadlocks(deadlocks));
+    EXPECT_EQ(1u, deadlocks);
+}
+} // end anonymous namespace
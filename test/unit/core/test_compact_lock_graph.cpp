@@ -0,0 +1,174 @@
+/**
+ * This file contains unit tests for the `CompactLockGraph` class.
+ */
+
+#include <d2/core/compact_lock_graph.hpp>
+#include <d2/core/happens_before_index.hpp>
+#include <d2/core/lock_graph.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/segmentation_graph.hpp>
+#include <d2/core/thread_id.hpp>
+
+#include <boost/graph/graph_traits.hpp>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <vector>
+
+
+using namespace d2;
+
+namespace {
+typedef boost::graph_traits<core::LockGraph>::vertex_descriptor Vertex;
+typedef boost::graph_traits<core::LockGraph>::edge_descriptor Edge;
+typedef core::CompactLockGraph<core::LockGraph> CompactLockGraph;
+
+struct compact_lock_graph_test : testing::Test {
+    core::LockGraph graph;
+    core::SegmentationGraph segmentation;
+    core::GatelockTable gatelocks;
+    std::vector<Segment> segments;
+    std::vector<Vertex> locks;
+
+    void SetUp() {
+        for (std::size_t i = 0; i < 3; ++i) {
+            segments.push_back(Segment() + i);
+            add_vertex(segments.back(), segmentation);
+        }
+        add_edge(0, 1, segmentation);
+
+        for (std::size_t i = 0; i < 4; ++i)
+            locks.push_back(add_vertex(LockId(i), graph));
+    }
+
+    Edge add_lock_edge(std::size_t u, std::size_t v, std::size_t thread,
+                       std::vector<LockId> const& held,
+                       std::size_t s1, std::size_t s2) {
+        // The call stacks of each edge are unique, to tell them apart.
+        core::LockGraphLabel label(segments[s1], ThreadId(thread),
+                                   gatelocks.intern(held), segments[s2]);
+        label.l1_info = 2 * num_edges(graph);
+        label.l2_info = 2 * num_edges(graph) + 1;
+        return add_edge(locks[u], locks[v], label, graph).first;
+    }
+};
+
+TEST_F(compact_lock_graph_test, empty_range_gives_empty_graph) {
+    core::HappensBeforeIndex const index(segmentation);
+    std::vector<Vertex> const none;
+    CompactLockGraph const compact(graph, none, index);
+
+    EXPECT_EQ(0u, compact.num_vertices());
+    EXPECT_EQ(0u, compact.num_edges());
+}
+
+TEST_F(compact_lock_graph_test, keeps_the_edges_between_the_vertices) {
+    std::vector<LockId> none, one;
+    one.push_back(LockId(3));
+    Edge const ab = add_lock_edge(0, 1, 0, none, 0, 0);
+    add_lock_edge(0, 3, 0, none, 0, 0);
+    Edge const ba1 = add_lock_edge(1, 0, 1, one, 1, 2);
+    Edge const ba2 = add_lock_edge(1, 0, 2, one, 0, 1);
+    add_lock_edge(2, 0, 1, none, 0, 0);
+
+    core::HappensBeforeIndex const index(segmentation);
+    std::vector<Vertex> vertices;
+    vertices.push_back(locks[0]);
+    vertices.push_back(locks[1]);
+    CompactLockGraph const compact(graph, vertices, index);
+
+    ASSERT_EQ(2u, compact.num_vertices());
+    ASSERT_EQ(3u, compact.num_edges());
+    EXPECT_EQ(LockId(0), compact.lock(0));
+    EXPECT_EQ(LockId(1), compact.lock(1));
+
+    // The edges leaving the component are dropped, and the others are kept
+    // in order.
+    ASSERT_EQ(1u, compact.edges_end(0) - compact.edges_begin(0));
+    ASSERT_EQ(2u, compact.edges_end(1) - compact.edges_begin(1));
+    std::size_t const e_ab = compact.edges_begin(0);
+    std::size_t const e_ba1 = compact.edges_begin(1);
+    std::size_t const e_ba2 = e_ba1 + 1;
+
+    EXPECT_EQ(1u, compact.target_of(e_ab));
+    EXPECT_EQ(0u, compact.target_of(e_ba1));
+    EXPECT_EQ(0u, compact.target_of(e_ba2));
+    EXPECT_EQ(graph[ab].l1_info, compact.l1_info(e_ab));
+    EXPECT_EQ(graph[ab].l2_info, compact.l2_info(e_ab));
+    EXPECT_EQ(graph[ba1].l1_info, compact.l1_info(e_ba1));
+    EXPECT_EQ(graph[ba1].l2_info, compact.l2_info(e_ba1));
+    EXPECT_EQ(graph[ba2].l1_info, compact.l1_info(e_ba2));
+    EXPECT_EQ(graph[ba2].l2_info, compact.l2_info(e_ba2));
+
+    EXPECT_EQ(ThreadId(0), compact.thread(e_ab));
+    EXPECT_EQ(ThreadId(1), compact.thread(e_ba1));
+    EXPECT_EQ(ThreadId(2), compact.thread(e_ba2));
+
+    // The segments are replaced by their positions in the index.
+    EXPECT_TRUE(index.happens_before_at(compact.s1(e_ba2),
+                                        compact.s2(e_ba2)));
+    EXPECT_FALSE(index.happens_before_at(compact.s1(e_ba1),
+                                         compact.s2(e_ba1)));
+    EXPECT_EQ(index.position_of(segments[2]), compact.s2(e_ba1));
+
+    // Equal gatelock sets overlap, and the empty set overlaps nothing.
+    EXPECT_TRUE(compact.gatelocks(e_ba1).intersects(compact.gatelocks(e_ba2)));
+    EXPECT_FALSE(compact.gatelocks(e_ab).intersects(compact.gatelocks(e_ba1)));
+    EXPECT_TRUE(compact.gatelocks(e_ab).none());
+}
+
+TEST_F(compact_lock_graph_test, distinct_gatelocks_overlap_on_common_locks) {
+    std::vector<LockId> first, second, third;
+    first.push_back(LockId(2));
+    first.push_back(LockId(3));
+    second.push_back(LockId(3));
+    third.push_back(LockId(10));
+    add_lock_edge(0, 1, 0, first, 0, 0);
+    add_lock_edge(1, 0, 1, second, 0, 0);
+    add_lock_edge(1, 0, 2, third, 0, 0);
+
+    core::HappensBeforeIndex const index(segmentation);
+    CompactLockGraph const compact(graph, locks, index);
+
+    ASSERT_EQ(3u, compact.num_edges());
+    EXPECT_TRUE(compact.gatelocks(0).intersects(compact.gatelocks(1)));
+    EXPECT_FALSE(compact.gatelocks(0).intersects(compact.gatelocks(2)));
+    EXPECT_FALSE(compact.gatelocks(1).intersects(compact.gatelocks(2)));
+    EXPECT_EQ(2u, compact.gatelocks(0).count());
+
+    // The held locks are kept in the order they were acquired.
+    EXPECT_EQ(first, compact.held_locks(0));
+    EXPECT_EQ(second, compact.held_locks(1));
+    EXPECT_EQ(third, compact.held_locks(2));
+}
+
+TEST_F(compact_lock_graph_test, gatelocks_are_numbered_by_their_locks) {
+    std::vector<LockId> first, second;
+    first.push_back(LockId(2));
+    second.push_back(LockId(3));
+
+    // The first set of another table has the number of `first` in ours,
+    // and a copy of a set that was not interned has no number at all.
+    core::GatelockTable other;
+    core::Gatelocks const copy(static_cast<
+        core::Gatelocks::underlying_set_type const&>(gatelocks.intern(first)));
+    ASSERT_EQ(gatelocks.intern(first).id(), other.intern(second).id());
+    ASSERT_EQ(std::size_t(core::Gatelocks::no_id), copy.id());
+
+    add_lock_edge(0, 1, 0, first, 0, 0);
+    add_edge(locks[1], locks[0], core::LockGraphLabel(segments[0],
+                ThreadId(1), other.intern(second), segments[0]), graph);
+    add_edge(locks[1], locks[2], core::LockGraphLabel(segments[0],
+                ThreadId(2), copy, segments[0]), graph);
+
+    core::HappensBeforeIndex const index(segmentation);
+    CompactLockGraph const compact(graph, locks, index);
+
+    ASSERT_EQ(3u, compact.num_edges());
+    EXPECT_FALSE(compact.gatelocks(0).intersects(compact.gatelocks(1)));
+    EXPECT_TRUE(compact.gatelocks(0).intersects(compact.gatelocks(2)));
+    EXPECT_EQ(first, compact.held_locks(0));
+    EXPECT_EQ(second, compact.held_locks(1));
+    EXPECT_EQ(first, compact.held_locks(2));
+}
+} // end anonymous namespace
@@ -2,12 +2,23 @@
  * This file contains unit tests for the `filesystem` class.
  */
 
+#include <d2/core/event_stream.hpp>
+#include <d2/core/events.hpp>
 #include <d2/core/filesystem.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/thread_id.hpp>
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/variant/get.hpp>
+#include <cstddef>
+#include <dyno/istream_iterator.hpp>
 #include <gtest/gtest.h>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 namespace bfs = boost::filesystem;
@@ -40,4 +51,57 @@ typedef d2::core::filesystem<bfs::fstream> Filesystem;
 TEST_F(filesystem_test, create_filesystem) {
     Filesystem fs(root, std::ios::in | std::ios::out);
 }
+
+typedef d2::core::filesystem<d2::core::event_ofstream> OutputFilesystem;
+typedef d2::core::filesystem<d2::core::event_ifstream> InputFilesystem;
+
+// Return the locks of the release events in the file of `thread`.
+std::vector<std::size_t> released_locks(bfs::path const& root,
+                                        std::size_t thread) {
+    InputFilesystem fs(root, std::ios::in);
+    std::vector<std::size_t> locks;
+    BOOST_FOREACH(InputFilesystem::file_entry file, fs.thread_files()) {
+        if (file.relative_path() != boost::lexical_cast<std::string>(thread))
+            continue;
+        typedef dyno::istream_iterator<
+                    d2::core::event_ifstream, d2::core::events::thread_specific
+                > Iterator;
+        for (Iterator it(file.stream()), end; it != end; ++it) {
+            d2::core::events::release const* release =
+                        boost::get<d2::core::events::release>(&*it);
+            if (release)
+                locks.push_back(
+                    boost::lexical_cast<std::size_t>(lock_of(*release)));
+        }
+    }
+    return locks;
+}
+
+TEST_F(filesystem_test, events_are_routed_to_the_file_of_their_thread) {
+    bfs::path const other_root = test_dir / bfs::unique_path();
+    {
+        OutputFilesystem fs(root, std::ios::out);
+        OutputFilesystem other(other_root, std::ios::out);
+        // Interleave threads and filesystems, so that the stream remembered
+        // by the current thread is never the right one.
+        for (std::size_t lock = 0; lock < 3; ++lock) {
+            fs.dispatch(d2::core::events::release(d2::ThreadId(1),
+                                                  d2::LockId(lock)));
+            other.dispatch(d2::core::events::release(d2::ThreadId(1),
+                                                     d2::LockId(lock + 5)));
+            fs.dispatch(d2::core::events::release(d2::ThreadId(2),
+                                                  d2::LockId(lock + 3)));
+        }
+    }
+
+    std::size_t const first[] = {0, 1, 2}, second[] = {3, 4, 5},
+                      other[] = {5, 6, 7};
+    EXPECT_EQ(std::vector<std::size_t>(first, first + 3),
+              released_locks(root, 1));
+    EXPECT_EQ(std::vector<std::size_t>(second, second + 3),
+              released_locks(root, 2));
+    EXPECT_EQ(std::vector<std::size_t>(other, other + 3),
+              released_locks(other_root, 1));
+    EXPECT_TRUE(released_locks(other_root, 2).empty());
+}
 } // end anonymous namespace
@@ -0,0 +1,263 @@
+/**
+ * This file contains unit tests for the `FilesystemDispatcher` class.
+ */
+
+#include <d2/core/event_stream.hpp>
+#include <d2/core/events.hpp>
+#include <d2/core/filesystem.hpp>
+#include <d2/core/filesystem_dispatcher.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/thread_id.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/range/distance.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/variant/get.hpp>
+#include <cstddef>
+#include <dyno/istream_iterator.hpp>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <vector>
+
+
+namespace bfs = boost::filesystem;
+using namespace d2;
+
+namespace {
+typedef core::filesystem<core::event_ifstream> InputFilesystem;
+
+static std::size_t const events_per_thread = 100;
+
+struct filesystem_dispatcher_test : testing::Test {
+    bfs::path test_dir, root;
+    core::FilesystemDispatcher dispatcher;
+
+    void SetUp() {
+        test_dir = bfs::temp_directory_path() / bfs::unique_path();
+        root = test_dir / bfs::unique_path();
+        bfs::create_directory(test_dir);
+    }
+
+    void TearDown() {
+        if (HasFailure())
+            std::clog << "test directory at: " << test_dir << '\n';
+        else
+            bfs::remove_all(test_dir);
+    }
+
+    void generate_events(std::size_t thread) {
+        for (std::size_t lock = 0; lock < events_per_thread; ++lock)
+            dispatcher.dispatch(core::events::release(ThreadId(thread),
+                                                      LockId(lock)));
+    }
+
+    void run_threads(std::size_t nthreads) {
+        dispatcher.set_repository(root);
+        boost::thread_group threads;
+        for (std::size_t thread = 1; thread <= nthreads; ++thread)
+            threads.create_thread(boost::bind(
+                &filesystem_dispatcher_test::generate_events, this, thread));
+        threads.join_all();
+    }
+
+    // Make sure every thread file contains all the events of its thread,
+    // in the order in which they were generated.
+    void check_repository(std::size_t nthreads,
+                          core::event_format format = core::text_format) {
+        dispatcher.unset_repository();
+        InputFilesystem fs(root, std::ios::in);
+        std::size_t nfiles = 0;
+        BOOST_FOREACH(InputFilesystem::file_entry file, fs.thread_files()) {
+            EXPECT_EQ(format, file.stream().format());
+            typedef dyno::istream_iterator<
+                        core::event_ifstream, core::events::thread_specific
+                    > Iterator;
+            std::vector<core::events::thread_specific>
+                                    events((Iterator(file.stream())), Iterator());
+            ASSERT_EQ(events_per_thread, events.size());
+            for (std::size_t lock = 0; lock < events.size(); ++lock) {
+                core::events::release const* release =
+                            boost::get<core::events::release>(&events[lock]);
+                ASSERT_TRUE(release != NULL);
+                EXPECT_EQ(LockId(lock), lock_of(*release));
+            }
+            ++nfiles;
+        }
+        EXPECT_EQ(nthreads, nfiles);
+    }
+
+    /**
+     * Write the events of a thread to a memory mapped repository, and copy
+     * the repository while it is still open, as if the program had crashed.
+     * Then append the events of the thread again to the copy, and make sure
+     * that the `crashed_events` that made it to the copy and the appended
+     * events are read back.
+     */
+    void append_to_unclosed_repository(core::event_format format,
+                                       bool compressed,
+                                       std::size_t crashed_events) {
+        dispatcher.set_mapped_files(true);
+        dispatcher.set_compressed_files(compressed);
+        dispatcher.set_format(format);
+        dispatcher.set_repository(root);
+        generate_events(1);
+        dispatcher.flush();
+
+        bfs::path const crashed = test_dir / bfs::unique_path();
+        bfs::create_directory(crashed);
+        for (bfs::directory_iterator it(root), last; it != last; ++it)
+            if (bfs::is_regular_file(it->path()))
+                bfs::copy_file(it->path(), crashed / it->path().filename());
+        dispatcher.unset_repository();
+
+        dispatcher.set_repository(crashed);
+        generate_events(1);
+        dispatcher.unset_repository();
+
+        InputFilesystem fs(crashed, std::ios::in);
+        ASSERT_EQ(1, boost::distance(fs.thread_files()));
+        BOOST_FOREACH(InputFilesystem::file_entry file, fs.thread_files()) {
+            typedef dyno::istream_iterator<
+                        core::event_ifstream, core::events::thread_specific
+                    > Iterator;
+            std::vector<core::events::thread_specific>
+                                    events((Iterator(file.stream())), Iterator());
+            ASSERT_EQ(crashed_events + events_per_thread, events.size());
+            for (std::size_t i = 0; i < events.size(); ++i) {
+                core::events::release const* release =
+                            boost::get<core::events::release>(&events[i]);
+                ASSERT_TRUE(release != NULL);
+                EXPECT_EQ(LockId(i % events_per_thread), lock_of(*release));
+            }
+        }
+    }
+};
+
+TEST_F(filesystem_dispatcher_test, unbuffered_events_are_all_written) {
+    run_threads(8);
+    check_repository(8);
+}
+
+TEST_F(filesystem_dispatcher_test, buffered_events_are_all_written_in_order) {
+    dispatcher.set_thread_buffer_size(7);
+    run_threads(8);
+    check_repository(8);
+}
+
+TEST_F(filesystem_dispatcher_test, events_of_live_threads_are_handed_off) {
+    dispatcher.set_thread_buffer_size(events_per_thread * 2);
+    dispatcher.set_repository(root);
+    generate_events(1);
+    check_repository(1);
+}
+
+TEST_F(filesystem_dispatcher_test, binary_events_are_all_written) {
+    dispatcher.set_format(core::binary_format);
+    dispatcher.set_thread_buffer_size(7);
+    run_threads(8);
+    check_repository(8, core::binary_format);
+}
+
+TEST_F(filesystem_dispatcher_test, mapped_events_are_all_written) {
+    dispatcher.set_mapped_files(true);
+    run_threads(8);
+    check_repository(8);
+}
+
+TEST_F(filesystem_dispatcher_test, mapped_binary_events_are_all_written) {
+    dispatcher.set_mapped_files(true);
+    dispatcher.set_format(core::binary_format);
+    run_threads(8);
+    check_repository(8, core::binary_format);
+}
+
+TEST_F(filesystem_dispatcher_test, events_are_appended_to_unclosed_files) {
+    append_to_unclosed_repository(core::text_format, false,
+                                  events_per_thread);
+}
+
+TEST_F(filesystem_dispatcher_test,
+       binary_events_are_appended_to_unclosed_files) {
+    append_to_unclosed_repository(core::binary_format, false,
+                                  events_per_thread);
+}
+
+TEST_F(filesystem_dispatcher_test,
+       compressed_events_are_appended_to_unclosed_files) {
+    // The events of the block that was being compressed are lost, but the
+    // padding must not hide the events appended afterwards.
+    append_to_unclosed_repository(core::binary_format, true, 0);
+}
+
+TEST_F(filesystem_dispatcher_test, compressed_events_are_all_written) {
+    dispatcher.set_compressed_files(true);
+    run_threads(8);
+    check_repository(8);
+}
+
+TEST_F(filesystem_dispatcher_test,
+       compressed_mapped_binary_events_are_all_written) {
+    dispatcher.set_compressed_files(true);
+    dispatcher.set_mapped_files(true);
+    dispatcher.set_format(core::binary_format);
+    run_threads(8);
+    check_repository(8, core::binary_format);
+}
+
+TEST_F(filesystem_dispatcher_test, asynchronous_events_are_all_written) {
+    // Small batches and a shallow queue make the threads wait for the
+    // writer thread to catch up.
+    dispatcher.set_async_queue_depth(2, 16);
+    run_threads(8);
+    check_repository(8);
+}
+
+TEST_F(filesystem_dispatcher_test,
+       buffered_asynchronous_events_are_all_written_in_order) {
+    dispatcher.set_thread_buffer_size(7);
+    dispatcher.set_async_queue_depth(2, 16);
+    run_threads(8);
+    check_repository(8);
+}
+
+TEST_F(filesystem_dispatcher_test,
+       asynchronous_events_are_buffered_by_their_thread) {
+    dispatcher.set_async_queue_depth(2, 16);
+    EXPECT_EQ(16u, dispatcher.thread_buffer_size());
+    dispatcher.set_thread_buffer_size(7);
+    EXPECT_EQ(7u, dispatcher.thread_buffer_size());
+    dispatcher.set_thread_buffer_size(0);
+    EXPECT_EQ(16u, dispatcher.thread_buffer_size());
+    dispatcher.set_async_queue_depth(0);
+    EXPECT_EQ(0u, dispatcher.thread_buffer_size());
+}
+
+TEST_F(filesystem_dispatcher_test,
+       asynchronous_events_are_written_to_their_repository) {
+    dispatcher.set_async_queue_depth(4);
+    bfs::path const other_root = test_dir / bfs::unique_path();
+    dispatcher.set_repository(other_root);
+    dispatcher.dispatch(core::events::release(ThreadId(1), LockId(0)));
+
+    dispatcher.set_repository(root);
+    generate_events(1);
+    check_repository(1);
+
+    InputFilesystem other(other_root, std::ios::in);
+    EXPECT_EQ(1, boost::distance(other.thread_files()));
+}
+
+TEST_F(filesystem_dispatcher_test, asynchronous_events_are_written_on_exit) {
+    {
+        core::FilesystemDispatcher dispatcher;
+        dispatcher.set_async_queue_depth(1);
+        dispatcher.set_repository(root);
+        for (std::size_t lock = 0; lock < events_per_thread; ++lock)
+            dispatcher.dispatch(core::events::release(ThreadId(1),
+                                                      LockId(lock)));
+    }
+    check_repository(1);
+}
+} // end anonymous namespace
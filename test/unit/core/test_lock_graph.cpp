@@ -0,0 +1,83 @@
+/**
+ * This file contains unit tests for the interning of the gatelock sets of
+ * the lock graph in a `GatelockTable`.
+ */
+
+#include <d2/core/lock_graph.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/thread_id.hpp>
+
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <vector>
+
+
+using namespace d2;
+
+namespace {
+struct gatelock_table_test : testing::Test {
+    core::GatelockTable table;
+    std::vector<LockId> AB, BA, A, none;
+
+    gatelock_table_test() {
+        AB.push_back(LockId(1));
+        AB.push_back(LockId(2));
+        BA.push_back(LockId(2));
+        BA.push_back(LockId(1));
+        A.push_back(LockId(1));
+    }
+};
+
+TEST_F(gatelock_table_test, equal_sequences_intern_to_the_same_id) {
+    core::Gatelocks const first = table.intern(AB);
+    core::Gatelocks const second = table.intern(std::vector<LockId>(AB));
+
+    EXPECT_EQ(first.id(), second.id());
+    EXPECT_TRUE(first.shares_with(second));
+    EXPECT_EQ(1u, table.size());
+}
+
+TEST_F(gatelock_table_test, distinct_sequences_intern_to_distinct_ids) {
+    core::Gatelocks const ab = table.intern(AB);
+    core::Gatelocks const ba = table.intern(BA);
+    core::Gatelocks const a = table.intern(A);
+    core::Gatelocks const empty = table.intern(none);
+
+    EXPECT_NE(ab.id(), ba.id());
+    EXPECT_NE(ab.id(), a.id());
+    EXPECT_NE(ba.id(), a.id());
+    EXPECT_NE(a.id(), empty.id());
+    EXPECT_EQ(4u, table.size());
+}
+
+TEST_F(gatelock_table_test, ids_are_dense) {
+    EXPECT_EQ(0u, table.intern(AB).id());
+    EXPECT_EQ(1u, table.intern(BA).id());
+    EXPECT_EQ(0u, table.intern(AB).id());
+    EXPECT_EQ(2u, table.intern(none).id());
+}
+
+TEST_F(gatelock_table_test, sets_interned_again_keep_their_id) {
+    core::Gatelocks const ab = table.intern(AB);
+    EXPECT_EQ(ab.id(), table.intern(ab).id());
+
+    core::GatelockTable other;
+    other.intern(A);
+    EXPECT_EQ(1u, other.intern(ab).id());
+}
+
+TEST_F(gatelock_table_test, labels_store_the_id_of_their_gatelocks) {
+    core::LockGraphLabel const label(Segment(), ThreadId(1),
+                                     table.intern(BA), Segment());
+    core::LockGraphLabel const same(Segment(), ThreadId(1),
+                                    table.intern(BA), Segment());
+
+    EXPECT_EQ(table.intern(BA).id(), gatelocks_id_of(label));
+    EXPECT_EQ(gatelocks_id_of(label), gatelocks_id_of(same));
+    EXPECT_EQ(std::size_t(core::Gatelocks::no_id),
+              gatelocks_id_of(core::LockGraphLabel(Segment(), ThreadId(1),
+                                                   core::Gatelocks(),
+                                                   Segment())));
+}
+} // end anonymous namespace
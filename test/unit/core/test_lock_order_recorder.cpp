@@ -0,0 +1,227 @@
+/**
+ * This file contains unit tests for the `LockOrderRecorder` class.
+ */
+
+#include <d2/core/build_lock_graph.hpp>
+#include <d2/core/events.hpp>
+#include <d2/core/lock_graph.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/lock_order_recorder.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/call_stack_table.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/variant/get.hpp>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <vector>
+
+
+using namespace d2;
+namespace ev = d2::core::events;
+
+namespace {
+struct lock_order_recorder_test : testing::Test {
+    core::LockOrderRecorder recorder;
+    ThreadId thread;
+    Segment segment;
+    LockId A, B, C;
+
+    // Events that would be logged without the recorder, and the ones that
+    // are logged with it.
+    std::vector<ev::thread_specific> raw, recorded;
+
+    lock_order_recorder_test()
+        : thread(1), segment(Segment() + 3), A(10), B(11), C(12)
+    {
+        recorder.set_enabled(true);
+        raw.push_back(ev::segment_hop(thread, segment));
+        recorded.push_back(ev::segment_hop(thread, segment));
+    }
+
+    // Sink receiving the events generated by the recorder.
+    void dispatch(ev::lock_order const& event) {
+        recorded.push_back(event);
+    }
+
+    void acquire(LockId const& lock, detail::CallStackId info = 1) {
+        ev::acquire event(thread, lock);
+        aux_info_of(event) = info;
+        raw.push_back(event);
+        recorder.acquire(thread, lock, segment, info, *this);
+    }
+
+    void release(LockId const& lock) {
+        raw.push_back(ev::release(thread, lock));
+        recorder.release(lock);
+    }
+
+    void recursive_acquire(LockId const& lock) {
+        raw.push_back(ev::recursive_acquire(thread, lock));
+        recorder.recursive_acquire(thread, lock, segment,
+                                   detail::no_call_stack, *this);
+    }
+
+    void recursive_release(LockId const& lock) {
+        raw.push_back(ev::recursive_release(thread, lock));
+        recorder.recursive_release(lock);
+    }
+
+    std::size_t lock_orders() const {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < recorded.size(); ++i)
+            count += boost::get<ev::lock_order>(&recorded[i]) != NULL;
+        return count;
+    }
+
+    // Make sure the lock graph built from the recorded edges is the same as
+    // the one built from the acquisitions and releases.
+    void check_same_graph() {
+        core::LockGraph expected, actual;
+        core::build_lock_graph<false>(raw, expected);
+        core::build_lock_graph<false>(recorded, actual);
+        EXPECT_EQ(num_vertices(expected), num_vertices(actual));
+        ASSERT_EQ(num_edges(expected), num_edges(actual));
+
+        typedef boost::graph_traits<core::LockGraph>::edge_iterator Iterator;
+        Iterator e, last;
+        for (boost::tie(e, last) = edges(expected); e != last; ++e) {
+            LockId const l1 = expected[source(*e, expected)];
+            LockId const l2 = expected[target(*e, expected)];
+            EXPECT_TRUE(build_lock_graph_detail::is_adjacent(
+                            actual, l1, l2, expected[*e]));
+        }
+    }
+};
+
+TEST_F(lock_order_recorder_test, repeated_edges_are_recorded_once) {
+    for (std::size_t i = 0; i < 100; ++i) {
+        acquire(A);
+        acquire(B);
+        acquire(C);
+        release(C);
+        release(B);
+        release(A);
+    }
+    // A -> B, A -> C and B -> C
+    EXPECT_EQ(3u, lock_orders());
+    check_same_graph();
+}
+
+TEST_F(lock_order_recorder_test, edges_are_distinguished_by_call_stack) {
+    acquire(A);
+    acquire(B, 1);
+    release(B);
+    acquire(B, 2);
+    release(B);
+    release(A);
+    EXPECT_EQ(2u, lock_orders());
+    check_same_graph();
+}
+
+TEST_F(lock_order_recorder_test, recursive_acquisitions_create_edges_once) {
+    recursive_acquire(A);
+    recursive_acquire(A);
+    acquire(B);
+    release(B);
+    recursive_release(A);
+    acquire(C);
+    release(C);
+    recursive_release(A);
+
+    // A is not held anymore.
+    acquire(B);
+    acquire(C);
+    release(C);
+    release(B);
+    EXPECT_EQ(3u, lock_orders());
+    check_same_graph();
+}
+
+TEST_F(lock_order_recorder_test, flush_records_the_occurrences) {
+    for (std::size_t i = 0; i < 5; ++i) {
+        acquire(A);
+        acquire(B);
+        release(B);
+        release(A);
+    }
+    acquire(B);
+    acquire(C);
+    release(C);
+    release(B);
+
+    recorded.clear();
+    recorder.flush(*this);
+    ASSERT_EQ(1u, recorded.size());
+    ev::lock_order const& edge = boost::get<ev::lock_order>(recorded[0]);
+    EXPECT_EQ(A, edge.l1);
+    EXPECT_EQ(B, edge.l2);
+    EXPECT_EQ(5u, edge.occurrences);
+
+    // Edges are recorded again after a flush.
+    recorded.clear();
+    acquire(A);
+    acquire(B);
+    EXPECT_EQ(1u, lock_orders());
+
+    // The occurrences are not dispatched twice.
+    release(B);
+    release(A);
+    recorded.clear();
+    recorder.flush(*this);
+    recorder.flush(*this);
+    EXPECT_TRUE(recorded.empty());
+}
+
+// Sink shared by several threads, which only expects the repeated edges
+// dispatched by `flush`.
+struct flushed_edges {
+    std::vector<ev::lock_order> edges;
+
+    void dispatch(ev::lock_order const& event) {
+        if (event.occurrences > 1)
+            edges.push_back(event);
+    }
+};
+
+void acquire_AB_repeatedly(core::LockOrderRecorder& recorder,
+                           flushed_edges& sink, ThreadId thread,
+                           std::size_t times) {
+    for (std::size_t i = 0; i < times; ++i) {
+        recorder.acquire(thread, LockId(10), Segment(), 1, sink);
+        recorder.acquire(thread, LockId(11), Segment(), 1, sink);
+        recorder.release(LockId(11));
+        recorder.release(LockId(10));
+    }
+}
+
+TEST(lock_order_recorder_threads, flush_merges_the_occurrences_of_threads) {
+    core::LockOrderRecorder recorder;
+    recorder.set_enabled(true);
+    // The edges seen by the threads are new, so they are not dispatched
+    // to this sink before the flush.
+    flushed_edges sinks[4], flushed;
+    boost::thread_group threads;
+    for (std::size_t i = 0; i < 4; ++i)
+        threads.create_thread(boost::bind(&acquire_AB_repeatedly,
+                                          boost::ref(recorder),
+                                          boost::ref(sinks[i]),
+                                          ThreadId(i + 1), 100 * (i + 1)));
+    threads.join_all();
+
+    recorder.flush(flushed);
+    ASSERT_EQ(4u, flushed.edges.size());
+    std::size_t total = 0;
+    BOOST_FOREACH(ev::lock_order const& edge, flushed.edges)
+        total += edge.occurrences;
+    EXPECT_EQ(100u + 200u + 300u + 400u, total);
+
+    // The threads exited, so they have nothing to flush anymore.
+    flushed.edges.clear();
+    recorder.flush(flushed);
+    EXPECT_TRUE(flushed.edges.empty());
+}
+} // end anonymous namespace
@@ -0,0 +1,235 @@
+/**
+ * This file contains unit tests for the `LogBudget` class.
+ */
+
+#include <d2/core/events.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/log_budget.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/thread_id.hpp>
+
+#include <boost/variant/get.hpp>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <vector>
+
+
+using namespace d2;
+namespace ev = d2::core::events;
+
+namespace {
+struct log_budget_test : testing::Test {
+    core::LogBudget budget;
+    ThreadId thread;
+    LockId A, B;
+
+    // Sizes reported as written to the repository, and the events logged.
+    std::size_t repository_bytes, thread_bytes;
+    std::vector<ev::thread_specific> logged;
+
+    log_budget_test()
+        : thread(1), A(10), B(11), repository_bytes(0), thread_bytes(0)
+    { }
+
+    // Dispatcher interface used by the budget.
+    template <typename Event>
+    void dispatch(Event& event) { logged.push_back(event); }
+
+    std::size_t bytes_written() const { return repository_bytes; }
+
+    std::size_t bytes_written(ThreadId const&) const { return thread_bytes; }
+
+    // Log an event the way the framework does.
+    template <typename Event>
+    void log(Event event, core::LogBudget::mode mode) {
+        if (mode == core::LogBudget::logging)
+            dispatch(event);
+        else
+            budget.keep(event, *this);
+    }
+
+    core::LogBudget::mode acquire(LockId const& lock) {
+        core::LogBudget::mode const mode = budget.acquire(thread, *this);
+        log(ev::acquire(thread, lock), mode);
+        return mode;
+    }
+
+    core::LogBudget::mode release(LockId const& lock) {
+        core::LogBudget::mode const mode = budget.release(thread, *this);
+        log(ev::release(thread, lock), mode);
+        return mode;
+    }
+
+    // Acquire and release a lock `times` times.
+    void repeat(std::size_t times) {
+        for (std::size_t i = 0; i < times; ++i) {
+            acquire(A);
+            release(A);
+        }
+    }
+
+    // Log 64 events, i.e. until the budget is checked again, and make the
+    // events of the thread 1000 bytes in total, or about 15 bytes each.
+    void log_events_of_15_bytes() {
+        repeat(32);
+        thread_bytes = 1000;
+    }
+
+    // Acquire and release a lock until the mode of the thread changes, and
+    // return the new mode.
+    core::LogBudget::mode acquire_until_not_logging() {
+        for (std::size_t i = 0; i < 1000; ++i) {
+            core::LogBudget::mode const mode = acquire(A);
+            release(A);
+            if (mode != core::LogBudget::logging)
+                return mode;
+        }
+        return core::LogBudget::logging;
+    }
+};
+
+TEST_F(log_budget_test, overflow_policies_are_parsed) {
+    core::overflow_policy policy;
+    ASSERT_TRUE(core::parse_overflow_policy("stop", policy));
+    EXPECT_EQ(core::stop_logging, policy);
+    ASSERT_TRUE(core::parse_overflow_policy("drop_call_stacks", policy));
+    EXPECT_EQ(core::drop_call_stacks, policy);
+    ASSERT_TRUE(core::parse_overflow_policy("lock_orders", policy));
+    EXPECT_EQ(core::keep_new_lock_orders, policy);
+    ASSERT_TRUE(core::parse_overflow_policy("recent_events", policy));
+    EXPECT_EQ(core::keep_recent_events, policy);
+    EXPECT_FALSE(core::parse_overflow_policy("everything", policy));
+}
+
+TEST_F(log_budget_test, stop_policy_drops_everything_past_the_budget) {
+    EXPECT_FALSE(budget.is_enabled());
+    budget.set_limits(1000, 0);
+    ASSERT_TRUE(budget.is_enabled());
+
+    EXPECT_EQ(core::LogBudget::logging, acquire(A));
+    EXPECT_EQ(core::LogBudget::logging, release(A));
+    EXPECT_EQ(2u, logged.size());
+
+    repository_bytes = 1000;
+    ASSERT_EQ(core::LogBudget::stopped, acquire_until_not_logging());
+    std::size_t const size = logged.size();
+    acquire(A);
+    release(A);
+    EXPECT_EQ(size, logged.size());
+    EXPECT_EQ(4u, budget.statistics().dropped_events);
+}
+
+TEST_F(log_budget_test, threads_degrade_only_when_they_hold_no_locks) {
+    budget.set_limits(0, 1000);
+    budget.set_policy(core::keep_new_lock_orders);
+
+    acquire(A);
+    thread_bytes = 1000;
+    for (std::size_t i = 0; i < 1000; ++i) {
+        EXPECT_EQ(core::LogBudget::logging, acquire(B));
+        EXPECT_EQ(core::LogBudget::logging, release(B));
+    }
+    release(A);
+    EXPECT_EQ(core::LogBudget::degraded, acquire(B));
+}
+
+TEST_F(log_budget_test, threads_stop_at_twice_the_budget_even_holding_locks) {
+    budget.set_limits(0, 1000);
+    budget.set_policy(core::keep_new_lock_orders);
+
+    acquire(A);
+    thread_bytes = 2000;
+    core::LogBudget::mode mode = core::LogBudget::logging;
+    for (std::size_t i = 0; i < 1000 && mode == core::LogBudget::logging;++i)
+        mode = acquire(B);
+    EXPECT_EQ(core::LogBudget::stopped, mode);
+}
+
+TEST_F(log_budget_test, recent_events_are_evicted_by_whole_chunks) {
+    // Room for 4 events.
+    budget.set_limits(0, 4 * sizeof(ev::thread_specific));
+    budget.set_policy(core::keep_recent_events);
+
+    thread_bytes = 4 * sizeof(ev::thread_specific);
+    ASSERT_EQ(core::LogBudget::degraded, acquire_until_not_logging());
+    logged.clear();
+
+    // The first chunk holds the acquisition and the release of A above.
+    ev::segment_hop hop(thread, Segment() + 3);
+    budget.keep(hop, *this);
+    acquire(B);
+    release(B);
+    EXPECT_TRUE(logged.empty());
+    EXPECT_EQ(3u, budget.statistics().dropped_events);
+
+    // The evicted segment_hop precedes the events that were kept.
+    budget.flush(*this);
+    ASSERT_EQ(3u, logged.size());
+    EXPECT_TRUE(boost::get<ev::segment_hop>(&logged[0]) != NULL);
+    EXPECT_TRUE(boost::get<ev::acquire>(&logged[1]) != NULL);
+    EXPECT_TRUE(boost::get<ev::release>(&logged[2]) != NULL);
+}
+
+TEST_F(log_budget_test, recent_events_are_measured_like_the_budget) {
+    budget.set_limits(0, 1000);
+    budget.set_policy(core::keep_recent_events);
+
+    log_events_of_15_bytes();
+    ASSERT_EQ(core::LogBudget::degraded, acquire(A));
+    release(A);
+    repeat(200);
+
+    // The last 33 chunks of 2 events of 15 bytes fit in the 1000 bytes.
+    logged.clear();
+    budget.flush(*this);
+    EXPECT_EQ(66u, logged.size());
+}
+
+TEST_F(log_budget_test, recent_events_are_logged_below_twice_the_budget) {
+    budget.set_limits(0, 1000);
+    budget.set_policy(core::keep_recent_events);
+
+    log_events_of_15_bytes();
+    ASSERT_EQ(core::LogBudget::degraded, acquire(A));
+    release(A);
+    repeat(200);
+
+    // Only 100 bytes can be written before the thread must be stopped.
+    thread_bytes = 1900;
+    logged.clear();
+    std::size_t const dropped = budget.statistics().dropped_events;
+    budget.flush(*this);
+    EXPECT_EQ(6u, logged.size());
+    EXPECT_EQ(dropped + 60u, budget.statistics().dropped_events);
+}
+
+TEST_F(log_budget_test, repository_budget_is_split_among_threads) {
+    budget.set_limits(1000, 0);
+    budget.set_policy(core::keep_recent_events);
+    ThreadId const other(2);
+    budget.acquire(other, *this);
+    budget.release(other, *this);
+
+    log_events_of_15_bytes();
+    repository_bytes = 1000;
+    ASSERT_EQ(core::LogBudget::degraded, acquire(A));
+    release(A);
+    repeat(200);
+
+    // The thread may only keep 500 bytes, i.e. 16 chunks.
+    logged.clear();
+    budget.flush(*this);
+    EXPECT_EQ(32u, logged.size());
+}
+
+TEST_F(log_budget_test, flush_makes_the_threads_log_again) {
+    budget.set_limits(1000, 0);
+    repository_bytes = 2000;
+    ASSERT_EQ(core::LogBudget::stopped, acquire_until_not_logging());
+
+    budget.flush(*this);
+    repository_bytes = 0;
+    EXPECT_EQ(core::LogBudget::logging, acquire(A));
+    EXPECT_EQ(core::LogBudget::logging, release(A));
+}
+} // end anonymous namespace
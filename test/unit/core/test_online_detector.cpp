@@ -0,0 +1,171 @@
+/**
+ * This file contains unit tests for the `OnlineDetector` class.
+ */
+
+#include <d2/core/diagnostic.hpp>
+#include <d2/core/lock_id.hpp>
+#include <d2/core/online_detector.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/detail/call_stack_table.hpp>
+
+#include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <vector>
+
+
+using namespace d2;
+using boost::assign::list_of;
+
+namespace {
+std::vector<core::potential_deadlock> reported;
+
+void record_deadlock(core::potential_deadlock const& deadlock) {
+    reported.push_back(deadlock);
+}
+
+struct online_detector_test : testing::Test {
+    core::OnlineDetector detector;
+    ThreadId t0, t1, t2;
+    LockId A, B, C, G;
+
+    online_detector_test()
+        : t0(0), t1(1), t2(2), A(10), B(11), C(12), G(13)
+    { }
+
+    void SetUp() {
+        reported.clear();
+        detector.set_callback(&record_deadlock);
+    }
+
+    void acquire(ThreadId const& thread, LockId const& lock) {
+        detector.acquire(thread, lock, detail::no_call_stack);
+    }
+
+    void release(ThreadId const& thread, LockId const& lock) {
+        detector.release(thread, lock);
+    }
+
+    // Make `thread` acquire `first` and then `second`, and release both.
+    void nest(ThreadId const& thread, LockId const& first,
+              LockId const& second) {
+        acquire(thread, first);
+        acquire(thread, second);
+        release(thread, second);
+        release(thread, first);
+    }
+
+    static core::deadlocked_thread
+    holding(ThreadId const& thread, std::vector<LockId> const& locks,
+            LockId const& waiting_for) {
+        return core::deadlocked_thread(thread, locks, waiting_for);
+    }
+};
+
+TEST_F(online_detector_test, nothing_is_reported_when_disabled) {
+    detector.set_callback(NULL);
+    EXPECT_FALSE(detector.is_enabled());
+    nest(t0, A, B);
+    nest(t1, B, A);
+    EXPECT_TRUE(reported.empty());
+}
+
+TEST_F(online_detector_test, ABBA_is_reported_on_the_second_acquire) {
+    nest(t0, A, B);
+    EXPECT_TRUE(reported.empty());
+
+    acquire(t1, B);
+    acquire(t1, A);
+    ASSERT_EQ(1u, reported.size());
+
+    std::vector<core::deadlocked_thread> expected = list_of
+        (holding(t0, list_of(A), B))
+        (holding(t1, list_of(B), A));
+    EXPECT_TRUE(core::potential_deadlock(expected)
+                                    .is_equivalent_to(reported.front()));
+}
+
+TEST_F(online_detector_test, each_deadlock_is_reported_once) {
+    for (std::size_t i = 0; i < 10; ++i) {
+        nest(t0, A, B);
+        nest(t1, B, A);
+    }
+    EXPECT_EQ(1u, reported.size());
+}
+
+TEST_F(online_detector_test, ABBA_in_the_same_thread_is_not_reported) {
+    nest(t0, A, B);
+    nest(t0, B, A);
+    EXPECT_TRUE(reported.empty());
+}
+
+TEST_F(online_detector_test, ABBA_with_a_gatelock_is_not_reported) {
+    acquire(t0, G);
+    nest(t0, A, B);
+    release(t0, G);
+
+    acquire(t1, G);
+    nest(t1, B, A);
+    release(t1, G);
+    EXPECT_TRUE(reported.empty());
+}
+
+TEST_F(online_detector_test, cycles_of_three_threads_are_reported) {
+    nest(t0, A, B);
+    nest(t1, B, C);
+    EXPECT_TRUE(reported.empty());
+    nest(t2, C, A);
+    EXPECT_EQ(1u, reported.size());
+}
+
+TEST_F(online_detector_test, cycles_through_a_lock_held_earlier_are_reported) {
+    acquire(t0, A);
+    nest(t0, B, C);
+    release(t0, A);
+
+    nest(t1, C, A);
+    EXPECT_EQ(1u, reported.size());
+}
+
+TEST_F(online_detector_test, recursive_locks_stay_held_until_last_release) {
+    acquire(t0, A);
+    detector.recursive_acquire(t0, A, detail::no_call_stack);
+    release(t0, A);
+    nest(t0, B, C);
+    release(t0, A);
+
+    nest(t1, C, A);
+    EXPECT_EQ(1u, reported.size());
+}
+TEST_F(online_detector_test, known_contexts_refer_to_their_first_call_stack) {
+    detail::CallStackId info = detail::no_call_stack;
+    EXPECT_TRUE(detector.is_new_context(t0, A, info));
+    detector.acquire(t0, A, 1);
+    EXPECT_TRUE(detector.is_new_context(t0, B, info));
+    detector.acquire(t0, B, 2);
+    release(t0, B);
+    release(t0, A);
+
+    EXPECT_FALSE(detector.is_new_context(t0, A, info));
+    EXPECT_EQ(1u, info);
+    detector.acquire(t0, A, info);
+    EXPECT_FALSE(detector.is_new_context(t0, B, info));
+    EXPECT_EQ(2u, info);
+
+    // The same lock acquired with other locks held is a new context.
+    EXPECT_TRUE(detector.is_new_context(t0, C, info));
+    EXPECT_TRUE(detector.is_new_context(t1, B, info));
+}
+
+TEST_F(online_detector_test, ABBA_is_reported_across_system_threads) {
+    void (online_detector_test::*nest)(ThreadId const&, LockId const&,
+                                       LockId const&)
+                                        = &online_detector_test::nest;
+    boost::thread(boost::bind(nest, this, t0, A, B)).join();
+    EXPECT_TRUE(reported.empty());
+    boost::thread(boost::bind(nest, this, t1, B, A)).join();
+    EXPECT_EQ(1u, reported.size());
+}
+} // end anonymous namespace
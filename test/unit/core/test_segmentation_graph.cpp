@@ -5,6 +5,7 @@
 #include <d2/core/build_segmentation_graph.hpp>
 #include <d2/core/events.hpp>
 #include <d2/core/exceptions.hpp>
+#include <d2/core/happens_before_index.hpp>
 #include <d2/core/segment.hpp>
 #include <d2/core/segmentation_graph.hpp>
 
@@ -34,6 +35,24 @@ struct test_segmentation_graph : testing::Test {
             segments.push_back(Segment() + i);
     }
 
+    // Check that `index` gives the same relation as `graph` for the first
+    // `count` segments.
+    void expect_index_agrees_with_the_graph(HappensBeforeIndex const& index,
+                                            unsigned int count) {
+        for (unsigned int u = 0; u < count; ++u) {
+            for (unsigned int v = 0; v < count; ++v) {
+                EXPECT_EQ(happens_before(segments[u], segments[v], graph),
+                          index.happens_before(segments[u], segments[v]))
+                    << "segments " << u << " and " << v;
+                EXPECT_EQ(index.happens_before(segments[u], segments[v]),
+                          index.happens_before_at(
+                                            index.position_of(segments[u]),
+                                            index.position_of(segments[v])))
+                    << "positions of segments " << u << " and " << v;
+            }
+        }
+    }
+
     void TearDown() {
         if (HasFailure()) {
             std::clog << "Test failed, printing the segmentation graph:\n";
@@ -200,4 +219,60 @@ TEST_F(test_segmentation_graph, multiple_starts_from_main_thread) {
     EXPECT_FALSE(happens_before(segments[6], segments[5], graph));
     EXPECT_FALSE(happens_before(segments[6], segments[6], graph));
 }
+
+TEST_F(test_segmentation_graph, index_agrees_with_the_graph) {
+    using namespace boost::assign;
+    //      0   1   2   3   4   5   6
+    // t0   o___o_______o_______o___o
+    // t1   |___|___o___________|   |
+    // t2       |___________o_______|
+
+    events +=
+        StartEvent(segments[0], segments[1], segments[2]),
+        StartEvent(segments[1], segments[3], segments[4]),
+        JoinEvent(segments[3], segments[5], segments[2]),
+        JoinEvent(segments[5], segments[6], segments[4])
+    ;
+
+    build_segmentation_graph<ignore_other_events>(events, graph);
+    HappensBeforeIndex const index(graph);
+    HappensBeforeIndex const searched(graph, 0);
+    EXPECT_TRUE(index.has_closure());
+    EXPECT_FALSE(searched.has_closure());
+
+    // Segments that are not in the graph are not ordered.
+    expect_index_agrees_with_the_graph(index, 8);
+    expect_index_agrees_with_the_graph(searched, 8);
+}
+
+TEST_F(test_segmentation_graph, index_agrees_with_the_graph_across_words) {
+    // Each thread starts the next one, and the first thread joins the
+    // last one, so the bits of the segments span several words.
+    //      0   1   2   3   4   5        300 301
+    // t0   o___o_______________________________o
+    // t1   |_______o___o                       |
+    // t2           |_______o___o               |
+    // ...                  |   ...             |
+    // t150                          o__________|
+    unsigned int const threads = 150;
+    for (unsigned int i = 0; i < threads; ++i)
+        events.push_back(StartEvent(segments[2 * i], segments[2 * i + 1],
+                                    segments[2 * i + 2]));
+    events.push_back(JoinEvent(segments[1], segments[2 * threads + 1],
+                               segments[2 * threads]));
+
+    build_segmentation_graph<ignore_other_events>(events, graph);
+    HappensBeforeIndex const index(graph);
+    HappensBeforeIndex const searched(graph, 0);
+    EXPECT_TRUE(index.has_closure());
+    EXPECT_FALSE(searched.has_closure());
+
+    expect_index_agrees_with_the_graph(index, 2 * threads + 2);
+    expect_index_agrees_with_the_graph(searched, 2 * threads + 2);
+}
+
+TEST_F(test_segmentation_graph, empty_index_orders_nothing) {
+    HappensBeforeIndex index;
+    EXPECT_FALSE(index.happens_before(segments[0], segments[1]));
+}
 } // end anonymous namespace
@@ -0,0 +1,105 @@
+/**
+ * This file contains unit tests for the `ThreadSegments` class.
+ */
+
+#include <d2/core/segment.hpp>
+#include <d2/core/thread_id.hpp>
+#include <d2/core/thread_segments.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <set>
+#include <vector>
+
+
+using namespace d2;
+
+namespace {
+struct thread_segments_test : testing::Test {
+    core::ThreadSegments segments;
+    Segment parent_segment, new_parent_segment, child_segment;
+
+    void start(std::size_t parent, std::size_t child) {
+        segments.start(ThreadId(parent), ThreadId(child),
+                       parent_segment, new_parent_segment, child_segment);
+    }
+
+    void join(std::size_t parent, std::size_t child) {
+        segments.join(ThreadId(parent), ThreadId(child),
+                      parent_segment, new_parent_segment, child_segment);
+    }
+};
+
+TEST_F(thread_segments_test, the_main_thread_starts_in_the_initial_segment) {
+    start(0, 1);
+    EXPECT_EQ(Segment(), parent_segment);
+    EXPECT_EQ(Segment() + 1, new_parent_segment);
+    EXPECT_EQ(Segment() + 2, child_segment);
+}
+
+TEST_F(thread_segments_test, segments_follow_starts_and_joins) {
+    start(0, 1);
+    start(1, 2);
+    EXPECT_EQ(Segment() + 2, parent_segment);
+    EXPECT_EQ(Segment() + 3, new_parent_segment);
+    EXPECT_EQ(Segment() + 4, child_segment);
+
+    join(0, 2);
+    EXPECT_EQ(Segment() + 1, parent_segment);
+    EXPECT_EQ(Segment() + 5, new_parent_segment);
+    EXPECT_EQ(Segment() + 4, child_segment);
+
+    join(0, 1);
+    EXPECT_EQ(Segment() + 5, parent_segment);
+    EXPECT_EQ(Segment() + 6, new_parent_segment);
+    EXPECT_EQ(Segment() + 3, child_segment);
+}
+
+static std::size_t const threads_per_parent = 100;
+
+struct concurrent_thread_segments_test : thread_segments_test {
+    std::vector<Segment> allocated[8];
+
+    // Start and join children of `parent`, which is a child of the main
+    // thread, recording the segments that were allocated.
+    void start_and_join_children(std::size_t parent) {
+        std::vector<Segment>& mine = allocated[parent - 1];
+        for (std::size_t i = 1; i <= threads_per_parent; ++i) {
+            std::size_t const child = parent * 1000 + i;
+            Segment before, after, child_segment;
+            segments.start(ThreadId(parent), ThreadId(child),
+                           before, after, child_segment);
+            EXPECT_LT(before, after);
+            mine.push_back(after);
+            mine.push_back(child_segment);
+
+            segments.join(ThreadId(parent), ThreadId(child),
+                          before, after, child_segment);
+            EXPECT_EQ(mine.back(), child_segment);
+            EXPECT_LT(before, after);
+            mine.push_back(after);
+        }
+    }
+};
+
+TEST_F(concurrent_thread_segments_test,
+       concurrent_starts_and_joins_get_distinct_segments) {
+    for (std::size_t parent = 1; parent <= 8; ++parent)
+        start(0, parent);
+
+    boost::thread_group threads;
+    for (std::size_t parent = 1; parent <= 8; ++parent)
+        threads.create_thread(boost::bind(
+            &concurrent_thread_segments_test::start_and_join_children,
+            this, parent));
+    threads.join_all();
+
+    std::set<Segment> distinct;
+    for (std::size_t parent = 0; parent < 8; ++parent)
+        distinct.insert(allocated[parent].begin(), allocated[parent].end());
+    EXPECT_EQ(8 * threads_per_parent * 3, distinct.size());
+    EXPECT_EQ(0u, distinct.count(Segment()));
+}
+} // end anonymous namespace
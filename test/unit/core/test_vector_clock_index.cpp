@@ -0,0 +1,102 @@
+/**
+ * This file contains unit tests for the `VectorClockIndex` class.
+ */
+
+#include <d2/core/build_segmentation_graph.hpp>
+#include <d2/core/events.hpp>
+#include <d2/core/segment.hpp>
+#include <d2/core/segmentation_graph.hpp>
+#include <d2/core/vector_clock_index.hpp>
+
+#include <boost/assign.hpp>
+#include <gtest/gtest.h>
+#include <vector>
+
+
+using namespace d2;
+using namespace d2::core;
+
+namespace {
+typedef d2::core::events::start StartEvent;
+typedef d2::core::events::join JoinEvent;
+typedef d2::core::events::acquire AcquireEvent;
+
+struct test_vector_clock_index : testing::Test {
+    std::vector<core::events::non_thread_specific> events;
+    std::vector<Segment> segments;
+
+    void SetUp() {
+        using namespace boost::assign;
+        for (unsigned int i = 0; i < 10; ++i)
+            segments.push_back(Segment() + i);
+
+        //      0   1   2   3   4   5   6   7   8
+        // t0   o___o_______o_______o___o_______o
+        // t1   |___|___o___________|   |       |
+        // t2       |___________o_______|___o___|
+        // t3                           |___o
+        events +=
+            StartEvent(segments[0], segments[1], segments[2]),
+            StartEvent(segments[1], segments[3], segments[4]),
+            JoinEvent(segments[3], segments[5], segments[2]),
+            JoinEvent(segments[5], segments[6], segments[4]),
+            StartEvent(segments[6], segments[7], segments[9]),
+            JoinEvent(segments[7], segments[8], segments[9])
+        ;
+    }
+
+    // Check that `index` gives the same relation as the segmentation graph
+    // of the events, including for segments that are in neither of them.
+    void expect_agrees_with_the_graph(VectorClockIndex const& index) {
+        SegmentationGraph graph;
+        static bool const ignore_other_events = true;
+        build_segmentation_graph<ignore_other_events>(events, graph);
+
+        for (unsigned int u = 0; u < segments.size() + 2; ++u) {
+            for (unsigned int v = 0; v < segments.size() + 2; ++v) {
+                Segment const su = Segment() + u, sv = Segment() + v;
+                EXPECT_EQ(happens_before(su, sv, graph),
+                          index.happens_before(su, sv))
+                    << "segments " << u << " and " << v;
+                EXPECT_EQ(index.happens_before(su, sv),
+                          index.happens_before_at(index.position_of(su),
+                                                  index.position_of(sv)))
+                    << "positions of segments " << u << " and " << v;
+            }
+        }
+    }
+};
+
+TEST_F(test_vector_clock_index, empty_index_orders_nothing) {
+    VectorClockIndex index;
+    EXPECT_EQ(0u, index.size());
+    EXPECT_FALSE(index.happens_before(segments[0], segments[1]));
+}
+
+TEST_F(test_vector_clock_index, agrees_with_the_graph) {
+    VectorClockIndex const index(events.begin(), events.end());
+    EXPECT_EQ(segments.size(), index.size());
+    EXPECT_EQ(4u, index.threads());
+
+    expect_agrees_with_the_graph(index);
+}
+
+TEST_F(test_vector_clock_index, events_can_be_in_any_order) {
+    std::vector<core::events::non_thread_specific> const
+                                        reversed(events.rbegin(), events.rend());
+    VectorClockIndex const index(reversed.begin(), reversed.end());
+
+    expect_agrees_with_the_graph(index);
+}
+
+TEST_F(test_vector_clock_index, other_events_are_ignored) {
+    std::vector<core::events::non_thread_specific> mixed;
+    for (unsigned int i = 0; i < events.size(); ++i) {
+        mixed.push_back(AcquireEvent());
+        mixed.push_back(events[i]);
+    }
+    VectorClockIndex const index(mixed.begin(), mixed.end());
+
+    expect_agrees_with_the_graph(index);
+}
+} // end anonymous namespace
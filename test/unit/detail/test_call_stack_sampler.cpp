@@ -0,0 +1,153 @@
+/**
+ * This file contains unit tests for the `CallStackSampler` class.
+ */
+
+#include <d2/detail/call_stack_sampler.hpp>
+#include <d2/detail/call_stack_table.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <cstddef>
+#include <gtest/gtest.h>
+
+
+using d2::detail::CallStackId;
+using d2::detail::CallStackSampler;
+using d2::detail::no_call_stack;
+
+namespace {
+struct call_stack_sampler : testing::Test {
+    CallStackSampler sampler;
+    CallStackId next_call_stack;
+
+    call_stack_sampler() : next_call_stack(1) { }
+
+    // Acquire `lock`, capturing a new call stack if the sampler asks for
+    // it, and return the call stack the acquisition refers to.
+    CallStackId acquire(std::size_t lock) {
+        CallStackId call_stack = no_call_stack;
+        if (sampler.acquire(lock, call_stack)) {
+            call_stack = next_call_stack++;
+            sampler.sampled(call_stack);
+        }
+        return call_stack;
+    }
+
+    // Return whether the sampler asks for the call stack of an acquisition
+    // of `lock`, without capturing it.
+    bool captures(std::size_t lock) {
+        CallStackId ignored;
+        return sampler.acquire(lock, ignored);
+    }
+};
+
+TEST_F(call_stack_sampler, every_call_stack_is_captured_by_default) {
+    for (std::size_t i = 0; i < 10; ++i) {
+        EXPECT_TRUE(captures(1));
+        sampler.release(1);
+    }
+}
+
+TEST_F(call_stack_sampler, no_call_stack_is_captured_without_samples) {
+    sampler.set_limit(0);
+    for (std::size_t i = 0; i < 10; ++i) {
+        EXPECT_EQ(no_call_stack, acquire(1));
+        EXPECT_EQ(no_call_stack, acquire(2));
+        sampler.release(2);
+        sampler.release(1);
+    }
+}
+
+TEST_F(call_stack_sampler, only_the_first_call_stacks_of_a_pair_are_captured) {
+    sampler.set_limit(2);
+    for (std::size_t i = 0; i < 10; ++i) {
+        CallStackId const a = acquire(1);
+        CallStackId const b = acquire(2);
+        sampler.release(2);
+        sampler.release(1);
+
+        // Later acquisitions refer to the last call stack captured for
+        // their pair.
+        EXPECT_EQ(i < 2 ? 2 * i + 1 : 3, a);
+        EXPECT_EQ(i < 2 ? 2 * i + 2 : 4, b);
+    }
+}
+
+TEST_F(call_stack_sampler, pairs_depend_on_the_held_locks) {
+    sampler.set_limit(1);
+    EXPECT_EQ(1u, acquire(1));
+    EXPECT_EQ(2u, acquire(3));
+    sampler.release(3);
+    EXPECT_EQ(3u, acquire(2));
+    EXPECT_EQ(4u, acquire(3));
+    sampler.release(3);
+    sampler.release(2);
+    sampler.release(1);
+
+    // The order in which the held locks were acquired does not matter.
+    EXPECT_EQ(5u, acquire(2));
+    EXPECT_EQ(6u, acquire(1));
+    EXPECT_EQ(4u, acquire(3));
+    sampler.release(3);
+
+    // Nor does the order in which they are released.
+    sampler.release(2);
+    EXPECT_EQ(2u, acquire(3));
+}
+
+TEST_F(call_stack_sampler, call_stacks_that_were_not_captured_are_decided) {
+    sampler.set_limit(1);
+    EXPECT_TRUE(captures(1));
+    sampler.sampled(no_call_stack);
+    sampler.release(1);
+
+    CallStackId call_stack = 1;
+    EXPECT_FALSE(sampler.acquire(1, call_stack));
+    EXPECT_EQ(no_call_stack, call_stack);
+    sampler.release(1);
+}
+
+TEST_F(call_stack_sampler, clearing_captures_the_call_stacks_again) {
+    sampler.set_limit(1);
+    EXPECT_EQ(1u, acquire(1));
+    sampler.release(1);
+    EXPECT_EQ(1u, acquire(1));
+    sampler.release(1);
+
+    sampler.clear();
+    EXPECT_TRUE(captures(1));
+}
+
+void acquire_in_order(CallStackSampler& sampler, std::size_t& captured) {
+    for (std::size_t i = 0; i < 100; ++i) {
+        for (std::size_t lock = 1; lock <= 2; ++lock) {
+            CallStackId call_stack;
+            if (sampler.acquire(lock, call_stack)) {
+                ++captured;
+                sampler.sampled(lock);
+            }
+        }
+        sampler.release(2);
+        sampler.release(1);
+    }
+}
+
+TEST_F(call_stack_sampler, threads_share_the_captured_call_stacks) {
+    sampler.set_limit(3);
+    std::size_t captured[8] = {0};
+    boost::thread_group threads;
+    for (std::size_t i = 0; i < 8; ++i)
+        threads.create_thread(boost::bind(&acquire_in_order,
+                                          boost::ref(sampler),
+                                          boost::ref(captured[i])));
+    threads.join_all();
+
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < 8; ++i)
+        total += captured[i];
+    // A thread may capture another call stack while the first call stack
+    // of a pair is being captured, but at most once per pair.
+    EXPECT_LE(3u * 2, total);
+    EXPECT_GE((3u + 8) * 2, total);
+}
+} // end anonymous namespace
@@ -0,0 +1,97 @@
+/**
+ * This file contains unit tests for the `CallStackTable` class.
+ */
+
+#include <d2/detail/call_stack_table.hpp>
+#include <d2/detail/lock_debug_info.hpp>
+
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <sstream>
+
+
+using namespace d2;
+
+namespace {
+struct call_stack_table_test : testing::Test {
+    detail::CallStackTable table;
+
+    static detail::LockDebugInfo::CallStack
+    make_stack(std::size_t ip, char const* function = "") {
+        detail::LockDebugInfo::CallStack stack;
+        stack.push_back(detail::StackFrame(ip, function, "module"));
+        stack.push_back(detail::StackFrame(0x400000, "main", "/bin/a b"));
+        return stack;
+    }
+};
+
+TEST_F(call_stack_table_test, equal_stacks_are_interned_once) {
+    std::pair<detail::CallStackId, bool> a = table.insert(make_stack(0x10));
+    std::pair<detail::CallStackId, bool> b = table.insert(make_stack(0x20));
+    std::pair<detail::CallStackId, bool> c = table.insert(make_stack(0x10));
+
+    EXPECT_TRUE(a.second);
+    EXPECT_TRUE(b.second);
+    EXPECT_FALSE(c.second);
+    EXPECT_EQ(1u, a.first);
+    EXPECT_EQ(2u, b.first);
+    EXPECT_EQ(a.first, c.first);
+    EXPECT_EQ(2u, table.size());
+}
+
+TEST_F(call_stack_table_test, stacks_are_found_by_id) {
+    detail::CallStackId const id = table.insert(make_stack(0x10, "f")).first;
+
+    ASSERT_NE((detail::LockDebugInfo const*)NULL, table.find(id));
+    EXPECT_TRUE(make_stack(0x10, "f") == table.find(id)->call_stack);
+    EXPECT_EQ(NULL, table.find(detail::no_call_stack));
+    EXPECT_EQ(NULL, table.find(id + 1));
+}
+
+TEST_F(call_stack_table_test, stacks_differing_only_by_names_are_distinct) {
+    detail::CallStackId const f = table.insert(make_stack(0x10, "f")).first;
+    detail::CallStackId const g = table.insert(make_stack(0x10, "g")).first;
+    EXPECT_NE(f, g);
+}
+
+TEST_F(call_stack_table_test, table_is_read_back_from_a_stream) {
+    table.insert(make_stack(0x10, "void f(int, char)"));
+    table.insert(make_stack(0x20));
+    std::stringstream stream;
+    stream << table;
+
+    detail::CallStackTable read;
+    stream >> read;
+    EXPECT_FALSE(stream.fail());
+    ASSERT_EQ(2u, read.size());
+    EXPECT_TRUE(*table.find(1) == *read.find(1));
+    EXPECT_TRUE(*table.find(2) == *read.find(2));
+}
+
+TEST_F(call_stack_table_test, stacks_written_one_at_a_time_are_read_back) {
+    std::stringstream stream;
+    detail::LockDebugInfo info;
+    info.call_stack = make_stack(0x10);
+    detail::CallStackTable::write(stream, 1, info);
+    info.call_stack = make_stack(0x20);
+    detail::CallStackTable::write(stream, 2, info);
+
+    detail::CallStackTable read;
+    stream >> read;
+    EXPECT_FALSE(stream.fail());
+    ASSERT_EQ(2u, read.size());
+    EXPECT_TRUE(info == *read.find(2));
+}
+
+TEST_F(call_stack_table_test, unexpected_id_sets_failbit) {
+    std::stringstream stream;
+    detail::LockDebugInfo info;
+    info.call_stack = make_stack(0x10);
+    detail::CallStackTable::write(stream, 2, info);
+
+    detail::CallStackTable read;
+    stream >> read;
+    EXPECT_TRUE(stream.fail());
+    EXPECT_TRUE(read.empty());
+}
+} // end anonymous namespace
@@ -0,0 +1,128 @@
+/**
+ * This file contains unit tests for the `compressing_streambuf` and the
+ * `decompressing_streambuf` classes.
+ */
+
+#include <d2/detail/compressed_streambuf.hpp>
+
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <ios>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <sstream>
+#include <string>
+
+
+using namespace d2;
+
+namespace {
+struct compressed_streambuf_test : testing::Test {
+    std::stringbuf file;
+
+    static std::string pattern(std::size_t size) {
+        std::string data(size, '\0');
+        for (std::size_t i = 0; i < size; ++i)
+            data[i] = static_cast<char>('a' + i % 26);
+        return data;
+    }
+
+    void compress(std::string const& data, std::size_t block_size) {
+        detail::compressing_streambuf buffer(block_size);
+        ASSERT_TRUE(buffer.open(&file));
+        std::ostream os(&buffer);
+        os.write(data.data(), static_cast<std::streamsize>(data.size()));
+        EXPECT_TRUE(os.good());
+        EXPECT_TRUE(buffer.close());
+    }
+
+    std::string decompress(std::size_t read_ahead) {
+        file.pubseekpos(0, std::ios::in);
+        detail::decompressing_streambuf buffer(read_ahead);
+        if (!buffer.open(&file))
+            return "not compressed";
+        std::istream is(&buffer);
+        return std::string(std::istreambuf_iterator<char>(is),
+                           std::istreambuf_iterator<char>());
+    }
+};
+
+TEST_F(compressed_streambuf_test, data_spanning_several_blocks_is_read_back) {
+    std::string const data = pattern(10000);
+    compress(data, 128);
+    EXPECT_GT(data.size(), file.str().size());
+    EXPECT_EQ(data, decompress(1));
+}
+
+TEST_F(compressed_streambuf_test, blocks_are_decompressed_in_parallel) {
+    std::string const data = pattern(10000);
+    compress(data, 128);
+    EXPECT_EQ(data, decompress(8));
+    EXPECT_EQ(data, decompress(1000));
+}
+
+TEST_F(compressed_streambuf_test, read_ahead_can_change_while_reading) {
+    std::string const data = pattern(10000);
+    compress(data, 128);
+    detail::decompressing_streambuf buffer(8);
+    ASSERT_TRUE(buffer.open(&file));
+    std::istream is(&buffer);
+
+    std::string read(3000, '\0');
+    is.read(&read[0], 3000);
+    buffer.set_read_ahead(1);
+    EXPECT_EQ(1u, buffer.read_ahead());
+    read += std::string(std::istreambuf_iterator<char>(is),
+                        std::istreambuf_iterator<char>());
+    EXPECT_EQ(data, read);
+}
+
+TEST_F(compressed_streambuf_test, nothing_is_written_before_a_block_is_full) {
+    detail::compressing_streambuf buffer(128);
+    ASSERT_TRUE(buffer.open(&file));
+    std::ostream os(&buffer);
+    os << "abc" << std::flush;
+    EXPECT_EQ("", decompress(1));
+
+    os << pattern(200);
+    EXPECT_EQ("abc" + pattern(125), decompress(1));
+
+    buffer.close();
+    EXPECT_EQ("abc" + pattern(200), decompress(1));
+}
+
+TEST_F(compressed_streambuf_test, zero_padding_ends_the_data) {
+    std::string const data = pattern(1000);
+    compress(data, 128);
+    file.sputn(std::string(100, '\0').data(), 100);
+    EXPECT_EQ(data, decompress(4));
+}
+
+TEST_F(compressed_streambuf_test, blocks_are_appended_to_existing_data) {
+    compress(pattern(100), 64);
+    compress("xyz", 64);
+    EXPECT_EQ(pattern(100) + "xyz", decompress(2));
+}
+
+TEST_F(compressed_streambuf_test, position_is_zero_only_in_new_containers) {
+    {
+        detail::compressing_streambuf buffer(64);
+        ASSERT_TRUE(buffer.open(&file));
+        std::ostream os(&buffer);
+        EXPECT_EQ(std::streampos(0), os.tellp());
+        os << pattern(100);
+        EXPECT_EQ(std::streampos(100), os.tellp());
+    }
+    detail::compressing_streambuf buffer(64);
+    ASSERT_TRUE(buffer.open(&file));
+    std::ostream os(&buffer);
+    EXPECT_NE(std::streampos(0), os.tellp());
+}
+
+TEST_F(compressed_streambuf_test, uncompressed_data_is_left_untouched) {
+    file.str("abcdef");
+    EXPECT_EQ("not compressed", decompress(1));
+    EXPECT_EQ('a', file.sgetc());
+}
+} // end anonymous namespace
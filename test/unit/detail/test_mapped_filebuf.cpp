@@ -0,0 +1,115 @@
+/**
+ * This file contains unit tests for the `mapped_filebuf` class.
+ */
+
+#include <d2/detail/mapped_filebuf.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstddef>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <ios>
+#include <iostream>
+#include <iterator>
+#include <ostream>
+#include <string>
+
+
+namespace bfs = boost::filesystem;
+using namespace d2;
+
+namespace {
+struct mapped_filebuf_test : testing::Test {
+    bfs::path test_dir, file;
+    std::size_t page;
+
+    void SetUp() {
+        test_dir = bfs::temp_directory_path() / bfs::unique_path();
+        file = test_dir / "file";
+        bfs::create_directory(test_dir);
+        page = boost::interprocess::mapped_region::get_page_size();
+    }
+
+    void TearDown() {
+        if (HasFailure())
+            std::clog << "test directory at: " << test_dir << '\n';
+        else
+            bfs::remove_all(test_dir);
+    }
+
+    std::string contents() const {
+        std::ifstream is(file.string().c_str(), std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(is),
+                           std::istreambuf_iterator<char>());
+    }
+
+    static std::string pattern(std::size_t size) {
+        std::string data(size, '\0');
+        for (std::size_t i = 0; i < size; ++i)
+            data[i] = static_cast<char>('a' + i % 26);
+        return data;
+    }
+};
+
+TEST_F(mapped_filebuf_test, data_spanning_several_chunks_is_written) {
+    std::string const data = pattern(page * 3 + page / 2);
+    {
+        detail::mapped_filebuf buffer(page);
+        ASSERT_TRUE(buffer.open(file, std::ios::out));
+        std::ostream os(&buffer);
+        os.write(data.data(), static_cast<std::streamsize>(page / 2));
+        os.put(data[page / 2]);
+        os.write(data.data() + page / 2 + 1,
+                 static_cast<std::streamsize>(data.size() - page / 2 - 1));
+        EXPECT_TRUE(os.good());
+        EXPECT_EQ(std::streampos(data.size()), os.tellp());
+    }
+    EXPECT_EQ(data, contents());
+}
+
+TEST_F(mapped_filebuf_test, data_is_in_the_file_before_it_is_closed) {
+    detail::mapped_filebuf buffer(page);
+    ASSERT_TRUE(buffer.open(file, std::ios::out));
+    std::ostream os(&buffer);
+    os << "abc";
+
+    // This is what is left if the process dies at this point.
+    std::string const expected = "abc" + std::string(page - 3, '\0');
+    EXPECT_EQ(expected, contents());
+
+    EXPECT_TRUE(buffer.close());
+    EXPECT_EQ("abc", contents());
+}
+
+TEST_F(mapped_filebuf_test, file_is_truncated_unless_appending) {
+    std::string const data = pattern(page + 10);
+    {
+        std::ofstream os(file.string().c_str(), std::ios::binary);
+        os << data;
+    }
+    {
+        detail::mapped_filebuf buffer(page);
+        ASSERT_TRUE(buffer.open(file, std::ios::out | std::ios::app));
+        std::ostream os(&buffer);
+        EXPECT_EQ(std::streampos(data.size()), os.tellp());
+        os << "xyz";
+    }
+    EXPECT_EQ(data + "xyz", contents());
+
+    {
+        detail::mapped_filebuf buffer(page);
+        ASSERT_TRUE(buffer.open(file, std::ios::out));
+        std::ostream os(&buffer);
+        os << "xyz";
+    }
+    EXPECT_EQ("xyz", contents());
+}
+
+TEST_F(mapped_filebuf_test, opening_an_invalid_path_fails) {
+    detail::mapped_filebuf buffer;
+    EXPECT_FALSE(buffer.open(test_dir / "nonexistent" / "file",
+                             std::ios::out));
+    EXPECT_FALSE(buffer.is_open());
+}
+} // end anonymous namespace
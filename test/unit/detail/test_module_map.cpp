@@ -0,0 +1,62 @@
+/**
+ * This file contains unit tests for the `ModuleMap` class.
+ */
+
+#include <d2/detail/module_map.hpp>
+
+#include <cstddef>
+#include <gtest/gtest.h>
+#include <sstream>
+
+
+using namespace d2;
+
+namespace {
+TEST(module_map, find_returns_the_module_containing_an_address) {
+    detail::ModuleMap map;
+    map.add(detail::LoadedModule(0x5000, 0x6000, 0x5000, "/lib/b.so"));
+    map.add(detail::LoadedModule(0x1000, 0x2000, 0, "/bin/a"));
+
+    ASSERT_EQ(2u, map.size());
+    EXPECT_EQ(NULL, map.find(0x0fff));
+    ASSERT_NE((detail::LoadedModule const*)NULL, map.find(0x1000));
+    EXPECT_EQ("/bin/a", map.find(0x1000)->path);
+    EXPECT_EQ("/bin/a", map.find(0x1fff)->path);
+    EXPECT_EQ(NULL, map.find(0x2000));
+    EXPECT_EQ(NULL, map.find(0x4fff));
+    ASSERT_NE((detail::LoadedModule const*)NULL, map.find(0x5123));
+    EXPECT_EQ("/lib/b.so", map.find(0x5123)->path);
+    EXPECT_EQ(0x123u, map.find(0x5123)->file_address(0x5123));
+    EXPECT_EQ(NULL, map.find(0x6000));
+}
+
+TEST(module_map, map_is_read_back_from_a_stream) {
+    detail::ModuleMap map;
+    map.add(detail::LoadedModule(0x1000, 0x2000, 0, "/bin/a"));
+    map.add(detail::LoadedModule(0x5000, 0x6000, 0x5000,
+                                 "/path with spaces/b.so"));
+    std::stringstream stream;
+    stream << map;
+
+    detail::ModuleMap read;
+    stream >> read;
+    EXPECT_FALSE(stream.fail());
+    ASSERT_EQ(2u, read.size());
+    ASSERT_NE((detail::LoadedModule const*)NULL, read.find(0x5000));
+    EXPECT_EQ("/path with spaces/b.so", read.find(0x5000)->path);
+    EXPECT_EQ(0x5000u, read.find(0x5000)->bias);
+    EXPECT_EQ(0x2000u, read.find(0x1000)->end);
+}
+
+#if defined(__linux__) || defined(__FreeBSD__)
+void function_in_this_module() { }
+
+TEST(module_map, current_process_contains_its_own_code) {
+    detail::ModuleMap map = detail::ModuleMap::of_current_process();
+    std::size_t const ip =
+        reinterpret_cast<std::size_t>(&function_in_this_module);
+    ASSERT_NE((detail::LoadedModule const*)NULL, map.find(ip));
+    EXPECT_FALSE(map.find(ip)->path.empty());
+}
+#endif
+} // end anonymous namespace